@@ -0,0 +1,636 @@
+/**********************************************************************
+ * $Id$
+ *
+ * Name:     cpl_hash_set_oa.h
+ * Project:  CPL - Common Portability Library
+ * Purpose:  Open addressing hash set, with the CPLHashSet interface and
+ *           inline-key variants for pointers and strings.
+ *
+ **********************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef _CPL_HASH_SET_OA_H_INCLUDED
+#define _CPL_HASH_SET_OA_H_INCLUDED
+
+#include "cpl_hash_set.h"
+#include "cpl_conv.h"
+#include <string.h>
+
+/**
+ * \file cpl_hash_set_oa.h
+ *
+ * Open addressing hash set.
+ *
+ * CPLHashSet chains its elements in lists, so that every insertion
+ * allocates a list node and every lookup follows pointers.  The tables
+ * in this file store the elements, with their hash value, directly in a
+ * single array, using Robin Hood linear probing: an element being
+ * inserted takes the place of any element closer to its home slot, which
+ * keeps probe sequences short, and removal shifts the following elements
+ * back instead of leaving tombstones.  Only growing or shrinking the
+ * table allocates.
+ *
+ * Three front ends share the table:
+ *
+ * - CPLOAHashSet, with the same functions and semantics as CPLHashSet
+ *   (CPLOAHashSetNew() for CPLHashSetNew(), etc.), so that code can switch
+ *   by renaming the calls.  The hash value is stored with each element
+ *   and compared before the equal function is called.
+ *
+ * - CPLPointerHashSet, a set of pointers with the hash and comparison
+ *   inlined.
+ *
+ * - CPLStringInternSet, which returns a unique copy of each distinct
+ *   string, the copies being packed in large blocks.
+ *
+ * As with CPLHashSet, a table must not be modified from the callback of
+ * a Foreach() on it, and must not be used by several threads at once.
+ */
+
+/* Largest load factor, in eighths, before growing. */
+#define CPL_OA_HASH_MAX_LOAD     7
+
+/* Smallest table size. */
+#define CPL_OA_HASH_MIN_SIZE     16
+
+/************************************************************************/
+/*                            CPLOAHashMix()                            */
+/*                                                                      */
+/*      Spread a hash value over 32 bits.  Pointer hashes have their    */
+/*      low bits clear, and the slot is taken from the high bits.       */
+/************************************************************************/
+
+static inline GUInt32 CPLOAHashMix( GUIntBig nHash )
+{
+    GUInt32 nMixed = (GUInt32) nHash ^ (GUInt32) (nHash >> 32);
+    nMixed ^= nMixed >> 16;
+    return nMixed * 0x9E3779B1U;
+}
+
+/************************************************************************/
+/* ==================================================================== */
+/*                           CPLOAHashTable                             */
+/* ==================================================================== */
+/************************************************************************/
+
+/*
+ * The Traits class provides:
+ *   GUInt32 Hash( const void *pKey ) const;
+ *   int     Equal( const void *pElt, const void *pKey ) const;
+ */
+
+template<class Traits> class CPLOAHashTable
+{
+public:
+    typedef struct
+    {
+        void       *pElt;
+        GUInt32     nHash;
+        GUInt32     nDist;      /* Probe distance + 1, 0 if empty. */
+    } Slot;
+
+    Traits      oTraits;
+    Slot       *pasSlots;
+    int         nSizeLog2;
+    int         nCount;
+
+    CPLOAHashTable() : pasSlots(NULL), nSizeLog2(0), nCount(0) {}
+    ~CPLOAHashTable() { CPLFree( pasSlots ); }
+
+    size_t      GetCapacity() const
+        { return pasSlots ? ((size_t) 1) << nSizeLog2 : 0; }
+
+    size_t      HomeSlot( GUInt32 nHash ) const
+        { return nSizeLog2 ? nHash >> (32 - nSizeLog2) : 0; }
+
+/* -------------------------------------------------------------------- */
+/*      Find the slot holding a key, or NULL.                           */
+/* -------------------------------------------------------------------- */
+    Slot       *Find( const void *pKey, GUInt32 nHash ) const
+    {
+        if( nCount == 0 )
+            return NULL;
+
+        const size_t nMask = GetCapacity() - 1;
+        size_t i = HomeSlot( nHash );
+
+        for( GUInt32 nDist = 1; ; nDist++, i = (i + 1) & nMask )
+        {
+            Slot *psSlot = pasSlots + i;
+
+            /* Robin Hood invariant: the key would have been stored */
+            /* before any element closer to its own home. */
+            if( psSlot->nDist < nDist )
+                return NULL;
+            if( psSlot->nHash == nHash
+                && oTraits.Equal( psSlot->pElt, pKey ) )
+                return psSlot;
+        }
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Insert an element known not to be in the table.                 */
+/* -------------------------------------------------------------------- */
+    Slot       *InsertNew( void *pElt, GUInt32 nHash )
+    {
+        if( (size_t) (nCount + 1) * 8 > GetCapacity() * CPL_OA_HASH_MAX_LOAD )
+            Resize( MAX( CPL_OA_HASH_MIN_SIZE, GetCapacity() * 2 ) );
+
+        const size_t nMask = GetCapacity() - 1;
+        size_t i = HomeSlot( nHash );
+        Slot sCur;
+        Slot *psResult = NULL;
+
+        sCur.pElt = pElt;
+        sCur.nHash = nHash;
+        sCur.nDist = 1;
+
+        for( ; ; i = (i + 1) & nMask, sCur.nDist++ )
+        {
+            Slot *psSlot = pasSlots + i;
+
+            if( psSlot->nDist == 0 )
+            {
+                *psSlot = sCur;
+                nCount++;
+                return psResult ? psResult : psSlot;
+            }
+
+            if( psSlot->nDist < sCur.nDist )
+            {
+                Slot sTmp = *psSlot;
+                *psSlot = sCur;
+                sCur = sTmp;
+                if( psResult == NULL )
+                    psResult = psSlot;
+            }
+        }
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Remove the element of a slot, shifting the following            */
+/*      displaced elements back by one.                                 */
+/* -------------------------------------------------------------------- */
+    void        RemoveSlot( Slot *psSlot )
+    {
+        const size_t nMask = GetCapacity() - 1;
+        size_t i = psSlot - pasSlots;
+
+        for( ;; )
+        {
+            const size_t iNext = (i + 1) & nMask;
+            Slot *psNext = pasSlots + iNext;
+
+            if( psNext->nDist <= 1 )
+                break;
+
+            pasSlots[i] = *psNext;
+            pasSlots[i].nDist--;
+            i = iNext;
+        }
+
+        pasSlots[i].pElt = NULL;
+        pasSlots[i].nHash = 0;
+        pasSlots[i].nDist = 0;
+        nCount--;
+
+        if( GetCapacity() > CPL_OA_HASH_MIN_SIZE
+            && (size_t) nCount * 8 < GetCapacity() )
+            Resize( GetCapacity() / 2 );
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Rehash all the elements into a table of nNewSize slots.         */
+/* -------------------------------------------------------------------- */
+    void        Resize( size_t nNewSize )
+    {
+        Slot *pasOld = pasSlots;
+        const size_t nOldSize = GetCapacity();
+
+        nSizeLog2 = 0;
+        while( (((size_t) 1) << nSizeLog2) < nNewSize )
+            nSizeLog2++;
+
+        pasSlots = (Slot *) CPLCalloc( ((size_t) 1) << nSizeLog2,
+                                       sizeof(Slot) );
+        nCount = 0;
+
+        for( size_t i = 0; i < nOldSize; i++ )
+        {
+            if( pasOld[i].nDist != 0 )
+                InsertNew( pasOld[i].pElt, pasOld[i].nHash );
+        }
+
+        CPLFree( pasOld );
+    }
+
+    /* Make room for nElts elements without growing again. */
+    void        Reserve( size_t nElts )
+    {
+        const size_t nNeeded = (nElts * 8 + CPL_OA_HASH_MAX_LOAD - 1)
+                             / CPL_OA_HASH_MAX_LOAD;
+        if( nNeeded > GetCapacity() )
+            Resize( MAX( (size_t) CPL_OA_HASH_MIN_SIZE, nNeeded ) );
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Call pfnFunc on each element until it returns FALSE.            */
+/* -------------------------------------------------------------------- */
+    void        Foreach( CPLHashSetIterEltFunc pfnFunc, void *pUserData )
+    {
+        const size_t nSize = GetCapacity();
+
+        for( size_t i = 0; i < nSize; i++ )
+        {
+            if( pasSlots[i].nDist != 0
+                && !pfnFunc( pasSlots[i].pElt, pUserData ) )
+                break;
+        }
+    }
+};
+
+/************************************************************************/
+/* ==================================================================== */
+/*                             CPLOAHashSet                             */
+/* ==================================================================== */
+/************************************************************************/
+
+class CPLOAHashSetTraits
+{
+public:
+    CPLHashSetHashFunc  fnHashFunc;
+    CPLHashSetEqualFunc fnEqualFunc;
+
+    GUInt32 Hash( const void *pKey ) const
+        { return CPLOAHashMix( (GUIntBig) fnHashFunc( pKey ) ); }
+    int     Equal( const void *pElt, const void *pKey ) const
+        { return fnEqualFunc( pElt, pKey ); }
+};
+
+typedef struct _CPLOAHashSet
+{
+    CPLOAHashTable<CPLOAHashSetTraits> oTable;
+    CPLHashSetFreeEltFunc              fnFreeEltFunc;
+} CPLOAHashSet;
+
+/************************************************************************/
+/*                           CPLOAHashSetNew()                          */
+/************************************************************************/
+
+/**
+ * Creates a new open addressing hash set.
+ *
+ * Same as CPLHashSetNew().
+ *
+ * @param fnHashFunc hash function, or NULL for CPLHashSetHashPointer().
+ * @param fnEqualFunc equal function, or NULL for CPLHashSetEqualPointer().
+ * @param fnFreeEltFunc function called on elements that are removed or
+ * replaced, and when the set is destroyed, or NULL.
+ *
+ * @return a new hash set, to be freed with CPLOAHashSetDestroy().
+ */
+
+static inline CPLOAHashSet *CPLOAHashSetNew( CPLHashSetHashFunc fnHashFunc,
+                                             CPLHashSetEqualFunc fnEqualFunc,
+                                             CPLHashSetFreeEltFunc fnFreeEltFunc )
+{
+    CPLOAHashSet *set = new CPLOAHashSet;
+
+    set->oTable.oTraits.fnHashFunc =
+        fnHashFunc ? fnHashFunc : CPLHashSetHashPointer;
+    set->oTable.oTraits.fnEqualFunc =
+        fnEqualFunc ? fnEqualFunc : CPLHashSetEqualPointer;
+    set->fnFreeEltFunc = fnFreeEltFunc;
+
+    return set;
+}
+
+/************************************************************************/
+/*                         CPLOAHashSetDestroy()                        */
+/************************************************************************/
+
+/** Destroys a hash set, freeing the elements with fnFreeEltFunc. */
+
+static inline void CPLOAHashSetDestroy( CPLOAHashSet *set )
+{
+    if( set->fnFreeEltFunc != NULL )
+    {
+        const size_t nSize = set->oTable.GetCapacity();
+        for( size_t i = 0; i < nSize; i++ )
+        {
+            if( set->oTable.pasSlots[i].nDist != 0 )
+                set->fnFreeEltFunc( set->oTable.pasSlots[i].pElt );
+        }
+    }
+
+    delete set;
+}
+
+/************************************************************************/
+/*                          CPLOAHashSetSize()                          */
+/************************************************************************/
+
+/** Returns the number of elements of a hash set. */
+
+static inline int CPLOAHashSetSize( const CPLOAHashSet *set )
+{
+    return set->oTable.nCount;
+}
+
+/************************************************************************/
+/*                         CPLOAHashSetReserve()                        */
+/************************************************************************/
+
+/** Makes room for nElts elements, to avoid growing while inserting. */
+
+static inline void CPLOAHashSetReserve( CPLOAHashSet *set, int nElts )
+{
+    if( nElts > 0 )
+        set->oTable.Reserve( nElts );
+}
+
+/************************************************************************/
+/*                         CPLOAHashSetForeach()                        */
+/************************************************************************/
+
+/**
+ * Walks through all the elements of a hash set, in no particular order,
+ * until fnIterFunc returns FALSE.  The set must not be modified meanwhile.
+ */
+
+static inline void CPLOAHashSetForeach( CPLOAHashSet *set,
+                                        CPLHashSetIterEltFunc fnIterFunc,
+                                        void *user_data )
+{
+    set->oTable.Foreach( fnIterFunc, user_data );
+}
+
+/************************************************************************/
+/*                          CPLOAHashSetInsert()                        */
+/************************************************************************/
+
+/**
+ * Inserts an element into a hash set.
+ *
+ * If an equal element is already in the set, it is freed with
+ * fnFreeEltFunc and replaced by the new one.
+ *
+ * @return TRUE if the element was not already in the set.
+ */
+
+static inline int CPLOAHashSetInsert( CPLOAHashSet *set, void *elt )
+{
+    const GUInt32 nHash = set->oTable.oTraits.Hash( elt );
+    CPLOAHashTable<CPLOAHashSetTraits>::Slot *psSlot =
+        set->oTable.Find( elt, nHash );
+
+    if( psSlot != NULL )
+    {
+        if( set->fnFreeEltFunc )
+            set->fnFreeEltFunc( psSlot->pElt );
+        psSlot->pElt = elt;
+        return FALSE;
+    }
+
+    set->oTable.InsertNew( elt, nHash );
+    return TRUE;
+}
+
+/************************************************************************/
+/*                          CPLOAHashSetLookup()                        */
+/************************************************************************/
+
+/** Returns the element of the set equal to elt, or NULL. */
+
+static inline void *CPLOAHashSetLookup( CPLOAHashSet *set, const void *elt )
+{
+    CPLOAHashTable<CPLOAHashSetTraits>::Slot *psSlot =
+        set->oTable.Find( elt, set->oTable.oTraits.Hash( elt ) );
+
+    return psSlot ? psSlot->pElt : NULL;
+}
+
+/************************************************************************/
+/*                          CPLOAHashSetRemove()                        */
+/************************************************************************/
+
+/**
+ * Removes the element equal to elt from a hash set, freeing it with
+ * fnFreeEltFunc.
+ *
+ * @return TRUE if the element was in the set.
+ */
+
+static inline int CPLOAHashSetRemove( CPLOAHashSet *set, const void *elt )
+{
+    CPLOAHashTable<CPLOAHashSetTraits>::Slot *psSlot =
+        set->oTable.Find( elt, set->oTable.oTraits.Hash( elt ) );
+
+    if( psSlot == NULL )
+        return FALSE;
+
+    void *pStored = psSlot->pElt;
+    set->oTable.RemoveSlot( psSlot );
+
+    if( set->fnFreeEltFunc )
+        set->fnFreeEltFunc( pStored );
+
+    return TRUE;
+}
+
+/************************************************************************/
+/* ==================================================================== */
+/*                          CPLPointerHashSet                           */
+/* ==================================================================== */
+/************************************************************************/
+
+class CPLPointerHashTraits
+{
+public:
+    GUInt32 Hash( const void *pKey ) const
+        { return CPLOAHashMix( (GUIntBig) (size_t) pKey ); }
+    int     Equal( const void *pElt, const void *pKey ) const
+        { return pElt == pKey; }
+};
+
+/**
+ * Set of pointers, with the hash and comparison inlined.  The pointers
+ * are not owned.  NULL can be stored.
+ */
+
+class CPLPointerHashSet
+{
+    CPLOAHashTable<CPLPointerHashTraits> oTable;
+
+    CPLPointerHashSet( const CPLPointerHashSet & );
+    CPLPointerHashSet &operator=( const CPLPointerHashSet & );
+
+public:
+    CPLPointerHashSet() {}
+
+    int     Size() const { return oTable.nCount; }
+    void    Reserve( int nElts ) { if( nElts > 0 ) oTable.Reserve( nElts ); }
+
+    /** Returns TRUE if the pointer was not already in the set. */
+    int     Insert( const void *p )
+    {
+        const GUInt32 nHash = oTable.oTraits.Hash( p );
+        if( oTable.Find( p, nHash ) != NULL )
+            return FALSE;
+        oTable.InsertNew( (void *) p, nHash );
+        return TRUE;
+    }
+
+    int     Contains( const void *p ) const
+        { return oTable.Find( p, oTable.oTraits.Hash( p ) ) != NULL; }
+
+    /** Returns TRUE if the pointer was in the set. */
+    int     Remove( const void *p )
+    {
+        CPLOAHashTable<CPLPointerHashTraits>::Slot *psSlot =
+            oTable.Find( p, oTable.oTraits.Hash( p ) );
+        if( psSlot == NULL )
+            return FALSE;
+        oTable.RemoveSlot( psSlot );
+        return TRUE;
+    }
+
+    void    Foreach( CPLHashSetIterEltFunc pfnFunc, void *pUserData )
+        { oTable.Foreach( pfnFunc, pUserData ); }
+};
+
+/************************************************************************/
+/* ==================================================================== */
+/*                          CPLStringInternSet                          */
+/* ==================================================================== */
+/************************************************************************/
+
+class CPLStringHashTraits
+{
+public:
+    /* FNV-1a, inlined rather than calling CPLHashSetHashStr(). */
+    GUInt32 Hash( const void *pKey ) const
+    {
+        const unsigned char *pabyStr = (const unsigned char *) pKey;
+        GUInt32 nHash = 2166136261U;
+        while( *pabyStr != '\0' )
+        {
+            nHash ^= *pabyStr++;
+            nHash *= 16777619U;
+        }
+        return CPLOAHashMix( nHash );
+    }
+    int     Equal( const void *pElt, const void *pKey ) const
+        { return strcmp( (const char *) pElt, (const char *) pKey ) == 0; }
+};
+
+/* Size of the blocks holding the strings. */
+#define CPL_STRING_INTERN_BLOCK_SIZE  65536
+
+/**
+ * Unique copies of strings.
+ *
+ * Intern() returns the same pointer for all equal strings, so that they
+ * can then be compared by pointer.  The copies live in blocks of
+ * CPL_STRING_INTERN_BLOCK_SIZE bytes (longer strings get their own
+ * block) until the set is destroyed.
+ */
+
+class CPLStringInternSet
+{
+    CPLOAHashTable<CPLStringHashTraits> oTable;
+
+    char      **papszBlocks;
+    int         nBlocks;
+    size_t      nBlockUsed;     /* In the last block. */
+    size_t      nBlockSize;
+
+    CPLStringInternSet( const CPLStringInternSet & );
+    CPLStringInternSet &operator=( const CPLStringInternSet & );
+
+    char       *Store( const char *pszStr, size_t nLen )
+    {
+        if( nBlocks == 0 || nBlockUsed + nLen + 1 > nBlockSize )
+        {
+            nBlockSize = MAX( (size_t) CPL_STRING_INTERN_BLOCK_SIZE,
+                              nLen + 1 );
+            papszBlocks = (char **)
+                CPLRealloc( papszBlocks, sizeof(char*) * (nBlocks + 1) );
+            papszBlocks[nBlocks++] = (char *) CPLMalloc( nBlockSize );
+            nBlockUsed = 0;
+        }
+
+        char *pszCopy = papszBlocks[nBlocks - 1] + nBlockUsed;
+        memcpy( pszCopy, pszStr, nLen + 1 );
+        nBlockUsed += nLen + 1;
+
+        return pszCopy;
+    }
+
+public:
+    CPLStringInternSet() : papszBlocks(NULL), nBlocks(0),
+                           nBlockUsed(0), nBlockSize(0) {}
+
+    ~CPLStringInternSet()
+    {
+        for( int i = 0; i < nBlocks; i++ )
+            CPLFree( papszBlocks[i] );
+        CPLFree( papszBlocks );
+    }
+
+    int     Size() const { return oTable.nCount; }
+    void    Reserve( int nElts ) { if( nElts > 0 ) oTable.Reserve( nElts ); }
+
+    /** Returns the unique copy of a string, creating it if needed. */
+    const char *Intern( const char *pszStr )
+    {
+        if( pszStr == NULL )
+            return NULL;
+
+        const GUInt32 nHash = oTable.oTraits.Hash( pszStr );
+        CPLOAHashTable<CPLStringHashTraits>::Slot *psSlot =
+            oTable.Find( pszStr, nHash );
+
+        if( psSlot != NULL )
+            return (const char *) psSlot->pElt;
+
+        char *pszCopy = Store( pszStr, strlen(pszStr) );
+        oTable.InsertNew( pszCopy, nHash );
+        return pszCopy;
+    }
+
+    /** Returns the unique copy of a string, or NULL if not interned. */
+    const char *Find( const char *pszStr ) const
+    {
+        if( pszStr == NULL )
+            return NULL;
+
+        CPLOAHashTable<CPLStringHashTraits>::Slot *psSlot =
+            oTable.Find( pszStr, oTable.oTraits.Hash( pszStr ) );
+
+        return psSlot ? (const char *) psSlot->pElt : NULL;
+    }
+
+    void    Foreach( CPLHashSetIterEltFunc pfnFunc, void *pUserData )
+        { oTable.Foreach( pfnFunc, pUserData ); }
+};
+
+#endif /* _CPL_HASH_SET_OA_H_INCLUDED */
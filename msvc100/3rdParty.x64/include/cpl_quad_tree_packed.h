@@ -0,0 +1,559 @@
+/**********************************************************************
+ * $Id$
+ *
+ * Project:  CPL - Common Portability Library
+ * Purpose:  Bulk-loaded, packed spatial index with buffer, callback and
+ *           batched searches.
+ *
+ ******************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef _CPL_QUAD_TREE_PACKED_H_INCLUDED
+#define _CPL_QUAD_TREE_PACKED_H_INCLUDED
+
+#include "cpl_quad_tree.h"
+#include "cpl_conv.h"
+#include <vector>
+#include <algorithm>
+
+/**
+ * \file cpl_quad_tree_packed.h
+ *
+ * Packed, read-only alternative to CPLQuadTree for static feature sets.
+ *
+ * CPLQuadTree is built one insertion at a time, its nodes are separately
+ * allocated, and each CPLQuadTreeSearch() returns a newly allocated
+ * array.  A CPLPackedQuadTree is built in one pass from all the features
+ * with the Sort-Tile-Recursive algorithm: the features are sorted into
+ * tiles of nearby bounds, and each level of the tree is packed the same
+ * way over the level below.  The nodes and the feature bounds are held
+ * in contiguous arrays, children of a node being adjacent, and the tree
+ * cannot be modified after creation.
+ *
+ * Searches can write into a caller-owned buffer that is only grown when
+ * needed, call a function for each feature found, or answer many
+ * rectangles at once.  As with CPLQuadTreeSearch(), a feature is found
+ * when its bounds intersect the area of interest, edges included.  The
+ * order of the features found is unspecified.
+ *
+ * A built tree is only read by searches, so several threads can search
+ * it at the same time, each one with its own buffer.
+ *
+ *     CPLPackedQuadTree *hTree =
+ *         CPLPackedQuadTreeCreate( nFeatures, pahFeatures, GetBounds, 0 );
+ *     void **pahFound = NULL;
+ *     int nFoundSize = 0;
+ *     for( ... each query ... )
+ *     {
+ *         int nFound = CPLPackedQuadTreeSearchBuffer( hTree, &sAoi,
+ *                                                     &pahFound,
+ *                                                     &nFoundSize );
+ *         ...
+ *     }
+ *     CPLFree( pahFound );
+ *     CPLPackedQuadTreeDestroy( hTree );
+ */
+
+/** Default maximum number of children of a node. */
+#define CPL_PACKED_QUAD_TREE_DEFAULT_CAPACITY  16
+
+typedef struct
+{
+    CPLRectObj  sBounds;
+    int         nFirst;     /* First child node, or first feature. */
+    int         nCount;     /* Number of children. */
+} CPLPackedQuadTreeNode;
+
+typedef struct _CPLPackedQuadTree
+{
+    int                     nFeatures;
+    void                  **pahFeatures;      /* In packed order. */
+    CPLRectObj             *pasFeatureBounds; /* In packed order. */
+
+    int                     nNodes;
+    CPLPackedQuadTreeNode  *pasNodes;         /* Root last. */
+    int                     nLeafNodes;       /* Nodes [0,nLeafNodes) */
+                                              /* have feature children. */
+    int                     nNodeCapacity;
+    int                     nDepth;
+} CPLPackedQuadTree;
+
+/************************************************************************/
+/*                      Sort-Tile-Recursive packing                     */
+/************************************************************************/
+
+typedef struct
+{
+    CPLRectObj  sBounds;
+    int         nIndex;
+} CPLPackedQuadTreeItem;
+
+static inline bool CPLPQTLessX( const CPLPackedQuadTreeItem &a,
+                                const CPLPackedQuadTreeItem &b )
+{
+    return a.sBounds.minx + a.sBounds.maxx < b.sBounds.minx + b.sBounds.maxx;
+}
+
+static inline bool CPLPQTLessY( const CPLPackedQuadTreeItem &a,
+                                const CPLPackedQuadTreeItem &b )
+{
+    return a.sBounds.miny + a.sBounds.maxy < b.sBounds.miny + b.sBounds.maxy;
+}
+
+/* Sort items in STR order: vertical slices by X center, each slice by */
+/* Y center, so that each run of nCapacity items is a compact tile. */
+static inline void CPLPQTSortSTR( std::vector<CPLPackedQuadTreeItem> &aoItems,
+                                  int nCapacity )
+{
+    const size_t nItems = aoItems.size();
+    const size_t nTiles = (nItems + nCapacity - 1) / nCapacity;
+    size_t nSlices = 1;
+
+    while( nSlices * nSlices < nTiles )
+        nSlices++;
+
+    const size_t nSliceSize = ((nTiles + nSlices - 1) / nSlices) * nCapacity;
+
+    std::stable_sort( aoItems.begin(), aoItems.end(), CPLPQTLessX );
+
+    for( size_t iStart = 0; iStart < nItems; iStart += nSliceSize )
+    {
+        const size_t iEnd = MIN( nItems, iStart + nSliceSize );
+        std::stable_sort( aoItems.begin() + iStart, aoItems.begin() + iEnd,
+                          CPLPQTLessY );
+    }
+}
+
+static inline void CPLPQTMergeRect( CPLRectObj *psDst, const CPLRectObj *psSrc )
+{
+    if( psSrc->minx < psDst->minx ) psDst->minx = psSrc->minx;
+    if( psSrc->miny < psDst->miny ) psDst->miny = psSrc->miny;
+    if( psSrc->maxx > psDst->maxx ) psDst->maxx = psSrc->maxx;
+    if( psSrc->maxy > psDst->maxy ) psDst->maxy = psSrc->maxy;
+}
+
+static inline int CPLPQTOverlap( const CPLRectObj *a, const CPLRectObj *b )
+{
+    return !( a->minx > b->maxx || a->maxx < b->minx
+              || a->miny > b->maxy || a->maxy < b->miny );
+}
+
+/************************************************************************/
+/*                  CPLPackedQuadTreeCreateWithBounds()                 */
+/************************************************************************/
+
+/**
+ * Build a packed tree from features with known bounds.
+ *
+ * @param nFeatures number of features.
+ * @param pahFeatures the features.  The array is copied; the features
+ * themselves are not.
+ * @param pasBounds the bounds of each feature.
+ * @param nNodeCapacity maximum number of children of a node, or 0 for
+ * CPL_PACKED_QUAD_TREE_DEFAULT_CAPACITY.
+ *
+ * @return the tree, to be freed with CPLPackedQuadTreeDestroy().
+ */
+
+static inline CPLPackedQuadTree *
+CPLPackedQuadTreeCreateWithBounds( int nFeatures, void * const *pahFeatures,
+                                   const CPLRectObj *pasBounds,
+                                   int nNodeCapacity )
+{
+    if( nNodeCapacity <= 0 )
+        nNodeCapacity = CPL_PACKED_QUAD_TREE_DEFAULT_CAPACITY;
+    if( nNodeCapacity < 2 )
+        nNodeCapacity = 2;
+    if( nFeatures < 0 )
+        nFeatures = 0;
+
+    CPLPackedQuadTree *psTree =
+        (CPLPackedQuadTree *) CPLCalloc( 1, sizeof(CPLPackedQuadTree) );
+    psTree->nNodeCapacity = nNodeCapacity;
+    psTree->nFeatures = nFeatures;
+
+    if( nFeatures == 0 )
+        return psTree;
+
+/* -------------------------------------------------------------------- */
+/*      Sort the features and lay out their arrays in packed order.     */
+/* -------------------------------------------------------------------- */
+    std::vector<CPLPackedQuadTreeItem> aoItems( nFeatures );
+    int i;
+
+    for( i = 0; i < nFeatures; i++ )
+    {
+        aoItems[i].sBounds = pasBounds[i];
+        aoItems[i].nIndex = i;
+    }
+
+    CPLPQTSortSTR( aoItems, nNodeCapacity );
+
+    psTree->pahFeatures = (void **) CPLMalloc( sizeof(void*) * nFeatures );
+    psTree->pasFeatureBounds =
+        (CPLRectObj *) CPLMalloc( sizeof(CPLRectObj) * nFeatures );
+
+    for( i = 0; i < nFeatures; i++ )
+    {
+        psTree->pahFeatures[i] = pahFeatures[aoItems[i].nIndex];
+        psTree->pasFeatureBounds[i] = aoItems[i].sBounds;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Build the levels bottom up.  Each level is made of runs of      */
+/*      nNodeCapacity consecutive items of the level below; the new     */
+/*      nodes are then sorted in turn and appended.                     */
+/* -------------------------------------------------------------------- */
+    std::vector<CPLPackedQuadTreeNode> aoNodes;
+    std::vector<CPLPackedQuadTreeItem> aoLevel;
+    int nChildren = nFeatures;
+    int nChildBase = 0;
+    int bLeafLevel = TRUE;
+
+    aoNodes.reserve( (size_t) nFeatures / (nNodeCapacity - 1) + 2 );
+
+    for( ;; )
+    {
+        aoLevel.clear();
+
+        for( int iFirst = 0; iFirst < nChildren; iFirst += nNodeCapacity )
+        {
+            CPLPackedQuadTreeNode sNode;
+
+            sNode.nFirst = nChildBase + iFirst;
+            sNode.nCount = MIN( nNodeCapacity, nChildren - iFirst );
+            sNode.sBounds = bLeafLevel
+                ? psTree->pasFeatureBounds[sNode.nFirst]
+                : aoNodes[sNode.nFirst].sBounds;
+
+            for( int iChild = 1; iChild < sNode.nCount; iChild++ )
+                CPLPQTMergeRect( &(sNode.sBounds), bLeafLevel
+                    ? &(psTree->pasFeatureBounds[sNode.nFirst + iChild])
+                    : &(aoNodes[sNode.nFirst + iChild].sBounds) );
+
+            CPLPackedQuadTreeItem sItem;
+            sItem.sBounds = sNode.sBounds;
+            sItem.nIndex = (int) aoNodes.size();
+            aoLevel.push_back( sItem );
+            aoNodes.push_back( sNode );
+        }
+
+        psTree->nDepth++;
+        if( bLeafLevel )
+            psTree->nLeafNodes = (int) aoNodes.size();
+
+        nChildBase = (int) aoNodes.size() - (int) aoLevel.size();
+        nChildren = (int) aoLevel.size();
+        bLeafLevel = FALSE;
+
+        if( nChildren == 1 )
+            break;
+
+        /* Reorder the new level in STR order before packing it. */
+        CPLPQTSortSTR( aoLevel, nNodeCapacity );
+
+        std::vector<CPLPackedQuadTreeNode> aoSorted( nChildren );
+        for( i = 0; i < nChildren; i++ )
+            aoSorted[i] = aoNodes[aoLevel[i].nIndex];
+        std::copy( aoSorted.begin(), aoSorted.end(),
+                   aoNodes.begin() + nChildBase );
+    }
+
+    psTree->nNodes = (int) aoNodes.size();
+    psTree->pasNodes = (CPLPackedQuadTreeNode *)
+        CPLMalloc( sizeof(CPLPackedQuadTreeNode) * psTree->nNodes );
+    std::copy( aoNodes.begin(), aoNodes.end(), psTree->pasNodes );
+
+    return psTree;
+}
+
+/************************************************************************/
+/*                       CPLPackedQuadTreeCreate()                      */
+/************************************************************************/
+
+/**
+ * Build a packed tree from features, fetching their bounds with a
+ * CPLQuadTreeGetBoundsFunc as CPLQuadTreeInsert() does.
+ *
+ * @see CPLPackedQuadTreeCreateWithBounds()
+ */
+
+static inline CPLPackedQuadTree *
+CPLPackedQuadTreeCreate( int nFeatures, void * const *pahFeatures,
+                         CPLQuadTreeGetBoundsFunc pfnGetBounds,
+                         int nNodeCapacity )
+{
+    std::vector<CPLRectObj> asBounds( MAX(nFeatures, 1) );
+
+    for( int i = 0; i < nFeatures; i++ )
+        pfnGetBounds( pahFeatures[i], &(asBounds[i]) );
+
+    return CPLPackedQuadTreeCreateWithBounds( nFeatures, pahFeatures,
+                                              &(asBounds[0]), nNodeCapacity );
+}
+
+/************************************************************************/
+/*                       CPLPackedQuadTreeDestroy()                     */
+/************************************************************************/
+
+static inline void CPLPackedQuadTreeDestroy( CPLPackedQuadTree *psTree )
+{
+    if( psTree == NULL )
+        return;
+
+    CPLFree( psTree->pahFeatures );
+    CPLFree( psTree->pasFeatureBounds );
+    CPLFree( psTree->pasNodes );
+    CPLFree( psTree );
+}
+
+/************************************************************************/
+/*                        CPLPackedQuadTreeVisit()                      */
+/*                                                                      */
+/*      Walk the subtree of a node, handing the features intersecting   */
+/*      the area of interest to a functor.  Returns FALSE if the        */
+/*      functor asked to stop.                                          */
+/************************************************************************/
+
+template<class Visitor>
+static inline int CPLPackedQuadTreeVisit( const CPLPackedQuadTree *psTree,
+                                          int iNode, const CPLRectObj *pAoi,
+                                          Visitor &oVisitor )
+{
+    const CPLPackedQuadTreeNode *psNode = psTree->pasNodes + iNode;
+    const int nEnd = psNode->nFirst + psNode->nCount;
+
+    if( iNode < psTree->nLeafNodes )
+    {
+        for( int i = psNode->nFirst; i < nEnd; i++ )
+        {
+            if( CPLPQTOverlap( psTree->pasFeatureBounds + i, pAoi )
+                && !oVisitor( psTree->pahFeatures[i] ) )
+                return FALSE;
+        }
+        return TRUE;
+    }
+
+    for( int i = psNode->nFirst; i < nEnd; i++ )
+    {
+        if( CPLPQTOverlap( &(psTree->pasNodes[i].sBounds), pAoi )
+            && !CPLPackedQuadTreeVisit( psTree, i, pAoi, oVisitor ) )
+            return FALSE;
+    }
+    return TRUE;
+}
+
+template<class Visitor>
+static inline int CPLPackedQuadTreeVisit( const CPLPackedQuadTree *psTree,
+                                          const CPLRectObj *pAoi,
+                                          Visitor &oVisitor )
+{
+    if( psTree->nNodes == 0
+        || !CPLPQTOverlap( &(psTree->pasNodes[psTree->nNodes-1].sBounds),
+                           pAoi ) )
+        return TRUE;
+
+    return CPLPackedQuadTreeVisit( psTree, psTree->nNodes - 1, pAoi,
+                                   oVisitor );
+}
+
+/* Appends to a CPLRealloc()'ed buffer, doubling it when full. */
+class CPLPackedQuadTreeCollector
+{
+public:
+    void     ***pppahBuffer;
+    int        *pnBufferSize;
+    int         nCount;
+
+    CPLPackedQuadTreeCollector( void ***pppahBufferIn, int *pnBufferSizeIn,
+                                int nCountIn )
+        : pppahBuffer(pppahBufferIn), pnBufferSize(pnBufferSizeIn),
+          nCount(nCountIn) {}
+
+    int operator()( void *hFeature )
+    {
+        if( nCount == *pnBufferSize )
+        {
+            *pnBufferSize = MAX( 16, *pnBufferSize * 2 );
+            *pppahBuffer = (void **)
+                CPLRealloc( *pppahBuffer, sizeof(void*) * *pnBufferSize );
+        }
+        (*pppahBuffer)[nCount++] = hFeature;
+        return TRUE;
+    }
+};
+
+class CPLPackedQuadTreeCallback
+{
+public:
+    CPLQuadTreeForeachFunc  pfnForeach;
+    void                   *pUserData;
+
+    int operator()( void *hFeature )
+    {
+        return pfnForeach( hFeature, pUserData );
+    }
+};
+
+/************************************************************************/
+/*                    CPLPackedQuadTreeSearchBuffer()                   */
+/************************************************************************/
+
+/**
+ * Find the features whose bounds intersect an area of interest, into a
+ * reusable buffer.
+ *
+ * @param psTree the tree.
+ * @param pAoi the area of interest.
+ * @param pppahBuffer pointer to a buffer allocated with CPLMalloc(), or
+ * to NULL.  It is reallocated when too small, and is to be freed by the
+ * caller with CPLFree().
+ * @param pnBufferSize pointer to the allocated size of the buffer, in
+ * features, updated when it is reallocated.
+ *
+ * @return the number of features found, stored at the start of the
+ * buffer.
+ */
+
+static inline int
+CPLPackedQuadTreeSearchBuffer( const CPLPackedQuadTree *psTree,
+                               const CPLRectObj *pAoi,
+                               void ***pppahBuffer, int *pnBufferSize )
+{
+    CPLPackedQuadTreeCollector oCollector( pppahBuffer, pnBufferSize, 0 );
+    CPLPackedQuadTreeVisit( psTree, pAoi, oCollector );
+    return oCollector.nCount;
+}
+
+/************************************************************************/
+/*                   CPLPackedQuadTreeSearchCallback()                  */
+/************************************************************************/
+
+/**
+ * Call a function for each feature whose bounds intersect an area of
+ * interest, without allocating anything.
+ *
+ * @param psTree the tree.
+ * @param pAoi the area of interest.
+ * @param pfnForeach function called with each feature found and
+ * pUserData.  It returns FALSE to stop the search.
+ * @param pUserData user data passed to pfnForeach.
+ *
+ * @return FALSE if pfnForeach stopped the search, TRUE otherwise.
+ */
+
+static inline int
+CPLPackedQuadTreeSearchCallback( const CPLPackedQuadTree *psTree,
+                                 const CPLRectObj *pAoi,
+                                 CPLQuadTreeForeachFunc pfnForeach,
+                                 void *pUserData )
+{
+    CPLPackedQuadTreeCallback oCallback;
+    oCallback.pfnForeach = pfnForeach;
+    oCallback.pUserData = pUserData;
+    return CPLPackedQuadTreeVisit( psTree, pAoi, oCallback );
+}
+
+/************************************************************************/
+/*                       CPLPackedQuadTreeSearch()                      */
+/************************************************************************/
+
+/**
+ * Find the features whose bounds intersect an area of interest, like
+ * CPLQuadTreeSearch().
+ *
+ * @return a newly allocated array of *pnFeatureCount features, to be
+ * freed with CPLFree(), or NULL if nothing is found.
+ */
+
+static inline void **
+CPLPackedQuadTreeSearch( const CPLPackedQuadTree *psTree,
+                         const CPLRectObj *pAoi, int *pnFeatureCount )
+{
+    void **pahBuffer = NULL;
+    int nBufferSize = 0;
+
+    *pnFeatureCount = CPLPackedQuadTreeSearchBuffer( psTree, pAoi,
+                                                     &pahBuffer,
+                                                     &nBufferSize );
+    return pahBuffer;
+}
+
+/************************************************************************/
+/*                    CPLPackedQuadTreeSearchBatch()                    */
+/************************************************************************/
+
+/**
+ * Find the features intersecting each of several areas of interest.
+ *
+ * The results of all the queries are stored one after the other in a
+ * single reusable buffer: the features found for query i are at
+ * (*pppahBuffer)[panOffsets[i]] to (*pppahBuffer)[panOffsets[i+1]-1].
+ *
+ * @param psTree the tree.
+ * @param nQueries number of areas of interest.
+ * @param pasAoi the areas of interest.
+ * @param panOffsets array of nQueries + 1 offsets, filled in.
+ * @param pppahBuffer pointer to a buffer allocated with CPLMalloc(), or
+ * to NULL, reallocated as needed, as in CPLPackedQuadTreeSearchBuffer().
+ * @param pnBufferSize pointer to the allocated size of the buffer.
+ *
+ * @return the total number of features found.
+ */
+
+static inline int
+CPLPackedQuadTreeSearchBatch( const CPLPackedQuadTree *psTree,
+                              int nQueries, const CPLRectObj *pasAoi,
+                              int *panOffsets,
+                              void ***pppahBuffer, int *pnBufferSize )
+{
+    CPLPackedQuadTreeCollector oCollector( pppahBuffer, pnBufferSize, 0 );
+
+    for( int i = 0; i < nQueries; i++ )
+    {
+        panOffsets[i] = oCollector.nCount;
+        CPLPackedQuadTreeVisit( psTree, pasAoi + i, oCollector );
+    }
+    panOffsets[nQueries] = oCollector.nCount;
+
+    return oCollector.nCount;
+}
+
+/************************************************************************/
+/*                      CPLPackedQuadTreeGetStats()                     */
+/************************************************************************/
+
+static inline void
+CPLPackedQuadTreeGetStats( const CPLPackedQuadTree *psTree,
+                           int *pnFeatureCount, int *pnNodeCount,
+                           int *pnMaxDepth, int *pnNodeCapacity )
+{
+    if( pnFeatureCount )
+        *pnFeatureCount = psTree->nFeatures;
+    if( pnNodeCount )
+        *pnNodeCount = psTree->nNodes;
+    if( pnMaxDepth )
+        *pnMaxDepth = psTree->nDepth;
+    if( pnNodeCapacity )
+        *pnNodeCapacity = psTree->nNodeCapacity;
+}
+
+#endif /* _CPL_QUAD_TREE_PACKED_H_INCLUDED */
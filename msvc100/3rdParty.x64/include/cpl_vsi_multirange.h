@@ -0,0 +1,403 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  CPL - Common Portability Library
+ * Purpose:  Vectored implementation of VSIFReadMultiRangeL() for local files.
+ *
+ ******************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef CPL_VSI_MULTIRANGE_H_INCLUDED
+#define CPL_VSI_MULTIRANGE_H_INCLUDED
+
+#include "cpl_vsi.h"
+#include "cpl_conv.h"
+#include "cpl_error.h"
+#include "cpl_string.h"
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#if defined(__linux__)
+#  define VSI_MULTIRANGE_HAVE_PREADV
+#  include <sys/types.h>
+#  include <sys/uio.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  ifndef IOV_MAX
+#    define IOV_MAX 1024
+#  endif
+#endif
+
+/**
+ * \file cpl_vsi_multirange.h
+ *
+ * VSIFReadMultiRangeVectoredL() reads several ranges of a file, like
+ * VSIFReadMultiRangeL(), but batches the I/O.  The ranges are sorted
+ * by offset, and ranges that are adjacent or separated by at most
+ * VSI_MULTIRANGE_MAX_GAP bytes (4096 by default, at most 1 MB) are
+ * coalesced into a single read.
+ *
+ * For files of the local file system on Linux, each coalesced read is a
+ * single preadv() call scattering directly into the caller's buffers, the
+ * bytes of the gaps going to a scratch buffer.  When several reads are
+ * needed, the kernel is first asked to read them all ahead with
+ * posix_fadvise(POSIX_FADV_WILLNEED), so that the disk can serve them in
+ * parallel, unless VSI_MULTIRANGE_PREFETCH is set to NO.
+ * VSI_MULTIRANGE_READAHEAD can be set to a number of bytes to also read
+ * ahead after the last range.
+ *
+ * For other files and platforms, each coalesced read is a VSIFSeekL() and
+ * VSIFReadL() into a temporary buffer.
+ *
+ * preadv() does not use nor change the file position.  Pending writes on
+ * the handle must have been flushed with VSIFFlushL() before.
+ */
+
+/* Upper bound of VSI_MULTIRANGE_MAX_GAP, which sizes the gap buffer. */
+#define VSI_MULTIRANGE_MAX_GAP_LIMIT  (1024 * 1024)
+
+/** Statistics of VSIFReadMultiRangeVectoredL(), accumulated over calls. */
+typedef struct
+{
+    /*! Calls to VSIFReadMultiRangeVectoredL(). */
+    GUIntBig    nRequests;
+    /*! Non empty ranges requested. */
+    GUIntBig    nRanges;
+    /*! Ranges read by the read of a previous range. */
+    GUIntBig    nCoalescedRanges;
+    /*! Read system calls (or VSIFReadL() calls). */
+    GUIntBig    nReadCalls;
+    /*! posix_fadvise() read ahead hints. */
+    GUIntBig    nPrefetchHints;
+    /*! Bytes requested. */
+    GUIntBig    nBytesRequested;
+    /*! Bytes read, including the gaps between coalesced ranges. */
+    GUIntBig    nBytesRead;
+} VSIMultiRangeStats;
+
+/* A run of coalesced ranges, [iFirst, iLast] in the sorted order. */
+typedef struct
+{
+    vsi_l_offset nOffset;
+    vsi_l_offset nEnd;
+    int          iFirst;
+    int          iLast;
+} VSIMultiRangeRun;
+
+class VSIMultiRangeOffsetLess
+{
+    const vsi_l_offset *panOffsets;
+  public:
+    explicit VSIMultiRangeOffsetLess( const vsi_l_offset *panOffsetsIn ) :
+        panOffsets(panOffsetsIn) {}
+    bool operator()( int a, int b ) const
+        { return panOffsets[a] < panOffsets[b]; }
+};
+
+/************************************************************************/
+/*                    VSIFReadMultiRangeCoalesce()                      */
+/************************************************************************/
+
+/* Sort the non empty ranges by offset into anOrder and group them into */
+/* runs of at most nMaxPerRun ranges. */
+
+static inline void
+VSIFReadMultiRangeCoalesce( int nRanges, const vsi_l_offset *panOffsets,
+                            const size_t *panSizes, vsi_l_offset nMaxGap,
+                            int nMaxPerRun,
+                            std::vector<int> &anOrder,
+                            std::vector<VSIMultiRangeRun> &asRuns )
+{
+    anOrder.clear();
+    asRuns.clear();
+
+    for( int i = 0; i < nRanges; i++ )
+    {
+        if( panSizes[i] > 0 )
+            anOrder.push_back( i );
+    }
+    std::stable_sort( anOrder.begin(), anOrder.end(),
+                      VSIMultiRangeOffsetLess( panOffsets ) );
+
+    for( int k = 0; k < (int) anOrder.size(); k++ )
+    {
+        const int i = anOrder[k];
+        const vsi_l_offset nEnd = panOffsets[i] + panSizes[i];
+
+        /* Overlapping ranges start a new run: a buffer cannot be */
+        /* scattered into twice. */
+        if( !asRuns.empty() )
+        {
+            VSIMultiRangeRun &sRun = asRuns.back();
+            if( panOffsets[i] >= sRun.nEnd
+                && panOffsets[i] - sRun.nEnd <= nMaxGap
+                && k - sRun.iFirst < nMaxPerRun )
+            {
+                sRun.nEnd = nEnd;
+                sRun.iLast = k;
+                continue;
+            }
+        }
+
+        VSIMultiRangeRun sRun;
+        sRun.nOffset = panOffsets[i];
+        sRun.nEnd = nEnd;
+        sRun.iFirst = k;
+        sRun.iLast = k;
+        asRuns.push_back( sRun );
+    }
+}
+
+/************************************************************************/
+/*                    VSIFReadMultiRangeVectoredL()                     */
+/************************************************************************/
+
+/**
+ * Read several ranges of a file in batched I/O.
+ *
+ * Same as VSIFReadMultiRangeL(), with the reads coalesced as described
+ * in cpl_vsi_multirange.h.  The file position is left unchanged.
+ *
+ * @param nRanges number of ranges.
+ * @param ppData array of nRanges buffers receiving the ranges.
+ * @param panOffsets array of nRanges offsets, in any order.
+ * @param panSizes array of nRanges sizes.
+ * @param fp file handle opened with VSIFOpenL().
+ * @param psStats statistics to update, typically kept per handle, or NULL.
+ *
+ * @return 0 on success, -1 on error (including a range past the end of
+ * the file).
+ */
+
+static inline int
+VSIFReadMultiRangeVectoredL( int nRanges, void **ppData,
+                             const vsi_l_offset *panOffsets,
+                             const size_t *panSizes, VSILFILE *fp,
+                             VSIMultiRangeStats *psStats = NULL )
+{
+    VSIMultiRangeStats sStats;
+    memset( &sStats, 0, sizeof(sStats) );
+    sStats.nRequests = 1;
+
+    const int nMaxGapOption =
+        atoi( CPLGetConfigOption( "VSI_MULTIRANGE_MAX_GAP", "4096" ) );
+    const vsi_l_offset nMaxGap = (vsi_l_offset)
+        MAX( 0, MIN( nMaxGapOption, VSI_MULTIRANGE_MAX_GAP_LIMIT ) );
+
+    std::vector<int> anOrder;
+    std::vector<VSIMultiRangeRun> asRuns;
+    int nRet = 0;
+
+#ifdef VSI_MULTIRANGE_HAVE_PREADV
+    void *pNativeFD = VSIFGetNativeFileDescriptorL( fp );
+    const int bNative = pNativeFD != NULL;
+    const int fd = (int) (size_t) pNativeFD;
+#endif
+
+    /* Each range and each gap takes one iovec. */
+    VSIFReadMultiRangeCoalesce( nRanges, panOffsets, panSizes, nMaxGap,
+#ifdef VSI_MULTIRANGE_HAVE_PREADV
+                                bNative ? (IOV_MAX + 1) / 2 : INT_MAX,
+#else
+                                INT_MAX,
+#endif
+                                anOrder, asRuns );
+
+    for( size_t k = 0; k < anOrder.size(); k++ )
+        sStats.nBytesRequested += panSizes[anOrder[k]];
+    sStats.nRanges = anOrder.size();
+    sStats.nCoalescedRanges = anOrder.size() - asRuns.size();
+
+#ifdef VSI_MULTIRANGE_HAVE_PREADV
+    if( bNative )
+    {
+/* -------------------------------------------------------------------- */
+/*      Ask the kernel to read all the runs ahead, so that the          */
+/*      preadv() calls below do not wait for each other.                */
+/* -------------------------------------------------------------------- */
+        const vsi_l_offset nReadAhead = (vsi_l_offset) MAX( 0,
+            atoi( CPLGetConfigOption( "VSI_MULTIRANGE_READAHEAD", "0" ) ) );
+
+        if( CSLTestBoolean(
+                CPLGetConfigOption( "VSI_MULTIRANGE_PREFETCH", "YES" ) ) )
+        {
+            for( size_t iRun = 0;
+                 asRuns.size() > 1 && iRun < asRuns.size(); iRun++ )
+            {
+                posix_fadvise( fd, (off_t) asRuns[iRun].nOffset,
+                               (off_t) (asRuns[iRun].nEnd
+                                        - asRuns[iRun].nOffset),
+                               POSIX_FADV_WILLNEED );
+                sStats.nPrefetchHints++;
+            }
+        }
+        if( nReadAhead > 0 && !asRuns.empty() )
+        {
+            posix_fadvise( fd, (off_t) asRuns.back().nEnd, (off_t) nReadAhead,
+                           POSIX_FADV_WILLNEED );
+            sStats.nPrefetchHints++;
+        }
+
+/* -------------------------------------------------------------------- */
+/*      One preadv() per run, the gaps going to a scratch buffer.       */
+/* -------------------------------------------------------------------- */
+        std::vector<GByte> abyScratch;
+        std::vector<struct iovec> asIov;
+
+        for( size_t iRun = 0; nRet == 0 && iRun < asRuns.size(); iRun++ )
+        {
+            const VSIMultiRangeRun &sRun = asRuns[iRun];
+            vsi_l_offset nPos = sRun.nOffset;
+
+            asIov.clear();
+            for( int k = sRun.iFirst; k <= sRun.iLast; k++ )
+            {
+                const int i = anOrder[k];
+                struct iovec sIov;
+
+                if( panOffsets[i] > nPos )
+                {
+                    if( abyScratch.empty() )
+                        abyScratch.resize( (size_t) nMaxGap );
+                    sIov.iov_base = &abyScratch[0];
+                    sIov.iov_len = (size_t) (panOffsets[i] - nPos);
+                    asIov.push_back( sIov );
+                }
+                sIov.iov_base = ppData[i];
+                sIov.iov_len = panSizes[i];
+                asIov.push_back( sIov );
+                nPos = panOffsets[i] + panSizes[i];
+            }
+
+            /* Loop on short reads. */
+            size_t iIov = 0;
+            nPos = sRun.nOffset;
+            while( iIov < asIov.size() )
+            {
+                const ssize_t nRead =
+                    preadv( fd, &asIov[iIov], (int) (asIov.size() - iIov),
+                            (off_t) nPos );
+                sStats.nReadCalls++;
+
+                if( nRead < 0 && errno == EINTR )
+                    continue;
+                if( nRead <= 0 )
+                {
+                    CPLError( CE_Failure, CPLE_FileIO,
+                              "preadv() of " CPL_FRMT_GUIB " bytes at "
+                              CPL_FRMT_GUIB " failed: %s",
+                              (GUIntBig) (sRun.nEnd - nPos), (GUIntBig) nPos,
+                              nRead == 0 ? "end of file" : strerror(errno) );
+                    nRet = -1;
+                    break;
+                }
+
+                sStats.nBytesRead += nRead;
+                nPos += nRead;
+
+                size_t nLeft = (size_t) nRead;
+                while( nLeft > 0 )
+                {
+                    if( nLeft >= asIov[iIov].iov_len )
+                    {
+                        nLeft -= asIov[iIov].iov_len;
+                        iIov++;
+                    }
+                    else
+                    {
+                        asIov[iIov].iov_base =
+                            (GByte *) asIov[iIov].iov_base + nLeft;
+                        asIov[iIov].iov_len -= nLeft;
+                        nLeft = 0;
+                    }
+                }
+            }
+        }
+    }
+    else
+#endif /* VSI_MULTIRANGE_HAVE_PREADV */
+    {
+/* -------------------------------------------------------------------- */
+/*      Generic path: one seek and read per run, into the caller's      */
+/*      buffer for single range runs, into a temporary buffer else.     */
+/* -------------------------------------------------------------------- */
+        const vsi_l_offset nSavedPos = VSIFTellL( fp );
+        std::vector<GByte> abyRun;
+
+        for( size_t iRun = 0; nRet == 0 && iRun < asRuns.size(); iRun++ )
+        {
+            const VSIMultiRangeRun &sRun = asRuns[iRun];
+            const size_t nRunSize = (size_t) (sRun.nEnd - sRun.nOffset);
+            GByte *pabyDst;
+
+            if( sRun.iFirst == sRun.iLast )
+                pabyDst = (GByte *) ppData[anOrder[sRun.iFirst]];
+            else
+            {
+                abyRun.resize( nRunSize );
+                pabyDst = &abyRun[0];
+            }
+
+            sStats.nReadCalls++;
+            if( VSIFSeekL( fp, sRun.nOffset, SEEK_SET ) != 0
+                || VSIFReadL( pabyDst, 1, nRunSize, fp ) != nRunSize )
+            {
+                CPLError( CE_Failure, CPLE_FileIO,
+                          "Read of %lu bytes at " CPL_FRMT_GUIB " failed.",
+                          (unsigned long) nRunSize, (GUIntBig) sRun.nOffset );
+                nRet = -1;
+                break;
+            }
+            sStats.nBytesRead += nRunSize;
+
+            if( sRun.iFirst != sRun.iLast )
+            {
+                for( int k = sRun.iFirst; k <= sRun.iLast; k++ )
+                {
+                    const int i = anOrder[k];
+                    memcpy( ppData[i],
+                            pabyDst + (size_t) (panOffsets[i] - sRun.nOffset),
+                            panSizes[i] );
+                }
+            }
+        }
+
+        VSIFSeekL( fp, nSavedPos, SEEK_SET );
+    }
+
+    if( psStats != NULL )
+    {
+        psStats->nRequests += sStats.nRequests;
+        psStats->nRanges += sStats.nRanges;
+        psStats->nCoalescedRanges += sStats.nCoalescedRanges;
+        psStats->nReadCalls += sStats.nReadCalls;
+        psStats->nPrefetchHints += sStats.nPrefetchHints;
+        psStats->nBytesRequested += sStats.nBytesRequested;
+        psStats->nBytesRead += sStats.nBytesRead;
+    }
+
+    return nRet;
+}
+
+#endif /* ndef CPL_VSI_MULTIRANGE_H_INCLUDED */
@@ -0,0 +1,857 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  GDAL Gridding API.
+ * Purpose:  Spatially indexed, multi-threaded gridding of scattered points.
+ *
+ ******************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef GDALGRID_MT_H_INCLUDED
+#define GDALGRID_MT_H_INCLUDED
+
+/**
+ * \file gdalgrid_mt.h
+ *
+ * Spatially indexed, multi-threaded variant of GDALGridCreate().
+ *
+ * The gridding algorithms with a search ellipse test every input point
+ * against every grid node.  GDALGridCreateMT() buckets the points once
+ * into a regular grid of cells of about the size of the search ellipse,
+ * so that each node only looks at the points of the cells covered by
+ * the bounding box of its ellipse, and computes the output rows on
+ * several threads.
+ *
+ * The candidate points of a node are visited in increasing index order,
+ * which is the order of the full scan, and go through the same tests and
+ * accumulations, so the indexed and the brute force (USE_INDEX=NO)
+ * results are identical, including the nMaxPoints cut-off and ties of
+ * the nearest neighbor search.  Without a search ellipse, the inverse
+ * distance to a power ignores nMinPoints and nMaxPoints, as
+ * GDALGridCreate() does.
+ *
+ * The index is used when both radii of the search ellipse are non-zero.
+ * Without a search ellipse every point contributes to every node, and
+ * the nodes are only spread over the threads.
+ */
+
+#include "gdalgrid.h"
+#include "cpl_multiproc.h"
+#include "cpl_worker_thread_pool.h"
+#include "cpl_atomic_ops.h"
+#include "cpl_string.h"
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#define GGMT_TO_RADIANS (3.14159265358979323846 / 180.0)
+
+/* CPLIsFinite() lets infinities through where isinf() is not a macro. */
+static inline int GDALGridIsFinite( double dfVal )
+{
+    return dfVal - dfVal == 0.0;
+}
+
+/* Maximum number of index cells per input point. */
+#define GGMT_MAX_CELLS_PER_POINT  4
+
+/************************************************************************/
+/* ==================================================================== */
+/*                           GDALGridPointIndex                         */
+/* ==================================================================== */
+/************************************************************************/
+
+/**
+ * Bucket grid over a set of points.
+ *
+ * The indices of the points falling in each cell are stored contiguously
+ * and in increasing order (compressed row storage).  Points with a non
+ * finite coordinate cannot be inside any search ellipse and are left out.
+ */
+
+class GDALGridPointIndex
+{
+    double              dfXMin;
+    double              dfYMin;
+    double              dfCellSize;
+    int                 nCellsX;
+    int                 nCellsY;
+
+    std::vector<GUInt32> anCellStart;
+    std::vector<GUInt32> anPoints;
+
+    int CellX( double dfX ) const
+    {
+        double dfCell = floor( (dfX - dfXMin) / dfCellSize );
+        if( dfCell < 0 ) return 0;
+        if( dfCell >= nCellsX ) return nCellsX - 1;
+        return (int) dfCell;
+    }
+
+    int CellY( double dfY ) const
+    {
+        double dfCell = floor( (dfY - dfYMin) / dfCellSize );
+        if( dfCell < 0 ) return 0;
+        if( dfCell >= nCellsY ) return nCellsY - 1;
+        return (int) dfCell;
+    }
+
+public:
+    GDALGridPointIndex() : dfXMin(0), dfYMin(0), dfCellSize(1),
+                           nCellsX(0), nCellsY(0) {}
+
+/************************************************************************/
+/*                                Build()                               */
+/************************************************************************/
+
+    /**
+     * Build the index.
+     *
+     * @param nPoints number of points.
+     * @param padfX point X coordinates.
+     * @param padfY point Y coordinates.
+     * @param dfCellSizeIn wanted cell size, normally the largest half
+     * extent of the search ellipse.  It is enlarged if needed to keep the
+     * number of cells under GGMT_MAX_CELLS_PER_POINT per point.
+     */
+    void Build( GUInt32 nPoints, const double *padfX, const double *padfY,
+                double dfCellSizeIn )
+    {
+        GUInt32 i;
+        double dfXMax = 0.0, dfYMax = 0.0;
+        GUInt32 nValid = 0;
+
+        for( i = 0; i < nPoints; i++ )
+        {
+            if( !GDALGridIsFinite(padfX[i]) || !GDALGridIsFinite(padfY[i]) )
+                continue;
+            if( nValid == 0 )
+            {
+                dfXMin = dfXMax = padfX[i];
+                dfYMin = dfYMax = padfY[i];
+            }
+            else
+            {
+                dfXMin = MIN( dfXMin, padfX[i] );
+                dfXMax = MAX( dfXMax, padfX[i] );
+                dfYMin = MIN( dfYMin, padfY[i] );
+                dfYMax = MAX( dfYMax, padfY[i] );
+            }
+            nValid++;
+        }
+
+/* -------------------------------------------------------------------- */
+/*      Choose the cell size.                                           */
+/* -------------------------------------------------------------------- */
+        const double dfWidth = dfXMax - dfXMin;
+        const double dfHeight = dfYMax - dfYMin;
+        const double dfMaxCells =
+            (double) MAX(nValid, 1) * GGMT_MAX_CELLS_PER_POINT;
+
+        dfCellSize = dfCellSizeIn;
+        if( !(dfCellSize > 0.0) || !GDALGridIsFinite(dfCellSize) )
+            dfCellSize = MAX( MAX(dfWidth, dfHeight), 1.0 );
+
+        while( (dfWidth / dfCellSize + 1.0) * (dfHeight / dfCellSize + 1.0)
+               > dfMaxCells )
+            dfCellSize *= 2.0;
+
+        nCellsX = (int) (dfWidth / dfCellSize) + 1;
+        nCellsY = (int) (dfHeight / dfCellSize) + 1;
+
+/* -------------------------------------------------------------------- */
+/*      Counting sort of the points by cell, which keeps them in        */
+/*      index order within each cell.                                   */
+/* -------------------------------------------------------------------- */
+        const size_t nCells = (size_t) nCellsX * nCellsY;
+
+        anCellStart.assign( nCells + 1, 0 );
+        anPoints.resize( nValid );
+
+        std::vector<GUInt32> anCell( nPoints );
+        for( i = 0; i < nPoints; i++ )
+        {
+            if( !GDALGridIsFinite(padfX[i]) || !GDALGridIsFinite(padfY[i]) )
+            {
+                anCell[i] = (GUInt32) nCells;
+                continue;
+            }
+            anCell[i] = (GUInt32)
+                ((size_t) CellY(padfY[i]) * nCellsX + CellX(padfX[i]));
+            anCellStart[anCell[i] + 1]++;
+        }
+
+        for( size_t iCell = 0; iCell < nCells; iCell++ )
+            anCellStart[iCell + 1] += anCellStart[iCell];
+
+        std::vector<GUInt32> anFill( anCellStart.begin(),
+                                     anCellStart.end() - 1 );
+        for( i = 0; i < nPoints; i++ )
+        {
+            if( anCell[i] < nCells )
+                anPoints[anFill[anCell[i]]++] = i;
+        }
+    }
+
+/************************************************************************/
+/*                               Search()                               */
+/************************************************************************/
+
+    /**
+     * Collect the indices of the points of the cells intersecting a
+     * rectangle.  The result is a superset of the points inside the
+     * rectangle, sorted within each cell only.
+     */
+    void Search( double dfXMinQ, double dfYMinQ, double dfXMaxQ, double dfYMaxQ,
+                 std::vector<GUInt32> &anResult ) const
+    {
+        anResult.clear();
+        if( anPoints.empty() )
+            return;
+
+        const int nX0 = CellX( dfXMinQ ), nX1 = CellX( dfXMaxQ );
+        const int nY0 = CellY( dfYMinQ ), nY1 = CellY( dfYMaxQ );
+
+        for( int iY = nY0; iY <= nY1; iY++ )
+        {
+            const size_t iRow = (size_t) iY * nCellsX;
+            anResult.insert( anResult.end(),
+                             anPoints.begin() + anCellStart[iRow + nX0],
+                             anPoints.begin() + anCellStart[iRow + nX1 + 1] );
+        }
+    }
+};
+
+/************************************************************************/
+/* ==================================================================== */
+/*                          Gridding algorithms                         */
+/* ==================================================================== */
+/************************************************************************/
+
+/* Search ellipse, as used by all the algorithms. */
+typedef struct
+{
+    double  dfRadius1Square;
+    double  dfRadius2Square;
+    double  dfR12Square;
+    int     bRotated;
+    double  dfCoeff1;
+    double  dfCoeff2;
+} GDALGridEllipse;
+
+static inline void GDALGridEllipseInit( GDALGridEllipse *psEllipse,
+                                        double dfRadius1, double dfRadius2,
+                                        double dfAngle )
+{
+    psEllipse->dfRadius1Square = dfRadius1 * dfRadius1;
+    psEllipse->dfRadius2Square = dfRadius2 * dfRadius2;
+    psEllipse->dfR12Square =
+        psEllipse->dfRadius1Square * psEllipse->dfRadius2Square;
+
+    dfAngle = GGMT_TO_RADIANS * dfAngle;
+    psEllipse->bRotated = ( dfAngle != 0.0 );
+    psEllipse->dfCoeff1 = psEllipse->bRotated ? cos(dfAngle) : 0.0;
+    psEllipse->dfCoeff2 = psEllipse->bRotated ? sin(dfAngle) : 0.0;
+}
+
+/* Rotate a node to point vector into the ellipse axes and test it. */
+static inline int GDALGridEllipseTest( const GDALGridEllipse *psEllipse,
+                                       double &dfRX, double &dfRY )
+{
+    if( psEllipse->bRotated )
+    {
+        const double dfRXRotated =
+            dfRX * psEllipse->dfCoeff1 + dfRY * psEllipse->dfCoeff2;
+        const double dfRYRotated =
+            dfRY * psEllipse->dfCoeff1 - dfRX * psEllipse->dfCoeff2;
+
+        dfRX = dfRXRotated;
+        dfRY = dfRYRotated;
+    }
+
+    return psEllipse->dfRadius2Square * dfRX * dfRX
+         + psEllipse->dfRadius1Square * dfRY * dfRY
+        <= psEllipse->dfR12Square;
+}
+
+/* Candidate points of a node: panIdx[0..nCount-1], or all the points in */
+/* order when panIdx is NULL. */
+#define GGMT_POINT(k)   ( panIdx != NULL ? panIdx[k] : (GUInt32)(k) )
+
+/************************************************************************/
+/*                         GDALGridMTEvaluate()                         */
+/*                                                                      */
+/*      Compute the value of one grid node from its candidate points.   */
+/************************************************************************/
+
+static inline double
+GDALGridMTEvaluate( GDALGridAlgorithm eAlgorithm, const void *poOptions,
+                    const GDALGridEllipse *psEllipse,
+                    const GUInt32 *panIdx, GUInt32 nCount,
+                    const double *padfX, const double *padfY,
+                    const double *padfZ,
+                    double dfXPoint, double dfYPoint,
+                    std::vector<GUInt32> &anInside )
+{
+    GUInt32 k, n = 0;
+
+    switch( eAlgorithm )
+    {
+/* -------------------------------------------------------------------- */
+/*      Inverse distance to a power.                                    */
+/* -------------------------------------------------------------------- */
+      case GGA_InverseDistanceToAPower:
+      {
+          const GDALGridInverseDistanceToAPowerOptions *psOptions =
+              (const GDALGridInverseDistanceToAPowerOptions *) poOptions;
+          const double dfPowerDiv2 = psOptions->dfPower / 2;
+          const double dfSmoothing = psOptions->dfSmoothing;
+          /* Without a search ellipse, GDALGridCreate() ignores the */
+          /* point count limits. */
+          const int bNoSearch = psOptions->dfRadius1 == 0.0
+                                && psOptions->dfRadius2 == 0.0;
+          const GUInt32 nMaxPoints = bNoSearch ? 0 : psOptions->nMaxPoints;
+          const GUInt32 nMinPoints = bNoSearch ? 0 : psOptions->nMinPoints;
+          double dfNominator = 0.0, dfDenominator = 0.0;
+
+          for( k = 0; k < nCount; k++ )
+          {
+              const GUInt32 i = GGMT_POINT(k);
+              double dfRX = padfX[i] - dfXPoint;
+              double dfRY = padfY[i] - dfYPoint;
+              const double dfR2 =
+                  dfRX * dfRX + dfRY * dfRY + dfSmoothing * dfSmoothing;
+
+              if( GDALGridEllipseTest( psEllipse, dfRX, dfRY ) )
+              {
+                  // If the test point is close to the grid node, use the
+                  // point value directly as a node value to avoid
+                  // singularity.
+                  if( dfR2 < 0.0000000000001 )
+                      return padfZ[i];
+
+                  const double dfInvW = 1.0 / pow( dfR2, dfPowerDiv2 );
+                  dfNominator += dfInvW * padfZ[i];
+                  dfDenominator += dfInvW;
+                  n++;
+                  if( nMaxPoints > 0 && n > nMaxPoints )
+                      break;
+              }
+          }
+
+          if( n < nMinPoints || dfDenominator == 0.0 )
+              return psOptions->dfNoDataValue;
+          return dfNominator / dfDenominator;
+      }
+
+/* -------------------------------------------------------------------- */
+/*      Moving average.                                                 */
+/* -------------------------------------------------------------------- */
+      case GGA_MovingAverage:
+      {
+          const GDALGridMovingAverageOptions *psOptions =
+              (const GDALGridMovingAverageOptions *) poOptions;
+          double dfAccumulator = 0.0;
+
+          for( k = 0; k < nCount; k++ )
+          {
+              const GUInt32 i = GGMT_POINT(k);
+              double dfRX = padfX[i] - dfXPoint;
+              double dfRY = padfY[i] - dfYPoint;
+
+              if( GDALGridEllipseTest( psEllipse, dfRX, dfRY ) )
+              {
+                  dfAccumulator += padfZ[i];
+                  n++;
+              }
+          }
+
+          if( n < psOptions->nMinPoints || n == 0 )
+              return psOptions->dfNoDataValue;
+          return dfAccumulator / n;
+      }
+
+/* -------------------------------------------------------------------- */
+/*      Nearest neighbor.  The nearest squared distance starts at the   */
+/*      square of the largest semi-axis; on ties the last point wins.   */
+/* -------------------------------------------------------------------- */
+      case GGA_NearestNeighbor:
+      {
+          const GDALGridNearestNeighborOptions *psOptions =
+              (const GDALGridNearestNeighborOptions *) poOptions;
+          double dfNearestValue = psOptions->dfNoDataValue;
+          double dfNearestR = MAX( psEllipse->dfRadius1Square,
+                                   psEllipse->dfRadius2Square );
+          const int bNoSearch = ( psEllipse->dfR12Square == 0.0 );
+
+          for( k = 0; k < nCount; k++ )
+          {
+              const GUInt32 i = GGMT_POINT(k);
+              double dfRX = padfX[i] - dfXPoint;
+              double dfRY = padfY[i] - dfYPoint;
+
+              if( GDALGridEllipseTest( psEllipse, dfRX, dfRY ) )
+              {
+                  const double dfR2 = dfRX * dfRX + dfRY * dfRY;
+                  if( (bNoSearch && n == 0) || dfR2 <= dfNearestR )
+                  {
+                      dfNearestR = dfR2;
+                      dfNearestValue = padfZ[i];
+                      n++;
+                  }
+              }
+          }
+
+          return dfNearestValue;
+      }
+
+/* -------------------------------------------------------------------- */
+/*      Minimum, maximum and range.                                     */
+/* -------------------------------------------------------------------- */
+      case GGA_MetricMinimum:
+      case GGA_MetricMaximum:
+      case GGA_MetricRange:
+      {
+          const GDALGridDataMetricsOptions *psOptions =
+              (const GDALGridDataMetricsOptions *) poOptions;
+          double dfMinimumValue = 0.0, dfMaximumValue = 0.0;
+
+          for( k = 0; k < nCount; k++ )
+          {
+              const GUInt32 i = GGMT_POINT(k);
+              double dfRX = padfX[i] - dfXPoint;
+              double dfRY = padfY[i] - dfYPoint;
+
+              if( GDALGridEllipseTest( psEllipse, dfRX, dfRY ) )
+              {
+                  if( n )
+                  {
+                      if( dfMinimumValue > padfZ[i] )
+                          dfMinimumValue = padfZ[i];
+                      if( dfMaximumValue < padfZ[i] )
+                          dfMaximumValue = padfZ[i];
+                  }
+                  else
+                      dfMinimumValue = dfMaximumValue = padfZ[i];
+                  n++;
+              }
+          }
+
+          if( n < psOptions->nMinPoints || n == 0 )
+              return psOptions->dfNoDataValue;
+          if( eAlgorithm == GGA_MetricMinimum )
+              return dfMinimumValue;
+          if( eAlgorithm == GGA_MetricMaximum )
+              return dfMaximumValue;
+          return dfMaximumValue - dfMinimumValue;
+      }
+
+/* -------------------------------------------------------------------- */
+/*      Number of points.                                               */
+/* -------------------------------------------------------------------- */
+      case GGA_MetricCount:
+      {
+          const GDALGridDataMetricsOptions *psOptions =
+              (const GDALGridDataMetricsOptions *) poOptions;
+
+          for( k = 0; k < nCount; k++ )
+          {
+              const GUInt32 i = GGMT_POINT(k);
+              double dfRX = padfX[i] - dfXPoint;
+              double dfRY = padfY[i] - dfYPoint;
+
+              if( GDALGridEllipseTest( psEllipse, dfRX, dfRY ) )
+                  n++;
+          }
+
+          if( n < psOptions->nMinPoints )
+              return psOptions->dfNoDataValue;
+          return (double) n;
+      }
+
+/* -------------------------------------------------------------------- */
+/*      Average distance from the node.                                 */
+/* -------------------------------------------------------------------- */
+      case GGA_MetricAverageDistance:
+      {
+          const GDALGridDataMetricsOptions *psOptions =
+              (const GDALGridDataMetricsOptions *) poOptions;
+          double dfAccumulator = 0.0;
+
+          for( k = 0; k < nCount; k++ )
+          {
+              const GUInt32 i = GGMT_POINT(k);
+              double dfRX = padfX[i] - dfXPoint;
+              double dfRY = padfY[i] - dfYPoint;
+
+              if( GDALGridEllipseTest( psEllipse, dfRX, dfRY ) )
+              {
+                  dfAccumulator += sqrt( dfRX * dfRX + dfRY * dfRY );
+                  n++;
+              }
+          }
+
+          if( n < psOptions->nMinPoints || n == 0 )
+              return psOptions->dfNoDataValue;
+          return dfAccumulator / n;
+      }
+
+/* -------------------------------------------------------------------- */
+/*      Average distance between the points, over all the pairs of      */
+/*      points inside the ellipse.                                      */
+/* -------------------------------------------------------------------- */
+      case GGA_MetricAverageDistancePts:
+      {
+          const GDALGridDataMetricsOptions *psOptions =
+              (const GDALGridDataMetricsOptions *) poOptions;
+          double dfAccumulator = 0.0;
+
+          anInside.clear();
+          for( k = 0; k < nCount; k++ )
+          {
+              const GUInt32 i = GGMT_POINT(k);
+              double dfRX = padfX[i] - dfXPoint;
+              double dfRY = padfY[i] - dfYPoint;
+
+              if( GDALGridEllipseTest( psEllipse, dfRX, dfRY ) )
+                  anInside.push_back( i );
+          }
+
+          for( size_t a = 0; a < anInside.size(); a++ )
+          {
+              for( size_t b = a + 1; b < anInside.size(); b++ )
+              {
+                  const double dfRX = padfX[anInside[b]] - padfX[anInside[a]];
+                  const double dfRY = padfY[anInside[b]] - padfY[anInside[a]];
+                  dfAccumulator += sqrt( dfRX * dfRX + dfRY * dfRY );
+                  n++;
+              }
+          }
+
+          if( n < psOptions->nMinPoints || n == 0 )
+              return psOptions->dfNoDataValue;
+          return dfAccumulator / n;
+      }
+    }
+
+    return 0.0;
+}
+
+#undef GGMT_POINT
+
+/************************************************************************/
+/* ==================================================================== */
+/*                           GDALGridCreateMT()                         */
+/* ==================================================================== */
+/************************************************************************/
+
+typedef struct
+{
+    GDALGridAlgorithm   eAlgorithm;
+    const void         *poOptions;
+    GDALGridEllipse     sEllipse;
+    double              dfHalfWidth;    /* Ellipse bounding box. */
+    double              dfHalfHeight;
+
+    GUInt32             nPoints;
+    const double       *padfX;
+    const double       *padfY;
+    const double       *padfZ;
+    const GDALGridPointIndex *poIndex;  /* NULL for a full scan. */
+
+    double              dfXMin;
+    double              dfYMin;
+    double              dfDeltaX;
+    double              dfDeltaY;
+    GUInt32             nXSize;
+    GUInt32             nYSize;
+    GDALDataType        eType;
+    GByte              *pabyData;
+
+    volatile int        nNextRow;
+    volatile int        nRowsDone;
+    volatile int        bCancelled;     /* Set under hMutex */
+    void               *hMutex;
+    GDALProgressFunc    pfnProgress;
+    void               *pProgressArg;
+} GDALGridMTContext;
+
+/************************************************************************/
+/*                        GDALGridMTIsCancelled()                       */
+/************************************************************************/
+
+static inline int GDALGridMTIsCancelled( GDALGridMTContext *psCtx )
+{
+    return CPLAtomicAdd( &(psCtx->bCancelled), 0 ) != 0;
+}
+
+/************************************************************************/
+/*                           GDALGridMTWorker()                         */
+/************************************************************************/
+
+static void GDALGridMTWorker( void *pArg )
+{
+    GDALGridMTContext *psCtx = (GDALGridMTContext *) pArg;
+    const int nDataTypeSize = GDALGetDataTypeSize( psCtx->eType ) / 8;
+    std::vector<GUInt32> anCandidates, anInside;
+
+    for( ;; )
+    {
+        const int nYPoint = CPLAtomicInc( &(psCtx->nNextRow) ) - 1;
+        if( nYPoint >= (int) psCtx->nYSize || GDALGridMTIsCancelled( psCtx ) )
+            break;
+
+        const double dfYPoint =
+            psCtx->dfYMin + ( nYPoint + 0.5 ) * psCtx->dfDeltaY;
+
+        for( GUInt32 nXPoint = 0; nXPoint < psCtx->nXSize; nXPoint++ )
+        {
+            const double dfXPoint =
+                psCtx->dfXMin + ( nXPoint + 0.5 ) * psCtx->dfDeltaX;
+            const GUInt32 *panIdx = NULL;
+            GUInt32 nCount = psCtx->nPoints;
+
+            if( psCtx->poIndex != NULL )
+            {
+                psCtx->poIndex->Search( dfXPoint - psCtx->dfHalfWidth,
+                                        dfYPoint - psCtx->dfHalfHeight,
+                                        dfXPoint + psCtx->dfHalfWidth,
+                                        dfYPoint + psCtx->dfHalfHeight,
+                                        anCandidates );
+
+/* -------------------------------------------------------------------- */
+/*      Keep the candidates inside the ellipse, with the same test      */
+/*      as the algorithms, and put them back in index order.            */
+/* -------------------------------------------------------------------- */
+                size_t nKept = 0;
+                for( size_t k = 0; k < anCandidates.size(); k++ )
+                {
+                    const GUInt32 i = anCandidates[k];
+                    double dfRX = psCtx->padfX[i] - dfXPoint;
+                    double dfRY = psCtx->padfY[i] - dfYPoint;
+
+                    if( GDALGridEllipseTest( &(psCtx->sEllipse), dfRX, dfRY ) )
+                        anCandidates[nKept++] = i;
+                }
+                std::sort( anCandidates.begin(),
+                           anCandidates.begin() + nKept );
+
+                nCount = (GUInt32) nKept;
+                panIdx = nKept ? &anCandidates[0] : NULL;
+            }
+
+            double dfValue =
+                GDALGridMTEvaluate( psCtx->eAlgorithm, psCtx->poOptions,
+                                    &(psCtx->sEllipse), panIdx, nCount,
+                                    psCtx->padfX, psCtx->padfY, psCtx->padfZ,
+                                    dfXPoint, dfYPoint, anInside );
+
+            GDALCopyWords( &dfValue, GDT_Float64, 0,
+                           psCtx->pabyData
+                           + ((size_t) nYPoint * psCtx->nXSize + nXPoint)
+                           * nDataTypeSize,
+                           psCtx->eType, nDataTypeSize, 1 );
+        }
+
+/* -------------------------------------------------------------------- */
+/*      Report progress.                                                */
+/* -------------------------------------------------------------------- */
+        const int nRowsDone = CPLAtomicInc( &(psCtx->nRowsDone) );
+
+        if( psCtx->pfnProgress != NULL )
+        {
+            CPLAcquireMutex( psCtx->hMutex, 1000.0 );
+            if( !GDALGridMTIsCancelled( psCtx )
+                && !psCtx->pfnProgress( nRowsDone / (double) psCtx->nYSize,
+                                        "", psCtx->pProgressArg ) )
+                CPLAtomicInc( &(psCtx->bCancelled) );
+            CPLReleaseMutex( psCtx->hMutex );
+        }
+    }
+}
+
+/************************************************************************/
+/*                           GDALGridCreateMT()                         */
+/************************************************************************/
+
+/**
+ * Create regular grid from the scattered data, using a spatial index and
+ * several threads.
+ *
+ * The arguments are those of GDALGridCreate(), followed by a list of
+ * options:
+ * <ul>
+ * <li>NUM_THREADS=number or ALL_CPUS: number of threads, the calling one
+ * and jobs of the shared CPLGetGlobalWorkerThreadPool().  Defaults to the
+ * GDAL_NUM_THREADS configuration option, or 1 when it is not set, as for
+ * GDALWarpKernelPerformWarpMT().</li>
+ * <li>USE_INDEX=YES/NO: whether to use the spatial index when the
+ * algorithm has a search ellipse.  Defaults to YES.</li>
+ * </ul>
+ *
+ * The point arrays, options and output buffer are shared by the threads,
+ * and the progress function is called from them, one at a time.
+ *
+ * @return CE_None on success or CE_Failure if something goes wrong.
+ */
+
+static inline CPLErr
+GDALGridCreateMT( GDALGridAlgorithm eAlgorithm, const void *poOptions,
+                  GUInt32 nPoints,
+                  const double *padfX, const double *padfY,
+                  const double *padfZ,
+                  double dfXMin, double dfXMax, double dfYMin, double dfYMax,
+                  GUInt32 nXSize, GUInt32 nYSize, GDALDataType eType,
+                  void *pData,
+                  GDALProgressFunc pfnProgress, void *pProgressArg,
+                  char **papszOptions )
+{
+    if( nXSize == 0 || nYSize == 0 )
+    {
+        CPLError( CE_Failure, CPLE_IllegalArg,
+                  "Output raster dimensions should have non-zero size." );
+        return CE_Failure;
+    }
+
+    if( poOptions == NULL )
+    {
+        CPLError( CE_Failure, CPLE_IllegalArg,
+                  "Gridding options should be specified." );
+        return CE_Failure;
+    }
+
+    if( eAlgorithm < GGA_InverseDistanceToAPower
+        || eAlgorithm > GGA_MetricAverageDistancePts )
+    {
+        CPLError( CE_Failure, CPLE_IllegalArg,
+                  "GDAL does not support gridding method %d", eAlgorithm );
+        return CE_Failure;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Fetch the search ellipse; it comes first in all the option      */
+/*      structures but the inverse distance one.                        */
+/* -------------------------------------------------------------------- */
+    GDALGridMTContext sCtx;
+    double dfRadius1, dfRadius2, dfAngle;
+
+    if( eAlgorithm == GGA_InverseDistanceToAPower )
+    {
+        const GDALGridInverseDistanceToAPowerOptions *psOptions =
+            (const GDALGridInverseDistanceToAPowerOptions *) poOptions;
+        dfRadius1 = psOptions->dfRadius1;
+        dfRadius2 = psOptions->dfRadius2;
+        dfAngle = psOptions->dfAngle;
+    }
+    else
+    {
+        const GDALGridMovingAverageOptions *psOptions =
+            (const GDALGridMovingAverageOptions *) poOptions;
+        dfRadius1 = psOptions->dfRadius1;
+        dfRadius2 = psOptions->dfRadius2;
+        dfAngle = psOptions->dfAngle;
+    }
+
+    GDALGridEllipseInit( &(sCtx.sEllipse), dfRadius1, dfRadius2, dfAngle );
+
+    const double dfCos = cos( GGMT_TO_RADIANS * dfAngle );
+    const double dfSin = sin( GGMT_TO_RADIANS * dfAngle );
+    dfRadius1 = fabs( dfRadius1 );
+    dfRadius2 = fabs( dfRadius2 );
+
+    /* Widen the box a little so that rounding in the ellipse test */
+    /* cannot accept a point the box rejected. */
+    sCtx.dfHalfWidth = 1.0000001 *
+        sqrt( dfRadius1 * dfRadius1 * dfCos * dfCos
+              + dfRadius2 * dfRadius2 * dfSin * dfSin );
+    sCtx.dfHalfHeight = 1.0000001 *
+        sqrt( dfRadius1 * dfRadius1 * dfSin * dfSin
+              + dfRadius2 * dfRadius2 * dfCos * dfCos );
+
+/* -------------------------------------------------------------------- */
+/*      Build the index.                                                */
+/* -------------------------------------------------------------------- */
+    GDALGridPointIndex oIndex;
+    const int bUseIndex =
+        CSLTestBoolean( CSLFetchNameValueDef( papszOptions, "USE_INDEX",
+                                              "YES" ) )
+        && dfRadius1 > 0.0 && dfRadius2 > 0.0
+        && GDALGridIsFinite(sCtx.dfHalfWidth) && GDALGridIsFinite(sCtx.dfHalfHeight);
+
+    if( bUseIndex )
+        oIndex.Build( nPoints, padfX, padfY,
+                      MAX( sCtx.dfHalfWidth, sCtx.dfHalfHeight ) );
+
+/* -------------------------------------------------------------------- */
+/*      Set up and run the jobs.                                        */
+/* -------------------------------------------------------------------- */
+    const char *pszThreads = CSLFetchNameValue( papszOptions, "NUM_THREADS" );
+    if( pszThreads == NULL )
+        pszThreads = CPLGetConfigOption( "GDAL_NUM_THREADS", "1" );
+
+    int nThreads = EQUAL(pszThreads, "ALL_CPUS") ? CPLGetNumCPUs()
+                                                 : atoi(pszThreads);
+    nThreads = MAX( 1, MIN( nThreads, (int) nYSize ) );
+
+    sCtx.eAlgorithm = eAlgorithm;
+    sCtx.poOptions = poOptions;
+    sCtx.nPoints = nPoints;
+    sCtx.padfX = padfX;
+    sCtx.padfY = padfY;
+    sCtx.padfZ = padfZ;
+    sCtx.poIndex = bUseIndex ? &oIndex : NULL;
+    sCtx.dfXMin = dfXMin;
+    sCtx.dfYMin = dfYMin;
+    sCtx.dfDeltaX = ( dfXMax - dfXMin ) / nXSize;
+    sCtx.dfDeltaY = ( dfYMax - dfYMin ) / nYSize;
+    sCtx.nXSize = nXSize;
+    sCtx.nYSize = nYSize;
+    sCtx.eType = eType;
+    sCtx.pabyData = (GByte *) pData;
+    sCtx.nNextRow = 0;
+    sCtx.nRowsDone = 0;
+    sCtx.bCancelled = FALSE;
+    sCtx.pfnProgress = pfnProgress;
+    sCtx.pProgressArg = pProgressArg;
+    sCtx.hMutex = CPLCreateMutex();
+    CPLReleaseMutex( sCtx.hMutex );
+
+    CPLWorkerThreadPool *poPool = CPLGetGlobalWorkerThreadPool();
+    CPLJobGroup oGroup;
+
+    for( int iThread = 1; iThread < nThreads; iThread++ )
+        poPool->SubmitJob( GDALGridMTWorker, &sCtx, &oGroup );
+
+    GDALGridMTWorker( &sCtx );
+    poPool->WaitGroup( &oGroup );
+
+    CPLDestroyMutex( sCtx.hMutex );
+
+    if( sCtx.bCancelled )
+    {
+        CPLError( CE_Failure, CPLE_UserInterrupt, "User terminated" );
+        return CE_Failure;
+    }
+
+    return CE_None;
+}
+
+#endif /* GDALGRID_MT_H_INCLUDED */
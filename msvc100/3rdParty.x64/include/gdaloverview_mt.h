@@ -0,0 +1,848 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  GDAL Core
+ * Purpose:  Multi-threaded, single pass generation of multi-band overviews.
+ *
+ ******************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef GDALOVERVIEW_MT_H_INCLUDED
+#define GDALOVERVIEW_MT_H_INCLUDED
+
+/**
+ * \file gdaloverview_mt.h
+ *
+ * Multi-threaded variant of GDALRegenerateOverviewsMultiBand().
+ *
+ * GDALRegenerateOverviewsMultiBand() reads the source once per overview
+ * level, and computes everything on the calling thread.
+ * GDALRegenerateOverviewsMultiBandMT() cuts the source into windows
+ * aligned on the pixels of the smallest overview, and for each window
+ * reads all the bands once and computes the pixels of all the levels
+ * falling in it, before writing them.  The windows are processed in
+ * parallel by jobs of the shared CPLGetGlobalWorkerThreadPool().  Reads
+ * and writes go through the bands, which are not thread-safe, so they are
+ * serialized by a mutex, and the computations run in parallel.
+ *
+ * Each overview pixel is computed directly from the source pixels, with
+ * the source pixel footprint of GDALRegenerateOverviewsMultiBand(), so
+ * that the result does not depend on the windows nor on the number of
+ * threads.  As in GDAL, AVERAGE leaves out the source pixels that are
+ * invalid in the mask band (or the alpha band itself) unless the mask
+ * flags have GMF_ALL_VALID, and overview pixels without any valid source
+ * pixel get the nodata value of the overview band, or 0.  Byte and UInt16
+ * levels whose size divides the source size, without mask, use integer
+ * kernels (SSE2 when available); the other cases are computed in double
+ * precision.
+ *
+ * NEAREST and AVERAGE are supported; other resamplings are delegated to
+ * GDALRegenerateOverviews() band by band.
+ */
+
+#include "gdal_priv.h"
+#include "cpl_multiproc.h"
+#include "cpl_worker_thread_pool.h"
+#include "cpl_atomic_ops.h"
+#include "cpl_progress.h"
+#include "cpl_string.h"
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define GDAL_OVR_MT_SSE2
+#  include <emmintrin.h>
+#endif
+
+/* Target size in source pixels of the side of a window, and the size */
+/* it may be shrunk to so that the windows of all the threads fit in   */
+/* GDAL_OVR_MT_MAX_MEMORY bytes. */
+#define GDAL_OVR_MT_WINDOW_SIZE     2048
+#define GDAL_OVR_MT_MIN_WINDOW_SIZE 256
+#define GDAL_OVR_MT_MAX_MEMORY      ((GIntBig) 256 * 1024 * 1024)
+
+/************************************************************************/
+/*                         GDALOvrMTFootprint()                         */
+/************************************************************************/
+
+/* Source pixels [*pnSrcOff, *pnSrcOff2) averaged into overview pixel  */
+/* iOvr, as computed by the AVERAGE resampling of GDAL.                */
+
+static inline void GDALOvrMTFootprint( int iOvr, int nOvrSize, int nSrcSize,
+                                       int *pnSrcOff, int *pnSrcOff2 )
+{
+    const double dfRatio = (double) nSrcSize / nOvrSize;
+    int nOff = (int) (0.5 + iOvr * dfRatio);
+    int nOff2 = (int) (0.5 + (iOvr + 1) * dfRatio);
+
+    if( nOff2 > nSrcSize || (dfRatio > 1 && iOvr == nOvrSize - 1) )
+        nOff2 = nSrcSize;
+    if( nOff > nSrcSize - 1 )
+        nOff = nSrcSize - 1;
+    if( nOff2 <= nOff )
+        nOff2 = nOff + 1;
+
+    *pnSrcOff = nOff;
+    *pnSrcOff2 = nOff2;
+}
+
+/* Source pixel picked for overview pixel iOvr by NEAREST. */
+
+static inline int GDALOvrMTNearestPixel( int iOvr, int nOvrSize, int nSrcSize )
+{
+    const int nOff = (int) (0.5 + iOvr * ((double) nSrcSize / nOvrSize));
+    return nOff < nSrcSize ? nOff : nSrcSize - 1;
+}
+
+/************************************************************************/
+/*                    Integer AVERAGE kernels                           */
+/************************************************************************/
+
+/* Add a row of n source pixels to panAcc. */
+
+template<class T>
+static inline void GDALOvrMTAccumulateRow( GUInt32 *panAcc, const T *pSrc,
+                                           int n )
+{
+    for( int i = 0; i < n; i++ )
+        panAcc[i] += pSrc[i];
+}
+
+#ifdef GDAL_OVR_MT_SSE2
+template<>
+inline void GDALOvrMTAccumulateRow<GByte>( GUInt32 *panAcc,
+                                           const GByte *pSrc, int n )
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+
+    for( ; i + 16 <= n; i += 16 )
+    {
+        const __m128i v = _mm_loadu_si128( (const __m128i *) (pSrc + i) );
+        const __m128i lo = _mm_unpacklo_epi8( v, zero );
+        const __m128i hi = _mm_unpackhi_epi8( v, zero );
+        __m128i *pAcc = (__m128i *) (panAcc + i);
+
+        _mm_storeu_si128( pAcc + 0, _mm_add_epi32( _mm_loadu_si128( pAcc + 0 ),
+                                        _mm_unpacklo_epi16( lo, zero ) ) );
+        _mm_storeu_si128( pAcc + 1, _mm_add_epi32( _mm_loadu_si128( pAcc + 1 ),
+                                        _mm_unpackhi_epi16( lo, zero ) ) );
+        _mm_storeu_si128( pAcc + 2, _mm_add_epi32( _mm_loadu_si128( pAcc + 2 ),
+                                        _mm_unpacklo_epi16( hi, zero ) ) );
+        _mm_storeu_si128( pAcc + 3, _mm_add_epi32( _mm_loadu_si128( pAcc + 3 ),
+                                        _mm_unpackhi_epi16( hi, zero ) ) );
+    }
+    for( ; i < n; i++ )
+        panAcc[i] += pSrc[i];
+}
+
+template<>
+inline void GDALOvrMTAccumulateRow<GUInt16>( GUInt32 *panAcc,
+                                             const GUInt16 *pSrc, int n )
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+
+    for( ; i + 8 <= n; i += 8 )
+    {
+        const __m128i v = _mm_loadu_si128( (const __m128i *) (pSrc + i) );
+        __m128i *pAcc = (__m128i *) (panAcc + i);
+
+        _mm_storeu_si128( pAcc + 0, _mm_add_epi32( _mm_loadu_si128( pAcc + 0 ),
+                                        _mm_unpacklo_epi16( v, zero ) ) );
+        _mm_storeu_si128( pAcc + 1, _mm_add_epi32( _mm_loadu_si128( pAcc + 1 ),
+                                        _mm_unpackhi_epi16( v, zero ) ) );
+    }
+    for( ; i < n; i++ )
+        panAcc[i] += pSrc[i];
+}
+#endif /* GDAL_OVR_MT_SSE2 */
+
+/* 2x2 average of one output row.  Returns the number of pixels done, */
+/* the rest being left to the generic code. */
+
+template<class T>
+static inline int GDALOvrMTAverage2x2Row( const T *, const T *, T *, int )
+{
+    return 0;
+}
+
+#ifdef GDAL_OVR_MT_SSE2
+template<>
+inline int GDALOvrMTAverage2x2Row<GByte>( const GByte *pRow0,
+                                          const GByte *pRow1,
+                                          GByte *pDst, int nOut )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16( 1 );
+    const __m128i two = _mm_set1_epi32( 2 );
+    int i = 0;
+
+    for( ; i + 8 <= nOut; i += 8 )
+    {
+        const __m128i a = _mm_loadu_si128( (const __m128i *) (pRow0 + 2 * i) );
+        const __m128i b = _mm_loadu_si128( (const __m128i *) (pRow1 + 2 * i) );
+
+        /* Column sums, then sums of adjacent columns. */
+        const __m128i lo = _mm_add_epi16( _mm_unpacklo_epi8( a, zero ),
+                                          _mm_unpacklo_epi8( b, zero ) );
+        const __m128i hi = _mm_add_epi16( _mm_unpackhi_epi8( a, zero ),
+                                          _mm_unpackhi_epi8( b, zero ) );
+        __m128i sumLo = _mm_madd_epi16( lo, one );
+        __m128i sumHi = _mm_madd_epi16( hi, one );
+
+        sumLo = _mm_srli_epi32( _mm_add_epi32( sumLo, two ), 2 );
+        sumHi = _mm_srli_epi32( _mm_add_epi32( sumHi, two ), 2 );
+
+        const __m128i res = _mm_packs_epi32( sumLo, sumHi );
+        _mm_storel_epi64( (__m128i *) (pDst + i),
+                          _mm_packus_epi16( res, res ) );
+    }
+    return i;
+}
+
+template<>
+inline int GDALOvrMTAverage2x2Row<GUInt16>( const GUInt16 *pRow0,
+                                            const GUInt16 *pRow1,
+                                            GUInt16 *pDst, int nOut )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi32( 2 );
+    const __m128i bias32 = _mm_set1_epi32( 32768 );
+    const __m128i bias16 = _mm_set1_epi16( (short) -32768 );
+    int i = 0;
+
+    for( ; i + 4 <= nOut; i += 4 )
+    {
+        const __m128i a = _mm_loadu_si128( (const __m128i *) (pRow0 + 2 * i) );
+        const __m128i b = _mm_loadu_si128( (const __m128i *) (pRow1 + 2 * i) );
+
+        /* Column sums as 32 bit, then sums of adjacent columns in the */
+        /* even lanes, gathered in the low half. */
+        const __m128i lo = _mm_add_epi32( _mm_unpacklo_epi16( a, zero ),
+                                          _mm_unpacklo_epi16( b, zero ) );
+        const __m128i hi = _mm_add_epi32( _mm_unpackhi_epi16( a, zero ),
+                                          _mm_unpackhi_epi16( b, zero ) );
+        const __m128i pairLo = _mm_shuffle_epi32(
+            _mm_add_epi32( lo, _mm_srli_epi64( lo, 32 ) ),
+            _MM_SHUFFLE(3, 1, 2, 0) );
+        const __m128i pairHi = _mm_shuffle_epi32(
+            _mm_add_epi32( hi, _mm_srli_epi64( hi, 32 ) ),
+            _MM_SHUFFLE(3, 1, 2, 0) );
+        __m128i sum = _mm_unpacklo_epi64( pairLo, pairHi );
+
+        sum = _mm_srli_epi32( _mm_add_epi32( sum, two ), 2 );
+
+        /* No unsigned 32 to 16 bit pack in SSE2: go through signed. */
+        __m128i res = _mm_packs_epi32( _mm_sub_epi32( sum, bias32 ),
+                                       _mm_sub_epi32( sum, bias32 ) );
+        res = _mm_add_epi16( res, bias16 );
+        _mm_storel_epi64( (__m128i *) (pDst + i), res );
+    }
+    return i;
+}
+#endif /* GDAL_OVR_MT_SSE2 */
+
+/************************************************************************/
+/*                       GDALOvrMTAverageInteger()                      */
+/************************************************************************/
+
+/* Average of nKX x nKY blocks of an integer buffer, rounded to nearest. */
+/* The source window starts on a block boundary. */
+
+template<class T>
+static void GDALOvrMTAverageInteger( const T *pSrc, int nSrcStride,
+                                     int nKX, int nKY,
+                                     int nOutXSize, int nOutYSize, T *pDst )
+{
+    const GUInt32 nCount = (GUInt32) (nKX * nKY);
+    std::vector<GUInt32> anAcc( (size_t) nOutXSize * nKX );
+
+    for( int iY = 0; iY < nOutYSize; iY++ )
+    {
+        const T *pRow = pSrc + (size_t) iY * nKY * nSrcStride;
+        T *pDstRow = pDst + (size_t) iY * nOutXSize;
+        int iX = 0;
+
+        if( nKX == 2 && nKY == 2 )
+            iX = GDALOvrMTAverage2x2Row<T>( pRow, pRow + nSrcStride,
+                                            pDstRow, nOutXSize );
+        if( iX == nOutXSize )
+            continue;
+
+        std::fill( anAcc.begin(), anAcc.end(), 0 );
+        for( int k = 0; k < nKY; k++ )
+            GDALOvrMTAccumulateRow<T>( &anAcc[0] + (size_t) iX * nKX,
+                                       pRow + (size_t) k * nSrcStride
+                                            + (size_t) iX * nKX,
+                                       (nOutXSize - iX) * nKX );
+
+        for( ; iX < nOutXSize; iX++ )
+        {
+            GUInt32 nSum = 0;
+            for( int k = 0; k < nKX; k++ )
+                nSum += anAcc[(size_t) iX * nKX + k];
+            pDstRow[iX] = (T) ((nSum + nCount / 2) / nCount);
+        }
+    }
+}
+
+/************************************************************************/
+/*                        GDALOvrMTGenericLevel()                       */
+/************************************************************************/
+
+/* Overview pixels [nOX0, nOX0 + nOutXSize) x [nOY0, nOY0 + nOutYSize)  */
+/* of a level, from the source window starting at (nWX0, nWY0), in      */
+/* double precision.  pabyMask, if not NULL, is the mask window: source */
+/* pixels at 0 in it are left out of averages.                          */
+
+template<class T>
+static void GDALOvrMTGenericLevel( const T *pSrc, int nSrcStride,
+                                   int nWX0, int nWY0,
+                                   int nSrcXSize, int nSrcYSize,
+                                   int nOvrXSize, int nOvrYSize,
+                                   int nOX0, int nOY0,
+                                   int nOutXSize, int nOutYSize,
+                                   int bNearest, const GByte *pabyMask,
+                                   double dfNoData, double *padfDst )
+{
+    std::vector<int> anX0( nOutXSize ), anX1( nOutXSize );
+
+    for( int iX = 0; iX < nOutXSize; iX++ )
+    {
+        if( bNearest )
+        {
+            anX0[iX] = GDALOvrMTNearestPixel( nOX0 + iX, nOvrXSize,
+                                              nSrcXSize ) - nWX0;
+            anX1[iX] = anX0[iX] + 1;
+        }
+        else
+        {
+            GDALOvrMTFootprint( nOX0 + iX, nOvrXSize, nSrcXSize,
+                                &anX0[iX], &anX1[iX] );
+            anX0[iX] -= nWX0;
+            anX1[iX] -= nWX0;
+        }
+    }
+
+    for( int iY = 0; iY < nOutYSize; iY++ )
+    {
+        int nY0, nY1;
+        if( bNearest )
+        {
+            nY0 = GDALOvrMTNearestPixel( nOY0 + iY, nOvrYSize, nSrcYSize );
+            nY1 = nY0 + 1;
+        }
+        else
+            GDALOvrMTFootprint( nOY0 + iY, nOvrYSize, nSrcYSize, &nY0, &nY1 );
+        nY0 -= nWY0;
+        nY1 -= nWY0;
+
+        double *padfDstRow = padfDst + (size_t) iY * nOutXSize;
+
+        for( int iX = 0; iX < nOutXSize; iX++ )
+        {
+            if( bNearest )
+            {
+                padfDstRow[iX] =
+                    (double) pSrc[(size_t) nY0 * nSrcStride + anX0[iX]];
+                continue;
+            }
+
+            double dfTotal = 0.0;
+            int nCount = 0;
+
+            for( int iSY = nY0; iSY < nY1; iSY++ )
+            {
+                const T *pRow = pSrc + (size_t) iSY * nSrcStride;
+                const GByte *pabyMaskRow =
+                    pabyMask ? pabyMask + (size_t) iSY * nSrcStride : NULL;
+                for( int iSX = anX0[iX]; iSX < anX1[iX]; iSX++ )
+                {
+                    if( pabyMaskRow && !pabyMaskRow[iSX] )
+                        continue;
+                    dfTotal += (double) pRow[iSX];
+                    nCount++;
+                }
+            }
+
+            padfDstRow[iX] = nCount > 0 ? dfTotal / nCount : dfNoData;
+        }
+    }
+}
+
+/************************************************************************/
+/*                          GDALOvrMTContext                            */
+/************************************************************************/
+
+typedef struct
+{
+    int                 nBands;
+    GDALRasterBand    **papoSrcBands;
+    int                 nOverviews;
+    GDALRasterBand   ***papapoOverviewBands;
+    int                 bNearest;
+
+    int                 nSrcXSize;
+    int                 nSrcYSize;
+    std::vector<int>    anOvrXSize;
+    std::vector<int>    anOvrYSize;
+    GDALDataType        eWrkType;       /* Byte, UInt16 or Float64. */
+    std::vector<GDALRasterBand *> apoMaskBands;     /* NULL if all valid. */
+    int                 bHasMask;
+    std::vector<double> adfOvrNoData;   /* [iBand * nOverviews + iOvr] */
+
+    /* Windows, in pixels of the smallest level. */
+    int                 nCoarseXSize;
+    int                 nCoarseYSize;
+    int                 nTileXSize;
+    int                 nTileYSize;
+    int                 nWindowsX;
+    int                 nWindows;
+
+    volatile int        nNextWindow;
+    int                 nWindowsDone;
+    volatile int        bStop;
+    CPLErr              eErr;
+    void               *hIOMutex;
+    GDALProgressFunc    pfnProgress;
+    void               *pProgressArg;
+} GDALOvrMTContext;
+
+/* Overview pixels of a level falling in coarse pixels [nC0, nC1). */
+
+static inline void GDALOvrMTLevelRange( int nC0, int nC1, int nCoarseSize,
+                                        int nOvrSize, int *pnO0, int *pnO1 )
+{
+    *pnO0 = (int) ((GIntBig) nC0 * nOvrSize / nCoarseSize);
+    *pnO1 = nC1 >= nCoarseSize ? nOvrSize
+                               : (int) ((GIntBig) nC1 * nOvrSize / nCoarseSize);
+}
+
+/* Source pixels read for overview pixels [nO0, nO1) of a level. */
+
+static inline void GDALOvrMTSourceRange( int nO0, int nO1, int nOvrSize,
+                                         int nSrcSize, int bNearest,
+                                         int *pnS0, int *pnS1 )
+{
+    if( bNearest )
+    {
+        *pnS0 = GDALOvrMTNearestPixel( nO0, nOvrSize, nSrcSize );
+        *pnS1 = GDALOvrMTNearestPixel( nO1 - 1, nOvrSize, nSrcSize ) + 1;
+    }
+    else
+    {
+        int nDummy;
+        GDALOvrMTFootprint( nO0, nOvrSize, nSrcSize, pnS0, &nDummy );
+        GDALOvrMTFootprint( nO1 - 1, nOvrSize, nSrcSize, &nDummy, pnS1 );
+    }
+}
+
+/************************************************************************/
+/*                         GDALOvrMTProcessWindow()                     */
+/************************************************************************/
+
+template<class T>
+static CPLErr GDALOvrMTProcessWindow( GDALOvrMTContext *psCtx, int iWindow )
+{
+    const int nCX0 = (iWindow % psCtx->nWindowsX) * psCtx->nTileXSize;
+    const int nCY0 = (iWindow / psCtx->nWindowsX) * psCtx->nTileYSize;
+    const int nCX1 = MIN( nCX0 + psCtx->nTileXSize, psCtx->nCoarseXSize );
+    const int nCY1 = MIN( nCY0 + psCtx->nTileYSize, psCtx->nCoarseYSize );
+
+/* -------------------------------------------------------------------- */
+/*      Overview pixels of each level, and source window covering all   */
+/*      their footprints.                                               */
+/* -------------------------------------------------------------------- */
+    std::vector<int> anOX0( psCtx->nOverviews ), anOX1( psCtx->nOverviews );
+    std::vector<int> anOY0( psCtx->nOverviews ), anOY1( psCtx->nOverviews );
+    int nWX0 = psCtx->nSrcXSize, nWX1 = 0;
+    int nWY0 = psCtx->nSrcYSize, nWY1 = 0;
+
+    for( int iOvr = 0; iOvr < psCtx->nOverviews; iOvr++ )
+    {
+        GDALOvrMTLevelRange( nCX0, nCX1, psCtx->nCoarseXSize,
+                             psCtx->anOvrXSize[iOvr],
+                             &anOX0[iOvr], &anOX1[iOvr] );
+        GDALOvrMTLevelRange( nCY0, nCY1, psCtx->nCoarseYSize,
+                             psCtx->anOvrYSize[iOvr],
+                             &anOY0[iOvr], &anOY1[iOvr] );
+        if( anOX0[iOvr] >= anOX1[iOvr] || anOY0[iOvr] >= anOY1[iOvr] )
+            continue;
+
+        int nS0, nS1;
+        GDALOvrMTSourceRange( anOX0[iOvr], anOX1[iOvr],
+                              psCtx->anOvrXSize[iOvr], psCtx->nSrcXSize,
+                              psCtx->bNearest, &nS0, &nS1 );
+        nWX0 = MIN( nWX0, nS0 );
+        nWX1 = MAX( nWX1, nS1 );
+        GDALOvrMTSourceRange( anOY0[iOvr], anOY1[iOvr],
+                              psCtx->anOvrYSize[iOvr], psCtx->nSrcYSize,
+                              psCtx->bNearest, &nS0, &nS1 );
+        nWY0 = MIN( nWY0, nS0 );
+        nWY1 = MAX( nWY1, nS1 );
+    }
+
+    if( nWX0 >= nWX1 || nWY0 >= nWY1 )
+        return CE_None;
+
+    const int nWXSize = nWX1 - nWX0;
+    const int nWYSize = nWY1 - nWY0;
+    const size_t nBandPixels = (size_t) nWXSize * nWYSize;
+
+    T *pSrc = (T *) VSIMalloc2( nBandPixels, sizeof(T) * psCtx->nBands );
+    GByte *pabyMask = NULL;
+    if( pSrc != NULL && psCtx->bHasMask )
+        pabyMask = (GByte *) VSIMalloc2( nBandPixels, psCtx->nBands );
+    if( pSrc == NULL || (psCtx->bHasMask && pabyMask == NULL) )
+    {
+        CPLError( CE_Failure, CPLE_OutOfMemory,
+                  "Cannot allocate overview source window of %d x %d.",
+                  nWXSize, nWYSize );
+        VSIFree( pSrc );
+        return CE_Failure;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Read all the bands of the window, and their masks.              */
+/* -------------------------------------------------------------------- */
+    CPLErr eErr = CE_None;
+
+    CPLAcquireMutex( psCtx->hIOMutex, 1000.0 );
+    for( int iBand = 0; iBand < psCtx->nBands && eErr == CE_None; iBand++ )
+    {
+        eErr = psCtx->papoSrcBands[iBand]->RasterIO(
+            GF_Read, nWX0, nWY0, nWXSize, nWYSize,
+            pSrc + iBand * nBandPixels, nWXSize, nWYSize,
+            psCtx->eWrkType, 0, 0 );
+        if( eErr == CE_None && psCtx->apoMaskBands[iBand] != NULL )
+            eErr = psCtx->apoMaskBands[iBand]->RasterIO(
+                GF_Read, nWX0, nWY0, nWXSize, nWYSize,
+                pabyMask + iBand * nBandPixels, nWXSize, nWYSize,
+                GDT_Byte, 0, 0 );
+    }
+    CPLReleaseMutex( psCtx->hIOMutex );
+
+/* -------------------------------------------------------------------- */
+/*      Compute and write each level.                                   */
+/* -------------------------------------------------------------------- */
+    std::vector<T> aoInt;
+    std::vector<double> adfOut;
+
+    for( int iOvr = 0; iOvr < psCtx->nOverviews && eErr == CE_None; iOvr++ )
+    {
+        const int nOutXSize = anOX1[iOvr] - anOX0[iOvr];
+        const int nOutYSize = anOY1[iOvr] - anOY0[iOvr];
+        if( nOutXSize <= 0 || nOutYSize <= 0 )
+            continue;
+
+        const int nOvrXSize = psCtx->anOvrXSize[iOvr];
+        const int nOvrYSize = psCtx->anOvrYSize[iOvr];
+        const int nKX = psCtx->nSrcXSize / nOvrXSize;
+        const int nKY = psCtx->nSrcYSize / nOvrYSize;
+        const int bExact = psCtx->eWrkType != GDT_Float64
+            && nKX * nOvrXSize == psCtx->nSrcXSize
+            && nKY * nOvrYSize == psCtx->nSrcYSize
+            && (GIntBig) nKX * nKY <= 65536;
+
+        for( int iBand = 0; iBand < psCtx->nBands && eErr == CE_None;
+             iBand++ )
+        {
+            const T *pBandSrc = pSrc + iBand * nBandPixels;
+            const GByte *pabyBandMask = psCtx->apoMaskBands[iBand] != NULL
+                ? pabyMask + iBand * nBandPixels : NULL;
+            const size_t nOut = (size_t) nOutXSize * nOutYSize;
+            void *pOut;
+            GDALDataType eOutType;
+
+            if( !psCtx->bNearest && bExact && pabyBandMask == NULL )
+            {
+                aoInt.resize( nOut );
+                GDALOvrMTAverageInteger<T>(
+                    pBandSrc + (size_t) (anOY0[iOvr] * nKY - nWY0) * nWXSize
+                             + (anOX0[iOvr] * nKX - nWX0),
+                    nWXSize, nKX, nKY, nOutXSize, nOutYSize, &aoInt[0] );
+                pOut = &aoInt[0];
+                eOutType = psCtx->eWrkType;
+            }
+            else
+            {
+                adfOut.resize( nOut );
+                GDALOvrMTGenericLevel<T>(
+                    pBandSrc, nWXSize, nWX0, nWY0,
+                    psCtx->nSrcXSize, psCtx->nSrcYSize,
+                    nOvrXSize, nOvrYSize, anOX0[iOvr], anOY0[iOvr],
+                    nOutXSize, nOutYSize, psCtx->bNearest, pabyBandMask,
+                    psCtx->adfOvrNoData[iBand * psCtx->nOverviews + iOvr],
+                    &adfOut[0] );
+                pOut = &adfOut[0];
+                eOutType = GDT_Float64;
+            }
+
+            CPLAcquireMutex( psCtx->hIOMutex, 1000.0 );
+            eErr = psCtx->papapoOverviewBands[iBand][iOvr]->RasterIO(
+                GF_Write, anOX0[iOvr], anOY0[iOvr], nOutXSize, nOutYSize,
+                pOut, nOutXSize, nOutYSize, eOutType, 0, 0 );
+            CPLReleaseMutex( psCtx->hIOMutex );
+        }
+    }
+
+    VSIFree( pSrc );
+    VSIFree( pabyMask );
+    return eErr;
+}
+
+/************************************************************************/
+/*                          GDALOvrMTWorker()                           */
+/************************************************************************/
+
+static void GDALOvrMTWorker( void *pData )
+{
+    GDALOvrMTContext *psCtx = (GDALOvrMTContext *) pData;
+
+    for( ;; )
+    {
+        if( psCtx->bStop )
+            break;
+
+        const int iWindow = CPLAtomicInc( &psCtx->nNextWindow ) - 1;
+        if( iWindow >= psCtx->nWindows )
+            break;
+
+        CPLErr eErr;
+        if( psCtx->eWrkType == GDT_Byte )
+            eErr = GDALOvrMTProcessWindow<GByte>( psCtx, iWindow );
+        else if( psCtx->eWrkType == GDT_UInt16 )
+            eErr = GDALOvrMTProcessWindow<GUInt16>( psCtx, iWindow );
+        else
+            eErr = GDALOvrMTProcessWindow<double>( psCtx, iWindow );
+
+        CPLAcquireMutex( psCtx->hIOMutex, 1000.0 );
+        if( eErr != CE_None )
+        {
+            psCtx->eErr = eErr;
+            psCtx->bStop = TRUE;
+        }
+        else
+        {
+            psCtx->nWindowsDone++;
+            if( !psCtx->bStop
+                && !psCtx->pfnProgress(
+                       psCtx->nWindowsDone / (double) psCtx->nWindows,
+                       NULL, psCtx->pProgressArg ) )
+            {
+                CPLError( CE_Failure, CPLE_UserInterrupt, "User terminated" );
+                psCtx->eErr = CE_Failure;
+                psCtx->bStop = TRUE;
+            }
+        }
+        CPLReleaseMutex( psCtx->hIOMutex );
+    }
+}
+
+/************************************************************************/
+/*                 GDALRegenerateOverviewsMultiBandMT()                 */
+/************************************************************************/
+
+/**
+ * Generate overviews of several bands, on several threads, in a single
+ * read of the source.
+ *
+ * The arguments are those of GDALRegenerateOverviewsMultiBand(), with
+ * papapoOverviewBands[iBand][iOverview] the overviews, followed by a
+ * list of options:
+ * <ul>
+ * <li>NUM_THREADS=number or ALL_CPUS: number of threads, the calling one
+ * and jobs of the shared CPLGetGlobalWorkerThreadPool().  Defaults to the
+ * GDAL_NUM_THREADS configuration option, or 1.</li>
+ * </ul>
+ *
+ * Each thread holds a window of all the bands, of up to about
+ * GDAL_OVR_MT_WINDOW_SIZE x GDAL_OVR_MT_WINDOW_SIZE source pixels.  The
+ * windows are made smaller, and then fewer threads used, to keep them
+ * all under GDAL_OVR_MT_MAX_MEMORY bytes.
+ *
+ * The progress function is called from the worker threads, one at a time.
+ *
+ * @return CE_None on success or CE_Failure if something goes wrong.
+ */
+
+static inline CPLErr
+GDALRegenerateOverviewsMultiBandMT( int nBands, GDALRasterBand **papoSrcBands,
+                                    int nOverviews,
+                                    GDALRasterBand ***papapoOverviewBands,
+                                    const char *pszResampling,
+                                    GDALProgressFunc pfnProgress,
+                                    void *pProgressData,
+                                    char **papszOptions = NULL )
+{
+    if( pfnProgress == NULL )
+        pfnProgress = GDALDummyProgress;
+
+    if( nBands == 0 || nOverviews == 0 )
+    {
+        pfnProgress( 1.0, NULL, pProgressData );
+        return CE_None;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Other resamplings: band by band.                                */
+/* -------------------------------------------------------------------- */
+    const int bNearest = EQUALN( pszResampling, "NEAR", 4 );
+    if( !bNearest && !EQUAL( pszResampling, "AVERAGE" ) )
+    {
+        CPLErr eErr = CE_None;
+        for( int iBand = 0; iBand < nBands && eErr == CE_None; iBand++ )
+        {
+            void *pScaledProgress = GDALCreateScaledProgress(
+                iBand / (double) nBands, (iBand + 1) / (double) nBands,
+                pfnProgress, pProgressData );
+            eErr = GDALRegenerateOverviews(
+                (GDALRasterBandH) papoSrcBands[iBand], nOverviews,
+                (GDALRasterBandH *) papapoOverviewBands[iBand],
+                pszResampling, GDALScaledProgress, pScaledProgress );
+            GDALDestroyScaledProgress( pScaledProgress );
+        }
+        return eErr;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Levels and working type.                                        */
+/* -------------------------------------------------------------------- */
+    GDALOvrMTContext sCtx;
+
+    sCtx.nBands = nBands;
+    sCtx.papoSrcBands = papoSrcBands;
+    sCtx.nOverviews = nOverviews;
+    sCtx.papapoOverviewBands = papapoOverviewBands;
+    sCtx.bNearest = bNearest;
+    sCtx.nSrcXSize = papoSrcBands[0]->GetXSize();
+    sCtx.nSrcYSize = papoSrcBands[0]->GetYSize();
+    sCtx.nCoarseXSize = sCtx.nSrcXSize;
+    sCtx.nCoarseYSize = sCtx.nSrcYSize;
+
+    for( int iOvr = 0; iOvr < nOverviews; iOvr++ )
+    {
+        GDALRasterBand *poOvr = papapoOverviewBands[0][iOvr];
+        sCtx.anOvrXSize.push_back( poOvr->GetXSize() );
+        sCtx.anOvrYSize.push_back( poOvr->GetYSize() );
+        sCtx.nCoarseXSize = MIN( sCtx.nCoarseXSize, poOvr->GetXSize() );
+        sCtx.nCoarseYSize = MIN( sCtx.nCoarseYSize, poOvr->GetYSize() );
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Masks, as in GDALRegenerateOverviews(): an alpha band is its    */
+/*      own mask.                                                       */
+/* -------------------------------------------------------------------- */
+    GDALDataType eType = papoSrcBands[0]->GetRasterDataType();
+    sCtx.bHasMask = FALSE;
+    for( int iBand = 0; iBand < nBands; iBand++ )
+    {
+        GDALRasterBand *poSrcBand = papoSrcBands[iBand];
+        if( poSrcBand->GetRasterDataType() != eType )
+            eType = GDT_Float64;
+
+        GDALRasterBand *poMaskBand = NULL;
+        if( !bNearest )
+        {
+            if( poSrcBand->GetColorInterpretation() == GCI_AlphaBand )
+                poMaskBand = poSrcBand;
+            else if( (poSrcBand->GetMaskFlags() & GMF_ALL_VALID) == 0 )
+                poMaskBand = poSrcBand->GetMaskBand();
+        }
+        sCtx.apoMaskBands.push_back( poMaskBand );
+        if( poMaskBand != NULL )
+            sCtx.bHasMask = TRUE;
+
+        for( int iOvr = 0; iOvr < nOverviews; iOvr++ )
+        {
+            int bHasNoData = FALSE;
+            const double dfNoData =
+                papapoOverviewBands[iBand][iOvr]->GetNoDataValue( &bHasNoData );
+            sCtx.adfOvrNoData.push_back( bHasNoData ? dfNoData : 0.0 );
+        }
+    }
+    sCtx.eWrkType = (eType == GDT_Byte || eType == GDT_UInt16)
+        ? eType : GDT_Float64;
+
+/* -------------------------------------------------------------------- */
+/*      Threads, and windows of about nWindowSize source pixels, as     */
+/*      large as the memory of all the threads allows.                  */
+/* -------------------------------------------------------------------- */
+    const char *pszThreads = CSLFetchNameValue( papszOptions, "NUM_THREADS" );
+    if( pszThreads == NULL )
+        pszThreads = CPLGetConfigOption( "GDAL_NUM_THREADS", "1" );
+    int nThreads = EQUAL(pszThreads, "ALL_CPUS") ? CPLGetNumCPUs()
+                                                 : atoi(pszThreads);
+    nThreads = MAX( 1, nThreads );
+
+    const GIntBig nPixelBytes = (GIntBig) nBands
+        * (GDALGetDataTypeSize( sCtx.eWrkType ) / 8 + (sCtx.bHasMask ? 1 : 0));
+    int nWindowSize = GDAL_OVR_MT_WINDOW_SIZE;
+
+    while( nWindowSize > GDAL_OVR_MT_MIN_WINDOW_SIZE &&
+           nThreads * nPixelBytes * nWindowSize * nWindowSize
+               > GDAL_OVR_MT_MAX_MEMORY )
+        nWindowSize /= 2;
+
+    const GIntBig nWindowBytes = nPixelBytes * nWindowSize * nWindowSize;
+    if( nThreads * nWindowBytes > GDAL_OVR_MT_MAX_MEMORY )
+        nThreads = (int) MAX( 1, GDAL_OVR_MT_MAX_MEMORY / nWindowBytes );
+
+    sCtx.nTileXSize = MAX( 1, (int) ((GIntBig) nWindowSize
+                                     * sCtx.nCoarseXSize / sCtx.nSrcXSize) );
+    sCtx.nTileYSize = MAX( 1, (int) ((GIntBig) nWindowSize
+                                     * sCtx.nCoarseYSize / sCtx.nSrcYSize) );
+    sCtx.nWindowsX = (sCtx.nCoarseXSize + sCtx.nTileXSize - 1)
+        / sCtx.nTileXSize;
+    sCtx.nWindows = sCtx.nWindowsX
+        * ((sCtx.nCoarseYSize + sCtx.nTileYSize - 1) / sCtx.nTileYSize);
+
+    nThreads = MIN( nThreads, sCtx.nWindows );
+
+    sCtx.nNextWindow = 0;
+    sCtx.nWindowsDone = 0;
+    sCtx.bStop = FALSE;
+    sCtx.eErr = CE_None;
+    sCtx.pfnProgress = pfnProgress;
+    sCtx.pProgressArg = pProgressData;
+    sCtx.hIOMutex = CPLCreateMutex();
+    CPLReleaseMutex( sCtx.hIOMutex );
+
+/* -------------------------------------------------------------------- */
+/*      Run the jobs, on the calling thread as well.                    */
+/* -------------------------------------------------------------------- */
+    CPLWorkerThreadPool *poPool = CPLGetGlobalWorkerThreadPool();
+    CPLJobGroup oGroup;
+
+    for( int iThread = 1; iThread < nThreads; iThread++ )
+        poPool->SubmitJob( GDALOvrMTWorker, &sCtx, &oGroup );
+
+    GDALOvrMTWorker( &sCtx );
+    poPool->WaitGroup( &oGroup );
+
+    CPLDestroyMutex( sCtx.hIOMutex );
+
+    return sCtx.eErr;
+}
+
+#endif /* ndef GDALOVERVIEW_MT_H_INCLUDED */
@@ -0,0 +1,688 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  GDAL Core
+ * Purpose:  Sharded, lock-striped raster block cache for multi-threaded
+ *           readers.
+ *
+ ******************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef GDAL_SHARDED_BLOCK_CACHE_H_INCLUDED
+#define GDAL_SHARDED_BLOCK_CACHE_H_INCLUDED
+
+/*
+ * The GDALRasterBlock cache keeps every block of the process on a single
+ * LRU list behind a single mutex, so threads reading rasters at the same
+ * time serialize on it.  GDALShardedBlockCache is a block cache that
+ * threads can share without that bottleneck:
+ *
+ *  - blocks are spread over shards by a hash of (dataset, band, block),
+ *    each shard with its own mutex, hash table and CLOCK eviction;
+ *  - blocks are keyed on the description (path) of the dataset, the
+ *    band, its overview level, its size and data type, and its block
+ *    size, so that the handles of the same file opened by different
+ *    threads share their blocks, and a block is only ever served to a
+ *    band it fits.  Datasets without a description are keyed on their
+ *    handle instead;
+ *  - the bytes held by all shards together are kept under a budget,
+ *    which is GDALGetCacheMax64() (as set by GDALSetCacheMax64() or
+ *    GDAL_CACHEMAX) unless SetMaxBytes() is called;
+ *  - hits, misses, evictions and contended shard locks are counted.
+ *
+ * Blocks are read with GDALRasterBand::ReadBlock(), which does not go
+ * through the GDALRasterBlock cache, so data is not held twice.  The
+ * cache is read-only: it must not be used on datasets being written.
+ *
+ * Flush() drops blocks, and those still in use can no longer be found.
+ * It also starts a new generation of the handles of datasets without a
+ * description, so that a dataset later opened at the same address does
+ * not see the blocks of the previous one.  Close() flushes the blocks of
+ * a dataset, then closes it: use it if the file may change before it is
+ * opened again, and for datasets without a description.
+ *
+ *     GDALShardedBlockCache oCache;
+ *
+ *     // in each thread, with its own GDALDataset *poDS on the same file:
+ *     oCache.ReadWindow( poDS->GetRasterBand(1), nXOff, nYOff,
+ *                        nXSize, nYSize, pafBuffer, GDT_Float32 );
+ *     ...
+ *     oCache.Close( poDS );
+ */
+
+#include "gdal_priv.h"
+#include "cpl_multiproc.h"
+#include "cpl_atomic_ops.h"
+#include "cpl_string.h"
+
+#include <vector>
+
+typedef struct
+{
+    GUIntBig    nHits;
+    GUIntBig    nMisses;
+    GUIntBig    nEvictions;
+    GUIntBig    nLockWaits;     /* Shard locks found held by another thread */
+    GIntBig     nBytesUsed;
+    int         nBlocks;
+} GDALShardedBlockCacheStats;
+
+/* ******************************************************************** */
+/*                           GDALCachedBlock                            */
+/* ******************************************************************** */
+
+//! A block held by a GDALShardedBlockCache.
+
+class GDALCachedBlock
+{
+    friend class GDALShardedBlockCache;
+
+    /* Key */
+    CPLString           osDataset;
+    void               *hDataset;       /* If no description: dataset, */
+    int                 nGeneration;    /* or band if none, and its    */
+                                        /* generation.                 */
+    int                 nBand;
+    int                 nOverview;      /* -1: not an overview */
+    int                 nRasterXSize;
+    int                 nRasterYSize;
+    int                 nXBlock;
+    int                 nYBlock;
+    GUInt32             nHash;
+
+    /* Block geometry, also part of the key */
+    GDALDataType        eType;
+    int                 nXSize;
+    int                 nYSize;
+
+    void               *pData;
+    int                 nKBytes;
+
+    volatile int        nRefCount;
+    int                 bStale;         /* Flushed while in use */
+    int                 bReferenced;    /* CLOCK "second chance" bit */
+    int                 iClockSlot;
+    GDALCachedBlock    *poHashNext;
+
+                GDALCachedBlock() : hDataset(NULL), nGeneration(0), nBand(0),
+                                    nOverview(-1), nRasterXSize(0),
+                                    nRasterYSize(0), nXBlock(0), nYBlock(0), nHash(0),
+                                    eType(GDT_Unknown), nXSize(0), nYSize(0),
+                                    pData(NULL), nKBytes(0), nRefCount(0),
+                                    bStale(FALSE), bReferenced(FALSE),
+                                    iClockSlot(-1), poHashNext(NULL) {}
+               ~GDALCachedBlock() { VSIFree( pData ); }
+
+  public:
+    GDALDataType GetDataType() const { return eType; }
+    int         GetXSize() const { return nXSize; }
+    int         GetYSize() const { return nYSize; }
+    const void *GetDataRef() const { return pData; }
+};
+
+/* ******************************************************************** */
+/*                        GDALShardedBlockCache                         */
+/* ******************************************************************** */
+
+class GDALShardedBlockCache
+{
+    struct Shard
+    {
+        void                          *hMutex;
+        volatile int                   nContenders;
+        std::vector<GDALCachedBlock*>  apoBuckets;
+        std::vector<GDALCachedBlock*>  apoClock;
+        size_t                         iHand;
+        int                            nBlocks;
+        GIntBig                        nBytes;
+        GUIntBig                       nHits;
+        GUIntBig                       nMisses;
+        GUIntBig                       nEvictions;
+        GUIntBig                       nLockWaits;
+    };
+
+    std::vector<Shard*> apoShards;
+    GIntBig             nMaxBytes;      /* -1: follow GDALGetCacheMax64() */
+    volatile int        nUsedKB;        /* All shards, in KiB */
+    volatile int        nGeneration;    /* Of the anonymous datasets */
+
+/* -------------------------------------------------------------------- */
+/*      Locking.                                                        */
+/* -------------------------------------------------------------------- */
+    static void Lock( Shard *poShard )
+    {
+        int bContended = CPLAtomicInc( &poShard->nContenders ) > 1;
+
+        CPLAcquireMutex( poShard->hMutex, 1000.0 );
+
+        if( bContended )
+            poShard->nLockWaits++;
+    }
+
+    static void Unlock( Shard *poShard )
+    {
+        CPLAtomicDec( &poShard->nContenders );
+        CPLReleaseMutex( poShard->hMutex );
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Keys.                                                           */
+/* -------------------------------------------------------------------- */
+    /* Index of poBand among the overviews of the band of its dataset, */
+    /* or -1. */
+    static int GetOverviewLevel( GDALRasterBand *poBand )
+    {
+        GDALDataset *poDS = poBand->GetDataset();
+        const int nBand = poBand->GetBand();
+
+        if( poDS == NULL || nBand < 1 || nBand > poDS->GetRasterCount() )
+            return -1;
+
+        GDALRasterBand *poBase = poDS->GetRasterBand( nBand );
+        if( poBase == poBand )
+            return -1;
+
+        for( int i = 0; i < poBase->GetOverviewCount(); i++ )
+        {
+            if( poBase->GetOverview( i ) == poBand )
+                return i;
+        }
+
+        return -1;
+    }
+
+    void SetKey( GDALCachedBlock *poKey, GDALRasterBand *poBand,
+                 int nXBlock, int nYBlock )
+    {
+        GDALDataset *poDS = poBand->GetDataset();
+
+        poKey->osDataset = poDS != NULL ? poDS->GetDescription() : "";
+        if( poKey->osDataset.empty() )
+        {
+            poKey->hDataset = poDS != NULL ? (void*)poDS : (void*)poBand;
+            poKey->nGeneration = nGeneration;
+        }
+        poKey->nBand = poBand->GetBand();
+        poKey->nOverview = GetOverviewLevel( poBand );
+        poKey->nRasterXSize = poBand->GetXSize();
+        poKey->nRasterYSize = poBand->GetYSize();
+        poKey->nXBlock = nXBlock;
+        poKey->nYBlock = nYBlock;
+        poKey->eType = poBand->GetRasterDataType();
+        poBand->GetBlockSize( &poKey->nXSize, &poKey->nYSize );
+
+        GUInt32 nHash = 2166136261U;
+        GUIntBig nHandle = (GUIntBig) (size_t) poKey->hDataset;
+
+        for( size_t i = 0; i < poKey->osDataset.size(); i++ )
+            nHash = (nHash ^ (GByte) poKey->osDataset[i]) * 16777619U;
+
+        int anKey[7] = { (int) nHandle, (int) (nHandle >> 32),
+                         poKey->nGeneration, poKey->nBand, poKey->nOverview,
+                         nXBlock, nYBlock };
+        for( int i = 0; i < 7; i++ )
+            nHash = (nHash ^ (GUInt32)anKey[i]) * 16777619U;
+
+        poKey->nHash = nHash ^ (nHash >> 15);
+    }
+
+    static void CopyKey( GDALCachedBlock *poDst, const GDALCachedBlock *poSrc )
+    {
+        poDst->osDataset = poSrc->osDataset;
+        poDst->hDataset = poSrc->hDataset;
+        poDst->nGeneration = poSrc->nGeneration;
+        poDst->nBand = poSrc->nBand;
+        poDst->nOverview = poSrc->nOverview;
+        poDst->nRasterXSize = poSrc->nRasterXSize;
+        poDst->nRasterYSize = poSrc->nRasterYSize;
+        poDst->nXBlock = poSrc->nXBlock;
+        poDst->nYBlock = poSrc->nYBlock;
+        poDst->nHash = poSrc->nHash;
+        poDst->eType = poSrc->eType;
+        poDst->nXSize = poSrc->nXSize;
+        poDst->nYSize = poSrc->nYSize;
+    }
+
+    static int SameKey( const GDALCachedBlock *poA, const GDALCachedBlock *poB )
+    {
+        return poA->nHash == poB->nHash &&
+               poA->nXBlock == poB->nXBlock && poA->nYBlock == poB->nYBlock &&
+               poA->hDataset == poB->hDataset &&
+               poA->nGeneration == poB->nGeneration &&
+               poA->nBand == poB->nBand && poA->nOverview == poB->nOverview &&
+               poA->nRasterXSize == poB->nRasterXSize &&
+               poA->nRasterYSize == poB->nRasterYSize &&
+               poA->eType == poB->eType &&
+               poA->nXSize == poB->nXSize && poA->nYSize == poB->nYSize &&
+               poA->osDataset == poB->osDataset;
+    }
+
+    Shard *ShardFor( GUInt32 nHash )
+    {
+        return apoShards[nHash % apoShards.size()];
+    }
+
+    static GDALCachedBlock **Bucket( Shard *poShard, GUInt32 nHash )
+    {
+        return &poShard->apoBuckets[(nHash / 7) % poShard->apoBuckets.size()];
+    }
+
+    static GDALCachedBlock *Find( Shard *poShard, const GDALCachedBlock *poKey )
+    {
+        for( GDALCachedBlock *poBlock = *Bucket( poShard, poKey->nHash );
+             poBlock != NULL; poBlock = poBlock->poHashNext )
+        {
+            if( !poBlock->bStale && SameKey( poBlock, poKey ) )
+                return poBlock;
+        }
+
+        return NULL;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Insertion and removal, with the shard locked.                   */
+/* -------------------------------------------------------------------- */
+    void Insert( Shard *poShard, GDALCachedBlock *poBlock )
+    {
+        GDALCachedBlock **ppoBucket = Bucket( poShard, poBlock->nHash );
+
+        poBlock->poHashNext = *ppoBucket;
+        *ppoBucket = poBlock;
+
+        poBlock->iClockSlot = (int) poShard->apoClock.size();
+        poShard->apoClock.push_back( poBlock );
+
+        poShard->nBlocks++;
+        poShard->nBytes += (GIntBig) poBlock->nKBytes * 1024;
+        CPLAtomicAdd( &nUsedKB, poBlock->nKBytes );
+
+        /* Keep the chains short */
+        if( poShard->nBlocks > 2 * (int) poShard->apoBuckets.size() )
+            Rehash( poShard );
+    }
+
+    void Remove( Shard *poShard, GDALCachedBlock *poBlock )
+    {
+        GDALCachedBlock **ppoIter = Bucket( poShard, poBlock->nHash );
+
+        while( *ppoIter != poBlock )
+            ppoIter = &(*ppoIter)->poHashNext;
+        *ppoIter = poBlock->poHashNext;
+
+        /* The last slot takes the place of the removed one */
+        size_t iSlot = poBlock->iClockSlot;
+        GDALCachedBlock *poLast = poShard->apoClock.back();
+
+        poShard->apoClock[iSlot] = poLast;
+        poLast->iClockSlot = (int) iSlot;
+        poShard->apoClock.pop_back();
+
+        if( poShard->iHand >= poShard->apoClock.size() )
+            poShard->iHand = 0;
+
+        poShard->nBlocks--;
+        poShard->nBytes -= (GIntBig) poBlock->nKBytes * 1024;
+        CPLAtomicAdd( &nUsedKB, -poBlock->nKBytes );
+    }
+
+    static void Rehash( Shard *poShard )
+    {
+        std::vector<GDALCachedBlock*> apoOld;
+        apoOld.swap( poShard->apoBuckets );
+        poShard->apoBuckets.resize( apoOld.size() * 2 + 1, NULL );
+
+        for( size_t i = 0; i < apoOld.size(); i++ )
+        {
+            GDALCachedBlock *poBlock = apoOld[i];
+            while( poBlock != NULL )
+            {
+                GDALCachedBlock *poNext = poBlock->poHashNext;
+                GDALCachedBlock **ppoBucket = Bucket( poShard, poBlock->nHash );
+
+                poBlock->poHashNext = *ppoBucket;
+                *ppoBucket = poBlock;
+                poBlock = poNext;
+            }
+        }
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Evict unreferenced blocks of this shard, CLOCK order, until     */
+/*      the whole cache is under budget.                                */
+/* -------------------------------------------------------------------- */
+    void Evict( Shard *poShard )
+    {
+        GIntBig nBudgetKB = GetMaxBytes() / 1024;
+        size_t  nSteps = 0;
+
+        while( (GIntBig) nUsedKB > nBudgetKB && !poShard->apoClock.empty() &&
+               nSteps < 2 * poShard->apoClock.size() )
+        {
+            GDALCachedBlock *poBlock = poShard->apoClock[poShard->iHand];
+
+            if( poBlock->nRefCount > 0 || poBlock->bReferenced )
+            {
+                poBlock->bReferenced = FALSE;
+                poShard->iHand = (poShard->iHand + 1) % poShard->apoClock.size();
+                nSteps++;
+                continue;
+            }
+
+            Remove( poShard, poBlock );
+            poShard->nEvictions++;
+            delete poBlock;
+            nSteps = 0;
+        }
+    }
+
+  public:
+
+/************************************************************************/
+/*                       GDALShardedBlockCache()                        */
+/*                                                                      */
+/*      nShards <= 0 picks four per CPU.  nMaxBytesIn < 0 follows       */
+/*      GDALGetCacheMax64().                                            */
+/************************************************************************/
+
+    GDALShardedBlockCache( int nShards = 0, GIntBig nMaxBytesIn = -1 ) :
+        nMaxBytes(nMaxBytesIn), nUsedKB(0), nGeneration(0)
+    {
+        if( nShards <= 0 )
+            nShards = 4 * MAX( 1, CPLGetNumCPUs() );
+
+        for( int i = 0; i < nShards; i++ )
+        {
+            Shard *poShard = new Shard;
+
+            poShard->hMutex = CPLCreateMutex();
+            CPLReleaseMutex( poShard->hMutex );   /* created locked */
+            poShard->nContenders = 0;
+            poShard->apoBuckets.resize( 61, NULL );
+            poShard->iHand = 0;
+            poShard->nBlocks = 0;
+            poShard->nBytes = 0;
+            poShard->nHits = poShard->nMisses = 0;
+            poShard->nEvictions = poShard->nLockWaits = 0;
+
+            apoShards.push_back( poShard );
+        }
+    }
+
+    ~GDALShardedBlockCache()
+    {
+        Flush();
+
+        for( size_t i = 0; i < apoShards.size(); i++ )
+        {
+            CPLDestroyMutex( apoShards[i]->hMutex );
+            delete apoShards[i];
+        }
+    }
+
+    void        SetMaxBytes( GIntBig nBytes ) { nMaxBytes = nBytes; }
+    GIntBig     GetMaxBytes() const
+        { return nMaxBytes >= 0 ? nMaxBytes : GDALGetCacheMax64(); }
+
+/************************************************************************/
+/*                              GetBlock()                              */
+/*                                                                      */
+/*      Returns the block, read if needed, with a reference that must   */
+/*      be given back with ReleaseBlock(), or NULL on a read error.     */
+/************************************************************************/
+
+    GDALCachedBlock *GetBlock( GDALRasterBand *poBand, int nXBlock, int nYBlock )
+    {
+        GDALCachedBlock oKey;
+        SetKey( &oKey, poBand, nXBlock, nYBlock );
+
+        Shard *poShard = ShardFor( oKey.nHash );
+
+        Lock( poShard );
+
+        GDALCachedBlock *poBlock = Find( poShard, &oKey );
+
+        if( poBlock != NULL )
+        {
+            CPLAtomicInc( &poBlock->nRefCount );
+            poBlock->bReferenced = TRUE;
+            poShard->nHits++;
+            Unlock( poShard );
+            return poBlock;
+        }
+
+        poShard->nMisses++;
+        Unlock( poShard );
+
+/* -------------------------------------------------------------------- */
+/*      Read without the lock held, so the rest of the shard stays      */
+/*      available.                                                      */
+/* -------------------------------------------------------------------- */
+        GDALCachedBlock *poNew = new GDALCachedBlock();
+
+        CopyKey( poNew, &oKey );
+
+        size_t nBytes = (size_t) poNew->nXSize * poNew->nYSize
+                        * (GDALGetDataTypeSize( poNew->eType ) / 8);
+
+        poNew->nKBytes = (int) ((nBytes + 1023) / 1024);
+        poNew->pData = VSIMalloc( nBytes );
+
+        if( poNew->pData == NULL )
+        {
+            CPLError( CE_Failure, CPLE_OutOfMemory,
+                      "GDALShardedBlockCache: Out of memory allocating a "
+                      "%dx%d block", poNew->nXSize, poNew->nYSize );
+            delete poNew;
+            return NULL;
+        }
+
+        if( poBand->ReadBlock( nXBlock, nYBlock, poNew->pData ) != CE_None )
+        {
+            delete poNew;
+            return NULL;
+        }
+
+        Lock( poShard );
+
+        /* Another thread may have read it meanwhile */
+        poBlock = Find( poShard, poNew );
+
+        if( poBlock != NULL )
+            delete poNew;
+        else
+        {
+            poBlock = poNew;
+            Insert( poShard, poBlock );
+        }
+
+        CPLAtomicInc( &poBlock->nRefCount );
+        poBlock->bReferenced = TRUE;
+
+        Evict( poShard );
+        Unlock( poShard );
+
+        return poBlock;
+    }
+
+    void ReleaseBlock( GDALCachedBlock *poBlock )
+    {
+        /* Eviction only looks at the count with the shard locked */
+        CPLAtomicDec( &poBlock->nRefCount );
+    }
+
+/************************************************************************/
+/*                             ReadWindow()                             */
+/*                                                                      */
+/*      Read a window at full resolution through the cache into a       */
+/*      packed nXSize x nYSize buffer of eBufType.                      */
+/************************************************************************/
+
+    CPLErr ReadWindow( GDALRasterBand *poBand, int nXOff, int nYOff,
+                       int nXSize, int nYSize,
+                       void *pBuffer, GDALDataType eBufType )
+    {
+        int nBlockXSize, nBlockYSize;
+        poBand->GetBlockSize( &nBlockXSize, &nBlockYSize );
+
+        if( nXOff < 0 || nYOff < 0 || nXSize <= 0 || nYSize <= 0 ||
+            nXOff + nXSize > poBand->GetXSize() ||
+            nYOff + nYSize > poBand->GetYSize() )
+        {
+            CPLError( CE_Failure, CPLE_IllegalArg,
+                      "GDALShardedBlockCache::ReadWindow(): Access window "
+                      "out of range: %d,%d %dx%d",
+                      nXOff, nYOff, nXSize, nYSize );
+            return CE_Failure;
+        }
+
+        int nBufPixelSize = GDALGetDataTypeSize( eBufType ) / 8;
+
+        for( int nYBlock = nYOff / nBlockYSize;
+             nYBlock <= (nYOff + nYSize - 1) / nBlockYSize; nYBlock++ )
+        {
+            for( int nXBlock = nXOff / nBlockXSize;
+                 nXBlock <= (nXOff + nXSize - 1) / nBlockXSize; nXBlock++ )
+            {
+                GDALCachedBlock *poBlock = GetBlock( poBand, nXBlock, nYBlock );
+
+                if( poBlock == NULL )
+                    return CE_Failure;
+
+                /* Same geometry as poBand's blocks, being part of the key */
+                int nSrcPixelSize = GDALGetDataTypeSize( poBlock->eType ) / 8;
+
+                /* Intersection of the window and this block */
+                int nX0 = MAX( nXOff, nXBlock * nBlockXSize );
+                int nY0 = MAX( nYOff, nYBlock * nBlockYSize );
+                int nX1 = MIN( nXOff + nXSize, (nXBlock + 1) * nBlockXSize );
+                int nY1 = MIN( nYOff + nYSize, (nYBlock + 1) * nBlockYSize );
+
+                for( int iY = nY0; iY < nY1; iY++ )
+                {
+                    GByte *pabySrc = (GByte *) poBlock->pData
+                        + ((size_t) (iY - nYBlock * nBlockYSize) * poBlock->nXSize
+                           + (nX0 - nXBlock * nBlockXSize)) * nSrcPixelSize;
+                    GByte *pabyDst = (GByte *) pBuffer
+                        + ((size_t) (iY - nYOff) * nXSize + (nX0 - nXOff))
+                          * nBufPixelSize;
+
+                    GDALCopyWords( pabySrc, poBlock->eType, nSrcPixelSize,
+                                   pabyDst, eBufType, nBufPixelSize,
+                                   nX1 - nX0 );
+                }
+
+                ReleaseBlock( poBlock );
+            }
+        }
+
+        return CE_None;
+    }
+
+/************************************************************************/
+/*                               Flush()                                */
+/*                                                                      */
+/*      Drop every block, or only those of the datasets with the given  */
+/*      description if pszDataset is given ("" for anonymous datasets). */
+/*      Blocks in use are left to eviction, but no longer found.        */
+/************************************************************************/
+
+    void Flush( const char *pszDataset = NULL )
+    {
+        /* Anonymous datasets opened from now on are new ones */
+        if( pszDataset == NULL || pszDataset[0] == '\0' )
+            CPLAtomicInc( &nGeneration );
+
+        for( size_t i = 0; i < apoShards.size(); i++ )
+        {
+            Shard *poShard = apoShards[i];
+
+            Lock( poShard );
+
+            for( size_t iSlot = poShard->apoClock.size(); iSlot-- > 0; )
+            {
+                GDALCachedBlock *poBlock = poShard->apoClock[iSlot];
+
+                if( pszDataset != NULL && poBlock->osDataset != pszDataset )
+                    continue;
+
+                if( poBlock->nRefCount > 0 )
+                {
+                    poBlock->bStale = TRUE;
+                    continue;
+                }
+
+                Remove( poShard, poBlock );
+                delete poBlock;
+            }
+
+            Unlock( poShard );
+        }
+    }
+
+/************************************************************************/
+/*                               Close()                                */
+/*                                                                      */
+/*      Flush the blocks of poDS, and close it.                         */
+/************************************************************************/
+
+    void Close( GDALDataset *poDS )
+    {
+        if( poDS == NULL )
+            return;
+
+        Flush( poDS->GetDescription() );
+        GDALClose( (GDALDatasetH) poDS );
+    }
+
+    void GetStats( GDALShardedBlockCacheStats *psStats )
+    {
+        memset( psStats, 0, sizeof(GDALShardedBlockCacheStats) );
+
+        for( size_t i = 0; i < apoShards.size(); i++ )
+        {
+            Shard *poShard = apoShards[i];
+
+            Lock( poShard );
+            psStats->nHits      += poShard->nHits;
+            psStats->nMisses    += poShard->nMisses;
+            psStats->nEvictions += poShard->nEvictions;
+            psStats->nLockWaits += poShard->nLockWaits;
+            psStats->nBytesUsed += poShard->nBytes;
+            psStats->nBlocks    += poShard->nBlocks;
+            Unlock( poShard );
+        }
+    }
+
+    void ResetStats()
+    {
+        for( size_t i = 0; i < apoShards.size(); i++ )
+        {
+            Shard *poShard = apoShards[i];
+
+            Lock( poShard );
+            poShard->nHits = poShard->nMisses = 0;
+            poShard->nEvictions = poShard->nLockWaits = 0;
+            Unlock( poShard );
+        }
+    }
+};
+
+#endif /* ndef GDAL_SHARDED_BLOCK_CACHE_H_INCLUDED */
@@ -0,0 +1,491 @@
+/**********************************************************************
+ *
+ * GEOS - Geometry Engine Open Source
+ * http://geos.osgeo.org
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU Lesser General Public Licence as published
+ * by the Free Software Foundation.
+ * See the COPYING file for more information.
+ *
+ **********************************************************************/
+
+#ifndef GEOS_INDEX_STRTREE_PACKEDSTRTREE_H
+#define GEOS_INDEX_STRTREE_PACKEDSTRTREE_H
+
+#include <geos/index/ItemVisitor.h>
+#include <geos/geom/Envelope.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace geos {
+namespace index { // geos::index
+namespace strtree { // geos::index::strtree
+
+/**
+ * \brief
+ * A query-only, packed R-tree of items sorted along a Hilbert curve.
+ *
+ * Like STRtree, the tree is bulk-built once all the items are inserted,
+ * explicitly by #build or on the first query, after which items may not
+ * be added or removed.  Unlike STRtree, its nodes are not objects: the
+ * envelopes of all the nodes are stored in one contiguous array, level
+ * by level, and a node is an index in that array.  This takes about
+ * 42 bytes per item on 64-bit platforms with the default capacity,
+ * with no allocation per item.
+ *
+ * Leaves are ordered by the Hilbert value of the centre of their
+ * envelope, and each run of nodeCapacity nodes of a level gets a parent
+ * in the next level, so that the children of a node are found from its
+ * position alone.
+ *
+ * Items with a null envelope are not inserted.  Once built, the tree
+ * may be queried from several threads at once.
+ *
+ * The methods taking geom::Envelope are convenience overloads; the
+ * others only depend on this header.
+ */
+class PackedSTRtree
+{
+public:
+
+	/**
+	 * Distance from the query to an item, for #nearestNeighbour.
+	 * It must not be less than the distance between the query
+	 * envelope and the envelope of the item.
+	 */
+	class ItemDistance {
+	public:
+		virtual ~ItemDistance() {}
+		virtual double distance(void* item) = 0;
+	};
+
+	/**
+	 * Constructs a PackedSTRtree with the given maximum number of
+	 * child nodes that a node may have
+	 */
+	explicit PackedSTRtree(std::size_t nodeCapacity = 16)
+		:
+		nodeCapacity(nodeCapacity < 2 ? 2 : nodeCapacity),
+		built(false)
+	{}
+
+	void insert(double minX, double minY, double maxX, double maxY,
+	            void* item)
+	{
+		assert(!built);
+		if (!(minX <= maxX) || !(minY <= maxY)) return;
+		const double b[4] = { minX, minY, maxX, maxY };
+		bounds.insert(bounds.end(), b, b + 4);
+		items.push_back(item);
+	}
+
+	void insert(const geom::Envelope* itemEnv, void* item)
+	{
+		if (itemEnv->isNull()) return;
+		insert(itemEnv->getMinX(), itemEnv->getMinY(),
+		       itemEnv->getMaxX(), itemEnv->getMaxY(), item);
+	}
+
+	/// Sorts the items and builds the upper levels of the tree
+	void build();
+
+	bool isBuilt() const { return built; }
+
+	/// Number of items in the tree
+	std::size_t size() const { return items.size(); }
+
+	std::size_t getNodeCapacity() const { return nodeCapacity; }
+
+	/// Bytes allocated by the tree
+	std::size_t getMemoryUsage() const
+	{
+		return sizeof(*this)
+			+ bounds.capacity() * sizeof(double)
+			+ items.capacity() * sizeof(void*)
+			+ levelStarts.capacity() * sizeof(std::size_t);
+	}
+
+	/**
+	 * Queries the tree for all the items whose envelope intersects
+	 * the given one, boundaries included.
+	 */
+	void query(double minX, double minY, double maxX, double maxY,
+	           std::vector<void*>& matches)
+	{
+		VectorCollector collector(matches);
+		queryImpl(minX, minY, maxX, maxY, collector);
+	}
+
+	void query(double minX, double minY, double maxX, double maxY,
+	           ItemVisitor& visitor)
+	{
+		ItemVisitorAdapter adapter(visitor);
+		queryImpl(minX, minY, maxX, maxY, adapter);
+	}
+
+	void query(const geom::Envelope* searchEnv, std::vector<void*>& matches)
+	{
+		if (searchEnv->isNull()) return;
+		query(searchEnv->getMinX(), searchEnv->getMinY(),
+		      searchEnv->getMaxX(), searchEnv->getMaxY(), matches);
+	}
+
+	void query(const geom::Envelope* searchEnv, ItemVisitor& visitor)
+	{
+		if (searchEnv->isNull()) return;
+		query(searchEnv->getMinX(), searchEnv->getMinY(),
+		      searchEnv->getMaxX(), searchEnv->getMaxY(), visitor);
+	}
+
+	/// Applies visitor to all the items, in leaf order once built
+	void iterate(ItemVisitor& visitor)
+	{
+		for (std::size_t i = 0; i < items.size(); ++i)
+			visitor.visitItem(items[i]);
+	}
+
+	/**
+	 * Finds the k items nearest to the given envelope, nearest first.
+	 *
+	 * The distance to an item is that given by itemDist, or the
+	 * distance between envelopes if itemDist is NULL.  Items further
+	 * than maxDistance are ignored.
+	 *
+	 * @param distances if not NULL, receives the distances of the items
+	 */
+	void nearestNeighbours(double minX, double minY,
+	                       double maxX, double maxY,
+	                       std::size_t k, std::vector<void*>& result,
+	                       ItemDistance* itemDist = NULL,
+	                       double maxDistance =
+	                           std::numeric_limits<double>::infinity(),
+	                       std::vector<double>* distances = NULL);
+
+	/**
+	 * The item nearest to the given envelope, or NULL if the tree is
+	 * empty.  See #nearestNeighbours.
+	 */
+	void* nearestNeighbour(double minX, double minY,
+	                       double maxX, double maxY,
+	                       ItemDistance* itemDist = NULL,
+	                       double* distance = NULL)
+	{
+		std::vector<void*> result;
+		std::vector<double> dist;
+		nearestNeighbours(minX, minY, maxX, maxY, 1, result, itemDist,
+		                  std::numeric_limits<double>::infinity(), &dist);
+		if (result.empty()) return NULL;
+		if (distance) *distance = dist[0];
+		return result[0];
+	}
+
+	void* nearestNeighbour(const geom::Envelope* env,
+	                       ItemDistance* itemDist = NULL,
+	                       double* distance = NULL)
+	{
+		if (env->isNull()) return NULL;
+		return nearestNeighbour(env->getMinX(), env->getMinY(),
+		                        env->getMaxX(), env->getMaxY(),
+		                        itemDist, distance);
+	}
+
+private:
+
+	/// Maximum number of children of a node
+	std::size_t nodeCapacity;
+
+	/// minX, minY, maxX, maxY of each node, leaves first, root last
+	std::vector<double> bounds;
+
+	/// Items, in the order of the leaves once built
+	std::vector<void*> items;
+
+	/// Index of the first node of each level, leaves first, then the
+	/// number of nodes
+	std::vector<std::size_t> levelStarts;
+
+	bool built;
+
+	struct VectorCollector {
+		std::vector<void*>& matches;
+		VectorCollector(std::vector<void*>& m) : matches(m) {}
+		void operator()(void* item) { matches.push_back(item); }
+	};
+
+	struct ItemVisitorAdapter {
+		ItemVisitor& visitor;
+		ItemVisitorAdapter(ItemVisitor& v) : visitor(v) {}
+		void operator()(void* item) { visitor.visitItem(item); }
+	};
+
+	bool intersects(std::size_t node, const double* q) const
+	{
+		const double* b = &bounds[4 * node];
+		return b[0] <= q[2] && b[2] >= q[0] && b[1] <= q[3] && b[3] >= q[1];
+	}
+
+	double distance(std::size_t node, const double* q) const
+	{
+		const double* b = &bounds[4 * node];
+		double dx = 0.0, dy = 0.0;
+		if (q[2] < b[0]) dx = b[0] - q[2];
+		else if (b[2] < q[0]) dx = q[0] - b[2];
+		if (q[3] < b[1]) dy = b[1] - q[3];
+		else if (b[3] < q[1]) dy = q[1] - b[3];
+		return std::sqrt(dx * dx + dy * dy);
+	}
+
+	/// Range of the children of node, which is at the given level
+	void getChildren(std::size_t node, std::size_t level,
+	                 std::size_t& first, std::size_t& end) const
+	{
+		first = levelStarts[level - 1]
+		        + (node - levelStarts[level]) * nodeCapacity;
+		end = std::min(first + nodeCapacity, levelStarts[level]);
+	}
+
+	/// Calls visitor(item) for the items intersecting the envelope
+	template<class Visitor>
+	void queryImpl(double minX, double minY, double maxX, double maxY,
+	               Visitor& visitor)
+	{
+		if (!built) build();
+		if (items.empty()) return;
+		const double q[4] = { minX, minY, maxX, maxY };
+		const std::size_t root = levelStarts.back() - 1;
+		if (intersects(root, q))
+			queryNode(root, levelStarts.size() - 2, q, visitor);
+	}
+
+	template<class Visitor>
+	void queryNode(std::size_t node, std::size_t level, const double* q,
+	               Visitor& visitor)
+	{
+		if (level == 0) {
+			visitor(items[node]);
+			return;
+		}
+		std::size_t first, end;
+		getChildren(node, level, first, end);
+		for (std::size_t child = first; child < end; ++child) {
+			if (!intersects(child, q)) continue;
+			if (level == 1) visitor(items[child]);
+			else queryNode(child, level - 1, q, visitor);
+		}
+	}
+
+	/// Position of (x, y) in [0, 65535]^2 along a Hilbert curve
+	static unsigned int hilbert(unsigned int x, unsigned int y);
+
+	/// Search entry of #nearestNeighbours: a node, or an item
+	struct Candidate {
+		double distance;
+		std::size_t node;
+		std::size_t level;	// Level of the node, or npos for an item
+		bool operator<(const Candidate& o) const {
+			return distance > o.distance; // For a min-heap
+		}
+	};
+
+	// Declare type as noncopyable
+	PackedSTRtree(const PackedSTRtree& other);
+	PackedSTRtree& operator=(const PackedSTRtree& rhs);
+};
+
+inline unsigned int
+PackedSTRtree::hilbert(unsigned int x, unsigned int y)
+{
+	// Fast Hilbert curve algorithm by http://threadlocalmutex.com/
+	// (public domain), for 16 bits coordinates
+	unsigned int a = x ^ y;
+	unsigned int b = 0xFFFF ^ a;
+	unsigned int c = 0xFFFF ^ (x | y);
+	unsigned int d = x & (y ^ 0xFFFF);
+
+	unsigned int A = a | (b >> 1);
+	unsigned int B = (a >> 1) ^ a;
+	unsigned int C = ((c >> 1) ^ (b & (d >> 1))) ^ c;
+	unsigned int D = ((a & (c >> 1)) ^ (d >> 1)) ^ d;
+
+	a = A; b = B; c = C; d = D;
+	A = ((a & (a >> 2)) ^ (b & (b >> 2)));
+	B = ((a & (b >> 2)) ^ (b & ((a ^ b) >> 2)));
+	C ^= ((a & (c >> 2)) ^ (b & (d >> 2)));
+	D ^= ((b & (c >> 2)) ^ ((a ^ b) & (d >> 2)));
+
+	a = A; b = B; c = C; d = D;
+	A = ((a & (a >> 4)) ^ (b & (b >> 4)));
+	B = ((a & (b >> 4)) ^ (b & ((a ^ b) >> 4)));
+	C ^= ((a & (c >> 4)) ^ (b & (d >> 4)));
+	D ^= ((b & (c >> 4)) ^ ((a ^ b) & (d >> 4)));
+
+	a = A; b = B; c = C; d = D;
+	C ^= ((a & (c >> 8)) ^ (b & (d >> 8)));
+	D ^= ((b & (c >> 8)) ^ ((a ^ b) & (d >> 8)));
+
+	a = C ^ (C >> 1);
+	b = D ^ (D >> 1);
+
+	unsigned int i0 = x ^ y;
+	unsigned int i1 = b | (0xFFFF ^ (i0 | a));
+
+	i0 = (i0 | (i0 << 8)) & 0x00FF00FF;
+	i0 = (i0 | (i0 << 4)) & 0x0F0F0F0F;
+	i0 = (i0 | (i0 << 2)) & 0x33333333;
+	i0 = (i0 | (i0 << 1)) & 0x55555555;
+
+	i1 = (i1 | (i1 << 8)) & 0x00FF00FF;
+	i1 = (i1 | (i1 << 4)) & 0x0F0F0F0F;
+	i1 = (i1 | (i1 << 2)) & 0x33333333;
+	i1 = (i1 | (i1 << 1)) & 0x55555555;
+
+	return (i1 << 1) | i0;
+}
+
+inline void
+PackedSTRtree::build()
+{
+	if (built) return;
+	built = true;
+
+	const std::size_t n = items.size();
+	if (n == 0) return;
+
+	double minX = bounds[0], minY = bounds[1];
+	double maxX = bounds[2], maxY = bounds[3];
+	for (std::size_t i = 1; i < n; ++i) {
+		const double* b = &bounds[4 * i];
+		minX = std::min(minX, b[0]);
+		minY = std::min(minY, b[1]);
+		maxX = std::max(maxX, b[2]);
+		maxY = std::max(maxY, b[3]);
+	}
+	const double width = maxX - minX;
+	const double height = maxY - minY;
+
+	// Sort the leaves along the curve; the index keeps it stable.
+	std::vector< std::pair<unsigned int, unsigned int> > order(n);
+	for (std::size_t i = 0; i < n; ++i) {
+		const double* b = &bounds[4 * i];
+		const double cx = (b[0] + b[2]) / 2.0;
+		const double cy = (b[1] + b[3]) / 2.0;
+		const unsigned int hx = width > 0 ?
+			static_cast<unsigned int>(65535.0 * (cx - minX) / width) : 0;
+		const unsigned int hy = height > 0 ?
+			static_cast<unsigned int>(65535.0 * (cy - minY) / height) : 0;
+		order[i].first = hilbert(hx, hy);
+		order[i].second = static_cast<unsigned int>(i);
+	}
+	std::sort(order.begin(), order.end());
+
+	// Leaves, then each level; nodes per level shrink by nodeCapacity.
+	std::size_t numNodes = n, count = n;
+	while (count > 1) {
+		count = (count + nodeCapacity - 1) / nodeCapacity;
+		numNodes += count;
+	}
+
+	std::vector<double> newBounds(4 * numNodes);
+	std::vector<void*> newItems(n);
+	for (std::size_t i = 0; i < n; ++i) {
+		const unsigned int src = order[i].second;
+		std::copy(&bounds[4 * src], &bounds[4 * src] + 4, &newBounds[4 * i]);
+		newItems[i] = items[src];
+	}
+
+	levelStarts.push_back(0);
+	levelStarts.push_back(n);
+	std::size_t pos = n;
+	while (levelStarts.back() - levelStarts[levelStarts.size() - 2] > 1) {
+		const std::size_t levelStart = levelStarts[levelStarts.size() - 2];
+		const std::size_t levelEnd = levelStarts.back();
+		for (std::size_t first = levelStart; first < levelEnd;
+		     first += nodeCapacity) {
+			const std::size_t end = std::min(first + nodeCapacity, levelEnd);
+			double* p = &newBounds[4 * pos];
+			std::copy(&newBounds[4 * first], &newBounds[4 * first] + 4, p);
+			for (std::size_t c = first + 1; c < end; ++c) {
+				const double* b = &newBounds[4 * c];
+				p[0] = std::min(p[0], b[0]);
+				p[1] = std::min(p[1], b[1]);
+				p[2] = std::max(p[2], b[2]);
+				p[3] = std::max(p[3], b[3]);
+			}
+			++pos;
+		}
+		levelStarts.push_back(pos);
+	}
+	assert(pos == numNodes);
+
+	bounds.swap(newBounds);
+	items.swap(newItems);
+}
+
+inline void
+PackedSTRtree::nearestNeighbours(double minX, double minY,
+                                 double maxX, double maxY,
+                                 std::size_t k, std::vector<void*>& result,
+                                 ItemDistance* itemDist, double maxDistance,
+                                 std::vector<double>* distances)
+{
+	if (!built) build();
+	if (items.empty() || k == 0) return;
+
+	const std::size_t npos = static_cast<std::size_t>(-1);
+	const double q[4] = { minX, minY, maxX, maxY };
+	std::priority_queue<Candidate> queue;
+
+	// Best-first search: nodes are expanded in order of their
+	// distance, which is a lower bound of those of their items.
+	Candidate c;
+	c.node = levelStarts.back() - 1;
+	c.level = levelStarts.size() - 2;
+	c.distance = distance(c.node, q);
+	queue.push(c);
+
+	std::size_t found = 0;
+	while (!queue.empty() && found < k) {
+		const Candidate top = queue.top();
+		queue.pop();
+		if (top.distance > maxDistance) break;
+
+		if (top.level == npos) {
+			result.push_back(items[top.node]);
+			if (distances) distances->push_back(top.distance);
+			++found;
+			continue;
+		}
+
+		std::size_t first = top.node, end = top.node + 1;
+		if (top.level > 0) getChildren(top.node, top.level, first, end);
+		for (std::size_t child = first; child < end; ++child) {
+			Candidate cc;
+			cc.distance = distance(child, q);
+			if (cc.distance > maxDistance) continue;
+			if (top.level <= 1) {
+				// A leaf: queue its item, at its exact distance
+				cc.node = child;
+				cc.level = npos;
+				if (itemDist) cc.distance = itemDist->distance(items[cc.node]);
+			}
+			else {
+				cc.node = child;
+				cc.level = top.level - 1;
+			}
+			queue.push(cc);
+		}
+	}
+}
+
+} // namespace geos::index::strtree
+} // namespace geos::index
+} // namespace geos
+
+#endif // GEOS_INDEX_STRTREE_PACKEDSTRTREE_H
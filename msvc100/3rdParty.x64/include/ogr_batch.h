@@ -0,0 +1,1280 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  OpenGIS Simple Features Reference Implementation
+ * Purpose:  Columnar batch reading of the features of a layer.
+ *
+ ******************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef _OGR_BATCH_H_INCLUDED
+#define _OGR_BATCH_H_INCLUDED
+
+#include "ogrsf_frmts.h"
+#include "cpl_conv.h"
+#include "cpl_string.h"
+#include "cpl_vsi.h"
+#include <string.h>
+#include <vector>
+
+/**
+ * \file ogr_batch.h
+ *
+ * Reading of the features of a layer by batches into columnar buffers.
+ *
+ * An OGRFeatureBatch holds N features as one array per attribute field,
+ * an array of FIDs, and the geometries packed as consecutive WKB
+ * (wkbNDR) blobs, without any OGRFeature or OGRGeometry object.  It is
+ * filled by an OGRLayerBatchReader, obtained from
+ * OGRCreateLayerBatchReader():
+ *
+ * <ul>
+ * <li>for layers of the ESRI Shapefile driver, the .shp, .shx and .dbf
+ * files are decoded straight into the batch by OGRShapeBatchReader;</li>
+ * <li>for other layers, including the Memory driver ones, an
+ * OGRGenericBatchReader copies the features returned by
+ * GetNextFeature().</li>
+ * </ul>
+ *
+ * Integer and Real fields are stored as int and double arrays.  Fields of
+ * other types are stored as UTF-8 strings, as returned by
+ * OGRFeature::GetFieldAsString().  Only the first geometry field is read.
+ */
+
+/************************************************************************/
+/*                           OGRFeatureBatch                            */
+/************************************************************************/
+
+/**
+ * Columnar buffer of features.
+ *
+ * The values of field iField for feature iFeature are at index iFeature of
+ * the arrays of the field.  Unset fields are reported by IsFieldSet(), and
+ * read as 0, 0.0 or an empty string.  String values are stored one after
+ * the other, each followed by a nul character, in GetFieldStringData(),
+ * and start at the offsets given by GetFieldStringOffsets(), which has
+ * GetFeatureCount() + 1 entries.  Geometries are laid out the same way in
+ * GetGeometryData(), without separator; an empty blob means no geometry.
+ *
+ * The buffers are kept from one batch to the next, so that reading a
+ * layer by batches into the same object does not allocate once they have
+ * reached the size of a batch.
+ */
+
+class OGRFeatureBatch
+{
+    typedef struct
+    {
+        OGRFieldType        eType;
+        std::vector<int>    anValues;
+        std::vector<double> adfValues;
+        std::vector<size_t> anOffsets;
+        std::vector<char>   achData;
+        std::vector<GByte>  abySet;
+    } Column;
+
+    int                     nFeatures;
+    std::vector<Column>     aoColumns;
+    std::vector<long>       anFIDs;
+    std::vector<size_t>     anGeomOffsets;
+    std::vector<GByte>      abyGeomData;
+
+  public:
+                OGRFeatureBatch() : nFeatures(0) { anGeomOffsets.push_back(0); }
+
+    /** Type in which an OGR field type is stored in a batch. */
+    static OGRFieldType GetStorageType( OGRFieldType eType )
+    {
+        return (eType == OFTInteger || eType == OFTReal) ? eType : OFTString;
+    }
+
+    /**
+     * Empty the batch and set its columns, from the types of the fields.
+     * The buffers are kept if the columns do not change.
+     */
+    void        Reset( int nFields, const OGRFieldType *paeTypes )
+    {
+        int bSame = (int) aoColumns.size() == nFields;
+        for( int i = 0; bSame && i < nFields; i++ )
+            bSame = aoColumns[i].eType == GetStorageType( paeTypes[i] );
+
+        if( !bSame )
+        {
+            aoColumns.clear();
+            aoColumns.resize( nFields );
+            for( int i = 0; i < nFields; i++ )
+                aoColumns[i].eType = GetStorageType( paeTypes[i] );
+        }
+        Clear();
+    }
+
+    /** Remove the features, keeping the columns and the buffers. */
+    void        Clear()
+    {
+        nFeatures = 0;
+        anFIDs.resize( 0 );
+        anGeomOffsets.resize( 1 );
+        abyGeomData.resize( 0 );
+        for( size_t i = 0; i < aoColumns.size(); i++ )
+        {
+            Column &oCol = aoColumns[i];
+            oCol.anValues.resize( 0 );
+            oCol.adfValues.resize( 0 );
+            oCol.anOffsets.resize( 0 );
+            oCol.achData.resize( 0 );
+            oCol.abySet.resize( 0 );
+            if( oCol.eType == OFTString )
+                oCol.anOffsets.push_back( 0 );
+        }
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Access.                                                         */
+/* -------------------------------------------------------------------- */
+    int          GetFeatureCount() const { return nFeatures; }
+    int          GetFieldCount() const { return (int) aoColumns.size(); }
+
+    /** OFTInteger, OFTReal or OFTString. */
+    OGRFieldType GetFieldType( int iField ) const
+                                        { return aoColumns[iField].eType; }
+
+    const long  *GetFIDs() const
+                            { return nFeatures ? &anFIDs[0] : NULL; }
+
+    int          IsFieldSet( int iFeature, int iField ) const
+                            { return aoColumns[iField].abySet[iFeature]; }
+
+    const int   *GetFieldIntegers( int iField ) const
+    {
+        const Column &oCol = aoColumns[iField];
+        return oCol.anValues.empty() ? NULL : &oCol.anValues[0];
+    }
+
+    const double *GetFieldReals( int iField ) const
+    {
+        const Column &oCol = aoColumns[iField];
+        return oCol.adfValues.empty() ? NULL : &oCol.adfValues[0];
+    }
+
+    const size_t *GetFieldStringOffsets( int iField ) const
+                            { return &aoColumns[iField].anOffsets[0]; }
+
+    const char  *GetFieldStringData( int iField ) const
+    {
+        const Column &oCol = aoColumns[iField];
+        return oCol.achData.empty() ? NULL : &oCol.achData[0];
+    }
+
+    /** String value of a field, of length *pnLength if not NULL. */
+    const char  *GetFieldString( int iFeature, int iField,
+                                 int *pnLength = NULL ) const
+    {
+        const Column &oCol = aoColumns[iField];
+        if( pnLength != NULL )
+            *pnLength = (int) (oCol.anOffsets[iFeature + 1]
+                               - oCol.anOffsets[iFeature] - 1);
+        return &oCol.achData[oCol.anOffsets[iFeature]];
+    }
+
+    const size_t *GetGeometryOffsets() const { return &anGeomOffsets[0]; }
+    const GByte *GetGeometryData() const
+            { return abyGeomData.empty() ? NULL : &abyGeomData[0]; }
+
+    /** WKB of the geometry of a feature, or NULL if it has none. */
+    const GByte *GetGeometryWKB( int iFeature, int *pnSize = NULL ) const
+    {
+        const size_t nSize = anGeomOffsets[iFeature + 1]
+                           - anGeomOffsets[iFeature];
+        if( pnSize != NULL )
+            *pnSize = (int) nSize;
+        return nSize ? &abyGeomData[anGeomOffsets[iFeature]] : NULL;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Filling, by the readers.  A feature is added by AddFeature(),   */
+/*      then at most one Set call per field, in field order for the     */
+/*      string fields, and AllocGeometry(), then EndFeature().          */
+/* -------------------------------------------------------------------- */
+    void        AddFeature( long nFID )
+    {
+        anFIDs.push_back( nFID );
+        for( size_t i = 0; i < aoColumns.size(); i++ )
+        {
+            Column &oCol = aoColumns[i];
+            oCol.abySet.push_back( 0 );
+            if( oCol.eType == OFTInteger )
+                oCol.anValues.push_back( 0 );
+            else if( oCol.eType == OFTReal )
+                oCol.adfValues.push_back( 0.0 );
+        }
+    }
+
+    void        SetInteger( int iField, int nValue )
+    {
+        Column &oCol = aoColumns[iField];
+        oCol.anValues[nFeatures] = nValue;
+        oCol.abySet[nFeatures] = 1;
+    }
+
+    void        SetReal( int iField, double dfValue )
+    {
+        Column &oCol = aoColumns[iField];
+        oCol.adfValues[nFeatures] = dfValue;
+        oCol.abySet[nFeatures] = 1;
+    }
+
+    void        SetString( int iField, const char *pszValue, size_t nLength )
+    {
+        Column &oCol = aoColumns[iField];
+        oCol.achData.insert( oCol.achData.end(), pszValue, pszValue + nLength );
+        oCol.achData.push_back( '\0' );
+        oCol.anOffsets.push_back( oCol.achData.size() );
+        oCol.abySet[nFeatures] = 1;
+    }
+
+    /** Room for the nSize bytes of WKB of the current feature. */
+    GByte      *AllocGeometry( size_t nSize )
+    {
+        const size_t nOffset = abyGeomData.size();
+        abyGeomData.resize( nOffset + nSize );
+        anGeomOffsets.push_back( abyGeomData.size() );
+        return &abyGeomData[nOffset];
+    }
+
+    void        EndFeature()
+    {
+        for( size_t i = 0; i < aoColumns.size(); i++ )
+        {
+            Column &oCol = aoColumns[i];
+            if( oCol.eType == OFTString
+                && oCol.anOffsets.size() == (size_t) nFeatures + 1 )
+            {
+                oCol.achData.push_back( '\0' );
+                oCol.anOffsets.push_back( oCol.achData.size() );
+            }
+        }
+        if( anGeomOffsets.size() == (size_t) nFeatures + 1 )
+            anGeomOffsets.push_back( abyGeomData.size() );
+        nFeatures++;
+    }
+};
+
+/************************************************************************/
+/*                         OGRLayerBatchReader                          */
+/************************************************************************/
+
+/** Reads the features of a layer into OGRFeatureBatch objects. */
+
+class OGRLayerBatchReader
+{
+  public:
+    virtual             ~OGRLayerBatchReader() {}
+
+    /** Restart from the first feature. */
+    virtual void        ResetReading() = 0;
+
+    /**
+     * Read the next features, up to nMaxFeatures, into poBatch, whose
+     * previous content is replaced.
+     *
+     * @return the number of features read, 0 once all have been read.
+     */
+    virtual int         ReadBatch( OGRFeatureBatch *poBatch,
+                                   int nMaxFeatures ) = 0;
+
+    /** "Shapefile" or "Generic". */
+    virtual const char *GetReaderName() = 0;
+};
+
+/************************************************************************/
+/*                        OGRGenericBatchReader                         */
+/************************************************************************/
+
+/**
+ * Batch reader of any layer, through GetNextFeature().  It honours the
+ * filters and ignored fields of the layer, and moves its reading cursor.
+ */
+
+class OGRGenericBatchReader : public OGRLayerBatchReader
+{
+    OGRLayer           *poLayer;
+    std::vector<OGRFieldType> aeTypes;
+
+  public:
+                        OGRGenericBatchReader( OGRLayer *poLayerIn )
+                                : poLayer(poLayerIn) {}
+
+    virtual void        ResetReading() { poLayer->ResetReading(); }
+    virtual const char *GetReaderName() { return "Generic"; }
+
+    virtual int         ReadBatch( OGRFeatureBatch *poBatch,
+                                   int nMaxFeatures )
+    {
+        OGRFeatureDefn *poDefn = poLayer->GetLayerDefn();
+        const int nFields = poDefn->GetFieldCount();
+
+        aeTypes.resize( nFields );
+        for( int i = 0; i < nFields; i++ )
+            aeTypes[i] = poDefn->GetFieldDefn( i )->GetType();
+        poBatch->Reset( nFields, nFields ? &aeTypes[0] : NULL );
+
+        OGRFeature *poFeature;
+        while( poBatch->GetFeatureCount() < nMaxFeatures
+               && (poFeature = poLayer->GetNextFeature()) != NULL )
+        {
+            poBatch->AddFeature( poFeature->GetFID() );
+
+            for( int i = 0; i < nFields; i++ )
+            {
+                if( !poFeature->IsFieldSet( i ) )
+                    continue;
+
+                OGRField *psField = poFeature->GetRawFieldRef( i );
+                if( aeTypes[i] == OFTInteger )
+                    poBatch->SetInteger( i, psField->Integer );
+                else if( aeTypes[i] == OFTReal )
+                    poBatch->SetReal( i, psField->Real );
+                else
+                {
+                    const char *pszValue = aeTypes[i] == OFTString
+                        ? psField->String : poFeature->GetFieldAsString( i );
+                    poBatch->SetString( i, pszValue, strlen(pszValue) );
+                }
+            }
+
+            OGRGeometry *poGeom = poFeature->GetGeometryRef();
+            if( poGeom != NULL )
+            {
+                const int nSize = poGeom->WkbSize();
+                if( nSize > 0 )
+                    poGeom->exportToWkb( wkbNDR,
+                                         poBatch->AllocGeometry( nSize ) );
+            }
+
+            poBatch->EndFeature();
+            OGRFeature::DestroyFeature( poFeature );
+        }
+
+        return poBatch->GetFeatureCount();
+    }
+};
+
+/************************************************************************/
+/*                         OGRShapeBatchReader                          */
+/************************************************************************/
+
+#ifndef OGR_BATCH_READ_SIZE
+/* Size of the reads in the .shp and .dbf files. */
+#  define OGR_BATCH_READ_SIZE   (1024 * 1024)
+#endif
+
+/* Window of a file read by chunks of OGR_BATCH_READ_SIZE. */
+
+class OGRBatchFileWindow
+{
+    VSILFILE           *fp;
+    vsi_l_offset        nOffset;
+    std::vector<GByte>  abyBuf;
+    size_t              nValid;
+
+  public:
+                        OGRBatchFileWindow() : fp(NULL), nOffset(0),
+                                               nValid(0) {}
+                        ~OGRBatchFileWindow() { Close(); }
+
+    int                 Open( const char *pszFilename )
+    {
+        Close();
+        fp = VSIFOpenL( pszFilename, "rb" );
+        return fp != NULL;
+    }
+
+    void                Close()
+    {
+        if( fp != NULL )
+            VSIFCloseL( fp );
+        fp = NULL;
+        nValid = 0;
+    }
+
+    int                 IsOpen() const { return fp != NULL; }
+
+    /** Bytes [nOff, nOff + nLen) of the file, or NULL if beyond its end. */
+    const GByte        *Get( vsi_l_offset nOff, size_t nLen )
+    {
+        if( nOff >= nOffset && nOff + nLen <= nOffset + nValid )
+            return &abyBuf[0] + (size_t) (nOff - nOffset);
+
+        const size_t nToRead = MAX( (size_t) OGR_BATCH_READ_SIZE, nLen );
+        if( abyBuf.size() < nToRead )
+            abyBuf.resize( nToRead );
+
+        nOffset = nOff;
+        nValid = 0;
+        if( VSIFSeekL( fp, nOff, SEEK_SET ) != 0 )
+            return NULL;
+        nValid = VSIFReadL( &abyBuf[0], 1, nToRead, fp );
+
+        return nValid >= nLen ? &abyBuf[0] : NULL;
+    }
+};
+
+static inline GInt32 OGRBatchGetLE32( const GByte *p )
+{
+    GInt32 nVal;
+    memcpy( &nVal, p, 4 );
+    CPL_LSBPTR32( &nVal );
+    return nVal;
+}
+
+static inline GInt32 OGRBatchGetBE32( const GByte *p )
+{
+    GInt32 nVal;
+    memcpy( &nVal, p, 4 );
+    CPL_MSBPTR32( &nVal );
+    return nVal;
+}
+
+static inline double OGRBatchGetLEDouble( const GByte *p )
+{
+    double dfVal;
+    memcpy( &dfVal, p, 8 );
+    CPL_LSBPTR64( &dfVal );
+    return dfVal;
+}
+
+static inline GByte *OGRBatchPutWKBHeader( GByte *p, GUInt32 nType )
+{
+    p[0] = wkbNDR;
+    CPL_LSBPTR32( &nType );
+    memcpy( p + 1, &nType, 4 );
+    return p + 5;
+}
+
+static inline GByte *OGRBatchPutLE32( GByte *p, GUInt32 nVal )
+{
+    CPL_LSBPTR32( &nVal );
+    memcpy( p, &nVal, 4 );
+    return p + 4;
+}
+
+/**
+ * Batch reader decoding a shapefile directly, bypassing OGRFeature.
+ *
+ * Features, FIDs, field types and values, null values and geometries are
+ * those of the ESRI Shapefile driver: deleted records are skipped, string
+ * values are trimmed and converted to UTF-8 from the encoding given by
+ * the SHAPE_ENCODING configuration option, the .cpg file or the language
+ * driver id of the .dbf, M values are dropped, and the rings of polygons
+ * are grouped into polygons by orientation, holes going to the clockwise
+ * ring containing them.
+ *
+ * The reader has its own cursor, and ignores the filters of the layer:
+ * OGRCreateLayerBatchReader() only uses it for layers without filters.
+ * MultiPatch files are not supported.
+ */
+
+class OGRShapeBatchReader : public OGRLayerBatchReader
+{
+    OGRBatchFileWindow  oSHP;
+    OGRBatchFileWindow  oDBF;
+    std::vector<GUInt32> anSHXOffsets;  /* In bytes, record content. */
+    std::vector<GUInt32> anSHXSizes;
+    int                 nShapeType;
+    int                 nRecords;
+    int                 iNextRecord;
+
+    int                 nDBFHeaderLength;
+    int                 nDBFRecordLength;
+    std::vector<char>   achDBFTypes;
+    std::vector<int>    anDBFOffsets;
+    std::vector<int>    anDBFWidths;
+    std::vector<char>   achValue;       /* Widest field, plus the nul. */
+    std::vector<OGRFieldType> aeTypes;
+    std::vector<CPLString> aosNames;
+    std::vector<int>    abIgnored;
+    int                 bGeometryIgnored;
+    CPLString           osEncoding;
+
+    std::vector<double> adfRingArea;
+    std::vector<int>    anRingOwner;
+
+/* -------------------------------------------------------------------- */
+/*      Encoding, as the driver works it out.                           */
+/* -------------------------------------------------------------------- */
+    static CPLString    GetEncodingFromCodePage( const char *pszCodePage )
+    {
+        static const struct { int nLDID; const char *pszEncoding; } asLDID[] =
+        {
+            { 1, "CP437" }, { 2, "CP850" }, { 3, "CP1252" },
+            { 0x57, "ISO-8859-1" }, { 0x64, "CP852" }, { 0x65, "CP866" },
+            { 0x4D, "CP936" }, { 0x4E, "CP949" }, { 0x4F, "CP950" },
+            { 0x13, "CP932" }, { 0x7D, "CP1255" }, { 0x7E, "CP1256" },
+            { 0xC8, "CP1250" }, { 0xC9, "CP1251" }, { 0xCA, "CP1254" },
+            { 0xCB, "CP1253" }
+        };
+
+        if( EQUALN( pszCodePage, "LDID/", 5 ) )
+        {
+            const int nLDID = atoi( pszCodePage + 5 );
+            for( size_t i = 0; i < sizeof(asLDID) / sizeof(asLDID[0]); i++ )
+                if( asLDID[i].nLDID == nLDID )
+                    return asLDID[i].pszEncoding;
+            return "";
+        }
+        if( EQUAL( pszCodePage, "UTF-8" ) || EQUAL( pszCodePage, "UTF8" )
+            || atoi( pszCodePage ) == 65001 )
+            return CPL_ENC_UTF8;
+        if( atoi( pszCodePage ) > 0 )
+            return CPLString().Printf( "CP%d", atoi( pszCodePage ) );
+        return pszCodePage;
+    }
+
+    static int          IsASCII( const char *psz, size_t nLen )
+    {
+        for( size_t i = 0; i < nLen; i++ )
+            if( ((const GByte *) psz)[i] >= 0x80 )
+                return FALSE;
+        return TRUE;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Attributes.                                                     */
+/* -------------------------------------------------------------------- */
+    void                ReadField( OGRFeatureBatch *poBatch, int iField,
+                                   const GByte *pabyRecord )
+    {
+        const char *pszRaw = (const char *) pabyRecord + anDBFOffsets[iField];
+        int nWidth = anDBFWidths[iField];
+        char *szValue = &achValue[0];
+
+        /* Value as the shapelib of the driver returns it, trimmed. */
+        const char *pszNul = (const char *) memchr( pszRaw, '\0', nWidth );
+        if( pszNul != NULL )
+            nWidth = (int) (pszNul - pszRaw);
+        while( nWidth > 0 && *pszRaw == ' ' )
+        {
+            pszRaw++;
+            nWidth--;
+        }
+        while( nWidth > 0 && pszRaw[nWidth - 1] == ' ' )
+            nWidth--;
+        memcpy( szValue, pszRaw, nWidth );
+        szValue[nWidth] = '\0';
+
+        switch( achDBFTypes[iField] )
+        {
+          case 'N':
+          case 'F':
+            if( nWidth == 0 || szValue[0] == '*' )
+                return;
+            break;
+          case 'D':
+            if( nWidth == 0 || strncmp( szValue, "00000000", 8 ) == 0 )
+                return;
+            break;
+          case 'L':
+            if( szValue[0] == '?' )
+                return;
+            break;
+          default:
+            if( nWidth == 0 )
+                return;
+            break;
+        }
+
+        switch( aeTypes[iField] )
+        {
+          case OFTInteger:
+          {
+            /* Plain digits, as most files have them, without CPLAtof(). */
+            const char *pszDigit = szValue + (szValue[0] == '-');
+            int nValue = 0;
+            while( *pszDigit >= '0' && *pszDigit <= '9' )
+                nValue = nValue * 10 + (*(pszDigit++) - '0');
+            if( *pszDigit != '\0' || pszDigit - szValue > 9 )
+                nValue = (int) CPLAtof( szValue );
+            else if( szValue[0] == '-' )
+                nValue = -nValue;
+            poBatch->SetInteger( iField, nValue );
+            break;
+          }
+
+          case OFTReal:
+            poBatch->SetReal( iField, CPLAtof( szValue ) );
+            break;
+
+          case OFTDate:
+          {
+            int nYear, nMonth, nDay;
+            if( nWidth >= 10 && szValue[2] == '/' && szValue[5] == '/' )
+            {
+                nMonth = atoi( szValue );
+                nDay = atoi( szValue + 3 );
+                nYear = atoi( szValue + 6 );
+            }
+            else
+            {
+                const int nFullDate = atoi( szValue );
+                nYear = nFullDate / 10000;
+                nMonth = (nFullDate / 100) % 100;
+                nDay = nFullDate % 100;
+            }
+            if( nYear >= 0 && nYear <= 9999 && nMonth >= 0 && nMonth <= 99
+                && nDay >= 0 && nDay <= 99 )
+            {
+                const char szDate[10] = {
+                    (char) ('0' + nYear / 1000), (char) ('0' + nYear / 100 % 10),
+                    (char) ('0' + nYear / 10 % 10), (char) ('0' + nYear % 10),
+                    '/', (char) ('0' + nMonth / 10), (char) ('0' + nMonth % 10),
+                    '/', (char) ('0' + nDay / 10), (char) ('0' + nDay % 10) };
+                poBatch->SetString( iField, szDate, 10 );
+            }
+            else
+            {
+                char szDate[64];
+                const int nLen = sprintf( szDate, "%04d/%02d/%02d",
+                                          nYear, nMonth, nDay );
+                poBatch->SetString( iField, szDate, nLen );
+            }
+            break;
+          }
+
+          default:
+            if( !osEncoding.empty() && !EQUAL( osEncoding, CPL_ENC_UTF8 )
+                && !IsASCII( szValue, nWidth ) )
+            {
+                char *pszUTF8 = CPLRecode( szValue, osEncoding,
+                                           CPL_ENC_UTF8 );
+                poBatch->SetString( iField, pszUTF8, strlen(pszUTF8) );
+                CPLFree( pszUTF8 );
+            }
+            else
+                poBatch->SetString( iField, szValue, nWidth );
+            break;
+        }
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Geometry.                                                       */
+/* -------------------------------------------------------------------- */
+
+    /* Copy nPoints points as WKB coordinates, from the XY array and the */
+    /* optional Z array of a shape. */
+    static GByte       *PutPoints( GByte *p, const GByte *pabyXY,
+                                   const GByte *pabyZ, int nPoints )
+    {
+        if( pabyZ == NULL )
+        {
+            memcpy( p, pabyXY, (size_t) nPoints * 16 );
+            return p + (size_t) nPoints * 16;
+        }
+        for( int i = 0; i < nPoints; i++ )
+        {
+            memcpy( p, pabyXY + (size_t) i * 16, 16 );
+            memcpy( p + 16, pabyZ + (size_t) i * 8, 8 );
+            p += 24;
+        }
+        return p;
+    }
+
+    /* Ring [nStart, nEnd) of a shape, closed if needed. */
+    static GByte       *PutRing( GByte *p, const GByte *pabyXY,
+                                 const GByte *pabyZ, int nStart, int nEnd,
+                                 int bClose )
+    {
+        const int nPoints = nEnd - nStart;
+        p = OGRBatchPutLE32( p, nPoints + (bClose ? 1 : 0) );
+        p = PutPoints( p, pabyXY + (size_t) nStart * 16,
+                       pabyZ ? pabyZ + (size_t) nStart * 8 : NULL, nPoints );
+        if( bClose )
+            p = PutPoints( p, pabyXY + (size_t) nStart * 16,
+                           pabyZ ? pabyZ + (size_t) nStart * 8 : NULL, 1 );
+        return p;
+    }
+
+    static int          IsRingClosed( const GByte *pabyXY, int nStart,
+                                      int nEnd )
+    {
+        return nEnd - nStart >= 2
+            && memcmp( pabyXY + (size_t) nStart * 16,
+                       pabyXY + (size_t) (nEnd - 1) * 16, 16 ) == 0;
+    }
+
+    /* Twice the signed area, positive for counter-clockwise rings. */
+    static double       RingArea( const GByte *pabyXY, int nStart, int nEnd )
+    {
+        double dfSum = 0.0;
+        for( int i = nStart; i < nEnd; i++ )
+        {
+            const int j = i + 1 < nEnd ? i + 1 : nStart;
+            dfSum += OGRBatchGetLEDouble( pabyXY + (size_t) i * 16 )
+                       * OGRBatchGetLEDouble( pabyXY + (size_t) j * 16 + 8 )
+                   - OGRBatchGetLEDouble( pabyXY + (size_t) j * 16 )
+                       * OGRBatchGetLEDouble( pabyXY + (size_t) i * 16 + 8 );
+        }
+        return dfSum;
+    }
+
+    static int          RingContains( const GByte *pabyXY, int nStart,
+                                      int nEnd, double dfX, double dfY )
+    {
+        int bInside = FALSE;
+        for( int i = nStart, j = nEnd - 1; i < nEnd; j = i++ )
+        {
+            const double dfXI = OGRBatchGetLEDouble( pabyXY + (size_t) i * 16 );
+            const double dfYI = OGRBatchGetLEDouble( pabyXY + (size_t) i * 16 + 8 );
+            const double dfXJ = OGRBatchGetLEDouble( pabyXY + (size_t) j * 16 );
+            const double dfYJ = OGRBatchGetLEDouble( pabyXY + (size_t) j * 16 + 8 );
+            if( ((dfYI > dfY) != (dfYJ > dfY))
+                && dfX < (dfXJ - dfXI) * (dfY - dfYI) / (dfYJ - dfYI) + dfXI )
+                bInside = !bInside;
+        }
+        return bInside;
+    }
+
+    void                ReadGeometry( OGRFeatureBatch *poBatch,
+                                      const GByte *p, size_t nLen );
+
+  public:
+                        OGRShapeBatchReader() : nShapeType(0), nRecords(0),
+                                iNextRecord(0), nDBFHeaderLength(0),
+                                nDBFRecordLength(0), bGeometryIgnored(FALSE) {}
+
+    int                 Open( const char *pszSHPFilename );
+
+    int                 GetFieldCount() const { return (int) aeTypes.size(); }
+    /** Type of a field for the driver: OFTInteger, OFTReal, OFTDate or
+     *  OFTString. */
+    OGRFieldType        GetFieldType( int i ) const { return aeTypes[i]; }
+    const char         *GetFieldName( int i ) const { return aosNames[i]; }
+    int                 GetShapeType() const { return nShapeType; }
+
+    void                SetFieldIgnored( int i, int bIgnored )
+                                                { abIgnored[i] = bIgnored; }
+    void                SetGeometryIgnored( int bIgnored )
+                                                { bGeometryIgnored = bIgnored; }
+
+    virtual void        ResetReading() { iNextRecord = 0; }
+    virtual const char *GetReaderName() { return "Shapefile"; }
+    virtual int         ReadBatch( OGRFeatureBatch *poBatch,
+                                   int nMaxFeatures );
+};
+
+/************************************************************************/
+/*                                Open()                                */
+/************************************************************************/
+
+/** Open a shapefile, from the name of its .shp file, with its .shx and
+ *  optional .dbf. */
+
+inline int OGRShapeBatchReader::Open( const char *pszSHPFilename )
+{
+    const CPLString osExt = CPLGetExtension( pszSHPFilename );
+    const int bUpper = osExt.size() && osExt == CPLString(osExt).toupper()
+                       && osExt != CPLString(osExt).tolower();
+
+/* -------------------------------------------------------------------- */
+/*      .shp header and .shx index.                                     */
+/* -------------------------------------------------------------------- */
+    if( !oSHP.Open( pszSHPFilename ) )
+        return FALSE;
+
+    const GByte *pabyHeader = oSHP.Get( 0, 100 );
+    if( pabyHeader == NULL || OGRBatchGetBE32( pabyHeader ) != 9994 )
+        return FALSE;
+    nShapeType = OGRBatchGetLE32( pabyHeader + 32 );
+    if( nShapeType == 31 )
+        return FALSE;
+
+    const CPLString osSHX = CPLResetExtension( pszSHPFilename,
+                                               bUpper ? "SHX" : "shx" );
+    VSILFILE *fpSHX = VSIFOpenL( osSHX, "rb" );
+    if( fpSHX == NULL )
+        return FALSE;
+
+    VSIFSeekL( fpSHX, 0, SEEK_END );
+    const vsi_l_offset nSHXSize = VSIFTellL( fpSHX );
+    if( nSHXSize < 100 || nSHXSize > 100 + (vsi_l_offset) 8 * INT_MAX )
+    {
+        VSIFCloseL( fpSHX );
+        return FALSE;
+    }
+    nRecords = (int) ((nSHXSize - 100) / 8);
+
+    std::vector<GByte> abySHX( (size_t) nRecords * 8 + 1 );
+    VSIFSeekL( fpSHX, 100, SEEK_SET );
+    const size_t nRead = VSIFReadL( &abySHX[0], 8, nRecords, fpSHX );
+    VSIFCloseL( fpSHX );
+    if( nRead != (size_t) nRecords )
+        return FALSE;
+
+    anSHXOffsets.resize( nRecords );
+    anSHXSizes.resize( nRecords );
+    for( int i = 0; i < nRecords; i++ )
+    {
+        /* In 16 bit words, and offset of the 8 byte record header. */
+        anSHXOffsets[i] = (GUInt32) OGRBatchGetBE32( &abySHX[i * 8] ) * 2 + 8;
+        anSHXSizes[i] = (GUInt32) OGRBatchGetBE32( &abySHX[i * 8 + 4] ) * 2;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      .dbf header and fields.                                         */
+/* -------------------------------------------------------------------- */
+    const CPLString osDBF = CPLResetExtension( pszSHPFilename,
+                                               bUpper ? "DBF" : "dbf" );
+    if( oDBF.Open( osDBF ) )
+    {
+        const GByte *pabyDBF = oDBF.Get( 0, 32 );
+        if( pabyDBF == NULL )
+            return FALSE;
+
+        const int nDBFRecords = OGRBatchGetLE32( pabyDBF + 4 );
+        nDBFHeaderLength = pabyDBF[8] | (pabyDBF[9] << 8);
+        nDBFRecordLength = pabyDBF[10] | (pabyDBF[11] << 8);
+        const int nLDID = pabyDBF[29];
+        if( nDBFRecords < nRecords )
+            nRecords = MAX( 0, nDBFRecords );
+
+        pabyDBF = oDBF.Get( 0, nDBFHeaderLength );
+        if( pabyDBF == NULL || nDBFHeaderLength < 32 )
+            return FALSE;
+
+        int nOffset = 1;
+        int nMaxWidth = 0;
+        for( int iOff = 32; iOff + 32 <= nDBFHeaderLength
+                            && pabyDBF[iOff] != 0x0D; iOff += 32 )
+        {
+            const GByte *pabyField = pabyDBF + iOff;
+            char szName[12];
+            memcpy( szName, pabyField, 11 );
+            szName[11] = '\0';
+
+            /* As shapelib: only N and F fields have decimals, the */
+            /* others have a 16 bit width. */
+            const char chType = (char) pabyField[11];
+            const int bNumeric = chType == 'N' || chType == 'F';
+            const int nWidth = bNumeric
+                ? pabyField[16] : pabyField[16] | (pabyField[17] << 8);
+            const int nDecimals = bNumeric ? pabyField[17] : 0;
+            OGRFieldType eType = OFTString;
+            if( bNumeric )
+                eType = (nDecimals == 0 && nWidth < 10) ? OFTInteger : OFTReal;
+            else if( chType == 'D' )
+                eType = OFTDate;
+
+            aosNames.push_back( szName );
+            achDBFTypes.push_back( chType );
+            anDBFOffsets.push_back( nOffset );
+            anDBFWidths.push_back( nWidth );
+            aeTypes.push_back( eType );
+            nOffset += nWidth;
+            nMaxWidth = MAX( nMaxWidth, nWidth );
+        }
+        if( nOffset > nDBFRecordLength )
+            return FALSE;
+        abIgnored.resize( aeTypes.size(), FALSE );
+        achValue.resize( nMaxWidth + 1 );
+
+        const char *pszEncoding = CPLGetConfigOption( "SHAPE_ENCODING", NULL );
+        if( pszEncoding != NULL )
+            osEncoding = pszEncoding;
+        else
+        {
+            const CPLString osCPG = CPLResetExtension(
+                pszSHPFilename, bUpper ? "CPG" : "cpg" );
+            VSILFILE *fpCPG = VSIFOpenL( osCPG, "rb" );
+            if( fpCPG != NULL )
+            {
+                char szCodePage[64];
+                const size_t nLen = VSIFReadL( szCodePage, 1,
+                                               sizeof(szCodePage) - 1, fpCPG );
+                VSIFCloseL( fpCPG );
+                szCodePage[nLen] = '\0';
+                osEncoding = GetEncodingFromCodePage(
+                    CPLString(szCodePage).Trim() );
+            }
+            else if( nLDID != 0 )
+                osEncoding = GetEncodingFromCodePage(
+                    CPLString().Printf( "LDID/%d", nLDID ) );
+        }
+    }
+
+    iNextRecord = 0;
+    return TRUE;
+}
+
+/************************************************************************/
+/*                             ReadBatch()                              */
+/************************************************************************/
+
+inline int OGRShapeBatchReader::ReadBatch( OGRFeatureBatch *poBatch,
+                                           int nMaxFeatures )
+{
+    const int nFields = (int) aeTypes.size();
+    poBatch->Reset( nFields, nFields ? &aeTypes[0] : NULL );
+
+    while( poBatch->GetFeatureCount() < nMaxFeatures
+           && iNextRecord < nRecords )
+    {
+        const int iRecord = iNextRecord++;
+        const GByte *pabyRecord = NULL;
+
+        if( oDBF.IsOpen() )
+        {
+            pabyRecord = oDBF.Get( nDBFHeaderLength
+                            + (vsi_l_offset) iRecord * nDBFRecordLength,
+                                   nDBFRecordLength );
+            if( pabyRecord == NULL )
+            {
+                CPLError( CE_Failure, CPLE_FileIO,
+                          "Cannot read record %d of .dbf file.", iRecord );
+                iNextRecord = nRecords;
+                break;
+            }
+            if( pabyRecord[0] == '*' )
+                continue;
+        }
+
+        poBatch->AddFeature( iRecord );
+
+        for( int iField = 0; iField < nFields; iField++ )
+            if( !abIgnored[iField] )
+                ReadField( poBatch, iField, pabyRecord );
+
+        if( !bGeometryIgnored && anSHXSizes[iRecord] >= 4 )
+        {
+            const GByte *pabyShape = oSHP.Get( anSHXOffsets[iRecord],
+                                               anSHXSizes[iRecord] );
+            if( pabyShape != NULL )
+                ReadGeometry( poBatch, pabyShape, anSHXSizes[iRecord] );
+            else
+                CPLDebug( "OGR", "Cannot read shape %d.", iRecord );
+        }
+
+        poBatch->EndFeature();
+    }
+
+    return poBatch->GetFeatureCount();
+}
+
+/************************************************************************/
+/*                            ReadGeometry()                            */
+/************************************************************************/
+
+/* Append the WKB of the shape p of nLen bytes, or nothing for a null or */
+/* corrupted shape. */
+
+inline void OGRShapeBatchReader::ReadGeometry( OGRFeatureBatch *poBatch,
+                                               const GByte *p, size_t nLen )
+{
+    const int nType = OGRBatchGetLE32( p );
+    const int bZ = nType == 11 || nType == 13 || nType == 15 || nType == 18;
+    const GUInt32 nZFlag = bZ ? wkb25DBit : 0;
+    const size_t nCoordSize = bZ ? 24 : 16;
+
+/* -------------------------------------------------------------------- */
+/*      Point.                                                          */
+/* -------------------------------------------------------------------- */
+    if( nType == 1 || nType == 11 || nType == 21 )
+    {
+        if( nLen < 20 )
+            return;
+        GByte *pabyWKB = poBatch->AllocGeometry( 5 + nCoordSize );
+        pabyWKB = OGRBatchPutWKBHeader( pabyWKB, wkbPoint | nZFlag );
+        memcpy( pabyWKB, p + 4, 16 );
+        if( bZ )
+        {
+            if( nLen >= 28 )
+                memcpy( pabyWKB + 16, p + 20, 8 );
+            else
+                memset( pabyWKB + 16, 0, 8 );
+        }
+        return;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      MultiPoint.                                                     */
+/* -------------------------------------------------------------------- */
+    if( nType == 8 || nType == 18 || nType == 28 )
+    {
+        if( nLen < 40 )
+            return;
+        const int nPoints = OGRBatchGetLE32( p + 36 );
+        if( nPoints < 0 || (GUIntBig) nPoints * 16 > nLen - 40 )
+            return;
+        const GByte *pabyXY = p + 40;
+        const GByte *pabyZ = NULL;
+        if( bZ )
+        {
+            if( 40 + (GUIntBig) nPoints * 24 + 16 > nLen )
+                return;
+            pabyZ = pabyXY + (size_t) nPoints * 16 + 16;
+        }
+
+        GByte *pabyWKB = poBatch->AllocGeometry(
+            9 + (size_t) nPoints * (5 + nCoordSize) );
+        pabyWKB = OGRBatchPutWKBHeader( pabyWKB, wkbMultiPoint | nZFlag );
+        pabyWKB = OGRBatchPutLE32( pabyWKB, nPoints );
+        for( int i = 0; i < nPoints; i++ )
+        {
+            pabyWKB = OGRBatchPutWKBHeader( pabyWKB, wkbPoint | nZFlag );
+            pabyWKB = PutPoints( pabyWKB, pabyXY + (size_t) i * 16,
+                                 pabyZ ? pabyZ + (size_t) i * 8 : NULL, 1 );
+        }
+        return;
+    }
+
+    const int bArc = nType == 3 || nType == 13 || nType == 23;
+    const int bPolygon = nType == 5 || nType == 15 || nType == 25;
+    if( (!bArc && !bPolygon) || nLen < 44 )
+        return;
+
+/* -------------------------------------------------------------------- */
+/*      Parts of arcs and polygons.                                     */
+/* -------------------------------------------------------------------- */
+    const int nParts = OGRBatchGetLE32( p + 36 );
+    const int nPoints = OGRBatchGetLE32( p + 40 );
+    if( nParts <= 0 || nPoints <= 0
+        || 44 + (GUIntBig) nParts * 4 + (GUIntBig) nPoints * 16 > nLen )
+        return;
+
+    const GByte *pabyParts = p + 44;
+    const GByte *pabyXY = pabyParts + (size_t) nParts * 4;
+    const GByte *pabyZ = NULL;
+    if( bZ )
+    {
+        if( 44 + (GUIntBig) nParts * 4 + (GUIntBig) nPoints * 24 + 16 > nLen )
+            return;
+        pabyZ = pabyXY + (size_t) nPoints * 16 + 16;
+    }
+
+    std::vector<int> anStart( nParts + 1 );
+    for( int i = 0; i < nParts; i++ )
+    {
+        anStart[i] = OGRBatchGetLE32( pabyParts + i * 4 );
+        if( anStart[i] < 0 || anStart[i] >= nPoints
+            || (i > 0 && anStart[i] < anStart[i - 1]) )
+            return;
+    }
+    anStart[nParts] = nPoints;
+
+    if( bArc )
+    {
+        if( nParts == 1 )
+        {
+            GByte *pabyWKB = poBatch->AllocGeometry(
+                9 + (size_t) nPoints * nCoordSize );
+            pabyWKB = OGRBatchPutWKBHeader( pabyWKB, wkbLineString | nZFlag );
+            PutRing( pabyWKB, pabyXY, pabyZ, 0, nPoints, FALSE );
+            return;
+        }
+
+        GByte *pabyWKB = poBatch->AllocGeometry(
+            9 + (size_t) nParts * 9 + (size_t) nPoints * nCoordSize );
+        pabyWKB = OGRBatchPutWKBHeader( pabyWKB,
+                                        wkbMultiLineString | nZFlag );
+        pabyWKB = OGRBatchPutLE32( pabyWKB, nParts );
+        for( int i = 0; i < nParts; i++ )
+        {
+            pabyWKB = OGRBatchPutWKBHeader( pabyWKB, wkbLineString | nZFlag );
+            pabyWKB = PutRing( pabyWKB, pabyXY, pabyZ,
+                               anStart[i], anStart[i + 1], FALSE );
+        }
+        return;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Polygons: clockwise rings are outer rings, and each counter     */
+/*      clockwise ring is a hole of the smallest outer ring containing  */
+/*      it, or an outer ring if there is none.                          */
+/* -------------------------------------------------------------------- */
+    adfRingArea.resize( nParts );
+    anRingOwner.resize( nParts );
+    size_t nRingPoints = 0;
+    int nPolygons = 0;
+
+    for( int i = 0; i < nParts; i++ )
+    {
+        adfRingArea[i] = nParts > 1
+            ? RingArea( pabyXY, anStart[i], anStart[i + 1] ) : 0.0;
+        anRingOwner[i] = adfRingArea[i] <= 0.0 ? i : -1;
+        nRingPoints += anStart[i + 1] - anStart[i]
+            + (IsRingClosed( pabyXY, anStart[i], anStart[i + 1] ) ? 0 : 1);
+    }
+
+    for( int i = 0; i < nParts; i++ )
+    {
+        if( anRingOwner[i] == i )
+        {
+            nPolygons++;
+            continue;
+        }
+
+        const double dfX = OGRBatchGetLEDouble( pabyXY + (size_t) anStart[i] * 16 );
+        const double dfY = OGRBatchGetLEDouble( pabyXY + (size_t) anStart[i] * 16 + 8 );
+        int iBest = -1;
+        for( int j = 0; j < nParts; j++ )
+        {
+            if( anRingOwner[j] != j
+                || (iBest >= 0 && adfRingArea[j] <= adfRingArea[iBest]) )
+                continue;
+            if( RingContains( pabyXY, anStart[j], anStart[j + 1], dfX, dfY ) )
+                iBest = j;
+        }
+        if( iBest < 0 )
+        {
+            anRingOwner[i] = i;
+            nPolygons++;
+        }
+        else
+            anRingOwner[i] = iBest;
+    }
+
+    const size_t nSize = (nPolygons > 1 ? 9 : 0) + (size_t) nPolygons * 9
+        + (size_t) nParts * 4 + nRingPoints * nCoordSize;
+    GByte *pabyWKB = poBatch->AllocGeometry( nSize );
+    if( nPolygons > 1 )
+    {
+        pabyWKB = OGRBatchPutWKBHeader( pabyWKB, wkbMultiPolygon | nZFlag );
+        pabyWKB = OGRBatchPutLE32( pabyWKB, nPolygons );
+    }
+
+    for( int i = 0; i < nParts; i++ )
+    {
+        if( anRingOwner[i] != i )
+            continue;
+
+        int nRings = 0;
+        for( int j = 0; j < nParts; j++ )
+            if( anRingOwner[j] == i )
+                nRings++;
+
+        pabyWKB = OGRBatchPutWKBHeader( pabyWKB, wkbPolygon | nZFlag );
+        pabyWKB = OGRBatchPutLE32( pabyWKB, nRings );
+        for( int k = -1; k < nParts; k++ )
+        {
+            /* The outer ring, then its holes. */
+            const int j = k < 0 ? i : k;
+            if( anRingOwner[j] != i || (k >= 0 && j == i) )
+                continue;
+            pabyWKB = PutRing( pabyWKB, pabyXY, pabyZ, anStart[j],
+                               anStart[j + 1],
+                               !IsRingClosed( pabyXY, anStart[j],
+                                              anStart[j + 1] ) );
+        }
+    }
+}
+
+/************************************************************************/
+/*                       OGRBatchLayerFilterAccess                      */
+/************************************************************************/
+
+/* Reads whether a layer has an attribute filter, which OGRLayer keeps */
+/* in a protected member. */
+
+class OGRBatchLayerFilterAccess : public OGRLayer
+{
+  public:
+    static int HasAttributeFilter( OGRLayer *poLayer )
+    {
+        OGRFeatureQuery *OGRLayer::*pmAttrQuery =
+            &OGRBatchLayerFilterAccess::m_poAttrQuery;
+        return (poLayer->*pmAttrQuery) != NULL;
+    }
+};
+
+/************************************************************************/
+/*                      OGRCreateLayerBatchReader()                     */
+/************************************************************************/
+
+/**
+ * Create the batch reader of a layer.
+ *
+ * Layers of the ESRI Shapefile driver without attribute or spatial
+ * filter, whose fields match those of the .dbf file, are read by an
+ * OGRShapeBatchReader, honouring the ignored fields of the layer, and
+ * others by an OGRGenericBatchReader.
+ *
+ * Options:
+ * <ul>
+ * <li>NATIVE=YES/NO: whether a native reader may be used.  Defaults to
+ * YES.</li>
+ * </ul>
+ *
+ * @param poDS the data source of the layer.
+ * @param poLayer the layer.
+ * @param papszOptions NULL terminated list of options, or NULL.
+ *
+ * @return a new reader, to delete after use and before the data source
+ * is closed.
+ */
+
+static inline OGRLayerBatchReader *
+OGRCreateLayerBatchReader( OGRDataSource *poDS, OGRLayer *poLayer,
+                           char **papszOptions = NULL )
+{
+    if( !CSLTestBoolean( CSLFetchNameValueDef( papszOptions, "NATIVE",
+                                               "YES" ) )
+        || poDS == NULL || poDS->GetDriver() == NULL
+        || !EQUAL( poDS->GetDriver()->GetName(), "ESRI Shapefile" )
+        || poLayer->GetSpatialFilter() != NULL
+        || OGRBatchLayerFilterAccess::HasAttributeFilter( poLayer ) )
+        return new OGRGenericBatchReader( poLayer );
+
+/* -------------------------------------------------------------------- */
+/*      The data source is either the .shp file, or a directory.        */
+/* -------------------------------------------------------------------- */
+    CPLString osSHP = poDS->GetName();
+    if( !EQUAL( CPLGetExtension( osSHP ), "shp" ) )
+    {
+        osSHP = CPLFormFilename( poDS->GetName(), poLayer->GetName(), "shp" );
+        VSIStatBufL sStat;
+        if( VSIStatL( osSHP, &sStat ) != 0 )
+            osSHP = CPLFormFilename( poDS->GetName(), poLayer->GetName(),
+                                     "SHP" );
+    }
+    else if( !EQUAL( CPLGetBasename( osSHP ), poLayer->GetName() ) )
+        return new OGRGenericBatchReader( poLayer );
+
+    OGRShapeBatchReader *poReader = new OGRShapeBatchReader();
+    OGRFeatureDefn *poDefn = poLayer->GetLayerDefn();
+    int bMatch = poReader->Open( osSHP )
+        && poReader->GetFieldCount() == poDefn->GetFieldCount();
+
+    for( int i = 0; bMatch && i < poDefn->GetFieldCount(); i++ )
+    {
+        OGRFieldDefn *poFieldDefn = poDefn->GetFieldDefn( i );
+        bMatch = poFieldDefn->GetType() == poReader->GetFieldType( i );
+        poReader->SetFieldIgnored( i, poFieldDefn->IsIgnored() );
+    }
+
+    if( !bMatch )
+    {
+        delete poReader;
+        return new OGRGenericBatchReader( poLayer );
+    }
+
+    poReader->SetGeometryIgnored( poDefn->IsGeometryIgnored() );
+    return poReader;
+}
+
+#endif /* ndef _OGR_BATCH_H_INCLUDED */
@@ -0,0 +1,969 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  OpenGIS Simple Features Reference Implementation
+ * Purpose:  Read-only views of WKB geometries, without decoding.
+ *
+ ******************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef _OGR_WKB_VIEW_H_INCLUDED
+#define _OGR_WKB_VIEW_H_INCLUDED
+
+#include "ogr_core.h"
+#include <math.h>
+#include <string.h>
+
+/**
+ * \file ogr_wkb_view.h
+ *
+ * OGRWKBGeometryView gives read access to a geometry encoded as WKB, in
+ * place: the buffer is walked on each call, and nothing is allocated or
+ * copied.  It is meant for read-mostly processing of WKB coming from a
+ * data source or an OGRFeatureBatch, where OGRGeometryFactory::
+ * createFromWkb() would build an OGRGeometry object graph just to compute
+ * an envelope, a length or a predicate.
+ *
+ * Both byte orders are read, with the Z flag of either the 99-402
+ * (wkb25DBit) or the ISO (+1000) convention.  ISO M and ZM coordinates
+ * are accepted, and their M values ignored.  Points, line strings,
+ * polygons, and their multi and collection types are supported.
+ *
+ * The methods follow those of the OGRGeometry classes of the same
+ * names.  The predicates are computed on the X and Y coordinates in
+ * double precision, without the robustness of GEOS for nearly
+ * degenerate cases.
+ */
+
+#define OGR_WKB_VIEW_MAX_DEPTH  32
+
+class OGRWKBGeometryView;
+
+/* -------------------------------------------------------------------- */
+/*      Decoding helpers.                                               */
+/* -------------------------------------------------------------------- */
+static inline GUInt32 OGRWKBViewReadUInt32( const GByte *p, int bSwap )
+{
+    GUInt32 nVal;
+    memcpy( &nVal, p, 4 );
+    if( bSwap )
+        CPL_SWAP32PTR( &nVal );
+    return nVal;
+}
+
+static inline double OGRWKBViewReadDouble( const GByte *p, int bSwap )
+{
+    double dfVal;
+    memcpy( &dfVal, p, 8 );
+    if( bSwap )
+        CPL_SWAP64PTR( &dfVal );
+    return dfVal;
+}
+
+/* Sequence of points: those of a line string or ring, or a single point. */
+
+typedef struct
+{
+    const GByte *pabyCoords;
+    int          nPoints;
+    int          nCoordSize;     /* Bytes per point. */
+    int          bSwap;
+} OGRWKBViewPath;
+
+static inline double OGRWKBViewPathX( const OGRWKBViewPath &sPath, int i )
+{
+    return OGRWKBViewReadDouble( sPath.pabyCoords
+                                 + (size_t) i * sPath.nCoordSize, sPath.bSwap );
+}
+
+static inline double OGRWKBViewPathY( const OGRWKBViewPath &sPath, int i )
+{
+    return OGRWKBViewReadDouble( sPath.pabyCoords
+                                 + (size_t) i * sPath.nCoordSize + 8,
+                                 sPath.bSwap );
+}
+
+/************************************************************************/
+/*                          OGRWKBGeometryView                          */
+/************************************************************************/
+
+/**
+ * Read-only view of a WKB geometry.
+ *
+ * The constructor checks the structure of the whole buffer: if IsValid()
+ * returns FALSE, no other method may be called.  The buffer must stay
+ * unchanged while the view, or the views obtained from it, are used.
+ *
+ * The rings of a polygon are views without WKB header, of type
+ * wkbLinearRing.
+ */
+
+class OGRWKBGeometryView
+{
+    const GByte        *pabyData;
+    size_t              nSize;          /* WKB size of the geometry. */
+    GUInt32             nFlatType;      /* 0 if invalid. */
+    int                 bSwap;
+    int                 nDim;           /* Coordinates per point, 2 to 4. */
+    int                 bHasZ;
+
+    /* A ring, of nDim coordinates, at pabyDataIn. */
+    OGRWKBGeometryView( const GByte *pabyDataIn, size_t nSizeIn,
+                        int bSwapIn, int nDimIn, int bHasZIn ) :
+        pabyData(pabyDataIn), nSize(nSizeIn), nFlatType(wkbLinearRing),
+        bSwap(bSwapIn), nDim(nDimIn), bHasZ(bHasZIn) {}
+
+/* -------------------------------------------------------------------- */
+/*      Structure.                                                      */
+/* -------------------------------------------------------------------- */
+
+    /* Read the header at p, of nAvail bytes.  Returns FALSE if invalid. */
+    static int          ReadHeader( const GByte *p, size_t nAvail,
+                                    int *pbSwap, GUInt32 *pnFlatType,
+                                    int *pnDim, int *pbHasZ )
+    {
+        if( nAvail < 5 || p[0] > 1 )
+            return FALSE;
+        *pbSwap = (p[0] == wkbNDR) != CPL_IS_LSB;
+
+        GUInt32 nType = OGRWKBViewReadUInt32( p + 1, *pbSwap );
+        *pbHasZ = (nType & wkb25DBit) != 0;
+        nType &= ~wkb25DBit;
+        *pnDim = 2;
+        if( nType >= 1000 && nType < 4000 )
+        {
+            const int nIsoDim = nType / 1000;
+            *pbHasZ = nIsoDim != 2;
+            *pnDim = nIsoDim == 3 ? 4 : 3;
+            nType %= 1000;
+        }
+        else if( *pbHasZ )
+            *pnDim = 3;
+
+        *pnFlatType = nType;
+        return nType >= wkbPoint && nType <= wkbGeometryCollection;
+    }
+
+    /* Size of the point array of nPoints points at p, or 0 if it does */
+    /* not fit in nAvail bytes. */
+    static size_t       PointArraySize( const GByte *p, size_t nAvail,
+                                        int bSwap, int nDimIn )
+    {
+        if( nAvail < 4 )
+            return 0;
+        const GUInt32 nPoints = OGRWKBViewReadUInt32( p, bSwap );
+        if( nPoints > (nAvail - 4) / (8 * nDimIn) )
+            return 0;
+        return 4 + (size_t) nPoints * 8 * nDimIn;
+    }
+
+    /* Size of the geometry at p, or 0 if invalid. */
+    static size_t       GeometrySize( const GByte *p, size_t nAvail,
+                                      int nDepth )
+    {
+        int bSwapG, nDimG, bHasZG;
+        GUInt32 nType;
+
+        if( nDepth > OGR_WKB_VIEW_MAX_DEPTH
+            || !ReadHeader( p, nAvail, &bSwapG, &nType, &nDimG, &bHasZG ) )
+            return 0;
+
+        size_t nOffset = 5;
+        if( nType == wkbPoint )
+            return nAvail >= 5 + 8 * (size_t) nDimG ? 5 + 8 * nDimG : 0;
+        if( nType == wkbLineString )
+        {
+            const size_t nArray = PointArraySize( p + 5, nAvail - 5,
+                                                  bSwapG, nDimG );
+            return nArray ? 5 + nArray : 0;
+        }
+
+        if( nAvail < 9 )
+            return 0;
+        const GUInt32 nParts = OGRWKBViewReadUInt32( p + 5, bSwapG );
+        nOffset = 9;
+        if( nParts > (nAvail - 9) / 4 )
+            return 0;
+
+        for( GUInt32 i = 0; i < nParts; i++ )
+        {
+            size_t nPart;
+            if( nType == wkbPolygon )
+                nPart = PointArraySize( p + nOffset, nAvail - nOffset,
+                                        bSwapG, nDimG );
+            else
+            {
+                nPart = GeometrySize( p + nOffset, nAvail - nOffset,
+                                      nDepth + 1 );
+                if( nPart != 0 && !IsValidMember( nType, p + nOffset ) )
+                    nPart = 0;
+            }
+            if( nPart == 0 )
+                return 0;
+            nOffset += nPart;
+        }
+        return nOffset;
+    }
+
+    static int          IsValidMember( GUInt32 nType, const GByte *p )
+    {
+        int bSwapM, nDimM, bHasZM;
+        GUInt32 nMember;
+        ReadHeader( p, 5, &bSwapM, &nMember, &nDimM, &bHasZM );
+        return nType == wkbGeometryCollection
+            || (nType == wkbMultiPoint && nMember == wkbPoint)
+            || (nType == wkbMultiLineString && nMember == wkbLineString)
+            || (nType == wkbMultiPolygon && nMember == wkbPolygon);
+    }
+
+    /* Offset of the first part of a polygon or collection. */
+    const GByte        *GetFirstPart() const { return pabyData + 9; }
+
+    OGRWKBGeometryView  GetSubGeometry( const GByte *p ) const
+    {
+        return OGRWKBGeometryView( p, GeometrySize( p, pabyData + nSize - p,
+                                                    0 ) );
+    }
+
+    OGRWKBGeometryView  GetRing( const GByte *p ) const
+    {
+        return OGRWKBGeometryView( p, PointArraySize( p, pabyData + nSize - p,
+                                                      bSwap, nDim ),
+                                   bSwap, nDim, bHasZ );
+    }
+
+    /* Number of rings of a polygon, or of members of a collection. */
+    int                 GetNumParts() const
+    {
+        if( nFlatType < wkbPolygon || nFlatType == wkbLinearRing )
+            return 0;
+        return (int) OGRWKBViewReadUInt32( pabyData + 5, bSwap );
+    }
+
+    /* Ring or member at *pp, moving *pp past it. */
+    OGRWKBGeometryView  GetNextPart( const GByte **pp ) const
+    {
+        const OGRWKBGeometryView oPart = nFlatType == wkbPolygon
+            ? GetRing( *pp ) : GetSubGeometry( *pp );
+        *pp += oPart.nSize;
+        return oPart;
+    }
+
+    /* Points of a point, line string or ring. */
+    OGRWKBViewPath      GetPath() const
+    {
+        OGRWKBViewPath sPath;
+        sPath.nCoordSize = 8 * nDim;
+        sPath.bSwap = bSwap;
+        if( nFlatType == wkbPoint )
+        {
+            sPath.pabyCoords = pabyData + 5;
+            sPath.nPoints = IsEmpty() ? 0 : 1;
+        }
+        else
+        {
+            const GByte *p = nFlatType == wkbLinearRing ? pabyData
+                                                        : pabyData + 5;
+            sPath.pabyCoords = p + 4;
+            sPath.nPoints = (int) OGRWKBViewReadUInt32( p, bSwap );
+        }
+        return sPath;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Predicates.                                                     */
+/* -------------------------------------------------------------------- */
+    static int          Orientation( double dfAX, double dfAY,
+                                     double dfBX, double dfBY,
+                                     double dfCX, double dfCY )
+    {
+        const double dfCross = (dfBX - dfAX) * (dfCY - dfAY)
+                             - (dfBY - dfAY) * (dfCX - dfAX);
+        return dfCross > 0 ? 1 : dfCross < 0 ? -1 : 0;
+    }
+
+    /* Whether C, collinear with AB, lies within its bounding box. */
+    static int          OnSegment( double dfAX, double dfAY,
+                                   double dfBX, double dfBY,
+                                   double dfCX, double dfCY )
+    {
+        const double dfMinX = MIN( dfAX, dfBX );
+        const double dfMaxX = MAX( dfAX, dfBX );
+        const double dfMinY = MIN( dfAY, dfBY );
+        const double dfMaxY = MAX( dfAY, dfBY );
+        return dfCX >= dfMinX && dfCX <= dfMaxX
+            && dfCY >= dfMinY && dfCY <= dfMaxY;
+    }
+
+    static int          SegmentsIntersect( double dfAX, double dfAY,
+                                           double dfBX, double dfBY,
+                                           double dfCX, double dfCY,
+                                           double dfDX, double dfDY )
+    {
+        const int o1 = Orientation( dfAX, dfAY, dfBX, dfBY, dfCX, dfCY );
+        const int o2 = Orientation( dfAX, dfAY, dfBX, dfBY, dfDX, dfDY );
+        const int o3 = Orientation( dfCX, dfCY, dfDX, dfDY, dfAX, dfAY );
+        const int o4 = Orientation( dfCX, dfCY, dfDX, dfDY, dfBX, dfBY );
+
+        if( o1 != o2 && o3 != o4 )
+            return TRUE;
+        return (o1 == 0 && OnSegment( dfAX, dfAY, dfBX, dfBY, dfCX, dfCY ))
+            || (o2 == 0 && OnSegment( dfAX, dfAY, dfBX, dfBY, dfDX, dfDY ))
+            || (o3 == 0 && OnSegment( dfCX, dfCY, dfDX, dfDY, dfAX, dfAY ))
+            || (o4 == 0 && OnSegment( dfCX, dfCY, dfDX, dfDY, dfBX, dfBY ));
+    }
+
+    /* Whether two paths have a common point: segments crossing or */
+    /* touching, or single points on the other path. */
+    static int          PathsIntersect( const OGRWKBViewPath &sA,
+                                        const OGRWKBViewPath &sB )
+    {
+        const int nSegA = MAX( sA.nPoints - 1, 1 );
+        const int nSegB = MAX( sB.nPoints - 1, 1 );
+        if( sA.nPoints == 0 || sB.nPoints == 0 )
+            return FALSE;
+
+        for( int i = 0; i < nSegA; i++ )
+        {
+            const int i2 = sA.nPoints > 1 ? i + 1 : i;
+            const double dfAX = OGRWKBViewPathX( sA, i );
+            const double dfAY = OGRWKBViewPathY( sA, i );
+            const double dfBX = OGRWKBViewPathX( sA, i2 );
+            const double dfBY = OGRWKBViewPathY( sA, i2 );
+            const double dfMinX = MIN( dfAX, dfBX );
+            const double dfMaxX = MAX( dfAX, dfBX );
+            const double dfMinY = MIN( dfAY, dfBY );
+            const double dfMaxY = MAX( dfAY, dfBY );
+
+            for( int j = 0; j < nSegB; j++ )
+            {
+                const int j2 = sB.nPoints > 1 ? j + 1 : j;
+                const double dfCX = OGRWKBViewPathX( sB, j );
+                const double dfCY = OGRWKBViewPathY( sB, j );
+                const double dfDX = OGRWKBViewPathX( sB, j2 );
+                const double dfDY = OGRWKBViewPathY( sB, j2 );
+
+                if( (dfCX < dfMinX && dfDX < dfMinX)
+                    || (dfCX > dfMaxX && dfDX > dfMaxX)
+                    || (dfCY < dfMinY && dfDY < dfMinY)
+                    || (dfCY > dfMaxY && dfDY > dfMaxY) )
+                    continue;
+                if( SegmentsIntersect( dfAX, dfAY, dfBX, dfBY,
+                                       dfCX, dfCY, dfDX, dfDY ) )
+                    return TRUE;
+            }
+        }
+        return FALSE;
+    }
+
+    /* Crossing number of a ray from (dfX, dfY) to +X with a ring. */
+    static int          RingCrossings( const OGRWKBViewPath &sRing,
+                                       double dfX, double dfY )
+    {
+        int nCrossings = 0;
+        if( sRing.nPoints == 0 )
+            return 0;
+
+        double dfXJ = OGRWKBViewPathX( sRing, sRing.nPoints - 1 );
+        double dfYJ = OGRWKBViewPathY( sRing, sRing.nPoints - 1 );
+        for( int i = 0; i < sRing.nPoints; i++ )
+        {
+            const double dfXI = OGRWKBViewPathX( sRing, i );
+            const double dfYI = OGRWKBViewPathY( sRing, i );
+            if( ((dfYI > dfY) != (dfYJ > dfY))
+                && dfX < (dfXJ - dfXI) * (dfY - dfYI) / (dfYJ - dfYI) + dfXI )
+                nCrossings++;
+            dfXJ = dfXI;
+            dfYJ = dfYI;
+        }
+        return nCrossings;
+    }
+
+    /* Whether (dfX, dfY) is in the interior of a polygon view, by the */
+    /* even-odd rule over all its rings. */
+    int                 PolygonContains( double dfX, double dfY ) const
+    {
+        int nCrossings = 0;
+        const GByte *p = GetFirstPart();
+        for( int i = 0; i < GetNumParts(); i++ )
+            nCrossings += RingCrossings( GetNextPart( &p ).GetPath(),
+                                         dfX, dfY );
+        return (nCrossings % 2) == 1;
+    }
+
+    /* Whether the boundaries or points of two points, line strings or */
+    /* polygons have a common point. */
+    static int          BoundariesIntersect( const OGRWKBGeometryView &oA,
+                                             const OGRWKBGeometryView &oB )
+    {
+        const int nPathsA = oA.nFlatType == wkbPolygon
+            ? oA.GetNumParts() : 1;
+        const int nPathsB = oB.nFlatType == wkbPolygon
+            ? oB.GetNumParts() : 1;
+
+        const GByte *pA = oA.GetFirstPart();
+        for( int i = 0; i < nPathsA; i++ )
+        {
+            const OGRWKBViewPath sA = oA.nFlatType == wkbPolygon
+                ? oA.GetNextPart( &pA ).GetPath() : oA.GetPath();
+            const GByte *pB = oB.GetFirstPart();
+            for( int j = 0; j < nPathsB; j++ )
+            {
+                const OGRWKBViewPath sB = oB.nFlatType == wkbPolygon
+                    ? oB.GetNextPart( &pB ).GetPath() : oB.GetPath();
+                if( PathsIntersect( sA, sB ) )
+                    return TRUE;
+            }
+        }
+        return FALSE;
+    }
+
+    /* First point of a point, line string or polygon. */
+    int                 GetFirstPoint( double *pdfX, double *pdfY ) const
+    {
+        const OGRWKBViewPath sPath = nFlatType == wkbPolygon
+            ? getExteriorRing().GetPath() : GetPath();
+        if( sPath.nPoints == 0 )
+            return FALSE;
+        *pdfX = OGRWKBViewPathX( sPath, 0 );
+        *pdfY = OGRWKBViewPathY( sPath, 0 );
+        return TRUE;
+    }
+
+    /* Intersection of two points, line strings or polygons. */
+    static int          SimpleIntersects( const OGRWKBGeometryView &oA,
+                                          const OGRWKBGeometryView &oB )
+    {
+        OGREnvelope sEnvA, sEnvB;
+        oA.getEnvelope( &sEnvA );
+        oB.getEnvelope( &sEnvB );
+        if( oA.IsEmpty() || oB.IsEmpty() || !sEnvA.Intersects( sEnvB ) )
+            return FALSE;
+
+        if( BoundariesIntersect( oA, oB ) )
+            return TRUE;
+
+        /* No common boundary point: one is inside the other, or they */
+        /* are disjoint. */
+        double dfX, dfY;
+        if( oB.nFlatType == wkbPolygon && oA.GetFirstPoint( &dfX, &dfY )
+            && oB.PolygonContains( dfX, dfY ) )
+            return TRUE;
+        if( oA.nFlatType == wkbPolygon && oB.GetFirstPoint( &dfX, &dfY )
+            && oA.PolygonContains( dfX, dfY ) )
+            return TRUE;
+        return FALSE;
+    }
+
+    /* Intersection of oA, simple, with any member of oB. */
+    static int          IntersectsAny( const OGRWKBGeometryView &oA,
+                                       const OGRWKBGeometryView &oB )
+    {
+        if( oB.nFlatType <= wkbPolygon || oB.nFlatType == wkbLinearRing )
+            return SimpleIntersects( oA, oB );
+
+        const GByte *p = oB.GetFirstPart();
+        for( int i = 0; i < oB.GetNumParts(); i++ )
+            if( IntersectsAny( oA, oB.GetNextPart( &p ) ) )
+                return TRUE;
+        return FALSE;
+    }
+
+    static double       RingArea( const OGRWKBViewPath &sRing )
+    {
+        if( sRing.nPoints < 2 )
+            return 0.0;
+
+        /* Shoelace formula, the ring being implicitly closed. */
+        double dfSum = 0.0;
+        double dfPrevX = OGRWKBViewPathX( sRing, sRing.nPoints - 1 );
+        double dfPrevY = OGRWKBViewPathY( sRing, sRing.nPoints - 1 );
+        for( int i = 0; i < sRing.nPoints; i++ )
+        {
+            const double dfX = OGRWKBViewPathX( sRing, i );
+            const double dfY = OGRWKBViewPathY( sRing, i );
+            dfSum += dfPrevX * dfY - dfX * dfPrevY;
+            dfPrevX = dfX;
+            dfPrevY = dfY;
+        }
+        return fabs( dfSum * 0.5 );
+    }
+
+  public:
+    /**
+     * View of the WKB geometry at pabyWKB.
+     *
+     * @param pabyWKB the WKB geometry.
+     * @param nBytes the number of bytes available at pabyWKB, which may be
+     * more than the size of the geometry.
+     */
+    OGRWKBGeometryView( const GByte *pabyWKB, size_t nBytes ) :
+        pabyData(pabyWKB), nSize(0), nFlatType(0), bSwap(FALSE), nDim(2),
+        bHasZ(FALSE)
+    {
+        nSize = pabyWKB != NULL ? GeometrySize( pabyWKB, nBytes, 0 ) : 0;
+        if( nSize == 0 || !ReadHeader( pabyWKB, nBytes, &bSwap, &nFlatType,
+                                       &nDim, &bHasZ ) )
+        {
+            nSize = 0;
+            nFlatType = 0;
+        }
+    }
+
+    /** Whether the buffer holds a valid geometry. */
+    int                 IsValid() const { return nFlatType != 0; }
+
+    /** Number of bytes of the geometry in the buffer. */
+    size_t              WkbSize() const { return nSize; }
+    const GByte        *GetData() const { return pabyData; }
+
+    /** Type, with wkb25DBit if the geometry has Z coordinates. */
+    OGRwkbGeometryType  getGeometryType() const
+    {
+        return (OGRwkbGeometryType) (bHasZ ? (nFlatType | wkb25DBit)
+                                           : nFlatType);
+    }
+
+    int                 getCoordinateDimension() const
+                                                { return bHasZ ? 3 : 2; }
+
+    /** Whether there are no points (an empty point has NaN coordinates). */
+    int                 IsEmpty() const
+    {
+        if( nFlatType == wkbPoint )
+        {
+            const double dfX = OGRWKBViewReadDouble( pabyData + 5, bSwap );
+            return CPLIsNan( dfX );
+        }
+        if( nFlatType == wkbLineString || nFlatType == wkbLinearRing )
+            return getNumPoints() == 0;
+        if( nFlatType == wkbPolygon )
+            return GetNumParts() == 0 || getExteriorRing().IsEmpty();
+
+        const GByte *p = GetFirstPart();
+        for( int i = 0; i < GetNumParts(); i++ )
+            if( !GetNextPart( &p ).IsEmpty() )
+                return FALSE;
+        return TRUE;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Points, line strings and rings.                                 */
+/* -------------------------------------------------------------------- */
+    int                 getNumPoints() const
+    {
+        if( nFlatType == wkbPoint )
+            return 1;
+        if( nFlatType != wkbLineString && nFlatType != wkbLinearRing )
+            return 0;
+        return (int) OGRWKBViewReadUInt32(
+            nFlatType == wkbLinearRing ? pabyData : pabyData + 5, bSwap );
+    }
+
+    double              getX( int i = 0 ) const
+                                    { return OGRWKBViewPathX( GetPath(), i ); }
+    double              getY( int i = 0 ) const
+                                    { return OGRWKBViewPathY( GetPath(), i ); }
+    double              getZ( int i = 0 ) const
+    {
+        if( !bHasZ )
+            return 0.0;
+        const OGRWKBViewPath sPath = GetPath();
+        return OGRWKBViewReadDouble( sPath.pabyCoords
+                                     + (size_t) i * sPath.nCoordSize + 16,
+                                     bSwap );
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Polygons.                                                       */
+/* -------------------------------------------------------------------- */
+    /** Number of interior rings, -1 if the polygon has no ring at all. */
+    int                 getNumInteriorRings() const
+    {
+        if( nFlatType != wkbPolygon )
+            return 0;
+        return (int) OGRWKBViewReadUInt32( pabyData + 5, bSwap ) - 1;
+    }
+
+    OGRWKBGeometryView  getExteriorRing() const
+                                            { return GetRing( GetFirstPart() ); }
+
+    OGRWKBGeometryView  getInteriorRing( int iRing ) const
+    {
+        const GByte *p = GetFirstPart();
+        const size_t nCoordSize = 8 * nDim;
+        for( int i = 0; i <= iRing; i++ )
+            p += 4 + OGRWKBViewReadUInt32( p, bSwap ) * nCoordSize;
+        return GetRing( p );
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Collections.                                                    */
+/* -------------------------------------------------------------------- */
+    int                 getNumGeometries() const
+    {
+        if( nFlatType < wkbMultiPoint )
+            return 0;
+        return (int) OGRWKBViewReadUInt32( pabyData + 5, bSwap );
+    }
+
+    /** Member iGeom of a collection.  Walks the previous members. */
+    OGRWKBGeometryView  getGeometryRef( int iGeom ) const
+    {
+        const GByte *p = GetFirstPart();
+        for( int i = 0; i < iGeom; i++ )
+            p += GeometrySize( p, pabyData + nSize - p, 0 );
+        return GetSubGeometry( p );
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Measures.                                                       */
+/* -------------------------------------------------------------------- */
+    void                getEnvelope( OGREnvelope *psEnvelope ) const;
+
+    /** Length of line strings, and of those of collections. */
+    double              get_Length() const
+    {
+        if( nFlatType == wkbLineString || nFlatType == wkbLinearRing )
+        {
+            const OGRWKBViewPath sPath = GetPath();
+            double dfLength = 0.0;
+            for( int i = 0; i + 1 < sPath.nPoints; i++ )
+            {
+                const double dfDX = OGRWKBViewPathX( sPath, i + 1 )
+                                  - OGRWKBViewPathX( sPath, i );
+                const double dfDY = OGRWKBViewPathY( sPath, i + 1 )
+                                  - OGRWKBViewPathY( sPath, i );
+                dfLength += sqrt( dfDX * dfDX + dfDY * dfDY );
+            }
+            return dfLength;
+        }
+
+        double dfLength = 0.0;
+        if( nFlatType == wkbMultiLineString
+            || nFlatType == wkbGeometryCollection )
+        {
+            const GByte *p = GetFirstPart();
+            for( int i = 0; i < GetNumParts(); i++ )
+                dfLength += GetNextPart( &p ).get_Length();
+        }
+        return dfLength;
+    }
+
+    /** Area of polygons, and of those of collections. */
+    double              get_Area() const
+    {
+        if( nFlatType == wkbLinearRing )
+            return RingArea( GetPath() );
+        double dfArea = 0.0;
+        const GByte *p = GetFirstPart();
+        if( nFlatType == wkbPolygon )
+        {
+            /* Exterior ring less the holes. */
+            for( int i = 0; i < GetNumParts(); i++ )
+            {
+                const double dfRingArea = GetNextPart( &p ).get_Area();
+                dfArea += i == 0 ? dfRingArea : -dfRingArea;
+            }
+        }
+        else if( nFlatType == wkbMultiPolygon
+                 || nFlatType == wkbGeometryCollection )
+        {
+            for( int i = 0; i < GetNumParts(); i++ )
+                dfArea += GetNextPart( &p ).get_Area();
+        }
+        return dfArea;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Predicates.                                                     */
+/* -------------------------------------------------------------------- */
+    int                 Intersects( const OGRWKBGeometryView &oOther ) const;
+    int                 Intersects( const OGREnvelope &sEnvelope ) const;
+    int                 Intersects( double dfX, double dfY ) const;
+
+    friend class OGRWKBPointIterator;
+};
+
+/************************************************************************/
+/*                            getEnvelope()                             */
+/************************************************************************/
+
+/** Envelope of the geometry, all zero if empty as for OGRGeometry. */
+
+inline void OGRWKBGeometryView::getEnvelope( OGREnvelope *psEnvelope ) const
+{
+    int bInit = FALSE;
+    psEnvelope->MinX = psEnvelope->MaxX = 0.0;
+    psEnvelope->MinY = psEnvelope->MaxY = 0.0;
+
+    if( nFlatType == wkbPoint || nFlatType == wkbLineString
+        || nFlatType == wkbLinearRing )
+    {
+        if( IsEmpty() )
+            return;
+
+        const OGRWKBViewPath sPath = GetPath();
+        for( int i = 0; i < sPath.nPoints; i++ )
+        {
+            const double dfX = OGRWKBViewPathX( sPath, i );
+            const double dfY = OGRWKBViewPathY( sPath, i );
+            if( !bInit )
+            {
+                psEnvelope->MinX = psEnvelope->MaxX = dfX;
+                psEnvelope->MinY = psEnvelope->MaxY = dfY;
+                bInit = TRUE;
+                continue;
+            }
+            if( dfX < psEnvelope->MinX ) psEnvelope->MinX = dfX;
+            if( dfX > psEnvelope->MaxX ) psEnvelope->MaxX = dfX;
+            if( dfY < psEnvelope->MinY ) psEnvelope->MinY = dfY;
+            if( dfY > psEnvelope->MaxY ) psEnvelope->MaxY = dfY;
+        }
+        return;
+    }
+
+    /* The exterior ring bounds a polygon. */
+    if( nFlatType == wkbPolygon )
+    {
+        if( getNumInteriorRings() >= 0 )
+            getExteriorRing().getEnvelope( psEnvelope );
+        return;
+    }
+
+    const GByte *p = GetFirstPart();
+    for( int i = 0; i < GetNumParts(); i++ )
+    {
+        const OGRWKBGeometryView oGeom = GetNextPart( &p );
+        if( oGeom.IsEmpty() )
+            continue;
+
+        OGREnvelope sGeomEnv;
+        oGeom.getEnvelope( &sGeomEnv );
+        if( !bInit )
+        {
+            psEnvelope->MinX = sGeomEnv.MinX;
+            psEnvelope->MaxX = sGeomEnv.MaxX;
+            psEnvelope->MinY = sGeomEnv.MinY;
+            psEnvelope->MaxY = sGeomEnv.MaxY;
+            bInit = TRUE;
+        }
+        else
+            psEnvelope->Merge( sGeomEnv );
+    }
+}
+
+/************************************************************************/
+/*                             Intersects()                             */
+/************************************************************************/
+
+/**
+ * Whether the geometries have at least one common point, boundaries
+ * included, as OGRGeometry::Intersects() with GEOS.
+ */
+
+inline int OGRWKBGeometryView::Intersects(
+                                const OGRWKBGeometryView &oOther ) const
+{
+    OGREnvelope sEnv, sOtherEnv;
+    getEnvelope( &sEnv );
+    oOther.getEnvelope( &sOtherEnv );
+    if( IsEmpty() || oOther.IsEmpty() || !sEnv.Intersects( sOtherEnv ) )
+        return FALSE;
+
+    if( nFlatType <= wkbPolygon || nFlatType == wkbLinearRing )
+        return IntersectsAny( *this, oOther );
+
+    const GByte *p = GetFirstPart();
+    for( int i = 0; i < GetNumParts(); i++ )
+        if( GetNextPart( &p ).Intersects( oOther ) )
+            return TRUE;
+    return FALSE;
+}
+
+/** Whether the geometry has a point in a rectangle, borders included. */
+
+inline int OGRWKBGeometryView::Intersects( const OGREnvelope &sEnvelope ) const
+{
+    OGREnvelope sEnv;
+    getEnvelope( &sEnv );
+    if( IsEmpty() || !sEnv.Intersects( sEnvelope ) )
+        return FALSE;
+    if( sEnvelope.Contains( sEnv ) )
+        return TRUE;
+
+    /* Rectangle as a WKB polygon, in the byte order of the host. */
+    GByte abyRect[9 + 4 + 5 * 16];
+    const GUInt32 anHeader[3] = { wkbPolygon, 1, 5 };
+    const double adfCoords[10] =
+    {
+        sEnvelope.MinX, sEnvelope.MinY, sEnvelope.MaxX, sEnvelope.MinY,
+        sEnvelope.MaxX, sEnvelope.MaxY, sEnvelope.MinX, sEnvelope.MaxY,
+        sEnvelope.MinX, sEnvelope.MinY
+    };
+    abyRect[0] = CPL_IS_LSB ? wkbNDR : wkbXDR;
+    memcpy( abyRect + 1, anHeader, 12 );
+    memcpy( abyRect + 13, adfCoords, sizeof(adfCoords) );
+
+    return Intersects( OGRWKBGeometryView( abyRect, sizeof(abyRect) ) );
+}
+
+/** Whether the geometry contains or touches a point. */
+
+inline int OGRWKBGeometryView::Intersects( double dfX, double dfY ) const
+{
+    GByte abyPoint[5 + 16];
+    const GUInt32 nType = wkbPoint;
+    const double adfCoords[2] = { dfX, dfY };
+    abyPoint[0] = CPL_IS_LSB ? wkbNDR : wkbXDR;
+    memcpy( abyPoint + 1, &nType, 4 );
+    memcpy( abyPoint + 5, adfCoords, 16 );
+
+    return Intersects( OGRWKBGeometryView( abyPoint, sizeof(abyPoint) ) );
+}
+
+/************************************************************************/
+/*                          OGRWKBPointIterator                         */
+/************************************************************************/
+
+/**
+ * Iterates over all the points of a WKB geometry view, in WKB order,
+ * including the points of all the rings and members.
+ */
+
+class OGRWKBPointIterator
+{
+    /* Stack of the collections and polygons being walked. */
+    struct Level
+    {
+        const GByte    *pabyNext;   /* Next member or ring. */
+        int             nLeft;      /* Members or rings left after it. */
+        int             bRings;
+        int             bSwap;
+        int             nDim;
+    };
+
+    Level               asStack[OGR_WKB_VIEW_MAX_DEPTH + 2];
+    int                 nDepth;
+    OGRWKBViewPath      sPath;
+    int                 iPoint;
+    int                 bHasZ;
+    const GByte        *pabyEnd;
+
+    /* Enter the geometry at p, or the ring at p if bRing. */
+    void                Enter( const GByte *p, int bRing, int bSwapIn,
+                               int nDimIn )
+    {
+        int bSwap = bSwapIn, nDim = nDimIn, bZ;
+        GUInt32 nType = wkbLinearRing;
+
+        if( !bRing )
+        {
+            OGRWKBGeometryView::ReadHeader( p, 5, &bSwap, &nType, &nDim, &bZ );
+            p += 5;
+        }
+
+        sPath.bSwap = bSwap;
+        sPath.nCoordSize = 8 * nDim;
+        if( nType == wkbPoint )
+        {
+            const double dfX = OGRWKBViewReadDouble( p, bSwap );
+            sPath.pabyCoords = p;
+            sPath.nPoints = CPLIsNan( dfX ) ? 0 : 1;
+        }
+        else if( nType == wkbLineString || nType == wkbLinearRing )
+        {
+            sPath.pabyCoords = p + 4;
+            sPath.nPoints = (int) OGRWKBViewReadUInt32( p, bSwap );
+        }
+        else
+        {
+            Level &sLevel = asStack[nDepth++];
+            sLevel.nLeft = (int) OGRWKBViewReadUInt32( p, bSwap );
+            sLevel.pabyNext = p + 4;
+            sLevel.bRings = nType == wkbPolygon;
+            sLevel.bSwap = bSwap;
+            sLevel.nDim = nDim;
+            sPath.nPoints = 0;
+        }
+        iPoint = 0;
+    }
+
+  public:
+    OGRWKBPointIterator( const OGRWKBGeometryView &oView ) :
+        nDepth(0), iPoint(0), bHasZ(oView.bHasZ),
+        pabyEnd(oView.pabyData + oView.nSize)
+    {
+        sPath.nPoints = 0;
+        if( !oView.IsValid() )
+            return;
+        if( oView.nFlatType == wkbLinearRing )
+            Enter( oView.pabyData, TRUE, oView.bSwap, oView.nDim );
+        else
+            Enter( oView.pabyData, FALSE, oView.bSwap, oView.nDim );
+    }
+
+    /**
+     * Fetch the next point.
+     *
+     * @return FALSE once all the points have been returned.
+     */
+    int                 getNextPoint( double *pdfX, double *pdfY,
+                                      double *pdfZ = NULL )
+    {
+        while( iPoint >= sPath.nPoints )
+        {
+            /* Move to the next member or ring. */
+            while( nDepth > 0 && asStack[nDepth - 1].nLeft == 0 )
+                nDepth--;
+            if( nDepth == 0 )
+                return FALSE;
+
+            Level &sLevel = asStack[nDepth - 1];
+            const GByte *p = sLevel.pabyNext;
+            sLevel.nLeft--;
+
+            if( sLevel.bRings )
+            {
+                sLevel.pabyNext = p + 4 + OGRWKBViewReadUInt32( p, sLevel.bSwap )
+                                          * (size_t) (8 * sLevel.nDim);
+                Enter( p, TRUE, sLevel.bSwap, sLevel.nDim );
+            }
+            else
+            {
+                sLevel.pabyNext = p + OGRWKBGeometryView::GeometrySize(
+                                                p, pabyEnd - p, 0 );
+                Enter( p, FALSE, sLevel.bSwap, sLevel.nDim );
+            }
+        }
+
+        const GByte *p = sPath.pabyCoords + (size_t) iPoint * sPath.nCoordSize;
+        *pdfX = OGRWKBViewReadDouble( p, sPath.bSwap );
+        *pdfY = OGRWKBViewReadDouble( p + 8, sPath.bSwap );
+        if( pdfZ != NULL )
+            *pdfZ = bHasZ && sPath.nCoordSize >= 24
+                ? OGRWKBViewReadDouble( p + 16, sPath.bSwap ) : 0.0;
+        iPoint++;
+        return TRUE;
+    }
+};
+
+#endif /* ndef _OGR_WKB_VIEW_H_INCLUDED */
@@ -0,0 +1,415 @@
+/*
+     PLIB - A Suite of Portable Game Libraries
+     Copyright (C) 1998,2002  Steve Baker
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Library General Public
+     License as published by the Free Software Foundation; either
+     version 2 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Library General Public License for more details.
+
+     You should have received a copy of the GNU Library General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+
+     For further information visit http://plib.sourceforge.net
+*/
+
+/*
+  Retained-mode drawing for PUI groups.
+  ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+  puDisplay() draws every widget every frame.  Wrapping a group class
+  in puRetained<> makes that group record its drawing into an OpenGL
+  display list, and replay the list on later frames for as long as
+  nothing in it has changed:
+
+    puRetained<puDialogBox> *dlg = new puRetained<puDialogBox> ( 20, 20 ) ;
+      ... add widgets as usual ...
+    dlg -> close  () ;
+    dlg -> reveal () ;
+
+  Damage is found by comparing a signature of everything that affects
+  the look of the group's widgets with the one taken when the list was
+  recorded.  The signature is a copy of that state rather than a hash,
+  so no change can go unnoticed.  It covers position and size,
+  visibility, activity and highlighting (hover), style, colours,
+  legends and labels (by contents), fonts, values (including those
+  held in valuator variables) and the extra state of the standard PUI
+  widgets - input cursors and selections, slider fractions and ranges,
+  list box scrolling, button and arrow types.  So an idle dialog costs one walk
+  over its widgets and one glCallList() per frame.
+
+  Some things cannot be seen from outside a widget, and the group
+  draws directly (without a list) while it holds any of them:
+
+    - widgets with a render callback
+    - the puAux widgets, whose internal state is private
+
+  Anything else that changes behind PUI's back - for instance the
+  strings of a puListBox edited in place - should be followed by a
+  call to invalidate() on the group, or to puInvalidateRetained() for
+  all of them.
+
+  Display lists are per context, so a group re-records whenever it is
+  drawn into a different PUI window.  A retained group that is inside
+  another one being recorded just draws normally.
+
+  puGetRetainedStats() counts the widgets that were really drawn and
+  the ones that were skipped because their group was replayed.
+*/
+
+#ifndef _PU_RETAINED_H_
+#define _PU_RETAINED_H_  1
+
+#include <string.h>
+#include "pu.h"
+
+
+struct puRetainedStats
+{
+  unsigned int drawn    ;   /* Widgets drawn the slow way            */
+  unsigned int skipped  ;   /* Widgets covered by a replayed list    */
+  unsigned int recorded ;   /* Display lists (re-)recorded           */
+  unsigned int replayed ;   /* Display lists replayed                */
+} ;
+
+inline puRetainedStats *puGetRetainedStats ( void )
+{
+  static puRetainedStats stats = { 0, 0, 0, 0 } ;
+  return & stats ;
+}
+
+inline void puResetRetainedStats ( void )
+{
+  memset ( puGetRetainedStats (), 0, sizeof(puRetainedStats) ) ;
+}
+
+inline unsigned int *_puRetainedGeneration ( void )
+{
+  static unsigned int generation = 0 ;
+  return & generation ;
+}
+
+inline int *_puRetainedRecording ( void )
+{
+  static int recording = FALSE ;
+  return & recording ;
+}
+
+/* Force every retained group to redraw on the next frame */
+
+inline void puInvalidateRetained ( void ) { ( *_puRetainedGeneration () ) ++ ; }
+
+
+/*
+  A signature is the drawable state itself, as a string of bytes, so
+  two different states never compare equal.  The buffer grows to the
+  largest signature seen and is then reused from frame to frame.
+*/
+
+class _puSignature
+{
+  unsigned char *data ;
+  size_t         size ;
+  size_t         max  ;
+
+  /* Not copyable */
+  _puSignature ( const _puSignature & ) ;
+  _puSignature &operator= ( const _puSignature & ) ;
+
+public:
+
+  _puSignature () { data = NULL ; size = max = 0 ; }
+  ~_puSignature () { delete [] data ; }
+
+  void clear ( void ) { size = 0 ; }
+
+  void add ( const void *p, size_t n )
+  {
+    if ( size + n > max )
+    {
+      size_t nmax = ( max < 256 ) ? 256 : max ;
+
+      while ( nmax < size + n )
+        nmax *= 2 ;
+
+      unsigned char *ndata = new unsigned char [ nmax ] ;
+
+      if ( size > 0 )
+        memcpy ( ndata, data, size ) ;
+
+      delete [] data ;
+      data = ndata ;
+      max  = nmax  ;
+    }
+
+    memcpy ( data + size, p, n ) ;
+    size += n ;
+  }
+
+  void add ( int   i ) { add ( &i, sizeof(i) ) ; }
+  void add ( float f ) { add ( &f, sizeof(f) ) ; }
+
+  void addString ( const char *s )
+  {
+    if ( s == NULL )
+    {
+      add ( -1 ) ;
+      return ;
+    }
+
+    int n = (int) strlen ( s ) ;
+    add ( n ) ;
+    add ( s, n ) ;
+  }
+
+  void addFont ( const puFont &f )
+  {
+    /* puFont has no padding (a pointer and two floats) but no accessor for the handle */
+
+    add ( &f, sizeof(puFont) ) ;
+  }
+
+  int equals ( const _puSignature &other ) const
+  {
+    return size == other.size &&
+           ( size == 0 || memcmp ( data, other.data, size ) == 0 ) ;
+  }
+
+  void swap ( _puSignature &other )
+  {
+    unsigned char *d = data ; data = other.data ; other.data = d ;
+    size_t         n = size ; size = other.size ; other.size = n ;
+    size_t         m = max  ; max  = other.max  ; other.max  = m ;
+  }
+} ;
+
+/*
+  Add the signature of 'ob' (and of its children, for groups) to *s.
+  Counts the widgets in *count, and returns FALSE if any of them has
+  state that cannot be checked.
+*/
+
+inline int _puAddSignature ( puObject *ob, _puSignature *s, int *count )
+{
+  int ok = TRUE ;
+  int t  = ob -> getType () ;
+
+  ( *count ) ++ ;
+
+  /* Render callbacks and the puAux widget bits */
+
+  if ( ob -> getRenderCallback () != NULL || ( t & 0xFFFC0000 ) != 0 )
+    ok = FALSE ;
+
+  s -> add ( t ) ;
+  s -> add ( ob -> getABox (), sizeof(puBox) ) ;
+  s -> add ( ob -> getBBox (), sizeof(puBox) ) ;
+  s -> add ( ob -> isVisible     () ) ;
+  s -> add ( ob -> isActive      () ) ;
+  s -> add ( ob -> isHighlighted () ) ;
+  s -> add ( ob -> isReturnDefault    () ) ;
+  s -> add ( ob -> getStyle           () ) ;
+  s -> add ( ob -> getBorderThickness () ) ;
+  s -> add ( ob -> getWindow          () ) ;
+  s -> add ( ob -> getVStatus         () ) ;
+
+  for ( int i = 0 ; i < PUCOL_MAX ; i++ )
+  {
+    float c [ 4 ] ;
+    ob -> getColour ( i, &c[0], &c[1], &c[2], &c[3] ) ;
+    s -> add ( c, sizeof(c) ) ;
+  }
+
+  s -> addString ( ob -> getLegend () ) ;
+  s -> addFont   ( ob -> getLegendFont () ) ;
+  s -> add       ( ob -> getLegendPlace () ) ;
+  s -> addString ( ob -> getLabel () ) ;
+  s -> addFont   ( ob -> getLabelFont () ) ;
+  s -> add       ( ob -> getLabelPlace () ) ;
+
+  /* Reads through to any valuator, so changes there are seen too */
+
+  s -> addString ( ob -> getStringValue () ) ;
+
+  if ( t & PUCLASS_INPUT )
+  {
+    puInput *in = (puInput *) ob ;
+    int ss, se ;
+
+    in -> getSelectRegion ( &ss, &se ) ;
+    s -> add ( in -> isAcceptingInput () ) ;
+    s -> add ( in -> getCursor () ) ;
+    s -> add ( ss ) ;
+    s -> add ( se ) ;
+  }
+
+  if ( t & PUCLASS_SLIDER )
+  {
+    puSlider *sl = (puSlider *) ob ;
+
+    s -> add ( sl -> isVertical        () ) ;
+    s -> add ( sl -> getSliderFraction () ) ;
+    s -> add ( sl -> getMinValue       () ) ;
+    s -> add ( sl -> getMaxValue       () ) ;
+  }
+
+  if ( t & PUCLASS_DIAL )
+  {
+    puDial *dl = (puDial *) ob ;
+
+    s -> add ( dl -> getMinValue () ) ;
+    s -> add ( dl -> getMaxValue () ) ;
+  }
+
+  if ( t & PUCLASS_LISTBOX )
+  {
+    puListBox *lb = (puListBox *) ob ;
+
+    s -> add ( lb -> getNumItems () ) ;
+    s -> add ( lb -> getTopItem  () ) ;
+  }
+
+  if ( t & PUCLASS_BUTTON )
+    s -> add ( ( (puButton *) ob ) -> getButtonType () ) ;
+
+  if ( t & PUCLASS_ARROW )
+    s -> add ( ( (puArrowButton *) ob ) -> getArrowType () ) ;
+
+  if ( t & PUCLASS_BUTTONBOX )
+    s -> add ( ( (puButtonBox *) ob ) -> getNumItems () ) ;
+
+  if ( t & PUCLASS_GROUP )
+  {
+    puGroup *gr = (puGroup *) ob ;
+
+    s -> add ( gr -> getNumChildren () ) ;
+
+    for ( puObject *ch = gr -> getFirstChild () ; ch != NULL ; ch = ch -> getNextObject () )
+    {
+      s -> add ( &ch, sizeof(ch) ) ;
+
+      if ( ! _puAddSignature ( ch, s, count ) )
+        ok = FALSE ;
+    }
+  }
+
+  return ok ;
+}
+
+
+/*
+  'Base' is puGroup or any class derived from it that is constructed
+  from an (x,y) position - puInterface, puPopup, puDialogBox...
+*/
+
+template < class Base >
+class puRetained : public Base
+{
+  GLuint       list ;
+  int          valid ;
+  int          retained ;
+  int          list_window ;
+  unsigned int generation ;
+
+  _puSignature signature ;    /* As recorded                          */
+  _puSignature current   ;    /* Scratch space for the current state  */
+
+public:
+
+  puRetained ( int x, int y ) : Base ( x, y )
+  {
+    list        = 0 ;
+    valid       = FALSE ;
+    retained    = TRUE ;
+    list_window = -1 ;
+    generation  = 0 ;
+  }
+
+  ~puRetained ()
+  {
+    if ( list != 0 )
+      glDeleteLists ( list, 1 ) ;
+  }
+
+  void setRetained ( int r ) { retained = r ; valid = FALSE ; }
+  int  isRetained  ( void ) const { return retained ; }
+
+  void invalidate ( void ) { valid = FALSE ; }
+
+  void draw ( int dx, int dy )
+  {
+    puRetainedStats *stats = puGetRetainedStats () ;
+
+    int w, h ;
+    puGetWindowSize ( &w, &h ) ;
+
+    /*
+      Where we are drawn, and the window size (menu bars and
+      'v_status' widgets follow the top of the window) are part of the
+      signature too.
+    */
+
+    int count = 0 ;
+
+    current.clear () ;
+    current.add ( dx ) ;
+    current.add ( dy ) ;
+    current.add ( w  ) ;
+    current.add ( h  ) ;
+
+    int ok = _puAddSignature ( this, &current, &count ) ;
+
+    if ( ! retained || ! ok || *_puRetainedRecording () )
+    {
+      valid = FALSE ;
+      Base::draw ( dx, dy ) ;
+      stats -> drawn += count ;
+      return ;
+    }
+
+    if ( valid && current.equals ( signature ) &&
+         generation  == *_puRetainedGeneration () &&
+         list_window == puGetWindow () )
+    {
+      glCallList ( list ) ;
+      stats -> skipped += count ;
+      stats -> replayed ++ ;
+      return ;
+    }
+
+    if ( list == 0 )
+      list = glGenLists ( 1 ) ;
+
+    if ( list == 0 )
+    {
+      /* No lists to be had - just draw */
+
+      Base::draw ( dx, dy ) ;
+      stats -> drawn += count ;
+      return ;
+    }
+
+    *_puRetainedRecording () = TRUE ;
+    glNewList ( list, GL_COMPILE_AND_EXECUTE ) ;
+    Base::draw ( dx, dy ) ;
+    glEndList () ;
+    *_puRetainedRecording () = FALSE ;
+
+    valid       = TRUE ;
+    signature.swap ( current ) ;
+    generation  = *_puRetainedGeneration () ;
+    list_window = puGetWindow () ;
+
+    stats -> drawn += count ;
+    stats -> recorded ++ ;
+  }
+} ;
+
+#endif
+
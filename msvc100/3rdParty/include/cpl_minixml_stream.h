@@ -0,0 +1,982 @@
+/**********************************************************************
+ * $Id$
+ *
+ * Project:  CPL - Common Portability Library
+ * Purpose:  Streaming (pull/SAX) XML parser and arena allocated tree
+ *           builder, alongside the CPL mini XML parser.
+ *
+ **********************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef _CPL_MINIXML_STREAM_H_INCLUDED
+#define _CPL_MINIXML_STREAM_H_INCLUDED
+
+#include "cpl_minixml.h"
+#include "cpl_vsi.h"
+#include "cpl_conv.h"
+#include "cpl_error.h"
+#include "cpl_string.h"
+#include <string.h>
+#include <vector>
+
+/**
+ * \file cpl_minixml_stream.h
+ *
+ * Streaming XML parser.
+ *
+ * CPLParseXMLString() and CPLParseXMLFile() build the whole CPLXMLNode
+ * tree, with one allocation per node and per string.  CPLXMLStreamParser
+ * reads a document from a VSILFILE or from memory in blocks, and returns
+ * it as a sequence of events (start of element, attribute, text, end of
+ * element...) whose names and values point into its read buffer: nothing
+ * is allocated per event.  Names and values are also nul terminated in
+ * place, and entities are decoded in place.
+ *
+ * The events follow the tree CPLParseXMLString() would build: text is
+ * returned without its leading white space, white space only text is
+ * skipped, CDATA sections are returned as text, <?xml ... ?> as an
+ * element named "?xml" with its attributes, and <!DOCTYPE ...> as a
+ * literal.
+ *
+ *     CPLXMLStreamParser oParser;
+ *     if( oParser.Open( "/vsizip/foo.zip/foo.vrt" ) )
+ *     {
+ *         CPLXMLStreamEvent eEvent;
+ *         while( (eEvent = oParser.Next()) > CXSE_EndOfDocument )
+ *         {
+ *             if( eEvent == CXSE_StartElement
+ *                 && EQUAL(oParser.GetName(), "SourceFilename") )
+ *                 ...
+ *         }
+ *         if( eEvent == CXSE_Error )
+ *             ...
+ *     }
+ *
+ * CPLXMLArenaTree builds the same CPLXMLNode tree as CPLParseXMLString()
+ * from a parser, with the nodes and strings packed in large blocks that
+ * are all freed with the CPLXMLArenaTree.
+ */
+
+typedef enum
+{
+    /*! A syntax or read error, see GetErrorMsg(). */  CXSE_Error = -1,
+    /*! End of the document. */                        CXSE_EndOfDocument = 0,
+    /*! Start of element: GetName(). */                CXSE_StartElement,
+    /*! Attribute of the last started element:
+        GetName() and GetValue(). */                   CXSE_Attribute,
+    /*! End of element: GetName(). */                  CXSE_EndElement,
+    /*! Text: GetValue(). */                           CXSE_Text,
+    /*! Comment, without <!-- -->: GetValue(). */      CXSE_Comment,
+    /*! Literal such as <!DOCTYPE ...>, without
+        the angle brackets: GetValue(). */             CXSE_Literal
+} CPLXMLStreamEvent;
+
+/* Size of the blocks read from files. */
+#ifndef CPL_XML_STREAM_READ_SIZE
+#  define CPL_XML_STREAM_READ_SIZE   65536
+#endif
+
+/************************************************************************/
+/* ==================================================================== */
+/*                          CPLXMLStreamParser                          */
+/* ==================================================================== */
+/************************************************************************/
+
+class CPLXMLStreamParser
+{
+    typedef struct
+    {
+        CPLXMLStreamEvent eEvent;
+        char       *pszName;
+        size_t      nNameLen;
+        char       *pszValue;
+        size_t      nValueLen;
+    } PendingEvent;
+
+    VSILFILE   *fp;
+    int         bOwnFile;
+    int         bEOF;
+
+    char       *pachBuf;        /* Read buffer. */
+    size_t      nBufAlloc;
+    size_t      nBufLen;        /* Bytes read into pachBuf. */
+    size_t      nPos;           /* Start of the next token. */
+    size_t      nConsumeTo;     /* End of the current token. */
+    int         bOwnBuf;
+
+    std::vector<PendingEvent> aoPending;
+    size_t      iPending;
+    PendingEvent sCurrent;
+
+    std::vector<char>   achStack;       /* Open element names, nul */
+    std::vector<size_t> anStack;        /* separated, and offsets. */
+
+    int         bError;
+    CPLString   osErrorMsg;
+
+    CPLXMLStreamParser( const CPLXMLStreamParser & );
+    CPLXMLStreamParser &operator=( const CPLXMLStreamParser & );
+
+/* -------------------------------------------------------------------- */
+/*      Read more data, keeping the bytes from nPos.  Returns FALSE     */
+/*      at end of file.                                                 */
+/* -------------------------------------------------------------------- */
+    int         Refill()
+    {
+        if( bEOF || fp == NULL )
+        {
+            bEOF = TRUE;
+            return FALSE;
+        }
+
+        if( nPos > 0 )
+        {
+            memmove( pachBuf, pachBuf + nPos, nBufLen - nPos );
+            nBufLen -= nPos;
+            nConsumeTo -= MIN( nConsumeTo, nPos );
+            nPos = 0;
+        }
+
+        if( nBufAlloc - nBufLen < CPL_XML_STREAM_READ_SIZE + 1 )
+        {
+            nBufAlloc = MAX( nBufAlloc * 2,
+                             nBufLen + CPL_XML_STREAM_READ_SIZE + 1 );
+            pachBuf = (char *) CPLRealloc( pachBuf, nBufAlloc );
+        }
+
+        const size_t nRead =
+            VSIFReadL( pachBuf + nBufLen, 1, CPL_XML_STREAM_READ_SIZE, fp );
+        nBufLen += nRead;
+        pachBuf[nBufLen] = '\0';
+
+        if( nRead < CPL_XML_STREAM_READ_SIZE )
+            bEOF = TRUE;
+
+        return nRead > 0;
+    }
+
+    /* Character at nPos + nOff, or -1 past the end of the document. */
+    int         Peek( size_t nOff )
+    {
+        while( nPos + nOff >= nBufLen )
+        {
+            if( !Refill() )
+                return -1;
+        }
+        return (unsigned char) pachBuf[nPos + nOff];
+    }
+
+    /* Offset from nPos of the next occurrence of pszPattern at or */
+    /* after nOff, or (size_t)-1. */
+    size_t      Find( size_t nOff, const char *pszPattern )
+    {
+        const size_t nPatLen = strlen(pszPattern);
+
+        for( ;; )
+        {
+            if( nPos + nOff + nPatLen <= nBufLen )
+            {
+                const char *pszFound = strstr( pachBuf + nPos + nOff,
+                                               pszPattern );
+                /* A nul byte in the data stops strstr() early. */
+                if( pszFound != NULL )
+                    return pszFound - (pachBuf + nPos);
+                if( strlen( pachBuf + nPos + nOff ) + nPos + nOff < nBufLen )
+                    return (size_t) -1;
+                nOff = nBufLen - nPos - (nPatLen - 1);
+            }
+            if( !Refill() )
+                return (size_t) -1;
+        }
+    }
+
+    void        SetError( const char *pszMsg )
+    {
+        bError = TRUE;
+        osErrorMsg = pszMsg;
+        CPLError( CE_Failure, CPLE_AppDefined, "%s", pszMsg );
+    }
+
+    void        Push( CPLXMLStreamEvent eEvent,
+                      char *pszName, size_t nNameLen,
+                      char *pszValue, size_t nValueLen )
+    {
+        PendingEvent sEvent;
+        sEvent.eEvent = eEvent;
+        sEvent.pszName = pszName;
+        sEvent.nNameLen = nNameLen;
+        sEvent.pszValue = pszValue;
+        sEvent.nValueLen = nValueLen;
+        aoPending.push_back( sEvent );
+    }
+
+    static int  IsSpace( int ch )
+        { return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n'; }
+
+/* -------------------------------------------------------------------- */
+/*      Decode the entities of a string in place.  Returns the new      */
+/*      length.                                                         */
+/* -------------------------------------------------------------------- */
+    static size_t DecodeEntities( char *pszStr, size_t nLen )
+    {
+        char *pszIn = (char *) memchr( pszStr, '&', nLen );
+        if( pszIn == NULL )
+            return nLen;
+
+        char *pszEnd = pszStr + nLen;
+        char *pszOut = pszIn;
+
+        while( pszIn < pszEnd )
+        {
+            if( *pszIn != '&' )
+            {
+                *pszOut++ = *pszIn++;
+                continue;
+            }
+
+            char *pszSemi = (char *) memchr( pszIn, ';',
+                                             MIN( pszEnd - pszIn, 12 ) );
+            const size_t nEnt = pszSemi ? pszSemi - pszIn + 1 : 0;
+
+            if( nEnt == 4 && strncmp( pszIn, "&lt;", 4 ) == 0 )
+                *pszOut++ = '<';
+            else if( nEnt == 4 && strncmp( pszIn, "&gt;", 4 ) == 0 )
+                *pszOut++ = '>';
+            else if( nEnt == 5 && strncmp( pszIn, "&amp;", 5 ) == 0 )
+                *pszOut++ = '&';
+            else if( nEnt == 6 && strncmp( pszIn, "&quot;", 6 ) == 0 )
+                *pszOut++ = '"';
+            else if( nEnt == 6 && strncmp( pszIn, "&apos;", 6 ) == 0 )
+                *pszOut++ = '\'';
+            else if( nEnt > 3 && pszIn[1] == '#' )
+            {
+                /* Numeric character reference, encoded as UTF-8. */
+                unsigned long nCode = (pszIn[2] == 'x' || pszIn[2] == 'X')
+                    ? strtoul( pszIn + 3, NULL, 16 )
+                    : strtoul( pszIn + 2, NULL, 10 );
+
+                if( nCode == 0 || nCode > 0x10FFFF )
+                {
+                    memmove( pszOut, pszIn, nEnt );
+                    pszOut += nEnt;
+                }
+                else if( nCode < 0x80 )
+                    *pszOut++ = (char) nCode;
+                else if( nCode < 0x800 )
+                {
+                    *pszOut++ = (char) (0xC0 | (nCode >> 6));
+                    *pszOut++ = (char) (0x80 | (nCode & 0x3F));
+                }
+                else if( nCode < 0x10000 )
+                {
+                    *pszOut++ = (char) (0xE0 | (nCode >> 12));
+                    *pszOut++ = (char) (0x80 | ((nCode >> 6) & 0x3F));
+                    *pszOut++ = (char) (0x80 | (nCode & 0x3F));
+                }
+                else
+                {
+                    *pszOut++ = (char) (0xF0 | (nCode >> 18));
+                    *pszOut++ = (char) (0x80 | ((nCode >> 12) & 0x3F));
+                    *pszOut++ = (char) (0x80 | ((nCode >> 6) & 0x3F));
+                    *pszOut++ = (char) (0x80 | (nCode & 0x3F));
+                }
+            }
+            else
+            {
+                *pszOut++ = *pszIn++;
+                continue;
+            }
+
+            pszIn += nEnt;
+        }
+
+        *pszOut = '\0';
+        return pszOut - pszStr;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Parse a start tag, or a <?...?> processing instruction, held    */
+/*      at pachBuf[nPos, nPos+nTagLen).                                 */
+/* -------------------------------------------------------------------- */
+    int         ParseStartTag( size_t nTagLen, int bPI )
+    {
+        char *pszTag = pachBuf + nPos;
+        size_t i = 1;
+
+        /* Element name. */
+        const size_t nNameStart = i;
+        if( bPI )
+            i++;
+        while( i < nTagLen && !IsSpace(pszTag[i]) && pszTag[i] != '>'
+               && pszTag[i] != '/' && !(bPI && pszTag[i] == '?') )
+            i++;
+
+        char *pszName = pszTag + nNameStart;
+        const size_t nNameLen = i - nNameStart;
+        if( nNameLen == 0 || (bPI && nNameLen == 1) )
+        {
+            SetError( "Missing element name." );
+            return FALSE;
+        }
+
+        const size_t nNameEnd = i;
+        Push( CXSE_StartElement, pszName, nNameLen, NULL, 0 );
+
+/* -------------------------------------------------------------------- */
+/*      Attributes.                                                     */
+/* -------------------------------------------------------------------- */
+        int bSelfClosing = bPI;
+
+        for( ;; )
+        {
+            while( i < nTagLen && IsSpace(pszTag[i]) )
+                i++;
+
+            if( i >= nTagLen || pszTag[i] == '>' )
+                break;
+            if( pszTag[i] == '/' || pszTag[i] == '?' )
+            {
+                bSelfClosing = TRUE;
+                break;
+            }
+
+            const size_t nAttrStart = i;
+            while( i < nTagLen && pszTag[i] != '=' && !IsSpace(pszTag[i])
+                   && pszTag[i] != '>' && pszTag[i] != '/' )
+                i++;
+            const size_t nAttrEnd = i;
+
+            while( i < nTagLen && IsSpace(pszTag[i]) )
+                i++;
+            if( i >= nTagLen || pszTag[i] != '=' )
+            {
+                SetError( CPLString().Printf(
+                    "Missing value for attribute '%.*s' of element '%.*s'.",
+                    (int) (nAttrEnd - nAttrStart), pszTag + nAttrStart,
+                    (int) nNameLen, pszName ) );
+                return FALSE;
+            }
+            i++;
+            while( i < nTagLen && IsSpace(pszTag[i]) )
+                i++;
+
+            size_t nValueStart, nValueEnd;
+            if( i < nTagLen && (pszTag[i] == '"' || pszTag[i] == '\'') )
+            {
+                const char chQuote = pszTag[i++];
+                nValueStart = i;
+                while( i < nTagLen && pszTag[i] != chQuote )
+                    i++;
+                nValueEnd = i;
+                if( i < nTagLen )
+                    i++;
+            }
+            else
+            {
+                nValueStart = i;
+                while( i < nTagLen && !IsSpace(pszTag[i])
+                       && pszTag[i] != '>' && pszTag[i] != '/' )
+                    i++;
+                nValueEnd = i;
+            }
+
+            pszTag[nAttrEnd] = '\0';
+            pszTag[nValueEnd] = '\0';
+            const size_t nValueLen =
+                DecodeEntities( pszTag + nValueStart, nValueEnd - nValueStart );
+
+            Push( CXSE_Attribute, pszTag + nAttrStart, nAttrEnd - nAttrStart,
+                  pszTag + nValueStart, nValueLen );
+        }
+
+        pszTag[nNameEnd] = '\0';
+
+        if( bSelfClosing )
+            Push( CXSE_EndElement, pszName, nNameLen, NULL, 0 );
+        else
+        {
+            anStack.push_back( achStack.size() );
+            achStack.insert( achStack.end(), pszName, pszName + nNameLen );
+            achStack.push_back( '\0' );
+        }
+
+        return TRUE;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Read the next token into aoPending.                             */
+/* -------------------------------------------------------------------- */
+    int         ReadToken()
+    {
+        aoPending.clear();
+        iPending = 0;
+        nPos = nConsumeTo;
+
+        for( ;; )
+        {
+            /* Skip white space, as CPLParseXMLString() does. */
+            int ch;
+            while( (ch = Peek(0)) >= 0 && IsSpace(ch) )
+                nPos++;
+
+            if( ch < 0 )
+            {
+                nConsumeTo = nPos;
+                if( !anStack.empty() )
+                {
+                    SetError( CPLString().Printf(
+                        "Parse error at EOF, not all elements have been "
+                        "closed, starting with %s",
+                        &achStack[anStack.back()] ) );
+                    return FALSE;
+                }
+                Push( CXSE_EndOfDocument, NULL, 0, NULL, 0 );
+                return TRUE;
+            }
+
+/* -------------------------------------------------------------------- */
+/*      Text.                                                           */
+/* -------------------------------------------------------------------- */
+            if( ch != '<' )
+            {
+                size_t nEnd = Find( 0, "<" );
+                if( nEnd == (size_t) -1 )
+                    nEnd = nBufLen - nPos;
+
+                char *pszText = pachBuf + nPos;
+                const char chSaved = pszText[nEnd];
+                pszText[nEnd] = '\0';
+                const size_t nLen = DecodeEntities( pszText, nEnd );
+
+                /* The '<' is put back before the next token is read. */
+                Push( CXSE_Text, NULL, 0, pszText, nLen );
+                nConsumeTo = nPos + nEnd;
+                if( chSaved == '<' )
+                    sRestore = nConsumeTo;
+                return TRUE;
+            }
+
+            const int ch1 = Peek(1);
+
+/* -------------------------------------------------------------------- */
+/*      Comment.                                                        */
+/* -------------------------------------------------------------------- */
+            if( ch1 == '!' && Peek(2) == '-' && Peek(3) == '-' )
+            {
+                const size_t nEnd = Find( 4, "-->" );
+                if( nEnd == (size_t) -1 )
+                {
+                    SetError( "Unterminated comment." );
+                    return FALSE;
+                }
+                pachBuf[nPos + nEnd] = '\0';
+                Push( CXSE_Comment, NULL, 0, pachBuf + nPos + 4, nEnd - 4 );
+                nConsumeTo = nPos + nEnd + 3;
+                return TRUE;
+            }
+
+/* -------------------------------------------------------------------- */
+/*      CDATA section, returned as text.                                */
+/* -------------------------------------------------------------------- */
+            if( ch1 == '!' && Peek(8) >= 0
+                && strncmp( pachBuf + nPos, "<![CDATA[", 9 ) == 0 )
+            {
+                const size_t nEnd = Find( 9, "]]>" );
+                if( nEnd == (size_t) -1 )
+                {
+                    SetError( "Unterminated CDATA section." );
+                    return FALSE;
+                }
+                pachBuf[nPos + nEnd] = '\0';
+                Push( CXSE_Text, NULL, 0, pachBuf + nPos + 9, nEnd - 9 );
+                nConsumeTo = nPos + nEnd + 3;
+                return TRUE;
+            }
+
+/* -------------------------------------------------------------------- */
+/*      Other <!...> literal, with an optional [...] internal subset.   */
+/* -------------------------------------------------------------------- */
+            if( ch1 == '!' )
+            {
+                size_t i = 2;
+                int bInBracket = FALSE;
+                int c;
+                while( (c = Peek(i)) >= 0 && (bInBracket || c != '>') )
+                {
+                    if( c == '[' ) bInBracket = TRUE;
+                    else if( c == ']' ) bInBracket = FALSE;
+                    i++;
+                }
+                if( c < 0 )
+                {
+                    SetError( "Unterminated literal." );
+                    return FALSE;
+                }
+                pachBuf[nPos + i] = '\0';
+                Push( CXSE_Literal, NULL, 0, pachBuf + nPos + 1, i - 1 );
+                nConsumeTo = nPos + i + 1;
+                return TRUE;
+            }
+
+/* -------------------------------------------------------------------- */
+/*      End tag.                                                        */
+/* -------------------------------------------------------------------- */
+            if( ch1 == '/' )
+            {
+                const size_t nEnd = Find( 2, ">" );
+                if( nEnd == (size_t) -1 )
+                {
+                    SetError( "Unterminated end tag." );
+                    return FALSE;
+                }
+
+                char *pszName = pachBuf + nPos + 2;
+                size_t nNameLen = nEnd - 2;
+                while( nNameLen > 0 && IsSpace(pszName[nNameLen-1]) )
+                    nNameLen--;
+                pszName[nNameLen] = '\0';
+
+                if( anStack.empty()
+                    || strcmp( &achStack[anStack.back()], pszName ) != 0 )
+                {
+                    SetError( CPLString().Printf(
+                        "Element </%s> does not match <%s>.", pszName,
+                        anStack.empty() ? "" : &achStack[anStack.back()] ) );
+                    return FALSE;
+                }
+
+                achStack.resize( anStack.back() );
+                anStack.pop_back();
+
+                Push( CXSE_EndElement, pszName, nNameLen, NULL, 0 );
+                nConsumeTo = nPos + nEnd + 1;
+                return TRUE;
+            }
+
+/* -------------------------------------------------------------------- */
+/*      Start tag or processing instruction: find the closing '>'       */
+/*      outside of quoted values.                                       */
+/* -------------------------------------------------------------------- */
+            {
+                size_t i = 1;
+                int c, chQuote = 0;
+                while( (c = Peek(i)) >= 0 )
+                {
+                    if( chQuote )
+                    {
+                        if( c == chQuote )
+                            chQuote = 0;
+                    }
+                    else if( c == '"' || c == '\'' )
+                        chQuote = c;
+                    else if( c == '>' )
+                        break;
+                    i++;
+                }
+                if( c < 0 )
+                {
+                    SetError( "Unterminated start tag." );
+                    return FALSE;
+                }
+
+                if( !ParseStartTag( i, ch1 == '?' ) )
+                    return FALSE;
+                nConsumeTo = nPos + i + 1;
+                return TRUE;
+            }
+        }
+    }
+
+    size_t      sRestore;       /* Offset where '<' must be put back. */
+
+public:
+                CPLXMLStreamParser() :
+                    fp(NULL), bOwnFile(FALSE), bEOF(TRUE),
+                    pachBuf(NULL), nBufAlloc(0), nBufLen(0), nPos(0),
+                    nConsumeTo(0), bOwnBuf(TRUE), iPending(0),
+                    bError(FALSE), sRestore((size_t) -1)
+    {
+        memset( &sCurrent, 0, sizeof(sCurrent) );
+    }
+
+               ~CPLXMLStreamParser() { Close(); }
+
+    /** Parse a file opened with VSIFOpenL(), closed with the parser if
+        bTakeOwnership is TRUE. */
+    int         Open( VSILFILE *fpIn, int bTakeOwnership = FALSE )
+    {
+        Close();
+        fp = fpIn;
+        bOwnFile = bTakeOwnership;
+        bEOF = (fp == NULL);
+        return fp != NULL;
+    }
+
+    /** Parse a file. */
+    int         Open( const char *pszFilename )
+    {
+        VSILFILE *fpIn = VSIFOpenL( pszFilename, "rb" );
+        if( fpIn == NULL )
+        {
+            CPLError( CE_Failure, CPLE_OpenFailed,
+                      "Failed to open file %s.", pszFilename );
+            return FALSE;
+        }
+        return Open( fpIn, TRUE );
+    }
+
+    /** Parse a nul terminated string, copied into the parser. */
+    int         OpenString( const char *pszDoc )
+    {
+        Close();
+        nBufLen = strlen( pszDoc );
+        nBufAlloc = nBufLen + 1;
+        pachBuf = (char *) CPLMalloc( nBufAlloc );
+        memcpy( pachBuf, pszDoc, nBufLen + 1 );
+        return TRUE;
+    }
+
+    void        Close()
+    {
+        if( fp != NULL && bOwnFile )
+            VSIFCloseL( fp );
+        fp = NULL;
+        bOwnFile = FALSE;
+        bEOF = TRUE;
+        CPLFree( pachBuf );
+        pachBuf = NULL;
+        nBufAlloc = nBufLen = nPos = nConsumeTo = 0;
+        aoPending.clear();
+        iPending = 0;
+        achStack.clear();
+        anStack.clear();
+        bError = FALSE;
+        osErrorMsg = "";
+        sRestore = (size_t) -1;
+        memset( &sCurrent, 0, sizeof(sCurrent) );
+    }
+
+/************************************************************************/
+/*                                Next()                                */
+/************************************************************************/
+
+    /**
+     * Move to the next event.  The names and values of the previous
+     * event are no longer valid.
+     */
+    CPLXMLStreamEvent Next()
+    {
+        if( bError )
+            return CXSE_Error;
+
+        if( iPending >= aoPending.size() )
+        {
+            if( sRestore != (size_t) -1 )
+            {
+                pachBuf[sRestore] = '<';
+                sRestore = (size_t) -1;
+            }
+
+            if( pachBuf == NULL && fp != NULL )
+                Refill();
+            if( pachBuf == NULL
+                || ( !aoPending.empty()
+                     && aoPending.back().eEvent == CXSE_EndOfDocument ) )
+            {
+                memset( &sCurrent, 0, sizeof(sCurrent) );
+                return CXSE_EndOfDocument;
+            }
+
+            if( !ReadToken() )
+            {
+                memset( &sCurrent, 0, sizeof(sCurrent) );
+                sCurrent.eEvent = CXSE_Error;
+                return CXSE_Error;
+            }
+        }
+
+        sCurrent = aoPending[iPending++];
+        return sCurrent.eEvent;
+    }
+
+    /** Element or attribute name of the current event. */
+    const char *GetName() const { return sCurrent.pszName; }
+    size_t      GetNameLength() const { return sCurrent.nNameLen; }
+
+    /** Attribute value, text, comment or literal of the current event. */
+    const char *GetValue() const { return sCurrent.pszValue; }
+    size_t      GetValueLength() const { return sCurrent.nValueLen; }
+
+    /** Number of elements open after the current event. */
+    int         GetDepth() const { return (int) anStack.size(); }
+
+    const char *GetErrorMsg() const { return osErrorMsg.c_str(); }
+};
+
+/************************************************************************/
+/*                           CPLXMLStreamSAX()                          */
+/************************************************************************/
+
+/** Callbacks for CPLXMLStreamSAX(); NULL ones are skipped. */
+typedef struct
+{
+    int (*pfnStartElement)( void *pUserData, const char *pszName );
+    int (*pfnAttribute)( void *pUserData, const char *pszName,
+                         const char *pszValue, size_t nValueLen );
+    int (*pfnEndElement)( void *pUserData, const char *pszName );
+    int (*pfnText)( void *pUserData, const char *pszText, size_t nLen );
+    int (*pfnComment)( void *pUserData, const char *pszText, size_t nLen );
+} CPLXMLStreamSAXHandlers;
+
+/**
+ * Run a parser to the end of the document, calling a handler for each
+ * event.  A handler returning FALSE stops the parsing.
+ *
+ * @return TRUE if the whole document was parsed, FALSE on error or if
+ * a handler stopped the parsing.
+ */
+
+static inline int CPLXMLStreamSAX( CPLXMLStreamParser *poParser,
+                                   const CPLXMLStreamSAXHandlers *psHandlers,
+                                   void *pUserData )
+{
+    for( ;; )
+    {
+        int bContinue = TRUE;
+
+        switch( poParser->Next() )
+        {
+          case CXSE_Error:
+            return FALSE;
+          case CXSE_EndOfDocument:
+            return TRUE;
+          case CXSE_StartElement:
+            if( psHandlers->pfnStartElement )
+                bContinue = psHandlers->pfnStartElement(
+                    pUserData, poParser->GetName() );
+            break;
+          case CXSE_Attribute:
+            if( psHandlers->pfnAttribute )
+                bContinue = psHandlers->pfnAttribute(
+                    pUserData, poParser->GetName(),
+                    poParser->GetValue(), poParser->GetValueLength() );
+            break;
+          case CXSE_EndElement:
+            if( psHandlers->pfnEndElement )
+                bContinue = psHandlers->pfnEndElement(
+                    pUserData, poParser->GetName() );
+            break;
+          case CXSE_Text:
+            if( psHandlers->pfnText )
+                bContinue = psHandlers->pfnText(
+                    pUserData, poParser->GetValue(),
+                    poParser->GetValueLength() );
+            break;
+          case CXSE_Comment:
+            if( psHandlers->pfnComment )
+                bContinue = psHandlers->pfnComment(
+                    pUserData, poParser->GetValue(),
+                    poParser->GetValueLength() );
+            break;
+          case CXSE_Literal:
+            break;
+        }
+
+        if( !bContinue )
+            return FALSE;
+    }
+}
+
+/************************************************************************/
+/* ==================================================================== */
+/*                            CPLXMLArenaTree                           */
+/* ==================================================================== */
+/************************************************************************/
+
+/* Size of the arena blocks. */
+#ifndef CPL_XML_ARENA_BLOCK_SIZE
+#  define CPL_XML_ARENA_BLOCK_SIZE   (256 * 1024)
+#endif
+
+/**
+ * CPLXMLNode tree with the nodes and strings allocated in large blocks.
+ *
+ * The tree has the same shape as the one of CPLParseXMLString(), and can
+ * be read with the usual functions (CPLGetXMLValue(), CPLGetXMLNode(),
+ * CPLSerializeXMLTree()...).  It belongs to the CPLXMLArenaTree: it must
+ * not be passed to CPLDestroyXMLNode() or to functions that free or
+ * reallocate nodes or values, such as CPLSetXMLValue() or
+ * CPLRemoveXMLChild().  CPLCloneXMLTree() gives a regular tree.
+ */
+
+class CPLXMLArenaTree
+{
+    std::vector<char *> apachBlocks;
+    size_t      nBlockUsed;
+    size_t      nBlockSize;
+    size_t      nAllocated;
+    CPLXMLNode *psRoot;
+
+    CPLXMLArenaTree( const CPLXMLArenaTree & );
+    CPLXMLArenaTree &operator=( const CPLXMLArenaTree & );
+
+    void       *Alloc( size_t nSize )
+    {
+        nSize = (nSize + 7) & ~((size_t) 7);
+        if( apachBlocks.empty() || nBlockUsed + nSize > nBlockSize )
+        {
+            nBlockSize = MAX( (size_t) CPL_XML_ARENA_BLOCK_SIZE, nSize );
+            apachBlocks.push_back( (char *) CPLMalloc( nBlockSize ) );
+            nBlockUsed = 0;
+            nAllocated += nBlockSize;
+        }
+        void *p = apachBlocks.back() + nBlockUsed;
+        nBlockUsed += nSize;
+        return p;
+    }
+
+    CPLXMLNode *NewNode( CPLXMLNodeType eType, const char *pszValue,
+                         size_t nLen )
+    {
+        CPLXMLNode *psNode = (CPLXMLNode *) Alloc( sizeof(CPLXMLNode) );
+        char *pszCopy = (char *) Alloc( nLen + 1 );
+
+        memcpy( pszCopy, pszValue, nLen );
+        pszCopy[nLen] = '\0';
+
+        psNode->eType = eType;
+        psNode->pszValue = pszCopy;
+        psNode->psNext = NULL;
+        psNode->psChild = NULL;
+        return psNode;
+    }
+
+public:
+                CPLXMLArenaTree() : nBlockUsed(0), nBlockSize(0),
+                                    nAllocated(0), psRoot(NULL) {}
+               ~CPLXMLArenaTree() { Clear(); }
+
+    void        Clear()
+    {
+        for( size_t i = 0; i < apachBlocks.size(); i++ )
+            CPLFree( apachBlocks[i] );
+        apachBlocks.clear();
+        nBlockUsed = nBlockSize = nAllocated = 0;
+        psRoot = NULL;
+    }
+
+    /** First top level node, followed by its siblings. */
+    CPLXMLNode *GetRoot() const { return psRoot; }
+
+    /** Number of bytes allocated for the tree. */
+    size_t      GetAllocatedBytes() const { return nAllocated; }
+
+/************************************************************************/
+/*                                Build()                               */
+/************************************************************************/
+
+    /**
+     * Build the tree from the events of a parser, replacing any
+     * previous tree.
+     *
+     * @return the first top level node, or NULL on error or for an empty
+     * document.
+     */
+    CPLXMLNode *Build( CPLXMLStreamParser *poParser )
+    {
+        Clear();
+
+        /* Last child of each open element, to append in O(1). */
+        std::vector<CPLXMLNode *> apsParents, apsLast;
+        CPLXMLNode *psTopLast = NULL;
+        CPLXMLStreamEvent eEvent;
+
+        while( (eEvent = poParser->Next()) > CXSE_EndOfDocument )
+        {
+            CPLXMLNode *psNode = NULL;
+
+            switch( eEvent )
+            {
+              case CXSE_StartElement:
+                psNode = NewNode( CXT_Element, poParser->GetName(),
+                                  poParser->GetNameLength() );
+                break;
+              case CXSE_Attribute:
+                psNode = NewNode( CXT_Attribute, poParser->GetName(),
+                                  poParser->GetNameLength() );
+                psNode->psChild = NewNode( CXT_Text, poParser->GetValue(),
+                                           poParser->GetValueLength() );
+                break;
+              case CXSE_Text:
+                psNode = NewNode( CXT_Text, poParser->GetValue(),
+                                  poParser->GetValueLength() );
+                break;
+              case CXSE_Comment:
+                psNode = NewNode( CXT_Comment, poParser->GetValue(),
+                                  poParser->GetValueLength() );
+                break;
+              case CXSE_Literal:
+                psNode = NewNode( CXT_Literal, poParser->GetValue(),
+                                  poParser->GetValueLength() );
+                break;
+              case CXSE_EndElement:
+                apsParents.pop_back();
+                apsLast.pop_back();
+                continue;
+              default:
+                continue;
+            }
+
+            if( apsParents.empty() )
+            {
+                if( psTopLast == NULL )
+                    psRoot = psNode;
+                else
+                    psTopLast->psNext = psNode;
+                psTopLast = psNode;
+            }
+            else
+            {
+                if( apsLast.back() == NULL )
+                    apsParents.back()->psChild = psNode;
+                else
+                    apsLast.back()->psNext = psNode;
+                apsLast.back() = psNode;
+            }
+
+            if( eEvent == CXSE_StartElement )
+            {
+                apsParents.push_back( psNode );
+                apsLast.push_back( NULL );
+            }
+        }
+
+        if( eEvent == CXSE_Error )
+        {
+            Clear();
+            return NULL;
+        }
+
+        return psRoot;
+    }
+};
+
+#endif /* _CPL_MINIXML_STREAM_H_INCLUDED */
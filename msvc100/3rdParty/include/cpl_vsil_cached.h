@@ -0,0 +1,612 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  CPL - Common Portability Library
+ * Purpose:  /vsicached/ : block level LRU read cache over any VSI path.
+ *
+ ******************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef CPL_VSIL_CACHED_H_INCLUDED
+#define CPL_VSIL_CACHED_H_INCLUDED
+
+#include "cpl_vsi_virtual.h"
+#include "cpl_multiproc.h"
+#include "cpl_conv.h"
+#include "cpl_error.h"
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * \file cpl_vsil_cached.h
+ *
+ * The /vsicached/ virtual file system, installed by
+ * VSIInstallCachedFileHandler(), wraps any other VSI path, such as
+ * /vsicached//data/dem.tif or /vsicached//vsicurl/http://host/dem.tif,
+ * and keeps the blocks read from it in a least recently used cache
+ * shared by all handles and threads.  Once a block of a file is cached,
+ * reading it again, through the same or another handle, does not reach
+ * the underlying file system.
+ *
+ * The underlying file is only opened on the first cache miss of a handle,
+ * so reopening a file whose headers are cached costs a single VSIStatL().
+ * The cached blocks of a file are dropped when its size or modification
+ * time changes.
+ *
+ * The cache is configured when the handler is installed by:
+ * <ul>
+ * <li>VSI_CACHED_SIZE: cache size in bytes, 64 MB by default.</li>
+ * <li>VSI_CACHED_BLOCK_SIZE: block size in bytes, 64 KB by default.</li>
+ * </ul>
+ *
+ * /vsicached/ files are read only.
+ */
+
+/** Metrics of the /vsicached/ cache, see VSICachedGetStats(). */
+typedef struct
+{
+    /*! Blocks found in the cache. */
+    GUIntBig    nHits;
+    /*! Blocks read from the underlying file system. */
+    GUIntBig    nMisses;
+    /*! Blocks evicted to stay under the cache size. */
+    GUIntBig    nEvictions;
+    /*! Reads issued to the underlying files. */
+    GUIntBig    nUnderlyingReads;
+    /*! Bytes read from the underlying files. */
+    GUIntBig    nUnderlyingBytes;
+    /*! Underlying files opened. */
+    GUIntBig    nUnderlyingOpens;
+    /*! Bytes currently cached. */
+    GUIntBig    nCachedBytes;
+} VSICachedStats;
+
+#define VSI_CACHED_PREFIX  "/vsicached/"
+
+/************************************************************************/
+/*                            VSICachedBlock                            */
+/************************************************************************/
+
+class VSICachedBlock
+{
+  public:
+    int             nFileId;
+    vsi_l_offset    nBlock;
+    size_t          nDataSize;      /* Less than the block size at EOF. */
+    GByte          *pabyData;
+
+    VSICachedBlock *poLRUPrev;      /* More recently used. */
+    VSICachedBlock *poLRUNext;      /* Less recently used. */
+};
+
+/************************************************************************/
+/* ==================================================================== */
+/*                      VSICachedFilesystemHandler                      */
+/* ==================================================================== */
+/************************************************************************/
+
+class VSICachedFilesystemHandler : public VSIFilesystemHandler
+{
+    typedef std::pair<int, vsi_l_offset> BlockKey;
+
+    typedef struct
+    {
+        int             nId;
+        vsi_l_offset    nSize;
+        GIntBig         nMTime;
+    } FileInfo;
+
+    void           *hMutex;
+    size_t          nBlockSize;
+    size_t          nMaxBlocks;
+
+    std::map<CPLString, FileInfo>           oFiles;
+    std::map<BlockKey, VSICachedBlock *>    oBlocks;
+    VSICachedBlock *poLRUStart;
+    VSICachedBlock *poLRUEnd;
+    int             nNextFileId;
+    VSICachedStats  sStats;
+
+    /* Must be called with hMutex held. */
+    void            Unlink( VSICachedBlock *poBlock )
+    {
+        if( poBlock->poLRUPrev != NULL )
+            poBlock->poLRUPrev->poLRUNext = poBlock->poLRUNext;
+        else
+            poLRUStart = poBlock->poLRUNext;
+        if( poBlock->poLRUNext != NULL )
+            poBlock->poLRUNext->poLRUPrev = poBlock->poLRUPrev;
+        else
+            poLRUEnd = poBlock->poLRUPrev;
+        poBlock->poLRUPrev = poBlock->poLRUNext = NULL;
+    }
+
+    void            PushFront( VSICachedBlock *poBlock )
+    {
+        poBlock->poLRUPrev = NULL;
+        poBlock->poLRUNext = poLRUStart;
+        if( poLRUStart != NULL )
+            poLRUStart->poLRUPrev = poBlock;
+        poLRUStart = poBlock;
+        if( poLRUEnd == NULL )
+            poLRUEnd = poBlock;
+    }
+
+    void            Drop( VSICachedBlock *poBlock )
+    {
+        Unlink( poBlock );
+        oBlocks.erase( BlockKey( poBlock->nFileId, poBlock->nBlock ) );
+        sStats.nCachedBytes -= poBlock->nDataSize;
+        CPLFree( poBlock->pabyData );
+        delete poBlock;
+    }
+
+    void            DropFile( int nFileId )
+    {
+        std::map<BlockKey, VSICachedBlock *>::iterator oIter =
+            oBlocks.lower_bound( BlockKey( nFileId, 0 ) );
+        while( oIter != oBlocks.end() && oIter->first.first == nFileId )
+        {
+            VSICachedBlock *poBlock = oIter->second;
+            ++oIter;
+            Drop( poBlock );
+        }
+    }
+
+    static const char *Underlying( const char *pszFilename )
+    {
+        if( EQUALN( pszFilename, VSI_CACHED_PREFIX,
+                    strlen(VSI_CACHED_PREFIX) ) )
+            return pszFilename + strlen(VSI_CACHED_PREFIX);
+        return pszFilename;
+    }
+
+  public:
+                    VSICachedFilesystemHandler( size_t nCacheSize,
+                                                size_t nBlockSizeIn ) :
+                        nBlockSize(MAX(nBlockSizeIn, 512)),
+                        poLRUStart(NULL), poLRUEnd(NULL), nNextFileId(0)
+    {
+        nMaxBlocks = MAX( 1, nCacheSize / nBlockSize );
+        memset( &sStats, 0, sizeof(sStats) );
+        hMutex = CPLCreateMutex();
+        CPLReleaseMutex( hMutex );     /* created locked */
+    }
+
+    virtual        ~VSICachedFilesystemHandler()
+    {
+        Clear();
+        CPLDestroyMutex( hMutex );
+    }
+
+    size_t          GetBlockSize() const { return nBlockSize; }
+    size_t          GetMaxBlocks() const { return nMaxBlocks; }
+
+    /** Drop all the cached blocks. */
+    void            Clear()
+    {
+        CPLMutexHolderD( hMutex );
+        while( poLRUEnd != NULL )
+            Drop( poLRUEnd );
+    }
+
+    void            GetStats( VSICachedStats *psStats )
+    {
+        CPLMutexHolderD( hMutex );
+        *psStats = sStats;
+    }
+
+/************************************************************************/
+/*                             Cache access                             */
+/************************************************************************/
+
+    /* Returns the id of a file, dropping its blocks if it has changed. */
+    int             RegisterFile( const char *pszFilename,
+                                  vsi_l_offset nSize, GIntBig nMTime )
+    {
+        CPLMutexHolderD( hMutex );
+
+        std::map<CPLString, FileInfo>::iterator oIter =
+            oFiles.find( pszFilename );
+        if( oIter != oFiles.end() )
+        {
+            if( oIter->second.nSize == nSize
+                && oIter->second.nMTime == nMTime )
+                return oIter->second.nId;
+            DropFile( oIter->second.nId );
+        }
+
+        FileInfo sInfo;
+        sInfo.nId = nNextFileId++;
+        sInfo.nSize = nSize;
+        sInfo.nMTime = nMTime;
+        oFiles[pszFilename] = sInfo;
+        return sInfo.nId;
+    }
+
+    /* Copy the part [nOffset, nOffset+nSize) of a cached block into */
+    /* pabyDst.  Returns the number of bytes copied, or -1 on a miss. */
+    int             ReadCached( int nFileId, vsi_l_offset nBlock,
+                                size_t nOffset, size_t nSize, GByte *pabyDst )
+    {
+        CPLMutexHolderD( hMutex );
+
+        std::map<BlockKey, VSICachedBlock *>::iterator oIter =
+            oBlocks.find( BlockKey( nFileId, nBlock ) );
+        if( oIter == oBlocks.end() )
+            return -1;
+
+        VSICachedBlock *poBlock = oIter->second;
+        sStats.nHits++;
+        if( poBlock != poLRUStart )
+        {
+            Unlink( poBlock );
+            PushFront( poBlock );
+        }
+
+        if( nOffset >= poBlock->nDataSize )
+            return 0;
+        nSize = MIN( nSize, poBlock->nDataSize - nOffset );
+        memcpy( pabyDst, poBlock->pabyData + nOffset, nSize );
+        return (int) nSize;
+    }
+
+    /* Whether a block is cached, without counting a hit. */
+    int             IsCached( int nFileId, vsi_l_offset nBlock )
+    {
+        CPLMutexHolderD( hMutex );
+        return oBlocks.find( BlockKey( nFileId, nBlock ) ) != oBlocks.end();
+    }
+
+    /* Count an underlying read of nBlocks blocks that were missing. */
+    void            CountRead( int nBlocks, size_t nBytesRead )
+    {
+        CPLMutexHolderD( hMutex );
+
+        sStats.nMisses += nBlocks;
+        sStats.nUnderlyingReads++;
+        sStats.nUnderlyingBytes += nBytesRead;
+    }
+
+    /* Add a complete block read from the underlying file. */
+    void            AddBlock( int nFileId, vsi_l_offset nBlock,
+                              const GByte *pabyData, size_t nDataSize )
+    {
+        CPLMutexHolderD( hMutex );
+
+        /* Another thread may have read it meanwhile. */
+        if( oBlocks.find( BlockKey( nFileId, nBlock ) ) != oBlocks.end() )
+            return;
+
+        while( oBlocks.size() >= nMaxBlocks && poLRUEnd != NULL )
+        {
+            Drop( poLRUEnd );
+            sStats.nEvictions++;
+        }
+
+        VSICachedBlock *poBlock = new VSICachedBlock();
+        poBlock->nFileId = nFileId;
+        poBlock->nBlock = nBlock;
+        poBlock->nDataSize = nDataSize;
+        poBlock->pabyData = (GByte *) CPLMalloc( MAX(nDataSize, 1) );
+        memcpy( poBlock->pabyData, pabyData, nDataSize );
+        PushFront( poBlock );
+        oBlocks[BlockKey( nFileId, nBlock )] = poBlock;
+        sStats.nCachedBytes += nDataSize;
+    }
+
+    void            CountOpen()
+    {
+        CPLMutexHolderD( hMutex );
+        sStats.nUnderlyingOpens++;
+    }
+
+/************************************************************************/
+/*                       VSIFilesystemHandler API                       */
+/************************************************************************/
+
+    virtual VSIVirtualHandle *Open( const char *pszFilename,
+                                    const char *pszAccess );
+
+    virtual int     Stat( const char *pszFilename, VSIStatBufL *pStatBuf,
+                          int nFlags )
+        { return VSIStatExL( Underlying(pszFilename), pStatBuf, nFlags ); }
+
+    virtual char  **ReadDir( const char *pszDirname )
+        { return VSIReadDir( Underlying(pszDirname) ); }
+};
+
+/************************************************************************/
+/* ==================================================================== */
+/*                           VSICachedHandle                            */
+/* ==================================================================== */
+/************************************************************************/
+
+class VSICachedHandle : public VSIVirtualHandle
+{
+    VSICachedFilesystemHandler *poFS;
+    CPLString       osUnderlying;
+    VSILFILE       *fpBase;         /* Opened on the first miss. */
+    int             nFileId;
+    vsi_l_offset    nFileSize;
+    vsi_l_offset    nCurOffset;
+    int             bEOF;
+    std::vector<GByte> abyMissBuf;
+
+    /* Read nBlocks blocks from the underlying file into abyMissBuf, */
+    /* and return the number of bytes read.  Only the complete blocks */
+    /* go into the cache, if bCache, so that a failed or short read is */
+    /* retried on the next access rather than remembered. */
+    size_t          ReadBlocks( vsi_l_offset nFirstBlock, int nBlocks,
+                                int bCache )
+    {
+        const size_t nBlockSize = poFS->GetBlockSize();
+
+        if( fpBase == NULL )
+        {
+            fpBase = VSIFOpenL( osUnderlying, "rb" );
+            if( fpBase == NULL )
+                return 0;
+            poFS->CountOpen();
+        }
+
+        const vsi_l_offset nStart = nFirstBlock * nBlockSize;
+        if( nStart >= nFileSize )
+            return 0;
+        const size_t nToRead = (size_t)
+            MIN( (vsi_l_offset) nBlocks * nBlockSize, nFileSize - nStart );
+
+        abyMissBuf.resize( nToRead );
+        if( VSIFSeekL( fpBase, nStart, SEEK_SET ) != 0 )
+            return 0;
+        const size_t nRead = VSIFReadL( &abyMissBuf[0], 1, nToRead, fpBase );
+
+        poFS->CountRead( nBlocks, nRead );
+
+        for( int i = 0; bCache && i < nBlocks; i++ )
+        {
+            const size_t nOff = i * nBlockSize;
+            if( nOff >= nRead )
+                break;
+
+            /* A block is complete when full, or when it ends the file. */
+            const size_t nDataSize = MIN( nBlockSize, nRead - nOff );
+            if( nDataSize < nBlockSize
+                && nStart + nOff + nDataSize != nFileSize )
+                break;
+
+            poFS->AddBlock( nFileId, nFirstBlock + i, &abyMissBuf[0] + nOff,
+                            nDataSize );
+        }
+
+        return nRead;
+    }
+
+  public:
+                    VSICachedHandle( VSICachedFilesystemHandler *poFSIn,
+                                     const char *pszUnderlying,
+                                     int nFileIdIn, vsi_l_offset nFileSizeIn ) :
+                        poFS(poFSIn), osUnderlying(pszUnderlying),
+                        fpBase(NULL), nFileId(nFileIdIn),
+                        nFileSize(nFileSizeIn), nCurOffset(0), bEOF(FALSE) {}
+
+    virtual        ~VSICachedHandle() { Close(); }
+
+    virtual int     Seek( vsi_l_offset nOffset, int nWhence )
+    {
+        bEOF = FALSE;
+        if( nWhence == SEEK_SET )
+            nCurOffset = nOffset;
+        else if( nWhence == SEEK_CUR )
+            nCurOffset += nOffset;
+        else
+            nCurOffset = nFileSize + nOffset;
+        return 0;
+    }
+
+    virtual vsi_l_offset Tell() { return nCurOffset; }
+
+    virtual size_t  Read( void *pBuffer, size_t nSize, size_t nMemb )
+    {
+        const size_t nBlockSize = poFS->GetBlockSize();
+        size_t nToRead = nSize * nMemb;
+        size_t nDone = 0;
+        GByte *pabyDst = (GByte *) pBuffer;
+
+        if( nSize == 0 )
+            return 0;
+
+        if( nCurOffset >= nFileSize )
+            nToRead = 0;
+        else if( nToRead > nFileSize - nCurOffset )
+            nToRead = (size_t) (nFileSize - nCurOffset);
+
+        while( nDone < nToRead )
+        {
+            const vsi_l_offset nBlock = nCurOffset / nBlockSize;
+            const size_t nInBlock = (size_t) (nCurOffset % nBlockSize);
+            const size_t nChunk = MIN( nToRead - nDone,
+                                       nBlockSize - nInBlock );
+
+            const int nCopied = poFS->ReadCached( nFileId, nBlock, nInBlock,
+                                                  nChunk, pabyDst + nDone );
+            if( nCopied < 0 )
+            {
+/* -------------------------------------------------------------------- */
+/*      Miss: read it with the following blocks of the request that     */
+/*      are not cached either, in a single underlying read, and serve   */
+/*      all of them from that read.  A run longer than the cache would  */
+/*      evict itself, so it is not cached.                              */
+/* -------------------------------------------------------------------- */
+                const vsi_l_offset nLastBlock =
+                    (nCurOffset + (nToRead - nDone) - 1) / nBlockSize;
+                int nBlocks = 1;
+                while( nBlock + nBlocks <= nLastBlock
+                       && !poFS->IsCached( nFileId, nBlock + nBlocks ) )
+                    nBlocks++;
+
+                const size_t nRead = ReadBlocks(
+                    nBlock, nBlocks, (size_t) nBlocks <= poFS->GetMaxBlocks() );
+                const size_t nAvail = nRead > nInBlock ? nRead - nInBlock : 0;
+                const size_t nWanted =
+                    MIN( nToRead - nDone, nBlocks * nBlockSize - nInBlock );
+                const size_t nSpan = MIN( nWanted, nAvail );
+
+                /* Copy what was read, even if short. */
+                if( nSpan > 0 )
+                    memcpy( pabyDst + nDone, &abyMissBuf[0] + nInBlock,
+                            nSpan );
+                nDone += nSpan;
+                nCurOffset += nSpan;
+                if( nSpan < nWanted )
+                    break;
+                continue;
+            }
+
+            nDone += nCopied;
+            nCurOffset += nCopied;
+            if( (size_t) nCopied < nChunk )
+                break;
+        }
+
+        if( nDone < nSize * nMemb )
+            bEOF = TRUE;
+
+        return nDone / nSize;
+    }
+
+    virtual size_t  Write( const void *, size_t, size_t )
+    {
+        CPLError( CE_Failure, CPLE_NotSupported,
+                  "%s files are read only.", VSI_CACHED_PREFIX );
+        return 0;
+    }
+
+    virtual int     Eof() { return bEOF; }
+
+    virtual int     Close()
+    {
+        if( fpBase != NULL )
+            VSIFCloseL( fpBase );
+        fpBase = NULL;
+        return 0;
+    }
+};
+
+/************************************************************************/
+/*                 VSICachedFilesystemHandler::Open()                   */
+/************************************************************************/
+
+inline VSIVirtualHandle *
+VSICachedFilesystemHandler::Open( const char *pszFilename,
+                                  const char *pszAccess )
+{
+    if( strchr( pszAccess, 'w' ) != NULL || strchr( pszAccess, '+' ) != NULL
+        || strchr( pszAccess, 'a' ) != NULL )
+    {
+        CPLError( CE_Failure, CPLE_NotSupported,
+                  "Only read-only mode is supported for %s.",
+                  VSI_CACHED_PREFIX );
+        return NULL;
+    }
+
+    const char *pszUnderlying = Underlying( pszFilename );
+    VSIStatBufL sStat;
+
+    if( VSIStatExL( pszUnderlying, &sStat,
+                    VSI_STAT_EXISTS_FLAG | VSI_STAT_NATURE_FLAG
+                    | VSI_STAT_SIZE_FLAG ) != 0
+        || VSI_ISDIR( sStat.st_mode ) )
+        return NULL;
+
+    const int nFileId = RegisterFile( pszUnderlying,
+                                      (vsi_l_offset) sStat.st_size,
+                                      (GIntBig) sStat.st_mtime );
+
+    return new VSICachedHandle( this, pszUnderlying, nFileId,
+                                (vsi_l_offset) sStat.st_size );
+}
+
+/************************************************************************/
+/*                    VSIInstallCachedFileHandler()                     */
+/************************************************************************/
+
+/**
+ * Install the /vsicached/ file system handler.
+ *
+ * VSI_CACHED_SIZE and VSI_CACHED_BLOCK_SIZE are read at that time.
+ * Installing it again replaces the cache.
+ */
+
+static inline void VSIInstallCachedFileHandler()
+{
+    const size_t nCacheSize = (size_t) CPLScanUIntBig(
+        CPLGetConfigOption( "VSI_CACHED_SIZE", "67108864" ), 20 );
+    const size_t nBlockSize = (size_t) atoi(
+        CPLGetConfigOption( "VSI_CACHED_BLOCK_SIZE", "65536" ) );
+
+    VSIFileManager::InstallHandler(
+        VSI_CACHED_PREFIX,
+        new VSICachedFilesystemHandler( nCacheSize, nBlockSize ) );
+}
+
+/************************************************************************/
+/*                         VSICachedGetStats()                          */
+/************************************************************************/
+
+/**
+ * Fetch the metrics of the /vsicached/ cache.
+ *
+ * @return FALSE if the handler is not installed.
+ */
+
+static inline int VSICachedGetStats( VSICachedStats *psStats )
+{
+    VSICachedFilesystemHandler *poFS =
+        dynamic_cast<VSICachedFilesystemHandler *>(
+            VSIFileManager::GetHandler( VSI_CACHED_PREFIX ) );
+
+    memset( psStats, 0, sizeof(VSICachedStats) );
+    if( poFS == NULL )
+        return FALSE;
+    poFS->GetStats( psStats );
+    return TRUE;
+}
+
+/************************************************************************/
+/*                         VSICachedClearCache()                        */
+/************************************************************************/
+
+/** Drop all the blocks of the /vsicached/ cache. */
+
+static inline void VSICachedClearCache()
+{
+    VSICachedFilesystemHandler *poFS =
+        dynamic_cast<VSICachedFilesystemHandler *>(
+            VSIFileManager::GetHandler( VSI_CACHED_PREFIX ) );
+
+    if( poFS != NULL )
+        poFS->Clear();
+}
+
+#endif /* ndef CPL_VSIL_CACHED_H_INCLUDED */
@@ -0,0 +1,587 @@
+/**********************************************************************
+ * $Id$
+ *
+ * Project:  CPL - Common Portability Library
+ * Purpose:  Worker thread pool with job groups and work stealing.
+ *
+ **********************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef _CPL_WORKER_THREAD_POOL_H_INCLUDED_
+#define _CPL_WORKER_THREAD_POOL_H_INCLUDED_
+
+#include "cpl_multiproc.h"
+#include "cpl_conv.h"
+#include "cpl_error.h"
+#include "cpl_string.h"
+#include <deque>
+#include <vector>
+
+/**
+ * \file cpl_worker_thread_pool.h
+ *
+ * Pool of worker threads running jobs, so that the parallel algorithms
+ * (warping, gridding, overviews...) can share a fixed set of threads
+ * rather than each starting its own.
+ *
+ * <ul>
+ * <li>Jobs submitted from outside the pool go to a shared queue, taken in
+ * submission order.  When it holds the maximum number of queued jobs,
+ * SubmitJob() blocks until a worker takes one.</li>
+ * <li>Jobs submitted by a job running in the pool go to the deque of its
+ * worker, which runs them most recent first.  Idle workers steal the
+ * oldest jobs of the other deques.  A worker never blocks on a full
+ * queue: it runs the job at once instead.</li>
+ * <li>Jobs can be put in a CPLJobGroup, and WaitGroup() waits for all the
+ * jobs of a group.  The waiting thread runs queued jobs meanwhile, so
+ * waiting from inside a job does not deadlock.</li>
+ * <li>The CPLError() messages of the jobs do not go to the error handlers
+ * of the threads running them, workers or waiting threads.  The first
+ * error of the highest class of the jobs of a group is raised again by
+ * WaitGroup(), on the waiting thread, and that of the jobs without a
+ * group by WaitCompletion().</li>
+ * </ul>
+ *
+ *     static void ProcessTile( void *pData ) { ... }
+ *
+ *     CPLWorkerThreadPool *poPool = CPLGetGlobalWorkerThreadPool();
+ *     CPLJobGroup oGroup;
+ *     for( int i = 0; i < nTiles; i++ )
+ *         poPool->SubmitJob( ProcessTile, &asTiles[i], &oGroup );
+ *     poPool->WaitGroup( &oGroup );
+ */
+
+/** Group of jobs that can be waited for with WaitGroup(). */
+class CPLJobGroup
+{
+  public:
+    /* Protected by the pool mutex. */
+    int         nRemaining;
+
+    /* First error of the highest class raised by the jobs. */
+    CPLErr      eErrClass;
+    int         nErrNo;
+    CPLString   osErrMsg;
+
+                CPLJobGroup() : nRemaining(0), eErrClass(CE_None),
+                                nErrNo(CPLE_None) {}
+};
+
+/************************************************************************/
+/* ==================================================================== */
+/*                          CPLWorkerThreadPool                         */
+/* ==================================================================== */
+/************************************************************************/
+
+class CPLWorkerThreadPool
+{
+    typedef struct
+    {
+        CPLThreadFunc   pfnFunc;
+        void           *pData;
+        CPLJobGroup    *poGroup;
+    } Job;
+
+    typedef struct
+    {
+        CPLWorkerThreadPool *poPool;
+        int             iWorker;
+        void           *hThread;
+        GIntBig         nThreadId;
+        void           *hDequeMutex;
+        std::deque<Job> aoDeque;        /* Jobs submitted by this worker. */
+    } Worker;
+
+    std::vector<Worker *> apoWorkers;
+
+    /* hMutex protects everything below. */
+    void           *hMutex;
+    void           *hJobCond;       /* Signalled when a job is queued. */
+    void           *hDoneCond;      /* Broadcast when a job completes. */
+    void           *hSpaceCond;     /* Signalled when the queue shrinks. */
+    std::deque<Job> aoQueue;        /* Jobs submitted from outside. */
+    int             nMaxQueued;
+    int             nQueued;        /* In aoQueue and in the deques. */
+    int             nUnfinished;    /* Queued and running. */
+    int             nSleeping;
+    int             nDoneWaiters;
+    int             nStarted;
+    int             bStop;
+    CPLJobGroup     oNoGroup;       /* Errors of the jobs without group. */
+
+    CPLWorkerThreadPool( const CPLWorkerThreadPool & );
+    CPLWorkerThreadPool &operator=( const CPLWorkerThreadPool & );
+
+    /* Index of the worker running on the calling thread, or -1. */
+    int             GetCurrentWorker() const
+    {
+        const GIntBig nId = CPLGetPID();
+        for( size_t i = 0; i < apoWorkers.size(); i++ )
+        {
+            if( apoWorkers[i]->nThreadId == nId )
+                return (int) i;
+        }
+        return -1;
+    }
+
+    void            DequeuedFromDeque()
+    {
+        CPLAcquireMutex( hMutex, 1000.0 );
+        nQueued--;
+        CPLCondSignal( hSpaceCond );
+        CPLReleaseMutex( hMutex );
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Take a job: from the own deque of the worker (newest first),    */
+/*      then from the shared queue, then from the other deques          */
+/*      (oldest first).                                                 */
+/* -------------------------------------------------------------------- */
+    int             TakeJob( int iWorker, Job *psJob )
+    {
+        const int nWorkers = (int) apoWorkers.size();
+
+        if( iWorker >= 0 )
+        {
+            Worker *poWorker = apoWorkers[iWorker];
+            CPLAcquireMutex( poWorker->hDequeMutex, 1000.0 );
+            const int bFound = !poWorker->aoDeque.empty();
+            if( bFound )
+            {
+                *psJob = poWorker->aoDeque.back();
+                poWorker->aoDeque.pop_back();
+            }
+            CPLReleaseMutex( poWorker->hDequeMutex );
+            if( bFound )
+            {
+                DequeuedFromDeque();
+                return TRUE;
+            }
+        }
+
+        CPLAcquireMutex( hMutex, 1000.0 );
+        if( !aoQueue.empty() )
+        {
+            *psJob = aoQueue.front();
+            aoQueue.pop_front();
+            nQueued--;
+            CPLCondSignal( hSpaceCond );
+            CPLReleaseMutex( hMutex );
+            return TRUE;
+        }
+        const int bAnyQueued = nQueued > 0;
+        CPLReleaseMutex( hMutex );
+
+        for( int i = 1; bAnyQueued && i <= nWorkers; i++ )
+        {
+            Worker *poVictim = apoWorkers[(MAX(iWorker, 0) + i) % nWorkers];
+            CPLAcquireMutex( poVictim->hDequeMutex, 1000.0 );
+            const int bFound = !poVictim->aoDeque.empty();
+            if( bFound )
+            {
+                *psJob = poVictim->aoDeque.front();
+                poVictim->aoDeque.pop_front();
+            }
+            CPLReleaseMutex( poVictim->hDequeMutex );
+            if( bFound )
+            {
+                DequeuedFromDeque();
+                return TRUE;
+            }
+        }
+
+        return FALSE;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Keep the first error of the highest class raised by a job, for  */
+/*      its waiter.  Debug messages go through.                         */
+/* -------------------------------------------------------------------- */
+    static void CPL_STDCALL JobErrorHandler( CPLErr eErrClass, int nErrNo,
+                                             const char *pszMsg )
+    {
+        if( eErrClass == CE_Debug )
+        {
+            CPLDefaultErrorHandler( eErrClass, nErrNo, pszMsg );
+            return;
+        }
+
+        CPLJobGroup *poErrors = (CPLJobGroup *) CPLGetErrorHandlerUserData();
+        if( eErrClass > poErrors->eErrClass )
+        {
+            poErrors->eErrClass = eErrClass;
+            poErrors->nErrNo = nErrNo;
+            poErrors->osErrMsg = pszMsg;
+        }
+    }
+
+    void            RunJob( const Job &sJob )
+    {
+        CPLJobGroup oErrors;
+
+        CPLPushErrorHandlerEx( JobErrorHandler, &oErrors );
+        sJob.pfnFunc( sJob.pData );
+        CPLPopErrorHandler();
+
+        CPLAcquireMutex( hMutex, 1000.0 );
+        CPLJobGroup *poGroup = sJob.poGroup ? sJob.poGroup : &oNoGroup;
+        if( oErrors.eErrClass > poGroup->eErrClass )
+        {
+            poGroup->eErrClass = oErrors.eErrClass;
+            poGroup->nErrNo = oErrors.nErrNo;
+            poGroup->osErrMsg.swap( oErrors.osErrMsg );
+        }
+        nUnfinished--;
+        if( sJob.poGroup != NULL )
+            sJob.poGroup->nRemaining--;
+        if( nDoneWaiters > 0 )
+            CPLCondBroadcast( hDoneCond );
+        CPLReleaseMutex( hMutex );
+    }
+
+    static void     WorkerMain( void *pData )
+    {
+        Worker *poWorker = (Worker *) pData;
+        CPLWorkerThreadPool *poPool = poWorker->poPool;
+
+        CPLAcquireMutex( poPool->hMutex, 1000.0 );
+        poWorker->nThreadId = CPLGetPID();
+        poPool->nStarted++;
+        CPLCondBroadcast( poPool->hDoneCond );
+        CPLReleaseMutex( poPool->hMutex );
+
+        for( ;; )
+        {
+            Job sJob;
+            if( poPool->TakeJob( poWorker->iWorker, &sJob ) )
+            {
+                poPool->RunJob( sJob );
+                continue;
+            }
+
+            CPLAcquireMutex( poPool->hMutex, 1000.0 );
+            if( poPool->nQueued == 0 )
+            {
+                if( poPool->bStop )
+                {
+                    CPLReleaseMutex( poPool->hMutex );
+                    break;
+                }
+                poPool->nSleeping++;
+                CPLCondWait( poPool->hJobCond, poPool->hMutex );
+                poPool->nSleeping--;
+            }
+            CPLReleaseMutex( poPool->hMutex );
+        }
+    }
+
+  public:
+
+/************************************************************************/
+/*                         CPLWorkerThreadPool()                        */
+/************************************************************************/
+
+    /**
+     * Start a pool.
+     *
+     * @param nThreads number of worker threads.  If 0 or less, the
+     * GDAL_NUM_THREADS configuration option (a number or ALL_CPUS) is
+     * used, and CPLGetNumCPUs() if it is not set.
+     * @param nMaxQueuedJobs maximum number of queued jobs, beyond which
+     * SubmitJob() blocks (0 for no limit).
+     */
+    explicit        CPLWorkerThreadPool( int nThreads = 0,
+                                         int nMaxQueuedJobs = 0 ) :
+                        nMaxQueued(nMaxQueuedJobs), nQueued(0),
+                        nUnfinished(0), nSleeping(0), nDoneWaiters(0),
+                        nStarted(0), bStop(FALSE)
+    {
+        if( nThreads <= 0 )
+        {
+            const char *pszNumThreads =
+                CPLGetConfigOption( "GDAL_NUM_THREADS", NULL );
+            if( pszNumThreads == NULL || EQUAL(pszNumThreads, "ALL_CPUS") )
+                nThreads = CPLGetNumCPUs();
+            else
+                nThreads = atoi( pszNumThreads );
+        }
+        nThreads = MAX( 1, nThreads );
+
+        hMutex = CPLCreateMutex();
+        CPLReleaseMutex( hMutex );     /* created locked */
+        hJobCond = CPLCreateCond();
+        hDoneCond = CPLCreateCond();
+        hSpaceCond = CPLCreateCond();
+
+        /* The workers all exist before any starts looking at the others, */
+        /* and all have registered their thread id before jobs come. */
+        for( int i = 0; i < nThreads; i++ )
+        {
+            Worker *poWorker = new Worker();
+            poWorker->poPool = this;
+            poWorker->iWorker = i;
+            poWorker->hThread = NULL;
+            poWorker->nThreadId = -1;
+            poWorker->hDequeMutex = CPLCreateMutex();
+            CPLReleaseMutex( poWorker->hDequeMutex );
+            apoWorkers.push_back( poWorker );
+        }
+
+        int nCreated = 0;
+        for( int i = 0; i < nThreads; i++ )
+        {
+            apoWorkers[i]->hThread =
+                CPLCreateJoinableThread( WorkerMain, apoWorkers[i] );
+            if( apoWorkers[i]->hThread != NULL )
+                nCreated++;
+            else
+                CPLError( CE_Failure, CPLE_AppDefined,
+                          "Cannot start worker thread %d.", i );
+        }
+
+        CPLAcquireMutex( hMutex, 1000.0 );
+        while( nStarted < nCreated )
+            CPLCondWait( hDoneCond, hMutex );
+        CPLReleaseMutex( hMutex );
+    }
+
+/************************************************************************/
+/*                        ~CPLWorkerThreadPool()                        */
+/************************************************************************/
+
+    /** Run the jobs still queued, and stop the workers. */
+                   ~CPLWorkerThreadPool()
+    {
+        WaitCompletion();
+
+        CPLAcquireMutex( hMutex, 1000.0 );
+        bStop = TRUE;
+        CPLCondBroadcast( hJobCond );
+        CPLReleaseMutex( hMutex );
+
+        for( size_t i = 0; i < apoWorkers.size(); i++ )
+        {
+            if( apoWorkers[i]->hThread != NULL )
+                CPLJoinThread( apoWorkers[i]->hThread );
+            CPLDestroyMutex( apoWorkers[i]->hDequeMutex );
+            delete apoWorkers[i];
+        }
+
+        CPLDestroyCond( hJobCond );
+        CPLDestroyCond( hDoneCond );
+        CPLDestroyCond( hSpaceCond );
+        CPLDestroyMutex( hMutex );
+    }
+
+    int             GetThreadCount() const { return (int) apoWorkers.size(); }
+
+/************************************************************************/
+/*                             SubmitJob()                              */
+/************************************************************************/
+
+    /**
+     * Queue a job.
+     *
+     * @param pfnFunc function running the job.
+     * @param pData argument of pfnFunc.
+     * @param poGroup group of the job, or NULL.
+     */
+    void            SubmitJob( CPLThreadFunc pfnFunc, void *pData,
+                               CPLJobGroup *poGroup = NULL )
+    {
+        Job sJob;
+        sJob.pfnFunc = pfnFunc;
+        sJob.pData = pData;
+        sJob.poGroup = poGroup;
+
+        const int iWorker = GetCurrentWorker();
+
+        CPLAcquireMutex( hMutex, 1000.0 );
+
+        if( iWorker < 0 )
+        {
+            while( nMaxQueued > 0 && nQueued >= nMaxQueued )
+                CPLCondWait( hSpaceCond, hMutex );
+        }
+        else if( nMaxQueued > 0 && nQueued >= nMaxQueued )
+        {
+            nUnfinished++;
+            if( poGroup != NULL )
+                poGroup->nRemaining++;
+            CPLReleaseMutex( hMutex );
+            RunJob( sJob );
+            return;
+        }
+
+        nUnfinished++;
+        nQueued++;
+        if( poGroup != NULL )
+            poGroup->nRemaining++;
+
+        if( iWorker < 0 )
+            aoQueue.push_back( sJob );
+        else
+        {
+            /* Pushed under hMutex so that nQueued > 0 implies a job */
+            /* can be found. */
+            Worker *poWorker = apoWorkers[iWorker];
+            CPLAcquireMutex( poWorker->hDequeMutex, 1000.0 );
+            poWorker->aoDeque.push_back( sJob );
+            CPLReleaseMutex( poWorker->hDequeMutex );
+        }
+
+        if( nSleeping > 0 )
+            CPLCondSignal( hJobCond );
+        if( nDoneWaiters > 0 )
+            CPLCondBroadcast( hDoneCond );
+        CPLReleaseMutex( hMutex );
+    }
+
+/************************************************************************/
+/*                             WaitGroup()                              */
+/************************************************************************/
+
+    /**
+     * Wait until the jobs of a group are done, running queued jobs of any
+     * group meanwhile, and raise the error kept from its jobs if any.
+     */
+    void            WaitGroup( CPLJobGroup *poGroup )
+    {
+        WaitUntil( poGroup, 0 );
+    }
+
+    /**
+     * Wait until at most nMaxRemainingJobs jobs of the pool are queued or
+     * running, running queued jobs meanwhile, and raise the error kept
+     * from the jobs without a group if any.
+     */
+    void            WaitCompletion( int nMaxRemainingJobs = 0 )
+    {
+        WaitUntil( NULL, nMaxRemainingJobs );
+    }
+
+  private:
+    void            WaitUntil( CPLJobGroup *poGroup, int nMaxRemaining )
+    {
+        const int iWorker = GetCurrentWorker();
+
+        for( ;; )
+        {
+            CPLAcquireMutex( hMutex, 1000.0 );
+            int nRemaining = poGroup ? poGroup->nRemaining : nUnfinished;
+            const int bQueued = nQueued > 0;
+            CPLReleaseMutex( hMutex );
+
+            if( nRemaining <= nMaxRemaining )
+                break;
+
+            Job sJob;
+            if( bQueued && TakeJob( iWorker, &sJob ) )
+            {
+                RunJob( sJob );
+                continue;
+            }
+
+            CPLAcquireMutex( hMutex, 1000.0 );
+            nRemaining = poGroup ? poGroup->nRemaining : nUnfinished;
+            if( nRemaining > nMaxRemaining && nQueued == 0 )
+            {
+                nDoneWaiters++;
+                CPLCondWait( hDoneCond, hMutex );
+                nDoneWaiters--;
+            }
+            CPLReleaseMutex( hMutex );
+        }
+
+/* -------------------------------------------------------------------- */
+/*      Raise the error of the jobs on this thread.                     */
+/* -------------------------------------------------------------------- */
+        CPLJobGroup oErrors;
+
+        CPLAcquireMutex( hMutex, 1000.0 );
+        CPLJobGroup *poErrors = poGroup ? poGroup : &oNoGroup;
+        oErrors.eErrClass = poErrors->eErrClass;
+        oErrors.nErrNo = poErrors->nErrNo;
+        oErrors.osErrMsg.swap( poErrors->osErrMsg );
+        poErrors->eErrClass = CE_None;
+        poErrors->nErrNo = CPLE_None;
+        CPLReleaseMutex( hMutex );
+
+        if( oErrors.eErrClass != CE_None )
+            CPLError( oErrors.eErrClass, oErrors.nErrNo, "%s",
+                      oErrors.osErrMsg.c_str() );
+    }
+
+    friend CPLWorkerThreadPool *CPLGetGlobalWorkerThreadPool();
+    friend void CPLCleanupGlobalWorkerThreadPool();
+
+    static CPLWorkerThreadPool **GetGlobalPoolPtr()
+    {
+        static CPLWorkerThreadPool *poGlobalPool = NULL;
+        return &poGlobalPool;
+    }
+
+    static void   **GetGlobalMutexPtr()
+    {
+        static void *hGlobalMutex = NULL;
+        return &hGlobalMutex;
+    }
+};
+
+/************************************************************************/
+/*                    CPLGetGlobalWorkerThreadPool()                    */
+/************************************************************************/
+
+/**
+ * Return the pool shared by the parallel algorithms, started on first
+ * use with the default number of threads.
+ */
+
+inline CPLWorkerThreadPool *CPLGetGlobalWorkerThreadPool()
+{
+    CPLMutexHolderD( CPLWorkerThreadPool::GetGlobalMutexPtr() );
+
+    CPLWorkerThreadPool **ppoPool = CPLWorkerThreadPool::GetGlobalPoolPtr();
+    if( *ppoPool == NULL )
+        *ppoPool = new CPLWorkerThreadPool();
+    return *ppoPool;
+}
+
+/************************************************************************/
+/*                  CPLCleanupGlobalWorkerThreadPool()                  */
+/************************************************************************/
+
+/** Stop the shared pool, after its queued jobs are done. */
+
+inline void CPLCleanupGlobalWorkerThreadPool()
+{
+    CPLWorkerThreadPool *poPool = NULL;
+    {
+        CPLMutexHolderD( CPLWorkerThreadPool::GetGlobalMutexPtr() );
+        CPLWorkerThreadPool **ppoPool =
+            CPLWorkerThreadPool::GetGlobalPoolPtr();
+        poPool = *ppoPool;
+        *ppoPool = NULL;
+    }
+    delete poPool;
+}
+
+#endif /* _CPL_WORKER_THREAD_POOL_H_INCLUDED_ */
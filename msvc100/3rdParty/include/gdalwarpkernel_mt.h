@@ -0,0 +1,557 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  High Performance Image Reprojector
+ * Purpose:  Multi-threaded execution of a GDALWarpKernel.
+ *
+ ******************************************************************************
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef GDALWARPKERNEL_MT_H_INCLUDED
+#define GDALWARPKERNEL_MT_H_INCLUDED
+
+/*
+ * GDALWarpKernel::PerformWarp() can itself spread the destination window
+ * over the threads given by the NUM_THREADS warp option or the
+ * GDAL_NUM_THREADS configuration option, provided that GDAL can clone
+ * the transformer.  GDALWarpKernelPerformWarpMT() runs the same kernel
+ * on several threads with any transformer, each one producing a band of
+ * destination rows:
+ *
+ *  - for nearest, bilinear and cubic resampling, whose result does not
+ *    depend on the size of the destination window, each thread runs a
+ *    copy of the kernel restricted to its rows (nDstYOff/nDstYSize and
+ *    the destination buffers are moved accordingly);
+ *
+ *  - for the other algorithms, whose filter footprint is derived from
+ *    nDstYSize / nSrcYSize, each thread runs a copy of the full kernel
+ *    and the transformer reports the destination rows outside of its
+ *    band as failed, so that they are skipped.
+ *
+ * In both cases every destination pixel is computed by the unmodified
+ * kernel code from exactly the same inputs as in the single threaded
+ * case, so the output is identical.  Band boundaries are chosen so that
+ * no two threads write to the same 32 bit word of panDstValid.
+ *
+ * The transformer is cloned for each thread through
+ * GDALSerializeTransformer() / GDALDeserializeTransformer() when it
+ * supports it (all the GDAL transformers do), and is otherwise shared
+ * and called under a mutex.  Progress from the threads is merged into
+ * a single progress report, and cancellation stops all the threads.
+ *
+ * The number of threads is taken from the NUM_THREADS warp option or
+ * the GDAL_NUM_THREADS configuration option (a number or ALL_CPUS), and
+ * defaults to 1 when neither is set, as for GDALGridCreateMT(), in which
+ * case PerformWarp() is simply called.  The
+ * calling thread takes part, and the other ones are jobs of the shared
+ * CPLGetGlobalWorkerThreadPool().  The kernels of the jobs are run with
+ * NUM_THREADS=1, so that PerformWarp() does not start threads of its
+ * own.
+ *
+ *     GDALWarpKernel oWK;
+ *     ... set up oWK as for PerformWarp() ...
+ *     eErr = GDALWarpKernelPerformWarpMT( &oWK );
+ */
+
+#include "gdalwarper.h"
+#include "gdal_alg.h"
+#include "cpl_multiproc.h"
+#include "cpl_worker_thread_pool.h"
+#include "cpl_atomic_ops.h"
+#include "cpl_minixml.h"
+#include "cpl_string.h"
+#include <vector>
+
+/* Minimum number of destination rows handled by one thread. */
+#define GWKMT_MIN_ROWS  8
+
+typedef struct _GWKMTContext GWKMTContext;
+
+typedef struct
+{
+    GWKMTContext       *psCtx;
+
+    GDALWarpKernel     *poWK;          /* The caller's kernel. */
+    int                 nRowStart;     /* Destination rows [start,end) */
+    int                 nRowEnd;       /* relative to poWK->nDstYOff. */
+    int                 bFullKernel;   /* Run the full kernel, mask rows. */
+
+    GDALTransformerFunc pfnTransformer;
+    void               *pTransformerArg;
+    int                 bOwnTransformer;
+
+    double              dfComplete;
+    CPLErr              eErr;
+} GWKMTJob;
+
+struct _GWKMTContext
+{
+    GDALWarpKernel     *poWK;
+    void               *hMutex;        /* Protects progress, bCancelled */
+                                       /* and shared transformer calls. */
+    int                 bCancelled;
+    volatile int        nNextJob;
+    std::vector<GWKMTJob> asJobs;
+};
+
+/************************************************************************/
+/*                        GWKMTGetThreadCount()                         */
+/************************************************************************/
+
+static inline int GWKMTGetThreadCount( GDALWarpKernel *poWK )
+{
+    const char *pszThreads =
+        CSLFetchNameValue( poWK->papszWarpOptions, "NUM_THREADS" );
+    if( pszThreads == NULL )
+        pszThreads = CPLGetConfigOption( "GDAL_NUM_THREADS", "1" );
+
+    int nThreads;
+    if( EQUAL(pszThreads, "ALL_CPUS") )
+        nThreads = CPLGetNumCPUs();
+    else
+        nThreads = atoi( pszThreads );
+
+    return MAX( nThreads, 1 );
+}
+
+/************************************************************************/
+/*                           GWKMTTransform()                           */
+/*                                                                      */
+/*      Transformer handed to the per-thread kernels.                   */
+/************************************************************************/
+
+static int GWKMTTransform( void *pTransformerArg,
+                           int bDstToSrc, int nPointCount,
+                           double *x, double *y, double *z, int *panSuccess )
+{
+    GWKMTJob *psJob = (GWKMTJob *) pTransformerArg;
+    GWKMTContext *psCtx = psJob->psCtx;
+
+/* -------------------------------------------------------------------- */
+/*      When running the full kernel, destination rows outside of       */
+/*      this job are not transformed.  The kernel transforms one        */
+/*      destination row at a time, so a whole call is normally in or    */
+/*      out of the job.                                                 */
+/* -------------------------------------------------------------------- */
+    int bMasked = FALSE;
+
+    if( psJob->bFullKernel && bDstToSrc && nPointCount > 0 )
+    {
+        const double dfRowStart = psJob->poWK->nDstYOff + psJob->nRowStart;
+        const double dfRowEnd = psJob->poWK->nDstYOff + psJob->nRowEnd;
+        int i, nInside = 0;
+
+        for( i = 0; i < nPointCount; i++ )
+        {
+            if( y[i] >= dfRowStart && y[i] < dfRowEnd )
+                nInside++;
+        }
+
+        if( nInside == 0 )
+        {
+            for( i = 0; i < nPointCount; i++ )
+                panSuccess[i] = FALSE;
+            return TRUE;
+        }
+
+        bMasked = (nInside != nPointCount);
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Call the real transformer.                                      */
+/* -------------------------------------------------------------------- */
+    double *padfY = NULL;
+    if( bMasked )
+    {
+        padfY = (double *) CPLMalloc( sizeof(double) * nPointCount );
+        memcpy( padfY, y, sizeof(double) * nPointCount );
+    }
+
+    int bResult;
+    if( psJob->bOwnTransformer )
+    {
+        bResult = psJob->pfnTransformer( psJob->pTransformerArg, bDstToSrc,
+                                         nPointCount, x, y, z, panSuccess );
+    }
+    else
+    {
+        CPLAcquireMutex( psCtx->hMutex, 1000.0 );
+        bResult = psJob->pfnTransformer( psJob->pTransformerArg, bDstToSrc,
+                                         nPointCount, x, y, z, panSuccess );
+        CPLReleaseMutex( psCtx->hMutex );
+    }
+
+    if( bMasked )
+    {
+        const double dfRowStart = psJob->poWK->nDstYOff + psJob->nRowStart;
+        const double dfRowEnd = psJob->poWK->nDstYOff + psJob->nRowEnd;
+
+        for( int i = 0; i < nPointCount; i++ )
+        {
+            if( padfY[i] < dfRowStart || padfY[i] >= dfRowEnd )
+                panSuccess[i] = FALSE;
+        }
+        CPLFree( padfY );
+    }
+
+    return bResult;
+}
+
+/************************************************************************/
+/*                           GWKMTProgress()                            */
+/*                                                                      */
+/*      Merges the progress of the jobs into the caller's progress      */
+/*      function.                                                       */
+/************************************************************************/
+
+static int CPL_STDCALL GWKMTProgress( double dfComplete,
+                                      const char *pszMessage,
+                                      void *pProgressArg )
+{
+    GWKMTJob *psJob = (GWKMTJob *) pProgressArg;
+    GWKMTContext *psCtx = psJob->psCtx;
+    GDALWarpKernel *poWK = psCtx->poWK;
+
+    CPLAcquireMutex( psCtx->hMutex, 1000.0 );
+
+    psJob->dfComplete = dfComplete;
+
+    if( !psCtx->bCancelled && poWK->pfnProgress != NULL )
+    {
+        double dfRows = 0.0;
+
+        for( size_t i = 0; i < psCtx->asJobs.size(); i++ )
+        {
+            const GWKMTJob &oJob = psCtx->asJobs[i];
+            dfRows += oJob.dfComplete * (oJob.nRowEnd - oJob.nRowStart);
+        }
+
+        if( !poWK->pfnProgress( poWK->dfProgressBase
+                                + poWK->dfProgressScale
+                                * dfRows / poWK->nDstYSize,
+                                pszMessage, poWK->pProgress ) )
+            psCtx->bCancelled = TRUE;
+    }
+
+    int bContinue = !psCtx->bCancelled;
+
+    CPLReleaseMutex( psCtx->hMutex );
+
+    return bContinue;
+}
+
+/************************************************************************/
+/*                             GWKMTRunJob()                            */
+/************************************************************************/
+
+static inline void GWKMTRunJob( GWKMTJob *psJob )
+{
+    GDALWarpKernel *poSrcWK = psJob->poWK;
+    GDALWarpKernel oWK;
+
+    /* One thread per job: PerformWarp() would otherwise start its own. */
+    oWK.papszWarpOptions = CSLSetNameValue(
+        CSLDuplicate( poSrcWK->papszWarpOptions ), "NUM_THREADS", "1" );
+    oWK.eResample = poSrcWK->eResample;
+    oWK.eWorkingDataType = poSrcWK->eWorkingDataType;
+    oWK.nBands = poSrcWK->nBands;
+
+    oWK.nSrcXSize = poSrcWK->nSrcXSize;
+    oWK.nSrcYSize = poSrcWK->nSrcYSize;
+    oWK.nSrcXOff = poSrcWK->nSrcXOff;
+    oWK.nSrcYOff = poSrcWK->nSrcYOff;
+    oWK.papabySrcImage = poSrcWK->papabySrcImage;
+    oWK.papanBandSrcValid = poSrcWK->papanBandSrcValid;
+    oWK.panUnifiedSrcValid = poSrcWK->panUnifiedSrcValid;
+    oWK.pafUnifiedSrcDensity = poSrcWK->pafUnifiedSrcDensity;
+
+    oWK.nDstXSize = poSrcWK->nDstXSize;
+    oWK.nDstYSize = poSrcWK->nDstYSize;
+    oWK.nDstXOff = poSrcWK->nDstXOff;
+    oWK.nDstYOff = poSrcWK->nDstYOff;
+    oWK.papabyDstImage = poSrcWK->papabyDstImage;
+    oWK.panDstValid = poSrcWK->panDstValid;
+    oWK.pafDstDensity = poSrcWK->pafDstDensity;
+    oWK.padfDstNoDataReal = poSrcWK->padfDstNoDataReal;
+
+    oWK.pfnTransformer = GWKMTTransform;
+    oWK.pTransformerArg = psJob;
+
+    oWK.pfnProgress = GWKMTProgress;
+    oWK.pProgress = psJob;
+    oWK.dfProgressBase = 0.0;
+    oWK.dfProgressScale = 1.0;
+
+/* -------------------------------------------------------------------- */
+/*      Restrict the kernel to the rows of the job, moving the          */
+/*      destination buffers to the first row.                           */
+/* -------------------------------------------------------------------- */
+    GByte **papabyDstImage = NULL;
+
+    if( !psJob->bFullKernel )
+    {
+        const int nWordSize = GDALGetDataTypeSize(oWK.eWorkingDataType) / 8;
+        const size_t nPixelOff =
+            (size_t) psJob->nRowStart * oWK.nDstXSize;
+
+        oWK.nDstYOff += psJob->nRowStart;
+        oWK.nDstYSize = psJob->nRowEnd - psJob->nRowStart;
+
+        papabyDstImage = (GByte **)
+            CPLCalloc( sizeof(GByte *), MAX(oWK.nBands, 1) );
+        for( int iBand = 0; iBand < oWK.nBands; iBand++ )
+            papabyDstImage[iBand] =
+                poSrcWK->papabyDstImage[iBand] + nPixelOff * nWordSize;
+        oWK.papabyDstImage = papabyDstImage;
+
+        if( oWK.panDstValid != NULL )
+            oWK.panDstValid += nPixelOff / 32;
+        if( oWK.pafDstDensity != NULL )
+            oWK.pafDstDensity += nPixelOff;
+    }
+
+    psJob->eErr = oWK.PerformWarp();
+
+    CPLFree( papabyDstImage );
+    CSLDestroy( oWK.papszWarpOptions );
+
+/* -------------------------------------------------------------------- */
+/*      The kernel destructor does not own anything, but clear the      */
+/*      borrowed pointers anyway.                                       */
+/* -------------------------------------------------------------------- */
+    oWK.papszWarpOptions = NULL;
+    oWK.papabySrcImage = NULL;
+    oWK.papanBandSrcValid = NULL;
+    oWK.panUnifiedSrcValid = NULL;
+    oWK.pafUnifiedSrcDensity = NULL;
+    oWK.papabyDstImage = NULL;
+    oWK.panDstValid = NULL;
+    oWK.pafDstDensity = NULL;
+    oWK.padfDstNoDataReal = NULL;
+}
+
+/************************************************************************/
+/*                            GWKMTWorker()                             */
+/************************************************************************/
+
+static void GWKMTWorker( void *pArg )
+{
+    GWKMTContext *psCtx = (GWKMTContext *) pArg;
+    const int nJobs = (int) psCtx->asJobs.size();
+
+    for( ;; )
+    {
+        int iJob = CPLAtomicInc( &(psCtx->nNextJob) ) - 1;
+        if( iJob >= nJobs )
+            break;
+
+        GWKMTJob *psJob = &(psCtx->asJobs[iJob]);
+
+        CPLAcquireMutex( psCtx->hMutex, 1000.0 );
+        const int bCancelled = psCtx->bCancelled;
+        CPLReleaseMutex( psCtx->hMutex );
+
+        if( bCancelled )
+        {
+            psJob->eErr = CE_Failure;
+            continue;
+        }
+
+        GWKMTRunJob( psJob );
+    }
+}
+
+/************************************************************************/
+/*                     GDALWarpKernelPerformWarpMT()                    */
+/************************************************************************/
+
+/**
+ * Perform a warp with a GDALWarpKernel on several threads.
+ *
+ * The kernel must be set up as for GDALWarpKernel::PerformWarp().  Its
+ * transformer is called from several threads, through a per-thread
+ * clone when it can be serialized and under a mutex otherwise.  The
+ * progress function is called from the worker threads, one at a time.
+ *
+ * @param poWK the kernel to run.
+ * @param nThreads the number of threads to use, or 0 to use the
+ * NUM_THREADS warp option or the GDAL_NUM_THREADS configuration option.
+ *
+ * @return CE_None on success or CE_Failure if the kernel failed or was
+ * cancelled.
+ */
+
+static inline CPLErr GDALWarpKernelPerformWarpMT( GDALWarpKernel *poWK,
+                                                  int nThreads = 0 )
+{
+    if( nThreads <= 0 )
+        nThreads = GWKMTGetThreadCount( poWK );
+
+/* -------------------------------------------------------------------- */
+/*      Work out the row bands.  Every band but the last must start     */
+/*      and end on a panDstValid word boundary, so the number of rows   */
+/*      per band is rounded to a multiple of 32 / gcd(nDstXSize, 32).   */
+/* -------------------------------------------------------------------- */
+    int nRowAlign = 32;
+    if( poWK->panDstValid != NULL )
+    {
+        int nXSize = poWK->nDstXSize;
+        while( nRowAlign > 1 && (nXSize % 2) == 0 )
+        {
+            nXSize /= 2;
+            nRowAlign /= 2;
+        }
+    }
+    else
+        nRowAlign = 1;
+
+    int nRowsPerJob = MAX( GWKMT_MIN_ROWS,
+                           (poWK->nDstYSize + nThreads - 1) / nThreads );
+    nRowsPerJob = ((nRowsPerJob + nRowAlign - 1) / nRowAlign) * nRowAlign;
+
+    const int nJobs = (poWK->nDstYSize + nRowsPerJob - 1) / nRowsPerJob;
+
+    if( nThreads <= 1 || nJobs <= 1
+        || poWK->nSrcXSize <= 0 || poWK->nSrcYSize <= 0 )
+        return poWK->PerformWarp();
+
+    if( poWK->Validate() != CE_None )
+        return CE_Failure;
+
+    nThreads = MIN( nThreads, nJobs );
+
+/* -------------------------------------------------------------------- */
+/*      Set up the jobs.                                                */
+/* -------------------------------------------------------------------- */
+    const int bFullKernel = !( poWK->eResample == GRA_NearestNeighbour
+                               || poWK->eResample == GRA_Bilinear
+                               || poWK->eResample == GRA_Cubic );
+
+    GWKMTContext sCtx;
+    sCtx.poWK = poWK;
+    sCtx.bCancelled = FALSE;
+    sCtx.nNextJob = 0;
+    sCtx.hMutex = CPLCreateMutex();
+    CPLReleaseMutex( sCtx.hMutex );
+
+    sCtx.asJobs.resize( nJobs );
+
+    for( int iJob = 0; iJob < nJobs; iJob++ )
+    {
+        GWKMTJob &oJob = sCtx.asJobs[iJob];
+
+        oJob.psCtx = &sCtx;
+        oJob.poWK = poWK;
+        oJob.nRowStart = iJob * nRowsPerJob;
+        oJob.nRowEnd = MIN( poWK->nDstYSize, oJob.nRowStart + nRowsPerJob );
+        oJob.bFullKernel = bFullKernel;
+        oJob.pfnTransformer = poWK->pfnTransformer;
+        oJob.pTransformerArg = poWK->pTransformerArg;
+        oJob.bOwnTransformer = FALSE;
+        oJob.dfComplete = 0.0;
+        oJob.eErr = CE_None;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Give each job its own clone of the transformer, or fall back    */
+/*      to the shared transformer, called under the mutex, if it        */
+/*      cannot be cloned.                                               */
+/* -------------------------------------------------------------------- */
+    CPLPushErrorHandler( CPLQuietErrorHandler );
+    CPLXMLNode *psTree =
+        GDALSerializeTransformer( poWK->pfnTransformer,
+                                  poWK->pTransformerArg );
+    CPLPopErrorHandler();
+
+    if( psTree != NULL )
+    {
+        int iJob;
+
+        for( iJob = 0; iJob < nJobs; iJob++ )
+        {
+            GWKMTJob &oJob = sCtx.asJobs[iJob];
+            GDALTransformerFunc pfnTransformer = NULL;
+            void *pTransformerArg = NULL;
+
+            if( GDALDeserializeTransformer( psTree, &pfnTransformer,
+                                            &pTransformerArg ) != CE_None
+                || pTransformerArg == NULL )
+                break;
+
+            oJob.pfnTransformer = pfnTransformer;
+            oJob.pTransformerArg = pTransformerArg;
+            oJob.bOwnTransformer = TRUE;
+        }
+
+        if( iJob < nJobs )
+        {
+            for( iJob = 0; iJob < nJobs; iJob++ )
+            {
+                GWKMTJob &oJob = sCtx.asJobs[iJob];
+                if( oJob.bOwnTransformer )
+                    GDALDestroyTransformer( oJob.pTransformerArg );
+                oJob.pfnTransformer = poWK->pfnTransformer;
+                oJob.pTransformerArg = poWK->pTransformerArg;
+                oJob.bOwnTransformer = FALSE;
+            }
+        }
+
+        CPLDestroyXMLNode( psTree );
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Run the jobs, on the calling thread as well.                    */
+/* -------------------------------------------------------------------- */
+    CPLWorkerThreadPool *poPool = CPLGetGlobalWorkerThreadPool();
+    CPLJobGroup oGroup;
+
+    for( int iThread = 1; iThread < nThreads; iThread++ )
+        poPool->SubmitJob( GWKMTWorker, &sCtx, &oGroup );
+
+    GWKMTWorker( &sCtx );
+    poPool->WaitGroup( &oGroup );
+
+/* -------------------------------------------------------------------- */
+/*      Cleanup.                                                        */
+/* -------------------------------------------------------------------- */
+    CPLErr eErr = CE_None;
+
+    for( int iJob = 0; iJob < nJobs; iJob++ )
+    {
+        GWKMTJob &oJob = sCtx.asJobs[iJob];
+        if( oJob.eErr != CE_None )
+            eErr = CE_Failure;
+        if( oJob.bOwnTransformer )
+            GDALDestroyTransformer( oJob.pTransformerArg );
+    }
+
+    CPLDestroyMutex( sCtx.hMutex );
+
+    if( sCtx.bCancelled )
+    {
+        CPLError( CE_Failure, CPLE_UserInterrupt, "User terminated" );
+        eErr = CE_Failure;
+    }
+
+    return eErr;
+}
+
+#endif /* ndef GDALWARPKERNEL_MT_H_INCLUDED */
@@ -0,0 +1,1032 @@
+/************************************************************************
+ *
+ *
+ * Batch and parallel operations for the GEOS C-Wrapper
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU Lesser General Public Licence as published
+ * by the Free Software Foundation.
+ * See the COPYING file for more information.
+ *
+ ***********************************************************************
+ *
+ * GENERAL NOTES:
+ *
+ *	- These functions spread one operation over several threads:
+ *	  a prepared predicate against an array of geometries, optionally
+ *	  pre-filtered by an STRtree, and the cascaded union of the
+ *	  components of a collection.
+ *
+ *	- GEOSPackedSTRtree is a build-once spatial index with the
+ *	  interface of GEOSSTRtree, stored in contiguous arrays.
+ *
+ *	- Each thread works with its own GEOSContextHandle_t and on
+ *	  geometries of its own: no geometry is read by a thread while
+ *	  another may update it, as GEOS computes envelopes and the
+ *	  indexes of prepared geometries lazily.  The calling thread is
+ *	  one of them, with the handle it passed.
+ *
+ *	- The first error and the first notice of each of the other
+ *	  threads are passed to the handlers of that handle, on the
+ *	  calling thread, once the threads are done.
+ *
+ *	- They are implemented inline on top of the reentrant (_r)
+ *	  functions of geos_c.h, so this header requires C++.
+ *
+ ***********************************************************************/
+
+#ifndef GEOS_C_BATCH_H_INCLUDED
+#define GEOS_C_BATCH_H_INCLUDED
+
+#ifndef __cplusplus
+# error geos_c_batch.h requires C++
+#endif
+
+#include <geos_c.h>
+#include <geos/geom/prep/PreparedGeometry.h>
+#include <geos/index/strtree/PackedSTRtree.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+# include <windows.h>
+# include <process.h>
+#else
+# include <pthread.h>
+# include <unistd.h>
+#endif
+
+typedef struct GEOSPackedSTRtree_t GEOSPackedSTRtree;
+
+/*
+ * Distance between two items, for GEOSPackedSTRtree_nearest_generic_r().
+ * Return 0 on exception, 1 otherwise.
+ */
+typedef int (*GEOSDistanceCallback)(const void* item1, const void* item2,
+                                    double* distance, void* userdata);
+
+enum GEOSPreparedPredicates {
+	GEOSPREP_CONTAINS=1,
+	GEOSPREP_CONTAINS_PROPERLY=2,
+	GEOSPREP_COVERED_BY=3,
+	GEOSPREP_COVERS=4,
+	GEOSPREP_CROSSES=5,
+	GEOSPREP_DISJOINT=6,
+	GEOSPREP_INTERSECTS=7,
+	GEOSPREP_OVERLAPS=8,
+	GEOSPREP_TOUCHES=9,
+	GEOSPREP_WITHIN=10
+};
+
+namespace geos {
+namespace capi { // geos::capi
+namespace batch { // geos::capi::batch
+
+/************************************************************************
+ *
+ *  Threads
+ *
+ ***********************************************************************/
+
+inline long
+atomicAdd(volatile long* value, long increment)
+{
+#ifdef _WIN32
+	return InterlockedExchangeAdd(value, increment);
+#else
+	return __sync_fetch_and_add(value, increment);
+#endif
+}
+
+inline int
+getNumCPUs()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return static_cast<int>(info.dwNumberOfProcessors);
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? static_cast<int>(n) : 1;
+#endif
+}
+
+/*
+ * Body of a thread: 'index' is 0 for the calling thread, and 'handle'
+ * is the context handle of the thread.  Bodies take their work from
+ * shared counters, so that the work of threads which could not be
+ * started is done by the others.
+ */
+typedef void (*ThreadBody)(void* arg, GEOSContextHandle_t handle, int index);
+
+struct Thread {
+	ThreadBody body;
+	void* arg;
+	GEOSContextHandle_t handle;
+	int index;
+#ifdef _WIN32
+	HANDLE thread;
+#else
+	pthread_t thread;
+#endif
+	bool started;
+	std::string error;	/* First messages of the thread */
+	std::string notice;
+};
+
+/* Thread running on the current thread, NULL on the calling one. */
+inline Thread*&
+currentThread()
+{
+#ifdef _WIN32
+	static __declspec(thread) Thread* current = NULL;
+#else
+	static __thread Thread* current = NULL;
+#endif
+	return current;
+}
+
+inline void
+recordMessage(std::string& message, const char* fmt, va_list ap)
+{
+	if (!message.empty()) return;
+
+	char buf[1024];
+#ifdef _WIN32
+	_vsnprintf(buf, sizeof(buf) - 1, fmt, ap);
+	buf[sizeof(buf) - 1] = '\0';
+#else
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+#endif
+	message = buf;
+}
+
+inline void
+threadErrorHandler(const char* fmt, ...)
+{
+	Thread* t = currentThread();
+	if (!t) return;
+	va_list ap;
+	va_start(ap, fmt);
+	recordMessage(t->error, fmt, ap);
+	va_end(ap);
+}
+
+inline void
+threadNoticeHandler(const char* fmt, ...)
+{
+	Thread* t = currentThread();
+	if (!t) return;
+	va_list ap;
+	va_start(ap, fmt);
+	recordMessage(t->notice, fmt, ap);
+	va_end(ap);
+}
+
+#ifdef _WIN32
+inline unsigned __stdcall
+threadMain(void* arg)
+{
+	Thread* t = static_cast<Thread*>(arg);
+	currentThread() = t;
+	t->body(t->arg, t->handle, t->index);
+	currentThread() = NULL;
+	return 0;
+}
+#else
+extern "C" inline void*
+threadMain(void* arg)
+{
+	Thread* t = static_cast<Thread*>(arg);
+	currentThread() = t;
+	t->body(t->arg, t->handle, t->index);
+	currentThread() = NULL;
+	return NULL;
+}
+#endif
+
+/*
+ * Run 'body' on nthreads threads, the calling one included, and wait
+ * for them.  The other threads get a new context handle each, whose
+ * first error and notice go to the handlers of 'handle' afterwards.
+ */
+inline void
+runThreads(GEOSContextHandle_t handle, int nthreads, ThreadBody body,
+           void* arg)
+{
+	std::vector<Thread> threads(nthreads > 1 ? nthreads : 1);
+	for (size_t i = 1; i < threads.size(); ++i) {
+		Thread& t = threads[i];
+		t.body = body;
+		t.arg = arg;
+		t.index = static_cast<int>(i);
+		t.handle = initGEOS_r(threadNoticeHandler, threadErrorHandler);
+		t.started = false;
+		if (!t.handle) continue;
+#ifdef _WIN32
+		t.thread = reinterpret_cast<HANDLE>(
+			_beginthreadex(NULL, 0, threadMain, &t, 0, NULL));
+		t.started = t.thread != 0;
+#else
+		t.started = pthread_create(&t.thread, NULL, threadMain, &t) == 0;
+#endif
+	}
+
+	body(arg, handle, 0);
+
+	for (size_t i = 1; i < threads.size(); ++i) {
+		Thread& t = threads[i];
+		if (t.started) {
+#ifdef _WIN32
+			WaitForSingleObject(t.thread, INFINITE);
+			CloseHandle(t.thread);
+#else
+			pthread_join(t.thread, NULL);
+#endif
+		}
+		if (t.handle) finishGEOS_r(t.handle);
+	}
+
+	/* The C API has no getters for the handlers: swap them out and back. */
+	const GEOSMessageHandler ef =
+		GEOSContext_setErrorHandler_r(handle, threadErrorHandler);
+	GEOSContext_setErrorHandler_r(handle, ef);
+	const GEOSMessageHandler nf =
+		GEOSContext_setNoticeHandler_r(handle, threadNoticeHandler);
+	GEOSContext_setNoticeHandler_r(handle, nf);
+
+	for (size_t i = 1; i < threads.size(); ++i) {
+		if (ef && !threads[i].error.empty())
+			ef("%s", threads[i].error.c_str());
+		if (nf && !threads[i].notice.empty())
+			nf("%s", threads[i].notice.c_str());
+	}
+}
+
+/*
+ * Envelope of g, through the C API.  Return false if g is empty or on
+ * exception.
+ */
+inline bool
+getEnvelope(GEOSContextHandle_t handle, const GEOSGeometry* g,
+            double& minX, double& minY, double& maxX, double& maxY)
+{
+	GEOSGeometry* env = GEOSEnvelope_r(handle, g);
+	if (!env) return false;
+
+	bool ok = false;
+	if (GEOSGeomTypeId_r(handle, env) == GEOS_POINT) {
+		ok = GEOSGeomGetX_r(handle, env, &minX) == 1
+		     && GEOSGeomGetY_r(handle, env, &minY) == 1;
+		maxX = minX;
+		maxY = minY;
+	}
+	else if (GEOSGeomTypeId_r(handle, env) == GEOS_POLYGON
+	         && GEOSisEmpty_r(handle, env) == 0) {
+		/* Corners 0 and 2 of the envelope are its min and max. */
+		const GEOSCoordSequence* s = GEOSGeom_getCoordSeq_r(handle,
+			GEOSGetExteriorRing_r(handle, env));
+		ok = s
+		     && GEOSCoordSeq_getX_r(handle, s, 0, &minX)
+		     && GEOSCoordSeq_getY_r(handle, s, 0, &minY)
+		     && GEOSCoordSeq_getX_r(handle, s, 2, &maxX)
+		     && GEOSCoordSeq_getY_r(handle, s, 2, &maxY);
+	}
+	GEOSGeom_destroy_r(handle, env);
+	return ok;
+}
+
+/************************************************************************
+ *
+ *  Prepared Geometry batch predicates
+ *
+ ***********************************************************************/
+
+/* Number of candidates a thread takes at a time. */
+const unsigned int CHUNK_SIZE = 32;
+
+inline char
+evalPredicate(GEOSContextHandle_t handle, const GEOSPreparedGeometry* pg,
+              int predicate, const GEOSGeometry* g)
+{
+	switch (predicate) {
+	case GEOSPREP_CONTAINS:
+		return GEOSPreparedContains_r(handle, pg, g);
+	case GEOSPREP_CONTAINS_PROPERLY:
+		return GEOSPreparedContainsProperly_r(handle, pg, g);
+	case GEOSPREP_COVERED_BY:
+		return GEOSPreparedCoveredBy_r(handle, pg, g);
+	case GEOSPREP_COVERS:
+		return GEOSPreparedCovers_r(handle, pg, g);
+	case GEOSPREP_CROSSES:
+		return GEOSPreparedCrosses_r(handle, pg, g);
+	case GEOSPREP_DISJOINT:
+		return GEOSPreparedDisjoint_r(handle, pg, g);
+	case GEOSPREP_INTERSECTS:
+		return GEOSPreparedIntersects_r(handle, pg, g);
+	case GEOSPREP_OVERLAPS:
+		return GEOSPreparedOverlaps_r(handle, pg, g);
+	case GEOSPREP_TOUCHES:
+		return GEOSPreparedTouches_r(handle, pg, g);
+	case GEOSPREP_WITHIN:
+		return GEOSPreparedWithin_r(handle, pg, g);
+	default:
+		return 2;
+	}
+}
+
+struct PredicateBatch {
+	const GEOSPreparedGeometry* prepared;	/* For the calling thread */
+	std::vector<GEOSGeometry*> clones;	/* For the others */
+	int predicate;
+	const GEOSGeometry* const* geoms;
+	const unsigned int* candidates;		/* NULL: all of geoms */
+	unsigned int ncandidates;
+	char* results;				/* One per candidate */
+	volatile long nextChunk;
+	volatile long nerrors;
+};
+
+inline void
+predicateThread(void* arg, GEOSContextHandle_t handle, int index)
+{
+	PredicateBatch* b = static_cast<PredicateBatch*>(arg);
+
+	/* Without its prepared clone, the other threads do its share. */
+	const GEOSPreparedGeometry* pg = b->prepared;
+	if (index > 0) {
+		if (!b->clones[index]) return;
+		pg = GEOSPrepare_r(handle, b->clones[index]);
+		if (!pg) return;
+	}
+
+	long nerrors = 0;
+	for (;;) {
+		const unsigned int start = CHUNK_SIZE *
+			static_cast<unsigned int>(atomicAdd(&b->nextChunk, 1));
+		if (start >= b->ncandidates) break;
+		unsigned int end = start + CHUNK_SIZE;
+		if (end > b->ncandidates) end = b->ncandidates;
+
+		for (unsigned int i = start; i < end; ++i) {
+			const unsigned int idx =
+				b->candidates ? b->candidates[i] : i;
+			const GEOSGeometry* g = b->geoms[idx];
+			char r = g ? evalPredicate(handle, pg, b->predicate, g) : 0;
+			if (r == 2) {
+				++nerrors;
+				r = 0;
+			}
+			b->results[i] = r;
+		}
+	}
+	if (nerrors) atomicAdd(&b->nerrors, nerrors);
+
+	if (index > 0) GEOSPreparedGeom_destroy_r(handle, pg);
+}
+
+inline void
+collectCandidate(void* item, void* userdata)
+{
+	std::vector<unsigned int>* candidates =
+		static_cast<std::vector<unsigned int>*>(userdata);
+	/* Items are 1-based indexes, see GEOSSTRtree_createBatch_r() */
+	candidates->push_back(static_cast<unsigned int>(
+		reinterpret_cast<size_t>(item) - 1));
+}
+
+/************************************************************************
+ *
+ *  Parallel cascaded union
+ *
+ ***********************************************************************/
+
+/* Fewest components worth a thread of their own. */
+const unsigned int MIN_UNION_CHUNK = 16;
+
+/*
+ * The components are unioned by chunks of spatially close ones, each
+ * with the sequential cascaded union, then the results of the chunks
+ * are unioned two by two.  All the unions of a level are independent.
+ */
+struct UnionJob {
+	std::vector<const GEOSGeometry*> parts;	/* In chunk order */
+	std::vector<unsigned int> bounds;	/* Of the chunks in parts */
+	std::vector<GEOSGeometry*> inputs;	/* Of the current level */
+	std::vector<GEOSGeometry*> outputs;
+	unsigned int ntasks;
+	volatile long nextTask;
+	volatile long nerrors;
+};
+
+struct PartCenter {
+	double x;
+	double y;
+	const GEOSGeometry* part;
+};
+
+inline bool
+lessX(const PartCenter& a, const PartCenter& b) { return a.x < b.x; }
+
+inline bool
+lessY(const PartCenter& a, const PartCenter& b) { return a.y < b.y; }
+
+/* Center of the envelope of g; (0, 0) if empty. */
+inline PartCenter
+getPartCenter(GEOSContextHandle_t handle, const GEOSGeometry* g)
+{
+	PartCenter c;
+	c.x = 0.0;
+	c.y = 0.0;
+	c.part = g;
+
+	double minX, minY, maxX, maxY;
+	if (getEnvelope(handle, g, minX, minY, maxX, maxY)) {
+		c.x = (minX + maxX) * 0.5;
+		c.y = (minY + maxY) * 0.5;
+	}
+	return c;
+}
+
+/*
+ * Order the components of g as Sort-Tile-Recursive does: in vertical
+ * slices by X, each sorted by Y, so that consecutive components are
+ * close.  Also computes their envelopes before any thread reads them.
+ */
+inline void
+sortParts(GEOSContextHandle_t handle, const GEOSGeometry* g,
+          unsigned int nchunks, std::vector<const GEOSGeometry*>& parts)
+{
+	const int n = GEOSGetNumGeometries_r(handle, g);
+	std::vector<PartCenter> centers;
+	centers.reserve(n > 0 ? n : 0);
+	for (int i = 0; i < n; ++i)
+		centers.push_back(getPartCenter(handle,
+			GEOSGetGeometryN_r(handle, g, i)));
+
+	std::stable_sort(centers.begin(), centers.end(), lessX);
+	const size_t nslices = static_cast<size_t>(
+		std::ceil(std::sqrt(static_cast<double>(nchunks))));
+	const size_t sliceSize = (centers.size() + nslices - 1) / nslices;
+	for (size_t start = 0; start < centers.size(); start += sliceSize) {
+		const size_t end = std::min(start + sliceSize, centers.size());
+		std::stable_sort(centers.begin() + start, centers.begin() + end,
+		                 lessY);
+	}
+
+	parts.resize(centers.size());
+	for (size_t i = 0; i < centers.size(); ++i)
+		parts[i] = centers[i].part;
+}
+
+/* First level: the cascaded union of each chunk. */
+inline void
+unionChunksThread(void* arg, GEOSContextHandle_t handle, int /*index*/)
+{
+	UnionJob* job = static_cast<UnionJob*>(arg);
+	for (;;) {
+		const long task = atomicAdd(&job->nextTask, 1);
+		if (task >= static_cast<long>(job->ntasks)) break;
+
+		const unsigned int start = job->bounds[task];
+		const unsigned int end = job->bounds[task + 1];
+
+		/* The collection takes ownership of the clones. */
+		std::vector<GEOSGeometry*> clones;
+		clones.reserve(end - start);
+		for (unsigned int i = start; i < end; ++i) {
+			GEOSGeometry* c = GEOSGeom_clone_r(handle, job->parts[i]);
+			if (c) clones.push_back(c);
+		}
+		GEOSGeometry* result = NULL;
+		GEOSGeometry* coll = clones.size() == end - start
+			? GEOSGeom_createCollection_r(handle,
+				GEOS_GEOMETRYCOLLECTION, &clones[0],
+				static_cast<unsigned int>(clones.size()))
+			: NULL;
+		if (coll) {
+			result = GEOSUnaryUnion_r(handle, coll);
+			GEOSGeom_destroy_r(handle, coll);
+		}
+		else {
+			for (size_t i = 0; i < clones.size(); ++i)
+				GEOSGeom_destroy_r(handle, clones[i]);
+		}
+
+		if (!result) atomicAdd(&job->nerrors, 1);
+		job->outputs[task] = result;
+	}
+}
+
+/* Next levels: the union of pairs of results. */
+inline void
+unionPairsThread(void* arg, GEOSContextHandle_t handle, int /*index*/)
+{
+	UnionJob* job = static_cast<UnionJob*>(arg);
+	for (;;) {
+		const long task = atomicAdd(&job->nextTask, 1);
+		if (task >= static_cast<long>(job->ntasks)) break;
+
+		GEOSGeometry* a = job->inputs[2 * task];
+		GEOSGeometry* b = 2 * task + 1 < static_cast<long>(job->inputs.size())
+			? job->inputs[2 * task + 1] : NULL;
+		GEOSGeometry* result = a;
+		if (a && b) {
+			result = GEOSUnion_r(handle, a, b);
+			GEOSGeom_destroy_r(handle, a);
+			GEOSGeom_destroy_r(handle, b);
+		}
+		else if (b) {
+			GEOSGeom_destroy_r(handle, b);
+		}
+
+		if (!result) atomicAdd(&job->nerrors, 1);
+		job->outputs[task] = result;
+	}
+}
+
+/* Parallel counterpart of GEOSUnaryUnion_r() for collections. */
+inline GEOSGeometry*
+unionParallel(GEOSContextHandle_t handle, const GEOSGeometry* g,
+              int nthreads)
+{
+	if (nthreads <= 0) nthreads = getNumCPUs();
+
+	const int typeId = GEOSGeomTypeId_r(handle, g);
+	const int nparts = GEOSGetNumGeometries_r(handle, g);
+	if (typeId < GEOS_MULTIPOINT || nparts < 0)
+		return GEOSUnaryUnion_r(handle, g);
+
+	unsigned int nchunks = 2 * static_cast<unsigned int>(nthreads);
+	if (nchunks > static_cast<unsigned int>(nparts) / MIN_UNION_CHUNK)
+		nchunks = static_cast<unsigned int>(nparts) / MIN_UNION_CHUNK;
+	if (nthreads == 1 || nchunks < 2)
+		return GEOSUnaryUnion_r(handle, g);
+
+	UnionJob job;
+	sortParts(handle, g, nchunks, job.parts);
+	job.bounds.resize(nchunks + 1);
+	for (unsigned int i = 0; i <= nchunks; ++i)
+		job.bounds[i] = static_cast<unsigned int>(
+			(static_cast<size_t>(nparts) * i) / nchunks);
+
+	job.ntasks = nchunks;
+	job.nextTask = 0;
+	job.nerrors = 0;
+	job.outputs.assign(nchunks, NULL);
+	runThreads(handle, std::min(nthreads, static_cast<int>(job.ntasks)),
+	           unionChunksThread, &job);
+
+	while (job.outputs.size() > 1 && job.nerrors == 0) {
+		job.inputs.swap(job.outputs);
+		job.ntasks = static_cast<unsigned int>(job.inputs.size() + 1) / 2;
+		job.nextTask = 0;
+		job.outputs.assign(job.ntasks, NULL);
+		runThreads(handle,
+		           std::min(nthreads, static_cast<int>(job.ntasks)),
+		           unionPairsThread, &job);
+	}
+
+	if (job.nerrors) {
+		for (size_t i = 0; i < job.outputs.size(); ++i)
+			if (job.outputs[i]) GEOSGeom_destroy_r(handle, job.outputs[i]);
+		return NULL;
+	}
+	return job.outputs[0];
+}
+
+/************************************************************************
+ *
+ *  Packed STRtree
+ *
+ ***********************************************************************/
+
+typedef geos::index::strtree::PackedSTRtree PackedSTRtree;
+
+inline PackedSTRtree*
+toPackedSTRtree(GEOSPackedSTRtree* tree)
+{
+	return reinterpret_cast<PackedSTRtree*>(tree);
+}
+
+class CallbackVisitor: public geos::index::ItemVisitor {
+	GEOSQueryCallback callback;
+	void* userdata;
+public:
+	CallbackVisitor(GEOSQueryCallback cb, void* ud)
+		: callback(cb), userdata(ud) {}
+	void visitItem(void* item) { callback(item, userdata); }
+};
+
+/* Distance between the query geometry and items which are geometries. */
+class GeometryDistance: public PackedSTRtree::ItemDistance {
+	GEOSContextHandle_t handle;
+	const GEOSGeometry* geom;
+public:
+	bool failed;
+	GeometryDistance(GEOSContextHandle_t h, const GEOSGeometry* g)
+		: handle(h), geom(g), failed(false) {}
+	double distance(void* item) {
+		double d;
+		if (GEOSDistance_r(handle, static_cast<const GEOSGeometry*>(item),
+		                   geom, &d) != 1) {
+			failed = true;
+			return std::numeric_limits<double>::infinity();
+		}
+		return d;
+	}
+};
+
+class CallbackDistance: public PackedSTRtree::ItemDistance {
+	const void* queryItem;
+	GEOSDistanceCallback distancefn;
+	void* userdata;
+public:
+	bool failed;
+	CallbackDistance(const void* item, GEOSDistanceCallback fn, void* ud)
+		: queryItem(item), distancefn(fn), userdata(ud), failed(false) {}
+	double distance(void* item) {
+		double d;
+		if (!distancefn(item, queryItem, &d, userdata)) {
+			failed = true;
+			return std::numeric_limits<double>::infinity();
+		}
+		return d;
+	}
+};
+
+} // namespace geos::capi::batch
+} // namespace geos::capi
+} // namespace geos
+
+/************************************************************************
+ *
+ *  Prepared Geometry batch predicates
+ *
+ *  Results are bitmaps of (ngeoms + 7) / 8 bytes: the result for
+ *  geoms[i] is bit (i % 8) of byte (i / 8).
+ *
+ ***********************************************************************/
+
+/*
+ * Create an STRtree over geoms[0..ngeoms-1], for use as the
+ * pre-filter of GEOSPreparedPredicateBatch_r() with the same array.
+ * The tree may be reused for any number of batches, and must be
+ * destroyed with GEOSSTRtree_destroy_r().
+ *
+ * The items of the tree are the 1-based indexes of the geometries,
+ * cast to void*.  NULL and empty geometries are not inserted.
+ *
+ * GEOSGeometry ownership is retained by caller
+ */
+inline GEOSSTRtree*
+GEOSSTRtree_createBatch_r(GEOSContextHandle_t handle,
+                          const GEOSGeometry* const* geoms,
+                          unsigned int ngeoms,
+                          size_t nodeCapacity)
+{
+	GEOSSTRtree* tree = GEOSSTRtree_create_r(handle, nodeCapacity);
+	if (!tree) return NULL;
+
+	for (unsigned int i = 0; i < ngeoms; ++i) {
+		if (!geoms[i] || GEOSisEmpty_r(handle, geoms[i]) != 0)
+			continue;
+		GEOSSTRtree_insert_r(handle, tree, geoms[i],
+			reinterpret_cast<void*>(static_cast<size_t>(i) + 1));
+	}
+	return tree;
+}
+
+/*
+ * Evaluate a prepared predicate of pg1 against geoms[0..ngeoms-1],
+ * setting the bit of each geometry for which it holds in 'result'.
+ *
+ * 'predicate' is one of GEOSPreparedPredicates: the bit of geoms[i]
+ * is that of GEOSPrepared<Predicate>_r(handle, pg1, geoms[i]).
+ *
+ * If 'tree' is not NULL, it must have been created by
+ * GEOSSTRtree_createBatch_r() on the same array, and only the
+ * geometries whose envelope intersects that of pg1 are evaluated;
+ * the others are disjoint from pg1.
+ *
+ * 'nthreads' is the number of threads to use, including the calling
+ * one; 0 or less means one per CPU.  The other threads evaluate
+ * their own prepared clone of the geometry of pg1.
+ * A geometry must not appear twice in 'geoms' when nthreads is not 1.
+ *
+ * NULL geometries evaluate to false.
+ *
+ * Return the number of bits set, or -1 on exception, in which case
+ * the bits of the geometries that raised it are cleared.
+ */
+inline int
+GEOSPreparedPredicateBatch_r(GEOSContextHandle_t handle,
+                             const GEOSPreparedGeometry* pg1,
+                             int predicate,
+                             const GEOSGeometry* const* geoms,
+                             unsigned int ngeoms,
+                             GEOSSTRtree* tree,
+                             unsigned char* result,
+                             int nthreads)
+{
+	using namespace geos::capi::batch;
+
+	std::memset(result, 0, (ngeoms + 7) / 8);
+	if (predicate < GEOSPREP_CONTAINS || predicate > GEOSPREP_WITHIN)
+		return -1;
+
+	const geos::geom::prep::PreparedGeometry* prep =
+		reinterpret_cast<const geos::geom::prep::PreparedGeometry*>(pg1);
+	const GEOSGeometry* g1 =
+		reinterpret_cast<const GEOSGeometry*>(&prep->getGeometry());
+
+	/* Pre-filter.  STRtree builds itself on the first query, so this
+	 * must happen before other threads may use the tree. */
+	std::vector<unsigned int> candidates;
+	if (tree) {
+		GEOSSTRtree_query_r(handle, tree, g1, collectCandidate,
+		                    &candidates);
+		if (predicate == GEOSPREP_DISJOINT) {
+			for (unsigned int i = 0; i < ngeoms; ++i)
+				if (geoms[i])
+					result[i >> 3] |= static_cast<unsigned char>(1 << (i & 7));
+		}
+	}
+
+	PredicateBatch batch;
+	batch.prepared = pg1;
+	batch.predicate = predicate;
+	batch.geoms = geoms;
+	batch.candidates = tree ? (candidates.empty() ? NULL : &candidates[0])
+	                        : NULL;
+	batch.ncandidates = tree ? static_cast<unsigned int>(candidates.size())
+	                         : ngeoms;
+	batch.nextChunk = 0;
+	batch.nerrors = 0;
+
+	std::vector<char> results(batch.ncandidates + 1);
+	batch.results = &results[0];
+
+	if (nthreads <= 0) nthreads = getNumCPUs();
+	const unsigned int nchunks =
+		(batch.ncandidates + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	if (static_cast<unsigned int>(nthreads) > nchunks)
+		nthreads = nchunks > 0 ? static_cast<int>(nchunks) : 1;
+
+	/* Clone the geometry for the other threads before any thread
+	 * starts: clone() reads lazily computed members of g1. */
+	batch.clones.assign(nthreads, NULL);
+	for (int i = 1; i < nthreads; ++i)
+		batch.clones[i] = GEOSGeom_clone_r(handle, g1);
+
+	runThreads(handle, nthreads, predicateThread, &batch);
+
+	for (int i = 1; i < nthreads; ++i)
+		if (batch.clones[i]) GEOSGeom_destroy_r(handle, batch.clones[i]);
+
+	/* Pack the results. */
+	int count = 0;
+	for (unsigned int i = 0; i < batch.ncandidates; ++i) {
+		const unsigned int idx = batch.candidates ? batch.candidates[i] : i;
+		const unsigned char bit =
+			static_cast<unsigned char>(1 << (idx & 7));
+		if (results[i])
+			result[idx >> 3] |= bit;
+		else
+			result[idx >> 3] &= static_cast<unsigned char>(~bit);
+	}
+	for (unsigned int i = 0; i < ngeoms; ++i)
+		count += (result[i >> 3] >> (i & 7)) & 1;
+
+	return batch.nerrors ? -1 : count;
+}
+
+/************************************************************************
+ *
+ *  Parallel cascaded union
+ *
+ ***********************************************************************/
+
+/*
+ * Same as GEOSUnaryUnion_r(), with the components of a collection
+ * unioned on nthreads threads, the calling one included; 0 or less
+ * means one per CPU.
+ *
+ * The components are split in 2 * nthreads groups of neighbours,
+ * each unioned by GEOSUnaryUnion_r() on a thread, and the results
+ * of the groups are unioned two by two, also in parallel.  The result
+ * is topologically equal to that of GEOSUnaryUnion_r(); its vertex
+ * order may differ.  Collections of less than 32 components, and
+ * other geometries, are unioned on the calling thread.
+ *
+ * Return NULL on exception.
+ */
+inline GEOSGeometry*
+GEOSUnaryUnionParallel_r(GEOSContextHandle_t handle, const GEOSGeometry* g,
+                         int nthreads)
+{
+	return geos::capi::batch::unionParallel(handle, g, nthreads);
+}
+
+/*
+ * Same as GEOSUnionCascaded_r(), in parallel as
+ * GEOSUnaryUnionParallel_r().  g must be a MultiPolygon.
+ *
+ * Return NULL on exception.
+ */
+inline GEOSGeometry*
+GEOSUnionCascadedParallel_r(GEOSContextHandle_t handle,
+                            const GEOSGeometry* g, int nthreads)
+{
+	if (GEOSGeomTypeId_r(handle, g) != GEOS_MULTIPOLYGON)
+		return GEOSUnionCascaded_r(handle, g);
+	return geos::capi::batch::unionParallel(handle, g, nthreads);
+}
+
+/************************************************************************
+ *
+ *  Packed STRtree functions
+ *
+ *  Same as the STRtree functions of geos_c.h, for a tree whose nodes
+ *  are stored in contiguous arrays, sorted along a Hilbert curve.  See
+ *  geos::index::strtree::PackedSTRtree.
+ *
+ *  The tree is built by GEOSPackedSTRtree_build_r(), or on the first
+ *  query or nearest-neighbour search, after which nothing may be
+ *  inserted.  Once built, it may be queried from several threads, each
+ *  with its own handle.
+ *
+ ***********************************************************************/
+
+/*
+ * GEOSGeometry ownership is retained by caller
+ */
+
+inline GEOSPackedSTRtree*
+GEOSPackedSTRtree_create_r(GEOSContextHandle_t /*handle*/,
+                           size_t nodeCapacity)
+{
+	using namespace geos::capi::batch;
+	return reinterpret_cast<GEOSPackedSTRtree*>(
+		new (std::nothrow) PackedSTRtree(nodeCapacity));
+}
+
+/* Insert an item with the envelope of g; nothing if g is empty. */
+inline void
+GEOSPackedSTRtree_insert_r(GEOSContextHandle_t handle,
+                           GEOSPackedSTRtree* tree,
+                           const GEOSGeometry* g,
+                           void* item)
+{
+	using namespace geos::capi::batch;
+	double minX, minY, maxX, maxY;
+	if (!getEnvelope(handle, g, minX, minY, maxX, maxY)) return;
+	try {
+		toPackedSTRtree(tree)->insert(minX, minY, maxX, maxY, item);
+	}
+	catch (const std::bad_alloc&) {
+	}
+}
+
+/* Insert an item with the given envelope, with no geometry. */
+inline void
+GEOSPackedSTRtree_insertEnvelope_r(GEOSContextHandle_t /*handle*/,
+                                   GEOSPackedSTRtree* tree,
+                                   double minX, double minY,
+                                   double maxX, double maxY,
+                                   void* item)
+{
+	try {
+		geos::capi::batch::toPackedSTRtree(tree)->insert(minX, minY,
+		                                                 maxX, maxY, item);
+	}
+	catch (const std::bad_alloc&) {
+	}
+}
+
+/* Return 1 on success, 0 on exception. */
+inline char
+GEOSPackedSTRtree_build_r(GEOSContextHandle_t /*handle*/,
+                          GEOSPackedSTRtree* tree)
+{
+	try {
+		geos::capi::batch::toPackedSTRtree(tree)->build();
+		return 1;
+	}
+	catch (const std::bad_alloc&) {
+		return 0;
+	}
+}
+
+inline void
+GEOSPackedSTRtree_query_r(GEOSContextHandle_t handle,
+                          GEOSPackedSTRtree* tree,
+                          const GEOSGeometry* g,
+                          GEOSQueryCallback callback,
+                          void* userdata)
+{
+	using namespace geos::capi::batch;
+	if (!GEOSPackedSTRtree_build_r(handle, tree)) return;
+	double minX, minY, maxX, maxY;
+	if (!getEnvelope(handle, g, minX, minY, maxX, maxY)) return;
+	CallbackVisitor visitor(callback, userdata);
+	toPackedSTRtree(tree)->query(minX, minY, maxX, maxY, visitor);
+}
+
+inline void
+GEOSPackedSTRtree_queryEnvelope_r(GEOSContextHandle_t handle,
+                                  GEOSPackedSTRtree* tree,
+                                  double minX, double minY,
+                                  double maxX, double maxY,
+                                  GEOSQueryCallback callback,
+                                  void* userdata)
+{
+	using namespace geos::capi::batch;
+	if (!GEOSPackedSTRtree_build_r(handle, tree)) return;
+	CallbackVisitor visitor(callback, userdata);
+	toPackedSTRtree(tree)->query(minX, minY, maxX, maxY, visitor);
+}
+
+inline void
+GEOSPackedSTRtree_iterate_r(GEOSContextHandle_t /*handle*/,
+                            GEOSPackedSTRtree* tree,
+                            GEOSQueryCallback callback,
+                            void* userdata)
+{
+	using namespace geos::capi::batch;
+	CallbackVisitor visitor(callback, userdata);
+	toPackedSTRtree(tree)->iterate(visitor);
+}
+
+/*
+ * Return the item nearest to geom, by GEOSDistance_r(), for a tree
+ * whose items are the GEOSGeometry they were inserted with.
+ * Return NULL if the tree is empty, or on exception.
+ */
+inline const GEOSGeometry*
+GEOSPackedSTRtree_nearest_r(GEOSContextHandle_t handle,
+                            GEOSPackedSTRtree* tree,
+                            const GEOSGeometry* geom)
+{
+	using namespace geos::capi::batch;
+	if (!GEOSPackedSTRtree_build_r(handle, tree)) return NULL;
+	double minX, minY, maxX, maxY;
+	if (!getEnvelope(handle, geom, minX, minY, maxX, maxY)) return NULL;
+	GeometryDistance distance(handle, geom);
+	try {
+		void* item = toPackedSTRtree(tree)->nearestNeighbour(
+			minX, minY, maxX, maxY, &distance);
+		return distance.failed ? NULL
+		                       : static_cast<const GEOSGeometry*>(item);
+	}
+	catch (const std::bad_alloc&) {
+		return NULL;
+	}
+}
+
+/*
+ * Return the item nearest to 'item', whose envelope is that of
+ * itemEnvelope, by distancefn, which must not return less than the
+ * distance between the envelopes of the items.
+ * Return NULL if the tree is empty, or on exception.
+ */
+inline const void*
+GEOSPackedSTRtree_nearest_generic_r(GEOSContextHandle_t handle,
+                                    GEOSPackedSTRtree* tree,
+                                    const void* item,
+                                    const GEOSGeometry* itemEnvelope,
+                                    GEOSDistanceCallback distancefn,
+                                    void* userdata)
+{
+	using namespace geos::capi::batch;
+	if (!GEOSPackedSTRtree_build_r(handle, tree)) return NULL;
+	double minX, minY, maxX, maxY;
+	if (!getEnvelope(handle, itemEnvelope, minX, minY, maxX, maxY))
+		return NULL;
+	CallbackDistance distance(item, distancefn, userdata);
+	try {
+		void* nearest = toPackedSTRtree(tree)->nearestNeighbour(
+			minX, minY, maxX, maxY, &distance);
+		return distance.failed ? NULL : nearest;
+	}
+	catch (const std::bad_alloc&) {
+		return NULL;
+	}
+}
+
+inline void
+GEOSPackedSTRtree_destroy_r(GEOSContextHandle_t /*handle*/,
+                            GEOSPackedSTRtree* tree)
+{
+	delete geos::capi::batch::toPackedSTRtree(tree);
+}
+
+#endif /* #ifndef GEOS_C_BATCH_H_INCLUDED */
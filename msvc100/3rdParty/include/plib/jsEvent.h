@@ -0,0 +1,1009 @@
+/*
+     PLIB - A Suite of Portable Game Libraries
+     Copyright (C) 1998,2002  Steve Baker
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Library General Public
+     License as published by the Free Software Foundation; either
+     version 2 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Library General Public License for more details.
+
+     You should have received a copy of the GNU Library General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+
+     For further information visit http://plib.sourceforge.net
+*/
+
+/*
+  Event driven joysticks.
+  ~~~~~~~~~~~~~~~~~~~~~~~
+
+  jsJoystick::read() asks the device for its state every time it is
+  called.  jsEventJoystick instead gets timestamped axis and button
+  changes from a device backend through a lock-free queue:
+
+    jsEventJoystick *js = new jsEventJoystick ( 0 ) ;
+
+    for each frame:
+      jsEvent e ;
+      while ( js -> getEvent ( &e ) )
+        ... e.time, e.type, e.index, e.value ...
+
+  or, with no changes to code written for jsJoystick,
+
+      js -> read ( &buttons, axes ) ;
+
+  which takes any queued events into account and returns the current
+  state, with the usual dead band, saturation and range handling.
+
+  Backends:
+
+    jsEvdevDevice  - Linux only.  Reads /dev/input/event* on a thread of
+                     its own, sleeping in epoll_wait() until the device
+                     has something to say.  Times are CLOCK_MONOTONIC
+                     nanoseconds, the same as ulGetNanoTime().
+
+    jsPolledDevice - Everywhere else.  Wraps an jsJoystick, polls it
+                     from the main loop and turns changes into events.
+
+    jsReplayDevice - No hardware at all.  Plays back a script of
+                     events, built up in code or read from a file, for
+                     testing and for replaying recorded sessions.
+
+  jsEventJoystick ( int ident ) picks the evdev backend on Linux and
+  the polled one elsewhere.  Any other backend can be handed to the
+  jsEventJoystick ( jsEventDevice * ) constructor, which takes ownership
+  of it.
+*/
+
+#ifndef __INCLUDED_JS_EVENT_H__
+#define __INCLUDED_JS_EVENT_H__ 1
+
+#include "js.h"
+#include "ulProfile.h"   /* for ulGetNanoTime() */
+
+#ifdef UL_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <linux/input.h>
+#endif
+
+
+#define JS_EVENT_AXIS    0
+#define JS_EVENT_BUTTON  1
+#define JS_EVENT_LOST    2    /* The device has gone away */
+
+#define JS_EVENT_QUEUE_SIZE  1024
+
+struct jsEvent
+{
+  unsigned long long time ;   /* ns, from ulGetNanoTime()'s clock     */
+  int   type  ;               /* JS_EVENT_AXIS, _BUTTON or _LOST      */
+  int   index ;               /* Axis or button number                */
+  float value ;               /* Raw axis value, or 0/1 for a button  */
+} ;
+
+
+inline void _jsBarrier ( void )
+{
+#if defined(UL_WIN32)
+  MemoryBarrier () ;
+#else
+  __sync_synchronize () ;
+#endif
+}
+
+/*
+  A single producer, single consumer ring of events.  Events pushed
+  while it is full are dropped and counted.
+*/
+
+class jsEventQueue
+{
+  jsEvent *ring ;
+  unsigned int mask ;
+
+  volatile unsigned int head ;      /* Next to pop  - written by the consumer */
+  volatile unsigned int tail ;      /* Next to push - written by the producer */
+  volatile unsigned int dropped ;
+
+public:
+
+  jsEventQueue ( int size = JS_EVENT_QUEUE_SIZE )
+  {
+    unsigned int n = 2 ;
+
+    while ( n < (unsigned int) size )
+      n += n ;
+
+    ring = new jsEvent [ n ] ;
+    mask = n - 1 ;
+    head = tail = dropped = 0 ;
+  }
+
+  ~jsEventQueue () { delete [] ring ; }
+
+  int push ( const jsEvent *e )
+  {
+    unsigned int t = tail ;
+
+    if ( t - head > mask )
+    {
+      dropped = dropped + 1 ;
+      return JS_FALSE ;
+    }
+
+    ring [ t & mask ] = *e ;
+    _jsBarrier () ;
+    tail = t + 1 ;
+    return JS_TRUE ;
+  }
+
+  int pop ( jsEvent *e )
+  {
+    unsigned int h = head ;
+
+    if ( h == tail )
+      return JS_FALSE ;
+
+    _jsBarrier () ;
+    *e = ring [ h & mask ] ;
+    _jsBarrier () ;
+    head = h + 1 ;
+    return JS_TRUE ;
+  }
+
+  int isEmpty ( void ) const { return head == tail ; }
+
+  unsigned int getNumDropped ( void ) const { return dropped ; }
+} ;
+
+
+/*
+  A source of events.  start() is given the queue to push into, and
+  service() is called from the consumer's thread each time it looks for
+  events, for backends that have no thread of their own.
+*/
+
+class jsEventDevice
+{
+protected:
+  jsEventQueue *queue ;
+  int   error ;
+  char  name [ 128 ] ;
+  int   num_axes ;
+  int   num_buttons ;
+  float axis_min  [ _JS_MAX_AXES ] ;
+  float axis_max  [ _JS_MAX_AXES ] ;
+  float axis_init [ _JS_MAX_AXES ] ;    /* Values before the first event */
+  int   button_init ;                   /* Bit mask, likewise */
+
+  void pushEvent ( unsigned long long time, int type, int index, float value )
+  {
+    jsEvent e ;
+    e.time  = time  ;
+    e.type  = type  ;
+    e.index = index ;
+    e.value = value ;
+
+    if ( queue != NULL )
+      queue -> push ( &e ) ;
+  }
+
+public:
+
+  jsEventDevice ()
+  {
+    queue       = NULL ;
+    error       = JS_TRUE ;
+    name [ 0 ]  = '\0' ;
+    num_axes    = 0 ;
+    num_buttons = 0 ;
+    button_init = 0 ;
+
+    for ( int i = 0 ; i < _JS_MAX_AXES ; i++ )
+    {
+      axis_min  [ i ] = -32767.0f ;
+      axis_max  [ i ] =  32767.0f ;
+      axis_init [ i ] = 0.0f ;
+    }
+  }
+
+  virtual ~jsEventDevice () {}
+
+  virtual int  start   ( jsEventQueue *q ) { queue = q ; return ! error ; }
+  virtual void stop    ( void ) { queue = NULL ; }
+  virtual void service ( unsigned long long /* now */ ) {}
+
+  const char *getName () const { return name ; }
+  int   getNumAxes    () const { return num_axes ; }
+  int   getNumButtons () const { return num_buttons ; }
+  int   notWorking    () const { return error ; }
+
+  float getAxisMin     ( int axis ) const { return axis_min  [ axis ] ; }
+  float getAxisMax     ( int axis ) const { return axis_max  [ axis ] ; }
+  float getAxisInitial ( int axis ) const { return axis_init [ axis ] ; }
+  int   getButtonsInitial ()        const { return button_init ; }
+} ;
+
+
+/* Any jsJoystick, polled from the consumer's thread */
+
+class jsPolledDevice : public jsEventDevice
+{
+  jsJoystick *js ;
+  int   buttons ;
+  float axes [ _JS_MAX_AXES ] ;
+
+public:
+
+  jsPolledDevice ( int ident = 0 )
+  {
+    js = new jsJoystick ( ident ) ;
+    error = js -> notWorking () ;
+
+    strncpy ( name, js -> getName (), sizeof(name) - 1 ) ;
+    name [ sizeof(name) - 1 ] = '\0' ;
+
+    num_axes    = js -> getNumAxes    () ;
+    num_buttons = js -> getNumButtons () ;
+
+    if ( num_axes > _JS_MAX_AXES ) num_axes = _JS_MAX_AXES ;
+
+    js -> getMinRange ( axis_min ) ;
+    js -> getMaxRange ( axis_max ) ;
+
+    buttons = 0 ;
+    memset ( axes, 0, sizeof(axes) ) ;
+
+    if ( ! error )
+      js -> rawRead ( &buttons, axes ) ;
+
+    button_init = buttons ;
+    memcpy ( axis_init, axes, sizeof(axes) ) ;
+  }
+
+  ~jsPolledDevice () { delete js ; }
+
+  void service ( unsigned long long now )
+  {
+    if ( error || queue == NULL )
+      return ;
+
+    int   b ;
+    float a [ _JS_MAX_AXES ] ;
+
+    js -> rawRead ( &b, a ) ;
+
+    if ( js -> notWorking () )
+    {
+      error = JS_TRUE ;
+      pushEvent ( now, JS_EVENT_LOST, 0, 0.0f ) ;
+      return ;
+    }
+
+    for ( int i = 0 ; i < num_axes ; i++ )
+      if ( a [ i ] != axes [ i ] )
+        pushEvent ( now, JS_EVENT_AXIS, i, axes [ i ] = a [ i ] ) ;
+
+    for ( int i = 0 ; i < num_buttons && i < _JS_MAX_BUTTONS ; i++ )
+      if ( ( ( b ^ buttons ) >> i ) & 1 )
+        pushEvent ( now, JS_EVENT_BUTTON, i, (float) ( ( b >> i ) & 1 ) ) ;
+
+    buttons = b ;
+  }
+} ;
+
+
+/*
+  A fake device that plays back a script of events.  Times in the
+  script are nanoseconds after start(), and events come out when
+  service() is called at or after their time - or all at once, in
+  order, with setRealTime ( JS_FALSE ).
+
+  Script files have one event per line:
+
+    <time ns> axis <n> <value>
+    <time ns> button <n> <0|1>
+    <time ns> lost
+
+  and lines starting with '#' are ignored.
+*/
+
+class jsReplayDevice : public jsEventDevice
+{
+  jsEvent *script ;
+  int   num_events ;
+  int   max_events ;
+  int   next ;
+  int   real_time ;
+  unsigned long long start_time ;
+
+public:
+
+  jsReplayDevice ( const char *nm = "Replay", int axes = 2, int nbuttons = 4 )
+  {
+    strncpy ( name, nm, sizeof(name) - 1 ) ;
+    name [ sizeof(name) - 1 ] = '\0' ;
+
+    num_axes    = ( axes > _JS_MAX_AXES ) ? _JS_MAX_AXES : axes ;
+    num_buttons = ( nbuttons > _JS_MAX_BUTTONS ) ? _JS_MAX_BUTTONS : nbuttons ;
+    error       = JS_FALSE ;
+
+    script     = NULL ;
+    num_events = max_events = next = 0 ;
+    real_time  = JS_TRUE ;
+    start_time = 0 ;
+  }
+
+  ~jsReplayDevice () { delete [] script ; }
+
+  void setRealTime ( int rt ) { real_time = rt ; }
+
+  void setAxisRange ( int axis, float mn, float mx )
+  {
+    axis_min [ axis ] = mn ;
+    axis_max [ axis ] = mx ;
+  }
+
+  /* Events must be added in time order */
+
+  void addEvent ( unsigned long long time, int type, int index, float value )
+  {
+    if ( num_events == max_events )
+    {
+      max_events = ( max_events == 0 ) ? 64 : max_events * 2 ;
+
+      jsEvent *s = new jsEvent [ max_events ] ;
+
+      if ( num_events > 0 )
+        memcpy ( s, script, num_events * sizeof(jsEvent) ) ;
+
+      delete [] script ;
+      script = s ;
+    }
+
+    jsEvent *e = & script [ num_events++ ] ;
+
+    e -> time  = time  ;
+    e -> type  = type  ;
+    e -> index = index ;
+    e -> value = value ;
+  }
+
+  int load ( const char *fname )
+  {
+    FILE *fd = fopen ( fname, "r" ) ;
+
+    if ( fd == NULL )
+    {
+      ulSetError ( UL_WARNING, "jsReplayDevice: Can't open '%s'", fname ) ;
+      return JS_FALSE ;
+    }
+
+    char line [ 256 ] ;
+    int  lineno = 0 ;
+
+    while ( fgets ( line, sizeof(line), fd ) != NULL )
+    {
+      char type [ 16 ] ;
+      unsigned long long t ;
+      int   index = 0 ;
+      float value = 0.0f ;
+
+      lineno ++ ;
+
+      if ( line [ 0 ] == '#' || line [ 0 ] == '\n' || line [ 0 ] == '\r' )
+        continue ;
+
+      if ( sscanf ( line, "%llu %15s %d %f", &t, type, &index, &value ) < 2 )
+      {
+        ulSetError ( UL_WARNING, "jsReplayDevice: Bad line %d in '%s'", lineno, fname ) ;
+        continue ;
+      }
+
+      if ( strcmp ( type, "axis" ) == 0 )
+        addEvent ( t, JS_EVENT_AXIS, index, value ) ;
+      else
+      if ( strcmp ( type, "button" ) == 0 )
+        addEvent ( t, JS_EVENT_BUTTON, index, value ) ;
+      else
+      if ( strcmp ( type, "lost" ) == 0 )
+        addEvent ( t, JS_EVENT_LOST, 0, 0.0f ) ;
+      else
+        ulSetError ( UL_WARNING, "jsReplayDevice: Bad event '%s' at line %d in '%s'", type, lineno, fname ) ;
+    }
+
+    fclose ( fd ) ;
+    return JS_TRUE ;
+  }
+
+  void rewind ( void ) { next = 0 ; start_time = ulGetNanoTime () ; }
+
+  int  isFinished ( void ) const { return next >= num_events ; }
+
+  int start ( jsEventQueue *q )
+  {
+    queue = q ;
+    rewind () ;
+    return JS_TRUE ;
+  }
+
+  void service ( unsigned long long now )
+  {
+    if ( queue == NULL )
+      return ;
+
+    while ( next < num_events &&
+            ( ! real_time || start_time + script [ next ] . time <= now ) )
+    {
+      jsEvent e = script [ next++ ] ;
+      e.time += start_time ;
+      queue -> push ( &e ) ;
+    }
+  }
+} ;
+
+
+#ifdef UL_LINUX
+
+#define _JS_EVDEV_BITS(n)     ( ( (n) + 8 * sizeof(unsigned long) - 1 ) / ( 8 * sizeof(unsigned long) ) )
+#define _JS_EVDEV_TEST(b,n)   ( ( (b) [ (n) / ( 8 * sizeof(unsigned long) ) ] >> ( (n) % ( 8 * sizeof(unsigned long) ) ) ) & 1 )
+
+/*
+  A Linux input device, read on its own thread.  jsEvdevDevice ( n )
+  opens the n'th /dev/input/event* device that looks like a joystick
+  (it has an X axis and joystick or gamepad buttons); a path can be
+  given instead.
+*/
+
+class jsEvdevDevice : public jsEventDevice
+{
+  int fd ;
+  int wake_fd ;
+  int epoll_fd ;
+  int monotonic ;
+  int started ;               /* Only touched by the owner's thread */
+  pthread_t thread ;
+
+  signed char abs_map [ ABS_CNT ] ;     /* evdev code -> axis, or -1   */
+  signed char key_map [ KEY_CNT ] ;     /* evdev code -> button, or -1 */
+  int  abs_code [ _JS_MAX_AXES    ] ;
+  int  key_code [ _JS_MAX_BUTTONS ] ;
+
+  static int isJoystick ( int f )
+  {
+    unsigned long abs_bits [ _JS_EVDEV_BITS ( ABS_CNT ) ] ;
+    unsigned long key_bits [ _JS_EVDEV_BITS ( KEY_CNT ) ] ;
+
+    memset ( abs_bits, 0, sizeof(abs_bits) ) ;
+    memset ( key_bits, 0, sizeof(key_bits) ) ;
+
+    if ( ioctl ( f, EVIOCGBIT ( EV_ABS, sizeof(abs_bits) ), abs_bits ) < 0 ||
+         ioctl ( f, EVIOCGBIT ( EV_KEY, sizeof(key_bits) ), key_bits ) < 0 )
+      return JS_FALSE ;
+
+    return _JS_EVDEV_TEST ( abs_bits, ABS_X ) &&
+         ( _JS_EVDEV_TEST ( key_bits, BTN_JOYSTICK ) ||
+           _JS_EVDEV_TEST ( key_bits, BTN_GAMEPAD  ) ||
+           _JS_EVDEV_TEST ( key_bits, BTN_TRIGGER_HAPPY ) ) ;
+  }
+
+  void openPath ( const char *path )
+  {
+    fd = ::open ( path, O_RDONLY | O_NONBLOCK ) ;
+
+    if ( fd < 0 )
+      return ;
+
+    if ( ioctl ( fd, EVIOCGNAME ( sizeof(name) ), name ) < 0 )
+      strcpy ( name, "Unknown" ) ;
+
+    name [ sizeof(name) - 1 ] = '\0' ;
+
+    /* Ask for the clock ulGetNanoTime() uses, else stamp events ourselves */
+
+#ifdef EVIOCSCLOCKID
+    int clk = CLOCK_MONOTONIC ;
+    monotonic = ( ioctl ( fd, EVIOCSCLOCKID, &clk ) == 0 ) ;
+#endif
+
+    unsigned long abs_bits [ _JS_EVDEV_BITS ( ABS_CNT ) ] ;
+    unsigned long key_bits [ _JS_EVDEV_BITS ( KEY_CNT ) ] ;
+
+    memset ( abs_bits, 0, sizeof(abs_bits) ) ;
+    memset ( key_bits, 0, sizeof(key_bits) ) ;
+
+    ioctl ( fd, EVIOCGBIT ( EV_ABS, sizeof(abs_bits) ), abs_bits ) ;
+    ioctl ( fd, EVIOCGBIT ( EV_KEY, sizeof(key_bits) ), key_bits ) ;
+
+    memset ( abs_map, -1, sizeof(abs_map) ) ;
+    memset ( key_map, -1, sizeof(key_map) ) ;
+
+    for ( int code = 0 ; code < ABS_CNT && num_axes < _JS_MAX_AXES ; code++ )
+    {
+      struct input_absinfo info ;
+
+      if ( ! _JS_EVDEV_TEST ( abs_bits, code ) || ioctl ( fd, EVIOCGABS ( code ), &info ) < 0 )
+        continue ;
+
+      abs_map  [ code ] = (signed char) num_axes ;
+      abs_code [ num_axes ] = code ;
+      axis_min [ num_axes ] = (float) info.minimum ;
+      axis_max [ num_axes ] = (float) info.maximum ;
+      num_axes ++ ;
+    }
+
+    /*
+      Buttons are numbered in joydev's order - BTN_JOYSTICK up to
+      KEY_MAX, then BTN_MISC up to BTN_JOYSTICK - so that they match
+      those of jsJoystick for the same device.
+    */
+
+    for ( int pass = 0 ; pass < 2 ; pass++ )
+    {
+      int first = ( pass == 0 ) ? BTN_JOYSTICK : BTN_MISC     ;
+      int last  = ( pass == 0 ) ? KEY_CNT      : BTN_JOYSTICK ;
+
+      for ( int code = first ; code < last && num_buttons < _JS_MAX_BUTTONS ; code++ )
+      {
+        if ( ! _JS_EVDEV_TEST ( key_bits, code ) )
+          continue ;
+
+        key_map  [ code ] = (signed char) num_buttons ;
+        key_code [ num_buttons ] = code ;
+        num_buttons ++ ;
+      }
+    }
+
+    readState ( axis_init, &button_init ) ;
+    error = JS_FALSE ;
+  }
+
+  void readState ( float *axes, int *buttons )
+  {
+    for ( int i = 0 ; i < num_axes ; i++ )
+    {
+      struct input_absinfo info ;
+
+      if ( ioctl ( fd, EVIOCGABS ( abs_code [ i ] ), &info ) == 0 )
+        axes [ i ] = (float) info.value ;
+    }
+
+    unsigned long key_state [ _JS_EVDEV_BITS ( KEY_CNT ) ] ;
+    memset ( key_state, 0, sizeof(key_state) ) ;
+    ioctl ( fd, EVIOCGKEY ( sizeof(key_state) ), key_state ) ;
+
+    *buttons = 0 ;
+
+    for ( int i = 0 ; i < num_buttons ; i++ )
+      if ( _JS_EVDEV_TEST ( key_state, key_code [ i ] ) )
+        *buttons |= 1 << i ;
+  }
+
+  /* After the kernel dropped events, report the current state in full */
+
+  void resync ( unsigned long long now )
+  {
+    float axes [ _JS_MAX_AXES ] ;
+    int   buttons ;
+
+    readState ( axes, &buttons ) ;
+
+    for ( int i = 0 ; i < num_axes ; i++ )
+      pushEvent ( now, JS_EVENT_AXIS, i, axes [ i ] ) ;
+
+    for ( int i = 0 ; i < num_buttons ; i++ )
+      pushEvent ( now, JS_EVENT_BUTTON, i, (float) ( ( buttons >> i ) & 1 ) ) ;
+  }
+
+  /* Returns JS_FALSE once the device is gone */
+
+  int readEvents ( void )
+  {
+    struct input_event ev [ 64 ] ;
+    int dropping = JS_FALSE ;
+
+    for (;;)
+    {
+      ssize_t n = ::read ( fd, ev, sizeof(ev) ) ;
+
+      if ( n < 0 )
+      {
+        if ( errno == EINTR )
+          continue ;
+
+        if ( errno != EAGAIN )
+        {
+          pushEvent ( ulGetNanoTime (), JS_EVENT_LOST, 0, 0.0f ) ;
+          return JS_FALSE ;
+        }
+
+        return JS_TRUE ;
+      }
+
+      for ( int i = 0 ; i < (int) ( n / sizeof(struct input_event) ) ; i++ )
+      {
+        const struct input_event *e = & ev [ i ] ;
+
+        unsigned long long t = monotonic ?
+             (unsigned long long) e -> time.tv_sec * 1000000000ull + e -> time.tv_usec * 1000ull :
+             ulGetNanoTime () ;
+
+        if ( e -> type == EV_SYN )
+        {
+          if ( e -> code == SYN_DROPPED )
+            dropping = JS_TRUE ;
+          else
+          if ( e -> code == SYN_REPORT && dropping )
+          {
+            dropping = JS_FALSE ;
+            resync ( t ) ;
+          }
+        }
+        else
+        if ( dropping )
+          continue ;
+        else
+        if ( e -> type == EV_ABS && e -> code < ABS_CNT && abs_map [ e -> code ] >= 0 )
+          pushEvent ( t, JS_EVENT_AXIS, abs_map [ e -> code ], (float) e -> value ) ;
+        else
+        if ( e -> type == EV_KEY && e -> code < KEY_CNT && key_map [ e -> code ] >= 0 && e -> value != 2 )
+          pushEvent ( t, JS_EVENT_BUTTON, key_map [ e -> code ], (float) e -> value ) ;
+      }
+    }
+  }
+
+  static void *threadMain ( void *self )
+  {
+    jsEvdevDevice *dev = (jsEvdevDevice *) self ;
+
+    for (;;)
+    {
+      struct epoll_event ev [ 2 ] ;
+      int n = epoll_wait ( dev -> epoll_fd, ev, 2, -1 ) ;
+
+      if ( n < 0 && errno != EINTR )
+        break ;
+
+      for ( int i = 0 ; i < n ; i++ )
+      {
+        if ( ev [ i ] . data.fd == dev -> wake_fd )
+          return NULL ;
+
+        if ( ev [ i ] . events & ( EPOLLERR | EPOLLHUP ) )
+        {
+          dev -> pushEvent ( ulGetNanoTime (), JS_EVENT_LOST, 0, 0.0f ) ;
+          return NULL ;
+        }
+
+        if ( ! dev -> readEvents () )
+          return NULL ;
+      }
+    }
+
+    return NULL ;
+  }
+
+  void init ( void )
+  {
+    fd = wake_fd = epoll_fd = -1 ;
+    monotonic = JS_FALSE ;
+    started   = JS_FALSE ;
+  }
+
+public:
+
+  jsEvdevDevice ( int ident = 0 )
+  {
+    init () ;
+
+    for ( int i = 0, found = 0 ; i < 64 ; i++ )
+    {
+      char path [ 32 ] ;
+      sprintf ( path, "/dev/input/event%d", i ) ;
+
+      int f = ::open ( path, O_RDONLY | O_NONBLOCK ) ;
+
+      if ( f < 0 )
+        continue ;
+
+      int joy = isJoystick ( f ) ;
+      ::close ( f ) ;
+
+      if ( joy && found++ == ident )
+      {
+        openPath ( path ) ;
+        break ;
+      }
+    }
+  }
+
+  jsEvdevDevice ( const char *path )
+  {
+    init () ;
+    openPath ( path ) ;
+  }
+
+  ~jsEvdevDevice ()
+  {
+    stop () ;
+
+    if ( fd >= 0 )
+      ::close ( fd ) ;
+  }
+
+  int start ( jsEventQueue *q )
+  {
+    if ( error || started )
+      return JS_FALSE ;
+
+    queue    = q ;
+    wake_fd  = eventfd ( 0, EFD_NONBLOCK ) ;
+    epoll_fd = epoll_create ( 2 ) ;
+
+    struct epoll_event ev ;
+    memset ( &ev, 0, sizeof(ev) ) ;
+    ev.events = EPOLLIN ;
+
+    int ok = ( wake_fd >= 0 && epoll_fd >= 0 ) ;
+
+    ev.data.fd = fd ;
+    ok = ok && epoll_ctl ( epoll_fd, EPOLL_CTL_ADD, fd, &ev ) == 0 ;
+    ev.data.fd = wake_fd ;
+    ok = ok && epoll_ctl ( epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev ) == 0 ;
+
+    if ( ok && pthread_create ( &thread, NULL, threadMain, this ) != 0 )
+      ok = JS_FALSE ;
+
+    started = ok ;
+
+    if ( ! ok )
+    {
+      ulSetError ( UL_WARNING, "jsEvdevDevice: Can't start the input thread for '%s'", name ) ;
+      stop () ;
+    }
+
+    return ok ;
+  }
+
+  /*
+    Also needed after a JS_EVENT_LOST, before start() may be called
+    again: the thread has ended by then, but it still has to be joined.
+  */
+
+  void stop ( void )
+  {
+    if ( started )
+    {
+      unsigned long long one = 1 ;
+      started = JS_FALSE ;
+
+      /* The thread may have ended already, which is fine */
+
+      if ( ::write ( wake_fd, &one, sizeof(one) ) != sizeof(one) )
+        ulSetError ( UL_WARNING, "jsEvdevDevice: Can't wake the input thread" ) ;
+
+      pthread_join ( thread, NULL ) ;
+    }
+
+    if ( epoll_fd >= 0 ) ::close ( epoll_fd ) ;
+    if ( wake_fd  >= 0 ) ::close ( wake_fd  ) ;
+
+    epoll_fd = wake_fd = -1 ;
+    queue = NULL ;
+  }
+} ;
+
+#endif
+
+
+/*
+  The jsJoystick interface over a jsEventDevice.  Button states are a
+  bit mask and axes are in the device's raw units for rawRead(), and
+  scaled to -1..1 by read(), just as for jsJoystick.
+*/
+
+class jsEventJoystick
+{
+  jsEventDevice *dev ;
+  jsEventQueue   queue ;
+  int   error ;
+  int   num_axes ;
+  int   num_buttons ;
+
+  int   buttons ;
+  float axes [ _JS_MAX_AXES ] ;
+
+  float dead_band [ _JS_MAX_AXES ] ;
+  float saturate  [ _JS_MAX_AXES ] ;
+  float center    [ _JS_MAX_AXES ] ;
+  float max       [ _JS_MAX_AXES ] ;
+  float min       [ _JS_MAX_AXES ] ;
+
+  void attach ( jsEventDevice *d )
+  {
+    dev = d ;
+    num_axes    = dev -> getNumAxes    () ;
+    num_buttons = dev -> getNumButtons () ;
+    buttons     = dev -> getButtonsInitial () ;
+
+    for ( int i = 0 ; i < _JS_MAX_AXES ; i++ )
+    {
+      axes      [ i ] = dev -> getAxisInitial ( i ) ;
+      min       [ i ] = dev -> getAxisMin ( i ) ;
+      max       [ i ] = dev -> getAxisMax ( i ) ;
+      center    [ i ] = ( max [ i ] + min [ i ] ) / 2.0f ;
+      dead_band [ i ] = 0.0f ;
+      saturate  [ i ] = 1.0f ;
+    }
+
+    error = dev -> notWorking () || ! dev -> start ( &queue ) ;
+  }
+
+  void apply ( const jsEvent *e )
+  {
+    switch ( e -> type )
+    {
+      case JS_EVENT_AXIS :
+        if ( e -> index >= 0 && e -> index < num_axes )
+          axes [ e -> index ] = e -> value ;
+        break ;
+
+      case JS_EVENT_BUTTON :
+        if ( e -> index >= 0 && e -> index < _JS_MAX_BUTTONS )
+        {
+          if ( e -> value != 0.0f )
+            buttons |=   1 << e -> index ;
+          else
+            buttons &= ~ ( 1 << e -> index ) ;
+        }
+        break ;
+
+      case JS_EVENT_LOST :
+        error = JS_TRUE ;
+        break ;
+    }
+  }
+
+  float fudge_axis ( float value, int axis ) const
+  {
+    if ( value < center [ axis ] )
+    {
+      float xx = ( value - center [ axis ] ) / ( center [ axis ] - min [ axis ] ) ;
+
+      if ( xx < -saturate [ axis ] ) return -1.0f ;
+      if ( xx > -dead_band [ axis ] ) return 0.0f ;
+
+      xx = ( xx + dead_band [ axis ] ) / ( saturate [ axis ] - dead_band [ axis ] ) ;
+
+      return ( xx < -1.0f ) ? -1.0f : xx ;
+    }
+    else
+    {
+      float xx = ( value - center [ axis ] ) / ( max [ axis ] - center [ axis ] ) ;
+
+      if ( xx > saturate [ axis ] ) return 1.0f ;
+      if ( xx < dead_band [ axis ] ) return 0.0f ;
+
+      xx = ( xx - dead_band [ axis ] ) / ( saturate [ axis ] - dead_band [ axis ] ) ;
+
+      return ( xx > 1.0f ) ? 1.0f : xx ;
+    }
+  }
+
+public:
+
+  jsEventJoystick ( int ident = 0 )
+  {
+#ifdef UL_LINUX
+    attach ( new jsEvdevDevice ( ident ) ) ;
+#else
+    attach ( new jsPolledDevice ( ident ) ) ;
+#endif
+  }
+
+  jsEventJoystick ( jsEventDevice *d ) { attach ( d ) ; }
+
+  ~jsEventJoystick ()
+  {
+    dev -> stop () ;
+    delete dev ;
+  }
+
+  jsEventDevice *getDevice () const { return dev ; }
+
+  const char* getName () const { return dev -> getName () ; }
+  int   getNumAxes    () const { return num_axes ; }
+  int   getNumButtons () const { return num_buttons; }
+  int   notWorking    () const { return error ;    }
+  void  setError      () { error = JS_TRUE ; }
+
+  float getDeadBand ( int axis ) const       { return dead_band [ axis ] ; }
+  void  setDeadBand ( int axis, float db )   { dead_band [ axis ] = db   ; }
+
+  float getSaturation ( int axis ) const     { return saturate [ axis ]  ; }
+  void  setSaturation ( int axis, float st ) { saturate [ axis ] = st    ; }
+
+  void setMinRange ( float *a ) { memcpy ( min   , a, num_axes * sizeof(float) ) ; }
+  void setMaxRange ( float *a ) { memcpy ( max   , a, num_axes * sizeof(float) ) ; }
+  void setCenter   ( float *a ) { memcpy ( center, a, num_axes * sizeof(float) ) ; }
+
+  void getMinRange ( float *a ) const { memcpy ( a, min   , num_axes * sizeof(float) ) ; }
+  void getMaxRange ( float *a ) const { memcpy ( a, max   , num_axes * sizeof(float) ) ; }
+  void getCenter   ( float *a ) const { memcpy ( a, center, num_axes * sizeof(float) ) ; }
+
+  unsigned int getNumDropped () const { return queue.getNumDropped () ; }
+
+  /*
+    The next event, in raw units.  Events are also applied to the state
+    that read() and rawRead() return.
+  */
+
+  int getEvent ( jsEvent *e )
+  {
+    if ( queue.isEmpty () )
+      dev -> service ( ulGetNanoTime () ) ;
+
+    if ( ! queue.pop ( e ) )
+      return JS_FALSE ;
+
+    apply ( e ) ;
+    return JS_TRUE ;
+  }
+
+  /* Take in all the pending events */
+
+  void update ()
+  {
+    jsEvent e ;
+
+    dev -> service ( ulGetNanoTime () ) ;
+
+    while ( queue.pop ( &e ) )
+      apply ( &e ) ;
+  }
+
+  void rawRead ( int *b, float *a )
+  {
+    update () ;
+
+    if ( error )
+    {
+      if ( b ) *b = 0 ;
+
+      if ( a )
+        for ( int i = 0 ; i < num_axes ; i++ )
+          a [ i ] = 0.0f ;
+
+      return ;
+    }
+
+    if ( b ) *b = buttons ;
+    if ( a ) memcpy ( a, axes, num_axes * sizeof(float) ) ;
+  }
+
+  void read ( int *b, float *a )
+  {
+    float raw [ _JS_MAX_AXES ] ;
+
+    rawRead ( b, raw ) ;
+
+    if ( a )
+      for ( int i = 0 ; i < num_axes ; i++ )
+        a [ i ] = error ? 0.0f : fudge_axis ( raw [ i ], i ) ;
+  }
+} ;
+
+#endif
+
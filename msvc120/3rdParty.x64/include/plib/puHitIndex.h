@@ -0,0 +1,451 @@
+/*
+     PLIB - A Suite of Portable Game Libraries
+     Copyright (C) 1998,2002  Steve Baker
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Library General Public
+     License as published by the Free Software Foundation; either
+     version 2 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Library General Public License for more details.
+
+     You should have received a copy of the GNU Library General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+
+     For further information visit http://plib.sourceforge.net
+*/
+
+/*
+  Spatially indexed hit testing for PUI groups.
+  ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+  puGroup::checkHit() offers every mouse event to each of its children
+  in turn, from the front-most backwards.  Wrapping a group class in
+  puIndexed<> keeps a uniform grid over the active boxes of its
+  children, so that only the few children under the mouse are asked:
+
+    puIndexed<puInterface> *panel = new puIndexed<puInterface> ( 0, 0 ) ;
+      ... add hundreds of widgets as usual ...
+    panel -> close () ;
+
+  Children are still asked in the same front-to-back order, and the
+  group's own right-button dragging works as before.
+
+  The grid is rebuilt lazily.  The layout (the children, their order,
+  types and active boxes) is compared with the one the grid was built
+  for whenever the group is drawn, and on a hit while a redisplay is
+  pending - PUI posts one whenever a widget moves, resizes or changes
+  its legend or label.  Anything that moves widgets behind PUI's back
+  should be followed by a call to invalidateIndex().
+
+  The grid relies on a widget never taking a click outside its active
+  box, which is true of all the leaf widgets in pu.h.  Child groups and
+  the puAux widgets are never put in the grid and are always asked, as
+  is anything for which isIndexable() returns FALSE - override it for
+  widgets of your own with unusual hit areas.
+
+  Menu bars and popup menus have hit tests of their own that look at
+  every item (to highlight the one under the mouse) and are left to
+  them.
+*/
+
+#ifndef _PU_HIT_INDEX_H_
+#define _PU_HIT_INDEX_H_  1
+
+#include "pu.h"
+
+
+#define PU_HIT_INDEX_MAX_CELLS  64   /* Per axis */
+
+
+struct puHitIndexStats
+{
+  unsigned int events  ;   /* Mouse events seen by indexed groups   */
+  unsigned int tested  ;   /* Children asked                        */
+  unsigned int skipped ;   /* Children not asked thanks to the grid */
+  unsigned int builds  ;   /* Grids (re-)built                      */
+} ;
+
+inline puHitIndexStats *puGetHitIndexStats ( void )
+{
+  static puHitIndexStats stats = { 0, 0, 0, 0 } ;
+  return & stats ;
+}
+
+inline void puResetHitIndexStats ( void )
+{
+  puHitIndexStats *stats = puGetHitIndexStats () ;
+  stats -> events = stats -> tested = stats -> skipped = stats -> builds = 0 ;
+}
+
+
+/*
+  'Base' is puGroup or any class derived from it that is constructed
+  from an (x,y) position - puInterface, puPopup, puDialogBox...
+*/
+
+template < class Base >
+class puIndexed : public Base
+{
+  puObject **children ;      /* In dlist order                        */
+  int       *types ;         /* Their type and active box when the     */
+  puBox     *boxes ;         /* grid was built                         */
+  int       *position ;      /* Grid cell contents (child positions)   */
+  int       *cell_start ;    /* Where each cell starts in 'position'   */
+  int       *others ;        /* Positions of children not in the grid  */
+  int        num_others ;
+  int        num_kids ;
+  int        size ;          /* Children allocated for                 */
+
+  int        org [ 2 ] ;     /* Grid origin, cell size and cell counts */
+  int        cell_size [ 2 ] ;
+  int        num_cells [ 2 ] ;
+
+  int        indexing ;
+  int        valid ;
+
+  /* Whether the children are still those the grid was built for */
+
+  int _sameLayout ( void )
+  {
+    int i = 0 ;
+
+    for ( puObject *ch = Base::getFirstChild () ; ch != NULL ; ch = ch -> getNextObject (), i++ )
+    {
+      if ( i >= num_kids || children [ i ] != ch || types [ i ] != ch -> getType () )
+        return FALSE ;
+
+      const puBox *b = ch -> getABox () ;
+
+      if ( boxes [ i ] . min[0] != b -> min[0] || boxes [ i ] . min[1] != b -> min[1] ||
+           boxes [ i ] . max[0] != b -> max[0] || boxes [ i ] . max[1] != b -> max[1] )
+        return FALSE ;
+    }
+
+    return i == num_kids ;
+  }
+
+  void _freeIndex ( void )
+  {
+    delete [] children   ; children   = NULL ;
+    delete [] types      ; types      = NULL ;
+    delete [] boxes      ; boxes      = NULL ;
+    delete [] position   ; position   = NULL ;
+    delete [] cell_start ; cell_start = NULL ;
+    delete [] others     ; others     = NULL ;
+    size = 0 ;
+  }
+
+  void _buildIndex ( void )
+  {
+    int n = 0 ;
+
+    for ( puObject *ch = Base::getFirstChild () ; ch != NULL ; ch = ch -> getNextObject () )
+      n ++ ;
+
+    if ( n > size )
+    {
+      _freeIndex () ;
+      size     = n ;
+      children = new puObject * [ n ] ;
+      types    = new int [ n ] ;
+      boxes    = new puBox [ n ] ;
+      others   = new int [ n ] ;
+    }
+
+    num_kids   = n ;
+    num_others = 0 ;
+
+    puBox bounds ;
+    bounds.empty () ;
+
+    int i = 0 ;
+
+    for ( puObject *ch = Base::getFirstChild () ; ch != NULL ; ch = ch -> getNextObject (), i++ )
+    {
+      const puBox *b = ch -> getABox () ;
+
+      children [ i ] = ch ;
+      types    [ i ] = ch -> getType () ;
+      boxes    [ i ] = *b ;
+
+      if ( ! _isGridded ( ch ) )
+        continue ;
+
+      if ( b -> min[0] < bounds.min[0] ) bounds.min[0] = b -> min[0] ;
+      if ( b -> min[1] < bounds.min[1] ) bounds.min[1] = b -> min[1] ;
+      if ( b -> max[0] > bounds.max[0] ) bounds.max[0] = b -> max[0] ;
+      if ( b -> max[1] > bounds.max[1] ) bounds.max[1] = b -> max[1] ;
+    }
+
+    int num_gridded = 0 ;
+
+    for ( i = 0 ; i < n ; i++ )
+      if ( _isGridded ( children [ i ] ) )
+        num_gridded ++ ;
+      else
+        others [ num_others++ ] = i ;
+
+    /* About one widget per cell */
+
+    int cells = 1 ;
+
+    while ( cells * cells < num_gridded && cells < PU_HIT_INDEX_MAX_CELLS )
+      cells ++ ;
+
+    if ( bounds.isEmpty () )
+    {
+      bounds.min[0] = bounds.min[1] = 0 ;
+      bounds.max[0] = bounds.max[1] = 0 ;
+    }
+
+    for ( int k = 0 ; k < 2 ; k++ )
+    {
+      int extent = bounds.max[k] - bounds.min[k] + 1 ;
+
+      org       [ k ] = bounds.min[k] ;
+      num_cells [ k ] = ( extent < cells ) ? extent : cells ;
+      cell_size [ k ] = ( extent + num_cells[k] - 1 ) / num_cells[k] ;
+    }
+
+    delete [] cell_start ;
+    cell_start = new int [ num_cells[0] * num_cells[1] + 1 ] ;
+
+    /*
+      Two passes - count, then fill.  A widget goes in every cell its
+      box touches, and children are visited in dlist order so each cell
+      lists them in that order too.
+    */
+
+    int total = 0 ;
+
+    for ( int pass = 0 ; pass < 2 ; pass++ )
+    {
+      int ncells = num_cells[0] * num_cells[1] ;
+
+      if ( pass == 1 )
+      {
+        delete [] position ;
+        position = new int [ total > 0 ? total : 1 ] ;
+
+        for ( int c = 0, start = 0 ; c <= ncells ; c++ )
+        {
+          int count = ( c < ncells ) ? cell_start [ c ] : 0 ;
+          cell_start [ c ] = start ;
+          start += count ;
+        }
+      }
+      else
+        for ( int c = 0 ; c < ncells ; c++ )
+          cell_start [ c ] = 0 ;
+
+      int *fill = ( pass == 1 ) ? new int [ ncells ] : NULL ;
+
+      if ( fill != NULL )
+        for ( int c = 0 ; c < ncells ; c++ )
+          fill [ c ] = cell_start [ c ] ;
+
+      for ( i = 0 ; i < n ; i++ )
+      {
+        if ( ! _isGridded ( children [ i ] ) )
+          continue ;
+
+        const puBox *b = children [ i ] -> getABox () ;
+
+        int x0 = _cell ( 0, b -> min[0] ), x1 = _cell ( 0, b -> max[0] ) ;
+        int y0 = _cell ( 1, b -> min[1] ), y1 = _cell ( 1, b -> max[1] ) ;
+
+        for ( int cy = y0 ; cy <= y1 ; cy++ )
+          for ( int cx = x0 ; cx <= x1 ; cx++ )
+          {
+            int c = cy * num_cells[0] + cx ;
+
+            if ( pass == 0 )
+            {
+              cell_start [ c ] ++ ;
+              total ++ ;
+            }
+            else
+              position [ fill [ c ] ++ ] = i ;
+          }
+      }
+
+      delete [] fill ;
+    }
+
+    valid = TRUE ;
+    puGetHitIndexStats () -> builds ++ ;
+  }
+
+  int _isGridded ( puObject *ob )
+  {
+    /* Groups and the puAux widget bits are always asked */
+
+    return ( ob -> getType () & ( PUCLASS_GROUP | 0xFFFC0000 ) ) == 0 &&
+           ! ob -> getABox () -> isEmpty () && isIndexable ( ob ) ;
+  }
+
+  int _cell ( int axis, int v ) const
+  {
+    int c = ( v - org [ axis ] ) / cell_size [ axis ] ;
+
+    return ( c < 0 ) ? 0 : ( c >= num_cells [ axis ] ) ? num_cells [ axis ] - 1 : c ;
+  }
+
+  void _checkLayout ( void )
+  {
+    if ( ! valid || ! _sameLayout () )
+      _buildIndex () ;
+  }
+
+  /* The children of 'this' under (x,y), front-most first */
+
+  int _childHit ( int button, int updown, int x, int y )
+  {
+    puHitIndexStats *stats = puGetHitIndexStats () ;
+
+    const int *cand = NULL ;
+    int num_cand = 0 ;
+
+    if ( x >= org[0] && x < org[0] + num_cells[0] * cell_size[0] &&
+         y >= org[1] && y < org[1] + num_cells[1] * cell_size[1] )
+    {
+      int c = _cell ( 1, y ) * num_cells[0] + _cell ( 0, x ) ;
+
+      cand     = position + cell_start [ c ] ;
+      num_cand = cell_start [ c + 1 ] - cell_start [ c ] ;
+    }
+
+    int i = num_cand   - 1 ;
+    int j = num_others - 1 ;
+    int asked = 0 ;
+    int hit = FALSE ;
+
+    while ( ! hit && ( i >= 0 || j >= 0 ) )
+    {
+      int p = ( j < 0 || ( i >= 0 && cand [ i ] > others [ j ] ) ) ? cand [ i-- ] : others [ j-- ] ;
+
+      asked ++ ;
+      hit = children [ p ] -> checkHit ( button, updown, x, y ) ;
+    }
+
+    stats -> tested  += asked ;
+    stats -> skipped += ( hit ? 0 : num_kids - asked ) ;
+    return hit ;
+  }
+
+public:
+
+  puIndexed ( int x, int y ) : Base ( x, y )
+  {
+    children   = NULL ;
+    types      = NULL ;
+    boxes      = NULL ;
+    position   = NULL ;
+    cell_start = NULL ;
+    others     = NULL ;
+    num_others = 0 ;
+    num_kids   = 0 ;
+    size       = 0 ;
+    indexing   = TRUE ;
+    valid      = FALSE ;
+  }
+
+  ~puIndexed ()
+  {
+    _freeIndex () ;
+  }
+
+  void setIndexed ( int i ) { indexing = i ; valid = FALSE ; }
+  int  isIndexed  ( void ) const { return indexing ; }
+
+  void invalidateIndex ( void ) { valid = FALSE ; }
+
+  /* Return FALSE for widgets that can be hit outside their active box */
+
+  virtual int isIndexable ( puObject * ) { return TRUE ; }
+
+  void draw ( int dx, int dy )
+  {
+    if ( indexing && valid && ! _sameLayout () )
+      valid = FALSE ;
+
+    Base::draw ( dx, dy ) ;
+  }
+
+  /*
+    The same as puGroup::checkHit(), except that the children are
+    looked up in the grid.
+  */
+
+  int checkHit ( int button, int updown, int x, int y )
+  {
+    if ( ! indexing || ( this -> getType () & ( PUCLASS_MENUBAR | PUCLASS_POPUPMENU ) ) )
+      return Base::checkHit ( button, updown, x, y ) ;
+
+    if ( this -> dlist == NULL || ! this -> isVisible () || ! this -> isActive () )
+      return FALSE ;
+
+    puGetHitIndexStats () -> events ++ ;
+
+    this -> recalc_bbox () ;
+
+    const puBox *ab = this -> getABox () ;
+
+    x -= ab -> min[0] ;
+    y -= ab -> min[1] ;
+
+    if ( ! this -> mouse_active )
+    {
+      if ( ! valid || puNeedRefresh () )
+        _checkLayout () ;
+
+      if ( _childHit ( button, updown, x, y ) )
+        return TRUE ;
+    }
+
+    x += ab -> min[0] ;
+    y += ab -> min[1] ;
+
+    /* Dragging the whole group about with the right mouse button */
+
+    if ( this -> mouse_active ||
+         ( this -> isHit ( x, y ) && this -> floating && button == PU_RIGHT_BUTTON ) )
+    {
+      puMoveToLast ( this ) ;
+
+      if ( updown == PU_DOWN )
+      {
+        this -> mouse_x = x ;
+        this -> mouse_y = y ;
+        this -> mouse_active = TRUE ;
+        return TRUE ;
+      }
+
+      if ( updown == PU_DRAG )
+      {
+        int px, py ;
+        this -> getPosition ( &px, &py ) ;
+        this -> setPosition ( px + x - this -> mouse_x, py + y - this -> mouse_y ) ;
+        this -> mouse_x = x ;
+        this -> mouse_y = y ;
+        return TRUE ;
+      }
+
+      if ( updown == PU_UP )
+      {
+        this -> mouse_active = FALSE ;
+        return TRUE ;
+      }
+    }
+
+    return FALSE ;
+  }
+} ;
+
+#endif
+
@@ -0,0 +1,2246 @@
+/*
+     PLIB - A Suite of Portable Game Libraries
+     Copyright (C) 1998,2002  Steve Baker
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Library General Public
+     License as published by the Free Software Foundation; either
+     version 2 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Library General Public License for more details.
+
+     You should have received a copy of the GNU Library General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+
+     For further information visit http://plib.sourceforge.net
+*/
+
+/*
+  Array ("batch") variants of the SG transform, culling and quaternion
+  routines.
+  ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+  Everything in here is inline so that it can be used against an
+  existing sg library build.  Each routine comes in two layouts:
+
+    AoS - an array of sgVec3/sgVec4 (the layout used everywhere else in SG)
+    SoA - separate x, y and z arrays
+
+  The SIMD kernels are picked at run time (see sgGetSIMDLevel).  They
+  perform the same multiplies and adds, in the same order, as the scalar
+  sgXformPnt3() family, so results are identical to calling those one
+  point at a time (FMA is never used).  'dst' may be the same array as
+  'src', but the two must not otherwise overlap.
+*/
+
+#ifndef SGBATCH_H
+#define SGBATCH_H  1
+
+#include "sg.h"
+
+/*
+  Work out which SIMD instruction sets we can compile for.
+*/
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(_M_IX86) || \
+    defined(__x86_64__) || ( defined(__i386__) && defined(__SSE2__) )
+#define SG_HAVE_SSE2  1
+#endif
+
+#if defined(SG_HAVE_SSE2)
+#  if defined(_MSC_VER)
+#    if _MSC_FULL_VER >= 160040219   /* VS2010 SP1 */
+#      define SG_HAVE_AVX  1
+#    endif
+#    include <intrin.h>
+#    include <emmintrin.h>
+#    if defined(SG_HAVE_AVX)
+#      include <immintrin.h>
+#    endif
+#    define SG_TARGET_AVX
+#  elif defined(__GNUC__)
+#    if defined(__clang__) || ( __GNUC__ > 4 ) || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 9 )
+#      define SG_HAVE_AVX  1
+#    endif
+#    include <emmintrin.h>
+#    if defined(SG_HAVE_AVX)
+#      include <immintrin.h>
+#    endif
+#    define SG_TARGET_AVX __attribute__ (( target ( "avx" ) ))
+#  else
+#    undef SG_HAVE_SSE2
+#  endif
+#endif
+
+
+/*
+  Run-time selection of the SIMD kernels.
+
+  sgGetSIMDLevel() returns the best level supported by both the
+  compiler and the CPU (and OS, for AVX).  sgSetSIMDLevel() may be used
+  to force a lower level - eg for testing the scalar path - it cannot
+  raise the level above what the machine supports.  Passing a negative
+  number restores the detected level.
+*/
+
+#define SG_SIMD_NONE  0
+#define SG_SIMD_SSE2  1
+#define SG_SIMD_AVX   2
+
+inline int sgDetectSIMDLevel (void)
+{
+  int level = SG_SIMD_NONE ;
+
+#if defined(SG_HAVE_SSE2)
+#  if defined(_MSC_VER)
+  int info [ 4 ] ;
+
+  __cpuid ( info, 1 ) ;
+
+  if ( info [ 3 ] & ( 1 << 26 ) )
+    level = SG_SIMD_SSE2 ;
+
+#    if defined(SG_HAVE_AVX)
+  /* AVX needs both the CPU bit and OS support for saving the YMM registers */
+
+  if ( level == SG_SIMD_SSE2 &&
+       ( info [ 2 ] & ( 1 << 27 ) ) != 0 &&
+       ( info [ 2 ] & ( 1 << 28 ) ) != 0 &&
+       ( _xgetbv ( 0 ) & 6 ) == 6 )
+    level = SG_SIMD_AVX ;
+#    endif
+#  else
+  __builtin_cpu_init () ;
+
+  if ( __builtin_cpu_supports ( "sse2" ) )
+    level = SG_SIMD_SSE2 ;
+
+#    if defined(SG_HAVE_AVX)
+  if ( level == SG_SIMD_SSE2 && __builtin_cpu_supports ( "avx" ) )
+    level = SG_SIMD_AVX ;
+#    endif
+#  endif
+#endif
+
+  return level ;
+}
+
+inline int *_sgSIMDLevelPtr (void)
+{
+  /* -1 means "not detected yet".  Racing threads all compute the same answer. */
+
+  static int level = -1 ;
+  return & level ;
+}
+
+inline int sgGetSIMDLevel (void)
+{
+  int *level = _sgSIMDLevelPtr () ;
+
+  if ( *level < 0 )
+    *level = sgDetectSIMDLevel () ;
+
+  return *level ;
+}
+
+inline void sgSetSIMDLevel ( int level )
+{
+  int best = sgDetectSIMDLevel () ;
+
+  *_sgSIMDLevelPtr () = ( level < 0 || level > best ) ? best : level ;
+}
+
+
+/*
+  Internal kernels.  The 'mode' argument is always a constant at the
+  call site, so the compiler folds the tests on it out of the loops.
+*/
+
+#define _SG_XFORM_VEC3   0   /* w = 0                 -- sgXformVec3     */
+#define _SG_XFORM_PNT3   1   /* w = 1                 -- sgXformPnt3     */
+#define _SG_XFORM_FULL3  2   /* w = 1, divide by w'   -- sgFullXformPnt3 */
+#define _SG_XFORM_VEC4   3   /* w = src[3]            -- sgXformVec4/Pnt4 */
+
+inline void _sgXformArray_C ( SGfloat *dst, const SGfloat *src, int n,
+                              const sgMat4 mat, int mode )
+{
+  int stride = ( mode == _SG_XFORM_VEC4 ) ? 4 : 3 ;
+
+  for ( int i = 0 ; i < n ; i++, src += stride, dst += stride )
+  {
+    SGfloat t0 = src [ 0 ] ;
+    SGfloat t1 = src [ 1 ] ;
+    SGfloat t2 = src [ 2 ] ;
+
+    if ( mode == _SG_XFORM_VEC3 )
+    {
+      dst [ 0 ] = t0 * mat[0][0] + t1 * mat[1][0] + t2 * mat[2][0] ;
+      dst [ 1 ] = t0 * mat[0][1] + t1 * mat[1][1] + t2 * mat[2][1] ;
+      dst [ 2 ] = t0 * mat[0][2] + t1 * mat[1][2] + t2 * mat[2][2] ;
+    }
+    else
+    if ( mode == _SG_XFORM_PNT3 )
+    {
+      dst [ 0 ] = t0 * mat[0][0] + t1 * mat[1][0] + t2 * mat[2][0] + mat[3][0] ;
+      dst [ 1 ] = t0 * mat[0][1] + t1 * mat[1][1] + t2 * mat[2][1] + mat[3][1] ;
+      dst [ 2 ] = t0 * mat[0][2] + t1 * mat[1][2] + t2 * mat[2][2] + mat[3][2] ;
+    }
+    else
+    if ( mode == _SG_XFORM_FULL3 )
+    {
+      SGfloat w = t0 * mat[0][3] + t1 * mat[1][3] + t2 * mat[2][3] + mat[3][3] ;
+      SGfloat r = SG_ONE / w ;
+
+      dst [ 0 ] = ( t0 * mat[0][0] + t1 * mat[1][0] + t2 * mat[2][0] + mat[3][0] ) * r ;
+      dst [ 1 ] = ( t0 * mat[0][1] + t1 * mat[1][1] + t2 * mat[2][1] + mat[3][1] ) * r ;
+      dst [ 2 ] = ( t0 * mat[0][2] + t1 * mat[1][2] + t2 * mat[2][2] + mat[3][2] ) * r ;
+    }
+    else
+    {
+      SGfloat t3 = src [ 3 ] ;
+
+      dst [ 0 ] = t0 * mat[0][0] + t1 * mat[1][0] + t2 * mat[2][0] + t3 * mat[3][0] ;
+      dst [ 1 ] = t0 * mat[0][1] + t1 * mat[1][1] + t2 * mat[2][1] + t3 * mat[3][1] ;
+      dst [ 2 ] = t0 * mat[0][2] + t1 * mat[1][2] + t2 * mat[2][2] + t3 * mat[3][2] ;
+      dst [ 3 ] = t0 * mat[0][3] + t1 * mat[1][3] + t2 * mat[2][3] + t3 * mat[3][3] ;
+    }
+  }
+}
+
+inline void _sgXformArraySoA_C ( SGfloat *dx, SGfloat *dy, SGfloat *dz,
+                                 const SGfloat *sx, const SGfloat *sy, const SGfloat *sz,
+                                 int first, int n, const sgMat4 mat, int mode )
+{
+  for ( int i = first ; i < n ; i++ )
+  {
+    SGfloat t0 = sx [ i ] ;
+    SGfloat t1 = sy [ i ] ;
+    SGfloat t2 = sz [ i ] ;
+
+    SGfloat x = t0 * mat[0][0] + t1 * mat[1][0] + t2 * mat[2][0] ;
+    SGfloat y = t0 * mat[0][1] + t1 * mat[1][1] + t2 * mat[2][1] ;
+    SGfloat z = t0 * mat[0][2] + t1 * mat[1][2] + t2 * mat[2][2] ;
+
+    if ( mode != _SG_XFORM_VEC3 )
+    {
+      x += mat[3][0] ;
+      y += mat[3][1] ;
+      z += mat[3][2] ;
+    }
+
+    if ( mode == _SG_XFORM_FULL3 )
+    {
+      SGfloat r = SG_ONE / ( t0 * mat[0][3] + t1 * mat[1][3] + t2 * mat[2][3] + mat[3][3] ) ;
+      x *= r ; y *= r ; z *= r ;
+    }
+
+    dx [ i ] = x ;
+    dy [ i ] = y ;
+    dz [ i ] = z ;
+  }
+}
+
+
+#if defined(SG_HAVE_SSE2)
+
+/*
+  AoS - one point per iteration, using the rows of the matrix as vectors:
+    dst = x * mat[0] + y * mat[1] + z * mat[2] + w * mat[3]
+  This yields all four output components (including w) at once.  The
+  same kernel serves the AVX level since the 12-byte stride of sgVec3
+  leaves nothing more to gain from wider registers.
+*/
+
+inline void _sgXformArray_SSE2 ( SGfloat *dst, const SGfloat *src, int n,
+                                 const sgMat4 mat, int mode )
+{
+  __m128 m0 = _mm_loadu_ps ( mat [ 0 ] ) ;
+  __m128 m1 = _mm_loadu_ps ( mat [ 1 ] ) ;
+  __m128 m2 = _mm_loadu_ps ( mat [ 2 ] ) ;
+  __m128 m3 = _mm_loadu_ps ( mat [ 3 ] ) ;
+  __m128 one = _mm_set1_ps ( SG_ONE ) ;
+
+  int stride = ( mode == _SG_XFORM_VEC4 ) ? 4 : 3 ;
+
+  for ( int i = 0 ; i < n ; i++, src += stride, dst += stride )
+  {
+    __m128 r = _mm_add_ps ( _mm_add_ps ( _mm_mul_ps ( _mm_set1_ps ( src[0] ), m0 ),
+                                         _mm_mul_ps ( _mm_set1_ps ( src[1] ), m1 ) ),
+                                         _mm_mul_ps ( _mm_set1_ps ( src[2] ), m2 ) ) ;
+
+    if ( mode == _SG_XFORM_VEC4 )
+    {
+      r = _mm_add_ps ( r, _mm_mul_ps ( _mm_set1_ps ( src[3] ), m3 ) ) ;
+      _mm_storeu_ps ( dst, r ) ;
+      continue ;
+    }
+
+    if ( mode != _SG_XFORM_VEC3 )
+      r = _mm_add_ps ( r, m3 ) ;
+
+    if ( mode == _SG_XFORM_FULL3 )
+      r = _mm_mul_ps ( r, _mm_div_ps ( one, _mm_shuffle_ps ( r, r, _MM_SHUFFLE(3,3,3,3) ) ) ) ;
+
+    /* Store exactly three floats - never touch the next element */
+
+    _mm_storel_pi ( (__m64 *) dst, r ) ;
+    _mm_store_ss  ( dst + 2, _mm_movehl_ps ( r, r ) ) ;
+  }
+}
+
+/* SoA - four points per iteration, each matrix element broadcast. */
+
+inline int _sgXformArraySoA_SSE2 ( SGfloat *dx, SGfloat *dy, SGfloat *dz,
+                                   const SGfloat *sx, const SGfloat *sy, const SGfloat *sz,
+                                   int n, const sgMat4 mat, int mode )
+{
+  __m128 m [ 4 ][ 4 ] ;
+
+  for ( int r = 0 ; r < 4 ; r++ )
+    for ( int c = 0 ; c < 4 ; c++ )
+      m [ r ][ c ] = _mm_set1_ps ( mat [ r ][ c ] ) ;
+
+  __m128 one = _mm_set1_ps ( SG_ONE ) ;
+
+  int i = 0 ;
+
+  for ( ; i + 4 <= n ; i += 4 )
+  {
+    __m128 t0 = _mm_loadu_ps ( sx + i ) ;
+    __m128 t1 = _mm_loadu_ps ( sy + i ) ;
+    __m128 t2 = _mm_loadu_ps ( sz + i ) ;
+    __m128 d [ 3 ] ;
+
+    for ( int c = 0 ; c < 3 ; c++ )
+    {
+      d [ c ] = _mm_add_ps ( _mm_add_ps ( _mm_mul_ps ( t0, m[0][c] ),
+                                          _mm_mul_ps ( t1, m[1][c] ) ),
+                                          _mm_mul_ps ( t2, m[2][c] ) ) ;
+      if ( mode != _SG_XFORM_VEC3 )
+        d [ c ] = _mm_add_ps ( d [ c ], m[3][c] ) ;
+    }
+
+    if ( mode == _SG_XFORM_FULL3 )
+    {
+      __m128 w = _mm_add_ps ( _mm_add_ps ( _mm_add_ps ( _mm_mul_ps ( t0, m[0][3] ),
+                                                        _mm_mul_ps ( t1, m[1][3] ) ),
+                                                        _mm_mul_ps ( t2, m[2][3] ) ),
+                                                        m[3][3] ) ;
+      w = _mm_div_ps ( one, w ) ;
+
+      for ( int c = 0 ; c < 3 ; c++ )
+        d [ c ] = _mm_mul_ps ( d [ c ], w ) ;
+    }
+
+    _mm_storeu_ps ( dx + i, d [ 0 ] ) ;
+    _mm_storeu_ps ( dy + i, d [ 1 ] ) ;
+    _mm_storeu_ps ( dz + i, d [ 2 ] ) ;
+  }
+
+  return i ;
+}
+
+/* Double precision, AoS - two __m128d halves per point. */
+
+inline void _sgdXformArray_SSE2 ( SGDfloat *dst, const SGDfloat *src, int n,
+                                  const sgdMat4 mat, int mode )
+{
+  __m128d m0l = _mm_loadu_pd ( & mat[0][0] ), m0h = _mm_loadu_pd ( & mat[0][2] ) ;
+  __m128d m1l = _mm_loadu_pd ( & mat[1][0] ), m1h = _mm_loadu_pd ( & mat[1][2] ) ;
+  __m128d m2l = _mm_loadu_pd ( & mat[2][0] ), m2h = _mm_loadu_pd ( & mat[2][2] ) ;
+  __m128d m3l = _mm_loadu_pd ( & mat[3][0] ), m3h = _mm_loadu_pd ( & mat[3][2] ) ;
+  __m128d one = _mm_set1_pd ( SGD_ONE ) ;
+
+  int stride = ( mode == _SG_XFORM_VEC4 ) ? 4 : 3 ;
+
+  for ( int i = 0 ; i < n ; i++, src += stride, dst += stride )
+  {
+    __m128d t0 = _mm_set1_pd ( src[0] ) ;
+    __m128d t1 = _mm_set1_pd ( src[1] ) ;
+    __m128d t2 = _mm_set1_pd ( src[2] ) ;
+
+    __m128d lo = _mm_add_pd ( _mm_add_pd ( _mm_mul_pd ( t0, m0l ), _mm_mul_pd ( t1, m1l ) ),
+                                           _mm_mul_pd ( t2, m2l ) ) ;
+    __m128d hi = _mm_add_pd ( _mm_add_pd ( _mm_mul_pd ( t0, m0h ), _mm_mul_pd ( t1, m1h ) ),
+                                           _mm_mul_pd ( t2, m2h ) ) ;
+
+    if ( mode == _SG_XFORM_VEC4 )
+    {
+      __m128d t3 = _mm_set1_pd ( src[3] ) ;
+      _mm_storeu_pd ( dst    , _mm_add_pd ( lo, _mm_mul_pd ( t3, m3l ) ) ) ;
+      _mm_storeu_pd ( dst + 2, _mm_add_pd ( hi, _mm_mul_pd ( t3, m3h ) ) ) ;
+      continue ;
+    }
+
+    if ( mode != _SG_XFORM_VEC3 )
+    {
+      lo = _mm_add_pd ( lo, m3l ) ;
+      hi = _mm_add_pd ( hi, m3h ) ;
+    }
+
+    if ( mode == _SG_XFORM_FULL3 )
+    {
+      __m128d r = _mm_div_pd ( one, _mm_unpackhi_pd ( hi, hi ) ) ;
+      lo = _mm_mul_pd ( lo, r ) ;
+      hi = _mm_mul_pd ( hi, r ) ;
+    }
+
+    _mm_storeu_pd ( dst, lo ) ;
+    _mm_store_sd  ( dst + 2, hi ) ;
+  }
+}
+
+/* Double precision, SoA - two points per iteration. */
+
+inline int _sgdXformArraySoA_SSE2 ( SGDfloat *dx, SGDfloat *dy, SGDfloat *dz,
+                                    const SGDfloat *sx, const SGDfloat *sy, const SGDfloat *sz,
+                                    int n, const sgdMat4 mat, int mode )
+{
+  __m128d m [ 4 ][ 4 ] ;
+
+  for ( int r = 0 ; r < 4 ; r++ )
+    for ( int c = 0 ; c < 4 ; c++ )
+      m [ r ][ c ] = _mm_set1_pd ( mat [ r ][ c ] ) ;
+
+  __m128d one = _mm_set1_pd ( SGD_ONE ) ;
+
+  int i = 0 ;
+
+  for ( ; i + 2 <= n ; i += 2 )
+  {
+    __m128d t0 = _mm_loadu_pd ( sx + i ) ;
+    __m128d t1 = _mm_loadu_pd ( sy + i ) ;
+    __m128d t2 = _mm_loadu_pd ( sz + i ) ;
+    __m128d d [ 3 ] ;
+
+    for ( int c = 0 ; c < 3 ; c++ )
+    {
+      d [ c ] = _mm_add_pd ( _mm_add_pd ( _mm_mul_pd ( t0, m[0][c] ),
+                                          _mm_mul_pd ( t1, m[1][c] ) ),
+                                          _mm_mul_pd ( t2, m[2][c] ) ) ;
+      if ( mode != _SG_XFORM_VEC3 )
+        d [ c ] = _mm_add_pd ( d [ c ], m[3][c] ) ;
+    }
+
+    if ( mode == _SG_XFORM_FULL3 )
+    {
+      __m128d w = _mm_add_pd ( _mm_add_pd ( _mm_add_pd ( _mm_mul_pd ( t0, m[0][3] ),
+                                                         _mm_mul_pd ( t1, m[1][3] ) ),
+                                                         _mm_mul_pd ( t2, m[2][3] ) ),
+                                                         m[3][3] ) ;
+      w = _mm_div_pd ( one, w ) ;
+
+      for ( int c = 0 ; c < 3 ; c++ )
+        d [ c ] = _mm_mul_pd ( d [ c ], w ) ;
+    }
+
+    _mm_storeu_pd ( dx + i, d [ 0 ] ) ;
+    _mm_storeu_pd ( dy + i, d [ 1 ] ) ;
+    _mm_storeu_pd ( dz + i, d [ 2 ] ) ;
+  }
+
+  return i ;
+}
+
+#endif  /* SG_HAVE_SSE2 */
+
+
+#if defined(SG_HAVE_AVX)
+
+/* SoA - eight points per iteration. */
+
+SG_TARGET_AVX
+inline int _sgXformArraySoA_AVX ( SGfloat *dx, SGfloat *dy, SGfloat *dz,
+                                  const SGfloat *sx, const SGfloat *sy, const SGfloat *sz,
+                                  int n, const sgMat4 mat, int mode )
+{
+  __m256 m [ 4 ][ 4 ] ;
+
+  for ( int r = 0 ; r < 4 ; r++ )
+    for ( int c = 0 ; c < 4 ; c++ )
+      m [ r ][ c ] = _mm256_set1_ps ( mat [ r ][ c ] ) ;
+
+  __m256 one = _mm256_set1_ps ( SG_ONE ) ;
+
+  int i = 0 ;
+
+  for ( ; i + 8 <= n ; i += 8 )
+  {
+    __m256 t0 = _mm256_loadu_ps ( sx + i ) ;
+    __m256 t1 = _mm256_loadu_ps ( sy + i ) ;
+    __m256 t2 = _mm256_loadu_ps ( sz + i ) ;
+    __m256 d [ 3 ] ;
+
+    for ( int c = 0 ; c < 3 ; c++ )
+    {
+      d [ c ] = _mm256_add_ps ( _mm256_add_ps ( _mm256_mul_ps ( t0, m[0][c] ),
+                                                _mm256_mul_ps ( t1, m[1][c] ) ),
+                                                _mm256_mul_ps ( t2, m[2][c] ) ) ;
+      if ( mode != _SG_XFORM_VEC3 )
+        d [ c ] = _mm256_add_ps ( d [ c ], m[3][c] ) ;
+    }
+
+    if ( mode == _SG_XFORM_FULL3 )
+    {
+      __m256 w = _mm256_add_ps ( _mm256_add_ps ( _mm256_add_ps ( _mm256_mul_ps ( t0, m[0][3] ),
+                                                                 _mm256_mul_ps ( t1, m[1][3] ) ),
+                                                                 _mm256_mul_ps ( t2, m[2][3] ) ),
+                                                                 m[3][3] ) ;
+      w = _mm256_div_ps ( one, w ) ;
+
+      for ( int c = 0 ; c < 3 ; c++ )
+        d [ c ] = _mm256_mul_ps ( d [ c ], w ) ;
+    }
+
+    _mm256_storeu_ps ( dx + i, d [ 0 ] ) ;
+    _mm256_storeu_ps ( dy + i, d [ 1 ] ) ;
+    _mm256_storeu_ps ( dz + i, d [ 2 ] ) ;
+  }
+
+  _mm256_zeroupper () ;
+  return i ;
+}
+
+/* Double precision, AoS - one __m256d per point. */
+
+SG_TARGET_AVX
+inline void _sgdXformArray_AVX ( SGDfloat *dst, const SGDfloat *src, int n,
+                                 const sgdMat4 mat, int mode )
+{
+  __m256d m0 = _mm256_loadu_pd ( mat [ 0 ] ) ;
+  __m256d m1 = _mm256_loadu_pd ( mat [ 1 ] ) ;
+  __m256d m2 = _mm256_loadu_pd ( mat [ 2 ] ) ;
+  __m256d m3 = _mm256_loadu_pd ( mat [ 3 ] ) ;
+  __m256d one = _mm256_set1_pd ( SGD_ONE ) ;
+
+  int stride = ( mode == _SG_XFORM_VEC4 ) ? 4 : 3 ;
+
+  for ( int i = 0 ; i < n ; i++, src += stride, dst += stride )
+  {
+    __m256d r = _mm256_add_pd ( _mm256_add_pd ( _mm256_mul_pd ( _mm256_set1_pd ( src[0] ), m0 ),
+                                                _mm256_mul_pd ( _mm256_set1_pd ( src[1] ), m1 ) ),
+                                                _mm256_mul_pd ( _mm256_set1_pd ( src[2] ), m2 ) ) ;
+
+    if ( mode == _SG_XFORM_VEC4 )
+    {
+      r = _mm256_add_pd ( r, _mm256_mul_pd ( _mm256_set1_pd ( src[3] ), m3 ) ) ;
+      _mm256_storeu_pd ( dst, r ) ;
+      continue ;
+    }
+
+    if ( mode != _SG_XFORM_VEC3 )
+      r = _mm256_add_pd ( r, m3 ) ;
+
+    if ( mode == _SG_XFORM_FULL3 )
+    {
+      __m256d w = _mm256_permute_pd ( r, 0xF ) ;                 /* ( y, y, w, w ) */
+      w = _mm256_permute2f128_pd ( w, w, 0x11 ) ;                /* ( w, w, w, w ) */
+      r = _mm256_mul_pd ( r, _mm256_div_pd ( one, w ) ) ;
+    }
+
+    _mm_storeu_pd ( dst, _mm256_castpd256_pd128 ( r ) ) ;
+    _mm_store_sd  ( dst + 2, _mm256_extractf128_pd ( r, 1 ) ) ;
+  }
+
+  _mm256_zeroupper () ;
+}
+
+/* Double precision, SoA - four points per iteration. */
+
+SG_TARGET_AVX
+inline int _sgdXformArraySoA_AVX ( SGDfloat *dx, SGDfloat *dy, SGDfloat *dz,
+                                   const SGDfloat *sx, const SGDfloat *sy, const SGDfloat *sz,
+                                   int n, const sgdMat4 mat, int mode )
+{
+  __m256d m [ 4 ][ 4 ] ;
+
+  for ( int r = 0 ; r < 4 ; r++ )
+    for ( int c = 0 ; c < 4 ; c++ )
+      m [ r ][ c ] = _mm256_set1_pd ( mat [ r ][ c ] ) ;
+
+  __m256d one = _mm256_set1_pd ( SGD_ONE ) ;
+
+  int i = 0 ;
+
+  for ( ; i + 4 <= n ; i += 4 )
+  {
+    __m256d t0 = _mm256_loadu_pd ( sx + i ) ;
+    __m256d t1 = _mm256_loadu_pd ( sy + i ) ;
+    __m256d t2 = _mm256_loadu_pd ( sz + i ) ;
+    __m256d d [ 3 ] ;
+
+    for ( int c = 0 ; c < 3 ; c++ )
+    {
+      d [ c ] = _mm256_add_pd ( _mm256_add_pd ( _mm256_mul_pd ( t0, m[0][c] ),
+                                                _mm256_mul_pd ( t1, m[1][c] ) ),
+                                                _mm256_mul_pd ( t2, m[2][c] ) ) ;
+      if ( mode != _SG_XFORM_VEC3 )
+        d [ c ] = _mm256_add_pd ( d [ c ], m[3][c] ) ;
+    }
+
+    if ( mode == _SG_XFORM_FULL3 )
+    {
+      __m256d w = _mm256_add_pd ( _mm256_add_pd ( _mm256_add_pd ( _mm256_mul_pd ( t0, m[0][3] ),
+                                                                  _mm256_mul_pd ( t1, m[1][3] ) ),
+                                                                  _mm256_mul_pd ( t2, m[2][3] ) ),
+                                                                  m[3][3] ) ;
+      w = _mm256_div_pd ( one, w ) ;
+
+      for ( int c = 0 ; c < 3 ; c++ )
+        d [ c ] = _mm256_mul_pd ( d [ c ], w ) ;
+    }
+
+    _mm256_storeu_pd ( dx + i, d [ 0 ] ) ;
+    _mm256_storeu_pd ( dy + i, d [ 1 ] ) ;
+    _mm256_storeu_pd ( dz + i, d [ 2 ] ) ;
+  }
+
+  _mm256_zeroupper () ;
+  return i ;
+}
+
+#endif  /* SG_HAVE_AVX */
+
+
+inline void _sgXformArray ( SGfloat *dst, const SGfloat *src, int n,
+                            const sgMat4 mat, int mode )
+{
+#if defined(SG_HAVE_SSE2)
+  if ( sgGetSIMDLevel () >= SG_SIMD_SSE2 )
+  {
+    _sgXformArray_SSE2 ( dst, src, n, mat, mode ) ;
+    return ;
+  }
+#endif
+  _sgXformArray_C ( dst, src, n, mat, mode ) ;
+}
+
+inline void _sgXformArraySoA ( SGfloat *dx, SGfloat *dy, SGfloat *dz,
+                               const SGfloat *sx, const SGfloat *sy, const SGfloat *sz,
+                               int n, const sgMat4 mat, int mode )
+{
+  int done = 0 ;
+
+#if defined(SG_HAVE_AVX)
+  if ( sgGetSIMDLevel () >= SG_SIMD_AVX )
+    done = _sgXformArraySoA_AVX ( dx, dy, dz, sx, sy, sz, n, mat, mode ) ;
+  else
+#endif
+#if defined(SG_HAVE_SSE2)
+  if ( sgGetSIMDLevel () >= SG_SIMD_SSE2 )
+    done = _sgXformArraySoA_SSE2 ( dx, dy, dz, sx, sy, sz, n, mat, mode ) ;
+#endif
+
+  _sgXformArraySoA_C ( dx, dy, dz, sx, sy, sz, done, n, mat, mode ) ;
+}
+
+
+/*
+  Single precision, AoS.
+*/
+
+inline void sgXformVec3Array ( sgVec3 *dst, const sgVec3 *src, int count, const sgMat4 mat )
+{
+  _sgXformArray ( dst [ 0 ], src [ 0 ], count, mat, _SG_XFORM_VEC3 ) ;
+}
+
+inline void sgXformPnt3Array ( sgVec3 *dst, const sgVec3 *src, int count, const sgMat4 mat )
+{
+  _sgXformArray ( dst [ 0 ], src [ 0 ], count, mat, _SG_XFORM_PNT3 ) ;
+}
+
+inline void sgFullXformPnt3Array ( sgVec3 *dst, const sgVec3 *src, int count, const sgMat4 mat )
+{
+  _sgXformArray ( dst [ 0 ], src [ 0 ], count, mat, _SG_XFORM_FULL3 ) ;
+}
+
+inline void sgXformVec4Array ( sgVec4 *dst, const sgVec4 *src, int count, const sgMat4 mat )
+{
+  _sgXformArray ( dst [ 0 ], src [ 0 ], count, mat, _SG_XFORM_VEC4 ) ;
+}
+
+inline void sgXformPnt4Array ( sgVec4 *dst, const sgVec4 *src, int count, const sgMat4 mat )
+{
+  _sgXformArray ( dst [ 0 ], src [ 0 ], count, mat, _SG_XFORM_VEC4 ) ;
+}
+
+inline void sgXformVec3Array ( sgVec3 *dst, int count, const sgMat4 mat ) { sgXformVec3Array ( dst, dst, count, mat ) ; }
+inline void sgXformPnt3Array ( sgVec3 *dst, int count, const sgMat4 mat ) { sgXformPnt3Array ( dst, dst, count, mat ) ; }
+inline void sgFullXformPnt3Array ( sgVec3 *dst, int count, const sgMat4 mat ) { sgFullXformPnt3Array ( dst, dst, count, mat ) ; }
+inline void sgXformVec4Array ( sgVec4 *dst, int count, const sgMat4 mat ) { sgXformVec4Array ( dst, dst, count, mat ) ; }
+inline void sgXformPnt4Array ( sgVec4 *dst, int count, const sgMat4 mat ) { sgXformPnt4Array ( dst, dst, count, mat ) ; }
+
+
+/*
+  Single precision, SoA.
+*/
+
+inline void sgXformVec3ArraySoA ( SGfloat *dx, SGfloat *dy, SGfloat *dz,
+                                  const SGfloat *sx, const SGfloat *sy, const SGfloat *sz,
+                                  int count, const sgMat4 mat )
+{
+  _sgXformArraySoA ( dx, dy, dz, sx, sy, sz, count, mat, _SG_XFORM_VEC3 ) ;
+}
+
+inline void sgXformPnt3ArraySoA ( SGfloat *dx, SGfloat *dy, SGfloat *dz,
+                                  const SGfloat *sx, const SGfloat *sy, const SGfloat *sz,
+                                  int count, const sgMat4 mat )
+{
+  _sgXformArraySoA ( dx, dy, dz, sx, sy, sz, count, mat, _SG_XFORM_PNT3 ) ;
+}
+
+inline void sgFullXformPnt3ArraySoA ( SGfloat *dx, SGfloat *dy, SGfloat *dz,
+                                      const SGfloat *sx, const SGfloat *sy, const SGfloat *sz,
+                                      int count, const sgMat4 mat )
+{
+  _sgXformArraySoA ( dx, dy, dz, sx, sy, sz, count, mat, _SG_XFORM_FULL3 ) ;
+}
+
+
+/**********************************************************************/
+
+inline void _sgdXformArray_C ( SGDfloat *dst, const SGDfloat *src, int n,
+                               const sgdMat4 mat, int mode )
+{
+  int stride = ( mode == _SG_XFORM_VEC4 ) ? 4 : 3 ;
+
+  for ( int i = 0 ; i < n ; i++, src += stride, dst += stride )
+  {
+    SGDfloat t0 = src [ 0 ] ;
+    SGDfloat t1 = src [ 1 ] ;
+    SGDfloat t2 = src [ 2 ] ;
+
+    if ( mode == _SG_XFORM_VEC3 )
+    {
+      dst [ 0 ] = t0 * mat[0][0] + t1 * mat[1][0] + t2 * mat[2][0] ;
+      dst [ 1 ] = t0 * mat[0][1] + t1 * mat[1][1] + t2 * mat[2][1] ;
+      dst [ 2 ] = t0 * mat[0][2] + t1 * mat[1][2] + t2 * mat[2][2] ;
+    }
+    else
+    if ( mode == _SG_XFORM_PNT3 )
+    {
+      dst [ 0 ] = t0 * mat[0][0] + t1 * mat[1][0] + t2 * mat[2][0] + mat[3][0] ;
+      dst [ 1 ] = t0 * mat[0][1] + t1 * mat[1][1] + t2 * mat[2][1] + mat[3][1] ;
+      dst [ 2 ] = t0 * mat[0][2] + t1 * mat[1][2] + t2 * mat[2][2] + mat[3][2] ;
+    }
+    else
+    if ( mode == _SG_XFORM_FULL3 )
+    {
+      SGDfloat w = t0 * mat[0][3] + t1 * mat[1][3] + t2 * mat[2][3] + mat[3][3] ;
+      SGDfloat r = SGD_ONE / w ;
+
+      dst [ 0 ] = ( t0 * mat[0][0] + t1 * mat[1][0] + t2 * mat[2][0] + mat[3][0] ) * r ;
+      dst [ 1 ] = ( t0 * mat[0][1] + t1 * mat[1][1] + t2 * mat[2][1] + mat[3][1] ) * r ;
+      dst [ 2 ] = ( t0 * mat[0][2] + t1 * mat[1][2] + t2 * mat[2][2] + mat[3][2] ) * r ;
+    }
+    else
+    {
+      SGDfloat t3 = src [ 3 ] ;
+
+      dst [ 0 ] = t0 * mat[0][0] + t1 * mat[1][0] + t2 * mat[2][0] + t3 * mat[3][0] ;
+      dst [ 1 ] = t0 * mat[0][1] + t1 * mat[1][1] + t2 * mat[2][1] + t3 * mat[3][1] ;
+      dst [ 2 ] = t0 * mat[0][2] + t1 * mat[1][2] + t2 * mat[2][2] + t3 * mat[3][2] ;
+      dst [ 3 ] = t0 * mat[0][3] + t1 * mat[1][3] + t2 * mat[2][3] + t3 * mat[3][3] ;
+    }
+  }
+}
+
+inline void _sgdXformArraySoA_C ( SGDfloat *dx, SGDfloat *dy, SGDfloat *dz,
+                                  const SGDfloat *sx, const SGDfloat *sy, const SGDfloat *sz,
+                                  int first, int n, const sgdMat4 mat, int mode )
+{
+  for ( int i = first ; i < n ; i++ )
+  {
+    SGDfloat t0 = sx [ i ] ;
+    SGDfloat t1 = sy [ i ] ;
+    SGDfloat t2 = sz [ i ] ;
+
+    SGDfloat x = t0 * mat[0][0] + t1 * mat[1][0] + t2 * mat[2][0] ;
+    SGDfloat y = t0 * mat[0][1] + t1 * mat[1][1] + t2 * mat[2][1] ;
+    SGDfloat z = t0 * mat[0][2] + t1 * mat[1][2] + t2 * mat[2][2] ;
+
+    if ( mode != _SG_XFORM_VEC3 )
+    {
+      x += mat[3][0] ;
+      y += mat[3][1] ;
+      z += mat[3][2] ;
+    }
+
+    if ( mode == _SG_XFORM_FULL3 )
+    {
+      SGDfloat r = SGD_ONE / ( t0 * mat[0][3] + t1 * mat[1][3] + t2 * mat[2][3] + mat[3][3] ) ;
+      x *= r ; y *= r ; z *= r ;
+    }
+
+    dx [ i ] = x ;
+    dy [ i ] = y ;
+    dz [ i ] = z ;
+  }
+}
+
+inline void _sgdXformArray ( SGDfloat *dst, const SGDfloat *src, int n,
+                             const sgdMat4 mat, int mode )
+{
+#if defined(SG_HAVE_AVX)
+  if ( sgGetSIMDLevel () >= SG_SIMD_AVX )
+  {
+    _sgdXformArray_AVX ( dst, src, n, mat, mode ) ;
+    return ;
+  }
+#endif
+#if defined(SG_HAVE_SSE2)
+  if ( sgGetSIMDLevel () >= SG_SIMD_SSE2 )
+  {
+    _sgdXformArray_SSE2 ( dst, src, n, mat, mode ) ;
+    return ;
+  }
+#endif
+  _sgdXformArray_C ( dst, src, n, mat, mode ) ;
+}
+
+inline void _sgdXformArraySoA ( SGDfloat *dx, SGDfloat *dy, SGDfloat *dz,
+                                const SGDfloat *sx, const SGDfloat *sy, const SGDfloat *sz,
+                                int n, const sgdMat4 mat, int mode )
+{
+  int done = 0 ;
+
+#if defined(SG_HAVE_AVX)
+  if ( sgGetSIMDLevel () >= SG_SIMD_AVX )
+    done = _sgdXformArraySoA_AVX ( dx, dy, dz, sx, sy, sz, n, mat, mode ) ;
+  else
+#endif
+#if defined(SG_HAVE_SSE2)
+  if ( sgGetSIMDLevel () >= SG_SIMD_SSE2 )
+    done = _sgdXformArraySoA_SSE2 ( dx, dy, dz, sx, sy, sz, n, mat, mode ) ;
+#endif
+
+  _sgdXformArraySoA_C ( dx, dy, dz, sx, sy, sz, done, n, mat, mode ) ;
+}
+
+
+/*
+  Double precision, AoS.
+*/
+
+inline void sgdXformVec3Array ( sgdVec3 *dst, const sgdVec3 *src, int count, const sgdMat4 mat )
+{
+  _sgdXformArray ( dst [ 0 ], src [ 0 ], count, mat, _SG_XFORM_VEC3 ) ;
+}
+
+inline void sgdXformPnt3Array ( sgdVec3 *dst, const sgdVec3 *src, int count, const sgdMat4 mat )
+{
+  _sgdXformArray ( dst [ 0 ], src [ 0 ], count, mat, _SG_XFORM_PNT3 ) ;
+}
+
+inline void sgdFullXformPnt3Array ( sgdVec3 *dst, const sgdVec3 *src, int count, const sgdMat4 mat )
+{
+  _sgdXformArray ( dst [ 0 ], src [ 0 ], count, mat, _SG_XFORM_FULL3 ) ;
+}
+
+inline void sgdXformVec4Array ( sgdVec4 *dst, const sgdVec4 *src, int count, const sgdMat4 mat )
+{
+  _sgdXformArray ( dst [ 0 ], src [ 0 ], count, mat, _SG_XFORM_VEC4 ) ;
+}
+
+inline void sgdXformPnt4Array ( sgdVec4 *dst, const sgdVec4 *src, int count, const sgdMat4 mat )
+{
+  _sgdXformArray ( dst [ 0 ], src [ 0 ], count, mat, _SG_XFORM_VEC4 ) ;
+}
+
+inline void sgdXformVec3Array ( sgdVec3 *dst, int count, const sgdMat4 mat ) { sgdXformVec3Array ( dst, dst, count, mat ) ; }
+inline void sgdXformPnt3Array ( sgdVec3 *dst, int count, const sgdMat4 mat ) { sgdXformPnt3Array ( dst, dst, count, mat ) ; }
+inline void sgdFullXformPnt3Array ( sgdVec3 *dst, int count, const sgdMat4 mat ) { sgdFullXformPnt3Array ( dst, dst, count, mat ) ; }
+inline void sgdXformVec4Array ( sgdVec4 *dst, int count, const sgdMat4 mat ) { sgdXformVec4Array ( dst, dst, count, mat ) ; }
+inline void sgdXformPnt4Array ( sgdVec4 *dst, int count, const sgdMat4 mat ) { sgdXformPnt4Array ( dst, dst, count, mat ) ; }
+
+
+/*
+  Double precision, SoA.
+*/
+
+inline void sgdXformVec3ArraySoA ( SGDfloat *dx, SGDfloat *dy, SGDfloat *dz,
+                                   const SGDfloat *sx, const SGDfloat *sy, const SGDfloat *sz,
+                                   int count, const sgdMat4 mat )
+{
+  _sgdXformArraySoA ( dx, dy, dz, sx, sy, sz, count, mat, _SG_XFORM_VEC3 ) ;
+}
+
+inline void sgdXformPnt3ArraySoA ( SGDfloat *dx, SGDfloat *dy, SGDfloat *dz,
+                                   const SGDfloat *sx, const SGDfloat *sy, const SGDfloat *sz,
+                                   int count, const sgdMat4 mat )
+{
+  _sgdXformArraySoA ( dx, dy, dz, sx, sy, sz, count, mat, _SG_XFORM_PNT3 ) ;
+}
+
+inline void sgdFullXformPnt3ArraySoA ( SGDfloat *dx, SGDfloat *dy, SGDfloat *dz,
+                                       const SGDfloat *sx, const SGDfloat *sy, const SGDfloat *sz,
+                                       int count, const sgdMat4 mat )
+{
+  _sgdXformArraySoA ( dx, dy, dz, sx, sy, sz, count, mat, _SG_XFORM_FULL3 ) ;
+}
+
+/**********************************************************************/
+
+/*
+  Batch frustum culling.
+  ~~~~~~~~~~~~~~~~~~~~~~
+
+  Classify whole arrays of spheres or boxes against a frustum, writing
+  one of SG_OUTSIDE, SG_INSIDE or SG_STRADDLE per volume into 'result'.
+
+  Every volume is tested against all six clip planes:
+
+    OUTSIDE  - completely behind at least one plane
+    INSIDE   - completely in front of all six planes
+    STRADDLE - anything else
+
+  A box is treated as a sphere whose radius, for each plane, is the
+  projection of the box's half-extents onto the plane normal.  Spheres
+  with a negative radius (ie sgSphere::isEmpty()) are SG_OUTSIDE.
+*/
+
+inline void _sgGetFrustumPlanes ( SGfloat pl [ 6 ][ 4 ], const sgFrustum *f )
+{
+  for ( int p = 0 ; p < 6 ; p++ )
+    sgCopyVec4 ( pl [ p ], f -> getPlane ( p ) ) ;
+}
+
+/*
+  The volumes are passed as six component pointers plus a stride (in
+  floats) so that one kernel serves both layouts:
+
+    spheres: a = centre x,y,z   b[0] = radius
+    boxes:   a = min x,y,z      b    = max x,y,z
+*/
+
+inline int _sgCullClassify ( const SGfloat pl [ 6 ][ 4 ],
+                             SGfloat x, SGfloat y, SGfloat z,
+                             SGfloat ex, SGfloat ey, SGfloat ez, int box )
+{
+  int inside = TRUE ;
+
+  for ( int p = 0 ; p < 6 ; p++ )
+  {
+    SGfloat d = pl[p][0] * x + pl[p][1] * y + pl[p][2] * z + pl[p][3] ;
+    SGfloat r = ! box ? ex : sgAbs ( pl[p][0] ) * ex +
+                             sgAbs ( pl[p][1] ) * ey +
+                             sgAbs ( pl[p][2] ) * ez ;
+
+    if ( d < -r ) return SG_OUTSIDE ;
+    if ( d <  r ) inside = FALSE ;
+  }
+
+  return inside ? SG_INSIDE : SG_STRADDLE ;
+}
+
+inline void _sgCull_C ( const SGfloat pl [ 6 ][ 4 ],
+                        const SGfloat *ax, const SGfloat *ay, const SGfloat *az,
+                        const SGfloat *bx, const SGfloat *by, const SGfloat *bz,
+                        int stride, int first, int n, int box, unsigned char *result )
+{
+  for ( int i = first ; i < n ; i++ )
+  {
+    int k = i * stride ;
+
+    if ( box )
+      result [ i ] = (unsigned char) _sgCullClassify ( pl,
+                          ( ax[k] + bx[k] ) * SG_HALF, ( ay[k] + by[k] ) * SG_HALF,
+                          ( az[k] + bz[k] ) * SG_HALF, ( bx[k] - ax[k] ) * SG_HALF,
+                          ( by[k] - ay[k] ) * SG_HALF, ( bz[k] - az[k] ) * SG_HALF, TRUE ) ;
+    else
+      result [ i ] = ( bx[k] < SG_ZERO ) ? SG_OUTSIDE :
+                     (unsigned char) _sgCullClassify ( pl, ax[k], ay[k], az[k],
+                                                       bx[k], bx[k], bx[k], FALSE ) ;
+  }
+}
+
+inline void _sgCullStore ( unsigned char *result, int n, int outside, int straddle )
+{
+  for ( int k = 0 ; k < n ; k++ )
+    result [ k ] = ( outside  & ( 1 << k ) ) ? SG_OUTSIDE  :
+                   ( straddle & ( 1 << k ) ) ? SG_STRADDLE : SG_INSIDE ;
+}
+
+
+#if defined(SG_HAVE_SSE2)
+
+inline __m128 _sgLoad4 ( const SGfloat *p, int stride )
+{
+  return ( stride == 1 ) ? _mm_loadu_ps ( p ) :
+           _mm_setr_ps ( p [ 0 ], p [ stride ], p [ 2 * stride ], p [ 3 * stride ] ) ;
+}
+
+inline int _sgCull_SSE2 ( const SGfloat pl [ 6 ][ 4 ],
+                          const SGfloat *ax, const SGfloat *ay, const SGfloat *az,
+                          const SGfloat *bx, const SGfloat *by, const SGfloat *bz,
+                          int stride, int n, int box, unsigned char *result )
+{
+  __m128 half = _mm_set1_ps ( SG_HALF ) ;
+  __m128 zero = _mm_setzero_ps () ;
+
+  int i = 0 ;
+
+  for ( ; i + 4 <= n ; i += 4 )
+  {
+    int k = i * stride ;
+    __m128 x, y, z, ex, ey, ez ;
+
+    if ( box )
+    {
+      __m128 x0 = _sgLoad4 ( ax + k, stride ), x1 = _sgLoad4 ( bx + k, stride ) ;
+      __m128 y0 = _sgLoad4 ( ay + k, stride ), y1 = _sgLoad4 ( by + k, stride ) ;
+      __m128 z0 = _sgLoad4 ( az + k, stride ), z1 = _sgLoad4 ( bz + k, stride ) ;
+
+      x  = _mm_mul_ps ( _mm_add_ps ( x0, x1 ), half ) ;
+      y  = _mm_mul_ps ( _mm_add_ps ( y0, y1 ), half ) ;
+      z  = _mm_mul_ps ( _mm_add_ps ( z0, z1 ), half ) ;
+      ex = _mm_mul_ps ( _mm_sub_ps ( x1, x0 ), half ) ;
+      ey = _mm_mul_ps ( _mm_sub_ps ( y1, y0 ), half ) ;
+      ez = _mm_mul_ps ( _mm_sub_ps ( z1, z0 ), half ) ;
+    }
+    else
+    {
+      x  = _sgLoad4 ( ax + k, stride ) ;
+      y  = _sgLoad4 ( ay + k, stride ) ;
+      z  = _sgLoad4 ( az + k, stride ) ;
+      ex = ey = ez = _sgLoad4 ( bx + k, stride ) ;
+    }
+
+    __m128 outside  = box ? zero : _mm_cmplt_ps ( ex, zero ) ;
+    __m128 straddle = zero ;
+
+    for ( int p = 0 ; p < 6 ; p++ )
+    {
+      __m128 d = _mm_add_ps ( _mm_add_ps ( _mm_add_ps (
+                     _mm_mul_ps ( x, _mm_set1_ps ( pl[p][0] ) ),
+                     _mm_mul_ps ( y, _mm_set1_ps ( pl[p][1] ) ) ),
+                     _mm_mul_ps ( z, _mm_set1_ps ( pl[p][2] ) ) ),
+                                     _mm_set1_ps ( pl[p][3] ) ) ;
+      __m128 r = ex ;
+
+      if ( box )
+        r = _mm_add_ps ( _mm_add_ps (
+                _mm_mul_ps ( ex, _mm_set1_ps ( sgAbs ( pl[p][0] ) ) ),
+                _mm_mul_ps ( ey, _mm_set1_ps ( sgAbs ( pl[p][1] ) ) ) ),
+                _mm_mul_ps ( ez, _mm_set1_ps ( sgAbs ( pl[p][2] ) ) ) ) ;
+
+      outside  = _mm_or_ps ( outside , _mm_cmplt_ps ( d, _mm_sub_ps ( zero, r ) ) ) ;
+      straddle = _mm_or_ps ( straddle, _mm_cmplt_ps ( d, r ) ) ;
+    }
+
+    _sgCullStore ( result + i, 4, _mm_movemask_ps ( outside ),
+                                  _mm_movemask_ps ( straddle ) ) ;
+  }
+
+  return i ;
+}
+
+#endif  /* SG_HAVE_SSE2 */
+
+
+#if defined(SG_HAVE_AVX)
+
+SG_TARGET_AVX
+inline __m256 _sgLoad8 ( const SGfloat *p, int stride )
+{
+  if ( stride == 1 )
+    return _mm256_loadu_ps ( p ) ;
+
+  return _mm256_setr_ps ( p [ 0 ], p [ stride ], p [ 2 * stride ], p [ 3 * stride ],
+                          p [ 4 * stride ], p [ 5 * stride ], p [ 6 * stride ], p [ 7 * stride ] ) ;
+}
+
+SG_TARGET_AVX
+inline int _sgCull_AVX ( const SGfloat pl [ 6 ][ 4 ],
+                         const SGfloat *ax, const SGfloat *ay, const SGfloat *az,
+                         const SGfloat *bx, const SGfloat *by, const SGfloat *bz,
+                         int stride, int n, int box, unsigned char *result )
+{
+  __m256 half = _mm256_set1_ps ( SG_HALF ) ;
+  __m256 zero = _mm256_setzero_ps () ;
+
+  int i = 0 ;
+
+  for ( ; i + 8 <= n ; i += 8 )
+  {
+    int k = i * stride ;
+    __m256 x, y, z, ex, ey, ez ;
+
+    if ( box )
+    {
+      __m256 x0 = _sgLoad8 ( ax + k, stride ), x1 = _sgLoad8 ( bx + k, stride ) ;
+      __m256 y0 = _sgLoad8 ( ay + k, stride ), y1 = _sgLoad8 ( by + k, stride ) ;
+      __m256 z0 = _sgLoad8 ( az + k, stride ), z1 = _sgLoad8 ( bz + k, stride ) ;
+
+      x  = _mm256_mul_ps ( _mm256_add_ps ( x0, x1 ), half ) ;
+      y  = _mm256_mul_ps ( _mm256_add_ps ( y0, y1 ), half ) ;
+      z  = _mm256_mul_ps ( _mm256_add_ps ( z0, z1 ), half ) ;
+      ex = _mm256_mul_ps ( _mm256_sub_ps ( x1, x0 ), half ) ;
+      ey = _mm256_mul_ps ( _mm256_sub_ps ( y1, y0 ), half ) ;
+      ez = _mm256_mul_ps ( _mm256_sub_ps ( z1, z0 ), half ) ;
+    }
+    else
+    {
+      x  = _sgLoad8 ( ax + k, stride ) ;
+      y  = _sgLoad8 ( ay + k, stride ) ;
+      z  = _sgLoad8 ( az + k, stride ) ;
+      ex = ey = ez = _sgLoad8 ( bx + k, stride ) ;
+    }
+
+    __m256 outside  = box ? zero : _mm256_cmp_ps ( ex, zero, _CMP_LT_OQ ) ;
+    __m256 straddle = zero ;
+
+    for ( int p = 0 ; p < 6 ; p++ )
+    {
+      __m256 d = _mm256_add_ps ( _mm256_add_ps ( _mm256_add_ps (
+                     _mm256_mul_ps ( x, _mm256_set1_ps ( pl[p][0] ) ),
+                     _mm256_mul_ps ( y, _mm256_set1_ps ( pl[p][1] ) ) ),
+                     _mm256_mul_ps ( z, _mm256_set1_ps ( pl[p][2] ) ) ),
+                                        _mm256_set1_ps ( pl[p][3] ) ) ;
+      __m256 r = ex ;
+
+      if ( box )
+        r = _mm256_add_ps ( _mm256_add_ps (
+                _mm256_mul_ps ( ex, _mm256_set1_ps ( sgAbs ( pl[p][0] ) ) ),
+                _mm256_mul_ps ( ey, _mm256_set1_ps ( sgAbs ( pl[p][1] ) ) ) ),
+                _mm256_mul_ps ( ez, _mm256_set1_ps ( sgAbs ( pl[p][2] ) ) ) ) ;
+
+      outside  = _mm256_or_ps ( outside , _mm256_cmp_ps ( d, _mm256_sub_ps ( zero, r ), _CMP_LT_OQ ) ) ;
+      straddle = _mm256_or_ps ( straddle, _mm256_cmp_ps ( d, r, _CMP_LT_OQ ) ) ;
+    }
+
+    _sgCullStore ( result + i, 8, _mm256_movemask_ps ( outside ),
+                                  _mm256_movemask_ps ( straddle ) ) ;
+  }
+
+  _mm256_zeroupper () ;
+  return i ;
+}
+
+#endif  /* SG_HAVE_AVX */
+
+
+inline void _sgCull ( const sgFrustum *f,
+                      const SGfloat *ax, const SGfloat *ay, const SGfloat *az,
+                      const SGfloat *bx, const SGfloat *by, const SGfloat *bz,
+                      int stride, int n, int box, unsigned char *result )
+{
+  SGfloat pl [ 6 ][ 4 ] ;
+  int done = 0 ;
+
+  _sgGetFrustumPlanes ( pl, f ) ;
+
+#if defined(SG_HAVE_AVX)
+  if ( sgGetSIMDLevel () >= SG_SIMD_AVX )
+    done = _sgCull_AVX ( pl, ax, ay, az, bx, by, bz, stride, n, box, result ) ;
+  else
+#endif
+#if defined(SG_HAVE_SSE2)
+  if ( sgGetSIMDLevel () >= SG_SIMD_SSE2 )
+    done = _sgCull_SSE2 ( pl, ax, ay, az, bx, by, bz, stride, n, box, result ) ;
+#endif
+
+  _sgCull_C ( pl, ax, ay, az, bx, by, bz, stride, done, n, box, result ) ;
+}
+
+
+/* Spheres packed as sgVec4 - centre in [0..2], radius in [3]. */
+
+inline void sgFrustumContainsSpheres ( const sgFrustum *f, const sgVec4 *spheres,
+                                       int count, unsigned char *result )
+{
+  const SGfloat *s = spheres [ 0 ] ;
+  _sgCull ( f, s, s + 1, s + 2, s + 3, s + 3, s + 3, 4, count, FALSE, result ) ;
+}
+
+inline void sgFrustumContainsSpheresSoA ( const sgFrustum *f,
+                                          const SGfloat *cx, const SGfloat *cy,
+                                          const SGfloat *cz, const SGfloat *radius,
+                                          int count, unsigned char *result )
+{
+  _sgCull ( f, cx, cy, cz, radius, radius, radius, 1, count, FALSE, result ) ;
+}
+
+inline void sgFrustumContainsBoxes ( const sgFrustum *f,
+                                     const sgVec3 *bmin, const sgVec3 *bmax,
+                                     int count, unsigned char *result )
+{
+  const SGfloat *a = bmin [ 0 ] ;
+  const SGfloat *b = bmax [ 0 ] ;
+  _sgCull ( f, a, a + 1, a + 2, b, b + 1, b + 2, 3, count, TRUE, result ) ;
+}
+
+inline void sgFrustumContainsBoxesSoA ( const sgFrustum *f,
+                                        const SGfloat *minx, const SGfloat *miny, const SGfloat *minz,
+                                        const SGfloat *maxx, const SGfloat *maxy, const SGfloat *maxz,
+                                        int count, unsigned char *result )
+{
+  _sgCull ( f, minx, miny, minz, maxx, maxy, maxz, 1, count, TRUE, result ) ;
+}
+
+
+/**********************************************************************/
+
+inline void _sgdGetFrustumPlanes ( SGDfloat pl [ 6 ][ 4 ], const sgdFrustum *f )
+{
+  for ( int p = 0 ; p < 6 ; p++ )
+    sgdCopyVec4 ( pl [ p ], f -> getPlane ( p ) ) ;
+}
+
+inline int _sgdCullClassify ( const SGDfloat pl [ 6 ][ 4 ],
+                              SGDfloat x, SGDfloat y, SGDfloat z,
+                              SGDfloat ex, SGDfloat ey, SGDfloat ez, int box )
+{
+  int inside = TRUE ;
+
+  for ( int p = 0 ; p < 6 ; p++ )
+  {
+    SGDfloat d = pl[p][0] * x + pl[p][1] * y + pl[p][2] * z + pl[p][3] ;
+    SGDfloat r = ! box ? ex : sgdAbs ( pl[p][0] ) * ex +
+                              sgdAbs ( pl[p][1] ) * ey +
+                              sgdAbs ( pl[p][2] ) * ez ;
+
+    if ( d < -r ) return SGD_OUTSIDE ;
+    if ( d <  r ) inside = FALSE ;
+  }
+
+  return inside ? SGD_INSIDE : SGD_STRADDLE ;
+}
+
+inline void _sgdCull_C ( const SGDfloat pl [ 6 ][ 4 ],
+                         const SGDfloat *ax, const SGDfloat *ay, const SGDfloat *az,
+                         const SGDfloat *bx, const SGDfloat *by, const SGDfloat *bz,
+                         int stride, int first, int n, int box, unsigned char *result )
+{
+  for ( int i = first ; i < n ; i++ )
+  {
+    int k = i * stride ;
+
+    if ( box )
+      result [ i ] = (unsigned char) _sgdCullClassify ( pl,
+                          ( ax[k] + bx[k] ) * SGD_HALF, ( ay[k] + by[k] ) * SGD_HALF,
+                          ( az[k] + bz[k] ) * SGD_HALF, ( bx[k] - ax[k] ) * SGD_HALF,
+                          ( by[k] - ay[k] ) * SGD_HALF, ( bz[k] - az[k] ) * SGD_HALF, TRUE ) ;
+    else
+      result [ i ] = ( bx[k] < SGD_ZERO ) ? SGD_OUTSIDE :
+                     (unsigned char) _sgdCullClassify ( pl, ax[k], ay[k], az[k],
+                                                        bx[k], bx[k], bx[k], FALSE ) ;
+  }
+}
+
+
+#if defined(SG_HAVE_SSE2)
+
+inline __m128d _sgdLoad2 ( const SGDfloat *p, int stride )
+{
+  return ( stride == 1 ) ? _mm_loadu_pd ( p ) : _mm_setr_pd ( p [ 0 ], p [ stride ] ) ;
+}
+
+inline int _sgdCull_SSE2 ( const SGDfloat pl [ 6 ][ 4 ],
+                           const SGDfloat *ax, const SGDfloat *ay, const SGDfloat *az,
+                           const SGDfloat *bx, const SGDfloat *by, const SGDfloat *bz,
+                           int stride, int n, int box, unsigned char *result )
+{
+  __m128d half = _mm_set1_pd ( SGD_HALF ) ;
+  __m128d zero = _mm_setzero_pd () ;
+
+  int i = 0 ;
+
+  for ( ; i + 2 <= n ; i += 2 )
+  {
+    int k = i * stride ;
+    __m128d x, y, z, ex, ey, ez ;
+
+    if ( box )
+    {
+      __m128d x0 = _sgdLoad2 ( ax + k, stride ), x1 = _sgdLoad2 ( bx + k, stride ) ;
+      __m128d y0 = _sgdLoad2 ( ay + k, stride ), y1 = _sgdLoad2 ( by + k, stride ) ;
+      __m128d z0 = _sgdLoad2 ( az + k, stride ), z1 = _sgdLoad2 ( bz + k, stride ) ;
+
+      x  = _mm_mul_pd ( _mm_add_pd ( x0, x1 ), half ) ;
+      y  = _mm_mul_pd ( _mm_add_pd ( y0, y1 ), half ) ;
+      z  = _mm_mul_pd ( _mm_add_pd ( z0, z1 ), half ) ;
+      ex = _mm_mul_pd ( _mm_sub_pd ( x1, x0 ), half ) ;
+      ey = _mm_mul_pd ( _mm_sub_pd ( y1, y0 ), half ) ;
+      ez = _mm_mul_pd ( _mm_sub_pd ( z1, z0 ), half ) ;
+    }
+    else
+    {
+      x  = _sgdLoad2 ( ax + k, stride ) ;
+      y  = _sgdLoad2 ( ay + k, stride ) ;
+      z  = _sgdLoad2 ( az + k, stride ) ;
+      ex = ey = ez = _sgdLoad2 ( bx + k, stride ) ;
+    }
+
+    __m128d outside  = box ? zero : _mm_cmplt_pd ( ex, zero ) ;
+    __m128d straddle = zero ;
+
+    for ( int p = 0 ; p < 6 ; p++ )
+    {
+      __m128d d = _mm_add_pd ( _mm_add_pd ( _mm_add_pd (
+                      _mm_mul_pd ( x, _mm_set1_pd ( pl[p][0] ) ),
+                      _mm_mul_pd ( y, _mm_set1_pd ( pl[p][1] ) ) ),
+                      _mm_mul_pd ( z, _mm_set1_pd ( pl[p][2] ) ) ),
+                                      _mm_set1_pd ( pl[p][3] ) ) ;
+      __m128d r = ex ;
+
+      if ( box )
+        r = _mm_add_pd ( _mm_add_pd (
+                _mm_mul_pd ( ex, _mm_set1_pd ( sgdAbs ( pl[p][0] ) ) ),
+                _mm_mul_pd ( ey, _mm_set1_pd ( sgdAbs ( pl[p][1] ) ) ) ),
+                _mm_mul_pd ( ez, _mm_set1_pd ( sgdAbs ( pl[p][2] ) ) ) ) ;
+
+      outside  = _mm_or_pd ( outside , _mm_cmplt_pd ( d, _mm_sub_pd ( zero, r ) ) ) ;
+      straddle = _mm_or_pd ( straddle, _mm_cmplt_pd ( d, r ) ) ;
+    }
+
+    _sgCullStore ( result + i, 2, _mm_movemask_pd ( outside ),
+                                  _mm_movemask_pd ( straddle ) ) ;
+  }
+
+  return i ;
+}
+
+#endif  /* SG_HAVE_SSE2 */
+
+
+#if defined(SG_HAVE_AVX)
+
+SG_TARGET_AVX
+inline __m256d _sgdLoad4 ( const SGDfloat *p, int stride )
+{
+  if ( stride == 1 )
+    return _mm256_loadu_pd ( p ) ;
+
+  return _mm256_setr_pd ( p [ 0 ], p [ stride ], p [ 2 * stride ], p [ 3 * stride ] ) ;
+}
+
+SG_TARGET_AVX
+inline int _sgdCull_AVX ( const SGDfloat pl [ 6 ][ 4 ],
+                          const SGDfloat *ax, const SGDfloat *ay, const SGDfloat *az,
+                          const SGDfloat *bx, const SGDfloat *by, const SGDfloat *bz,
+                          int stride, int n, int box, unsigned char *result )
+{
+  __m256d half = _mm256_set1_pd ( SGD_HALF ) ;
+  __m256d zero = _mm256_setzero_pd () ;
+
+  int i = 0 ;
+
+  for ( ; i + 4 <= n ; i += 4 )
+  {
+    int k = i * stride ;
+    __m256d x, y, z, ex, ey, ez ;
+
+    if ( box )
+    {
+      __m256d x0 = _sgdLoad4 ( ax + k, stride ), x1 = _sgdLoad4 ( bx + k, stride ) ;
+      __m256d y0 = _sgdLoad4 ( ay + k, stride ), y1 = _sgdLoad4 ( by + k, stride ) ;
+      __m256d z0 = _sgdLoad4 ( az + k, stride ), z1 = _sgdLoad4 ( bz + k, stride ) ;
+
+      x  = _mm256_mul_pd ( _mm256_add_pd ( x0, x1 ), half ) ;
+      y  = _mm256_mul_pd ( _mm256_add_pd ( y0, y1 ), half ) ;
+      z  = _mm256_mul_pd ( _mm256_add_pd ( z0, z1 ), half ) ;
+      ex = _mm256_mul_pd ( _mm256_sub_pd ( x1, x0 ), half ) ;
+      ey = _mm256_mul_pd ( _mm256_sub_pd ( y1, y0 ), half ) ;
+      ez = _mm256_mul_pd ( _mm256_sub_pd ( z1, z0 ), half ) ;
+    }
+    else
+    {
+      x  = _sgdLoad4 ( ax + k, stride ) ;
+      y  = _sgdLoad4 ( ay + k, stride ) ;
+      z  = _sgdLoad4 ( az + k, stride ) ;
+      ex = ey = ez = _sgdLoad4 ( bx + k, stride ) ;
+    }
+
+    __m256d outside  = box ? zero : _mm256_cmp_pd ( ex, zero, _CMP_LT_OQ ) ;
+    __m256d straddle = zero ;
+
+    for ( int p = 0 ; p < 6 ; p++ )
+    {
+      __m256d d = _mm256_add_pd ( _mm256_add_pd ( _mm256_add_pd (
+                      _mm256_mul_pd ( x, _mm256_set1_pd ( pl[p][0] ) ),
+                      _mm256_mul_pd ( y, _mm256_set1_pd ( pl[p][1] ) ) ),
+                      _mm256_mul_pd ( z, _mm256_set1_pd ( pl[p][2] ) ) ),
+                                         _mm256_set1_pd ( pl[p][3] ) ) ;
+      __m256d r = ex ;
+
+      if ( box )
+        r = _mm256_add_pd ( _mm256_add_pd (
+                _mm256_mul_pd ( ex, _mm256_set1_pd ( sgdAbs ( pl[p][0] ) ) ),
+                _mm256_mul_pd ( ey, _mm256_set1_pd ( sgdAbs ( pl[p][1] ) ) ) ),
+                _mm256_mul_pd ( ez, _mm256_set1_pd ( sgdAbs ( pl[p][2] ) ) ) ) ;
+
+      outside  = _mm256_or_pd ( outside , _mm256_cmp_pd ( d, _mm256_sub_pd ( zero, r ), _CMP_LT_OQ ) ) ;
+      straddle = _mm256_or_pd ( straddle, _mm256_cmp_pd ( d, r, _CMP_LT_OQ ) ) ;
+    }
+
+    _sgCullStore ( result + i, 4, _mm256_movemask_pd ( outside ),
+                                  _mm256_movemask_pd ( straddle ) ) ;
+  }
+
+  _mm256_zeroupper () ;
+  return i ;
+}
+
+#endif  /* SG_HAVE_AVX */
+
+
+inline void _sgdCull ( const sgdFrustum *f,
+                       const SGDfloat *ax, const SGDfloat *ay, const SGDfloat *az,
+                       const SGDfloat *bx, const SGDfloat *by, const SGDfloat *bz,
+                       int stride, int n, int box, unsigned char *result )
+{
+  SGDfloat pl [ 6 ][ 4 ] ;
+  int done = 0 ;
+
+  _sgdGetFrustumPlanes ( pl, f ) ;
+
+#if defined(SG_HAVE_AVX)
+  if ( sgGetSIMDLevel () >= SG_SIMD_AVX )
+    done = _sgdCull_AVX ( pl, ax, ay, az, bx, by, bz, stride, n, box, result ) ;
+  else
+#endif
+#if defined(SG_HAVE_SSE2)
+  if ( sgGetSIMDLevel () >= SG_SIMD_SSE2 )
+    done = _sgdCull_SSE2 ( pl, ax, ay, az, bx, by, bz, stride, n, box, result ) ;
+#endif
+
+  _sgdCull_C ( pl, ax, ay, az, bx, by, bz, stride, done, n, box, result ) ;
+}
+
+
+inline void sgdFrustumContainsSpheres ( const sgdFrustum *f, const sgdVec4 *spheres,
+                                        int count, unsigned char *result )
+{
+  const SGDfloat *s = spheres [ 0 ] ;
+  _sgdCull ( f, s, s + 1, s + 2, s + 3, s + 3, s + 3, 4, count, FALSE, result ) ;
+}
+
+inline void sgdFrustumContainsSpheresSoA ( const sgdFrustum *f,
+                                           const SGDfloat *cx, const SGDfloat *cy,
+                                           const SGDfloat *cz, const SGDfloat *radius,
+                                           int count, unsigned char *result )
+{
+  _sgdCull ( f, cx, cy, cz, radius, radius, radius, 1, count, FALSE, result ) ;
+}
+
+inline void sgdFrustumContainsBoxes ( const sgdFrustum *f,
+                                      const sgdVec3 *bmin, const sgdVec3 *bmax,
+                                      int count, unsigned char *result )
+{
+  const SGDfloat *a = bmin [ 0 ] ;
+  const SGDfloat *b = bmax [ 0 ] ;
+  _sgdCull ( f, a, a + 1, a + 2, b, b + 1, b + 2, 3, count, TRUE, result ) ;
+}
+
+inline void sgdFrustumContainsBoxesSoA ( const sgdFrustum *f,
+                                         const SGDfloat *minx, const SGDfloat *miny, const SGDfloat *minz,
+                                         const SGDfloat *maxx, const SGDfloat *maxy, const SGDfloat *maxz,
+                                         int count, unsigned char *result )
+{
+  _sgdCull ( f, minx, miny, minz, maxx, maxy, maxz, 1, count, TRUE, result ) ;
+}
+
+/**********************************************************************/
+
+/*
+  Batch quaternion and matrix routines.
+  ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+  N quaternion pairs -> N results, N quaternions -> N matrices and so
+  on.  The AoS forms take arrays of sgQuat/sgMat4, the SoA forms take
+  four component arrays indexed by SG_X, SG_Y, SG_Z and SG_W, eg:
+
+    SGfloat *q [ 4 ] = { qx, qy, qz, qw } ;
+
+  sgMultQuatArray, sgQuatToMatrixArray, sgMatrixToQuatArray and the
+  SG_SLERP_EXACT mode of sgSlerpQuatArray give bit-identical results to
+  the scalar routines.  sgInvertMat4Array uses the cofactor expansion
+  rather than the pivoting elimination of sgInvertMat4, so its results
+  agree only to within rounding; singular matrices are handed to
+  sgInvertMat4 itself so that they are reported in the usual way.
+
+  SG_SLERP_NLERP replaces the spherical interpolation by a normalised
+  linear one (the arc is the same, only the speed along it differs).
+  For unit quaternions whose rotations differ by at most 30, 90 or 180
+  degrees the result is within 0.034, 0.92 or 8.2 degrees respectively
+  of sgSlerpQuat.  It is exact at t = 0, 0.5 and 1 and needs no
+  trigonometry, so it runs entirely in SIMD registers.
+*/
+
+#define SG_SLERP_EXACT  0
+#define SG_SLERP_NLERP  1
+
+inline void _sgMultQuat ( SGfloat *dst, const SGfloat *a, const SGfloat *b )
+{
+  /* Same eight-multiply form, in the same order, as sgMultQuat() */
+
+  SGfloat t0 = ( a[SG_W] + a[SG_X] ) * ( b[SG_W] + b[SG_X] ) ;
+  SGfloat t1 = ( a[SG_Z] - a[SG_Y] ) * ( b[SG_Y] - b[SG_Z] ) ;
+  SGfloat t2 = ( a[SG_X] - a[SG_W] ) * ( b[SG_Y] + b[SG_Z] ) ;
+  SGfloat t3 = ( a[SG_Y] + a[SG_Z] ) * ( b[SG_X] - b[SG_W] ) ;
+  SGfloat t4 = ( a[SG_X] + a[SG_Z] ) * ( b[SG_X] + b[SG_Y] ) ;
+  SGfloat t5 = ( a[SG_X] - a[SG_Z] ) * ( b[SG_X] - b[SG_Y] ) ;
+  SGfloat t6 = ( a[SG_W] + a[SG_Y] ) * ( b[SG_W] - b[SG_Z] ) ;
+  SGfloat t7 = ( a[SG_W] - a[SG_Y] ) * ( b[SG_W] + b[SG_Z] ) ;
+
+  dst[SG_W] =  t1 + ( ( -t4 - t5 + t6 + t7 ) * SG_HALF ) ;
+  dst[SG_X] =  t0 - ( (  t4 + t5 + t6 + t7 ) * SG_HALF ) ;
+  dst[SG_Y] = -t2 + ( (  t4 - t5 + t6 - t7 ) * SG_HALF ) ;
+  dst[SG_Z] = -t3 + ( (  t4 - t5 - t6 + t7 ) * SG_HALF ) ;
+}
+
+inline void _sgSlerpQuat ( SGfloat *dst, const SGfloat *from, const SGfloat *to,
+                           SGfloat t, int mode )
+{
+  SGfloat co = sgScalarProductVec4 ( from, to ) ;
+  SGfloat scale0, scale1 ;
+  int flip = FALSE ;
+
+  if ( co < SG_ZERO )
+  {
+    co   = -co ;
+    flip = TRUE ;
+  }
+
+  if ( mode == SG_SLERP_EXACT && co < 0.999999f )
+  {
+    /*
+      As sgSlerpQuat() - the trig is done in double precision there, so
+      make sure that the float overloads from <cmath> are not picked up.
+    */
+
+    SGfloat o  = (SGfloat) acos ( (double) co ) ;
+    SGfloat so = SG_ONE / (SGfloat) sin ( (double) o ) ;
+
+    scale0 = (SGfloat) sin ( (double) ( ( SG_ONE - t ) * o ) ) * so ;
+    scale1 = (SGfloat) sin ( (double) ( t * o ) ) * so ;
+  }
+  else
+  {
+    scale0 = SG_ONE - t ;
+    scale1 = t ;
+  }
+
+  if ( flip )
+    scale1 = -scale1 ;
+
+  sgVec4 r ;
+
+  r[SG_X] = scale0 * from[SG_X] + scale1 * to[SG_X] ;
+  r[SG_Y] = scale0 * from[SG_Y] + scale1 * to[SG_Y] ;
+  r[SG_Z] = scale0 * from[SG_Z] + scale1 * to[SG_Z] ;
+  r[SG_W] = scale0 * from[SG_W] + scale1 * to[SG_W] ;
+
+  if ( mode == SG_SLERP_NLERP )
+  {
+    SGfloat d = sgScalarProductVec4 ( r, r ) ;
+    sgScaleVec4 ( r, ( d > SG_ZERO ) ? SG_ONE / sgSqrt ( d ) : SG_ONE ) ;
+  }
+
+  sgCopyVec4 ( dst, r ) ;
+}
+
+inline void _sgQuatToMatrix ( sgMat4 dst, SGfloat x, SGfloat y, SGfloat z, SGfloat w )
+{
+  /* As sgQuatToMatrix() */
+
+  SGfloat two_xx = x * ( x + x ) ;
+  SGfloat two_xy = x * ( y + y ) ;
+  SGfloat two_xz = x * ( z + z ) ;
+
+  SGfloat two_wx = w * ( x + x ) ;
+  SGfloat two_wy = w * ( y + y ) ;
+  SGfloat two_wz = w * ( z + z ) ;
+
+  SGfloat two_yy = y * ( y + y ) ;
+  SGfloat two_yz = y * ( z + z ) ;
+
+  SGfloat two_zz = z * ( z + z ) ;
+
+  sgSetVec4 ( dst[0], SG_ONE - ( two_yy + two_zz ), two_xy - two_wz, two_xz + two_wy, SG_ZERO ) ;
+  sgSetVec4 ( dst[1], two_xy + two_wz, SG_ONE - ( two_xx + two_zz ), two_yz - two_wx, SG_ZERO ) ;
+  sgSetVec4 ( dst[2], two_xz - two_wy, two_yz + two_wx, SG_ONE - ( two_xx + two_yy ), SG_ZERO ) ;
+  sgSetVec4 ( dst[3], SG_ZERO, SG_ZERO, SG_ZERO, SG_ONE ) ;
+}
+
+inline void _sgMatrixToQuat ( SGfloat *quat, const sgMat4 m )
+{
+  /* As sgMatrixToQuat() - including the final negation of w */
+
+  SGfloat tr = m[0][0] + m[1][1] + m[2][2] ;
+
+  if ( tr > SG_ZERO )
+  {
+    SGfloat s = (SGfloat) sqrt ( (double) ( tr + SG_ONE ) ) ;
+
+    quat[SG_W] = s / SG_TWO ;
+    s = SG_HALF / s ;
+    quat[SG_X] = ( m[1][2] - m[2][1] ) * s ;
+    quat[SG_Y] = ( m[2][0] - m[0][2] ) * s ;
+    quat[SG_Z] = ( m[0][1] - m[1][0] ) * s ;
+  }
+  else
+  {
+    static const int nxt [ 3 ] = { 1, 2, 0 } ;
+    SGfloat q [ 4 ] ;
+
+    int i = 0 ;
+    if ( m[1][1] > m[0][0] ) i = 1 ;
+    if ( m[2][2] > m[i][i] ) i = 2 ;
+    int j = nxt [ i ] ;
+    int k = nxt [ j ] ;
+
+    SGfloat s = (SGfloat) sqrt ( (double) ( ( m[i][i] - ( m[j][j] + m[k][k] ) ) + SG_ONE ) ) ;
+
+    q[i] = s * SG_HALF ;
+    if ( s != SG_ZERO ) s = SG_HALF / s ;
+    q[3] = ( m[j][k] - m[k][j] ) * s ;
+    q[j] = ( m[i][j] + m[j][i] ) * s ;
+    q[k] = ( m[i][k] + m[k][i] ) * s ;
+
+    quat[SG_X] = q[0] ;
+    quat[SG_Y] = q[1] ;
+    quat[SG_Z] = q[2] ;
+    quat[SG_W] = q[3] ;
+  }
+
+  quat[SG_W] = -quat[SG_W] ;
+}
+
+
+#if defined(SG_HAVE_SSE2)
+
+/*
+  The SSE2 kernels work on four quaternions (or matrices) at once with
+  one register per component.  AoS data is transposed on the way in
+  and out.
+*/
+
+inline void _sgLoadQuat4 ( __m128 q [ 4 ], const SGfloat *src )
+{
+  q [ 0 ] = _mm_loadu_ps ( src      ) ;
+  q [ 1 ] = _mm_loadu_ps ( src +  4 ) ;
+  q [ 2 ] = _mm_loadu_ps ( src +  8 ) ;
+  q [ 3 ] = _mm_loadu_ps ( src + 12 ) ;
+  _MM_TRANSPOSE4_PS ( q [ 0 ], q [ 1 ], q [ 2 ], q [ 3 ] ) ;
+}
+
+/* By address: x86 MSVC cannot pass more than three __m128 by value */
+
+inline void _sgStoreQuat4 ( SGfloat *dst, const __m128 q [ 4 ] )
+{
+  __m128 q0 = q [ 0 ], q1 = q [ 1 ], q2 = q [ 2 ], q3 = q [ 3 ] ;
+  _MM_TRANSPOSE4_PS ( q0, q1, q2, q3 ) ;
+  _mm_storeu_ps ( dst     , q0 ) ;
+  _mm_storeu_ps ( dst +  4, q1 ) ;
+  _mm_storeu_ps ( dst +  8, q2 ) ;
+  _mm_storeu_ps ( dst + 12, q3 ) ;
+}
+
+inline void _sgMultQuat_SSE2 ( __m128 d [ 4 ], const __m128 a [ 4 ], const __m128 b [ 4 ] )
+{
+  __m128 half = _mm_set1_ps ( SG_HALF ) ;
+
+  __m128 t0 = _mm_mul_ps ( _mm_add_ps ( a[SG_W], a[SG_X] ), _mm_add_ps ( b[SG_W], b[SG_X] ) ) ;
+  __m128 t1 = _mm_mul_ps ( _mm_sub_ps ( a[SG_Z], a[SG_Y] ), _mm_sub_ps ( b[SG_Y], b[SG_Z] ) ) ;
+  __m128 t2 = _mm_mul_ps ( _mm_sub_ps ( a[SG_X], a[SG_W] ), _mm_add_ps ( b[SG_Y], b[SG_Z] ) ) ;
+  __m128 t3 = _mm_mul_ps ( _mm_add_ps ( a[SG_Y], a[SG_Z] ), _mm_sub_ps ( b[SG_X], b[SG_W] ) ) ;
+  __m128 t4 = _mm_mul_ps ( _mm_add_ps ( a[SG_X], a[SG_Z] ), _mm_add_ps ( b[SG_X], b[SG_Y] ) ) ;
+  __m128 t5 = _mm_mul_ps ( _mm_sub_ps ( a[SG_X], a[SG_Z] ), _mm_sub_ps ( b[SG_X], b[SG_Y] ) ) ;
+  __m128 t6 = _mm_mul_ps ( _mm_add_ps ( a[SG_W], a[SG_Y] ), _mm_sub_ps ( b[SG_W], b[SG_Z] ) ) ;
+  __m128 t7 = _mm_mul_ps ( _mm_sub_ps ( a[SG_W], a[SG_Y] ), _mm_add_ps ( b[SG_W], b[SG_Z] ) ) ;
+
+  /* -t4 - t5 == -( t4 + t5 ) and -t2 + u == u - t2 exactly, so these match _sgMultQuat */
+
+  __m128 p45 = _mm_add_ps ( t4, t5 ) ;
+  __m128 m45 = _mm_sub_ps ( t4, t5 ) ;
+
+  d[SG_W] = _mm_add_ps ( t1, _mm_mul_ps ( _mm_add_ps ( _mm_sub_ps ( t6, p45 ), t7 ), half ) ) ;
+  d[SG_X] = _mm_sub_ps ( t0, _mm_mul_ps ( _mm_add_ps ( _mm_add_ps ( p45, t6 ), t7 ), half ) ) ;
+  d[SG_Y] = _mm_sub_ps ( _mm_mul_ps ( _mm_sub_ps ( _mm_add_ps ( m45, t6 ), t7 ), half ), t2 ) ;
+  d[SG_Z] = _mm_sub_ps ( _mm_mul_ps ( _mm_add_ps ( _mm_sub_ps ( m45, t6 ), t7 ), half ), t3 ) ;
+}
+
+inline void _sgNlerpQuat_SSE2 ( __m128 d [ 4 ], const __m128 a [ 4 ], const __m128 b [ 4 ], __m128 t )
+{
+  __m128 zero = _mm_setzero_ps () ;
+  __m128 one  = _mm_set1_ps ( SG_ONE ) ;
+  __m128 sign = _mm_set1_ps ( -0.0f ) ;
+
+  __m128 co = _mm_add_ps ( _mm_add_ps ( _mm_add_ps ( _mm_mul_ps ( a[0], b[0] ),
+                                                     _mm_mul_ps ( a[1], b[1] ) ),
+                                                     _mm_mul_ps ( a[2], b[2] ) ),
+                                                     _mm_mul_ps ( a[3], b[3] ) ) ;
+
+  __m128 scale0 = _mm_sub_ps ( one, t ) ;
+  __m128 scale1 = _mm_xor_ps ( t, _mm_and_ps ( _mm_cmplt_ps ( co, zero ), sign ) ) ;
+
+  for ( int c = 0 ; c < 4 ; c++ )
+    d [ c ] = _mm_add_ps ( _mm_mul_ps ( scale0, a [ c ] ), _mm_mul_ps ( scale1, b [ c ] ) ) ;
+
+  __m128 len = _mm_add_ps ( _mm_add_ps ( _mm_add_ps ( _mm_mul_ps ( d[0], d[0] ),
+                                                      _mm_mul_ps ( d[1], d[1] ) ),
+                                                      _mm_mul_ps ( d[2], d[2] ) ),
+                                                      _mm_mul_ps ( d[3], d[3] ) ) ;
+
+  /* 1/sqrt(len), or 1 where len is zero */
+
+  __m128 ok = _mm_cmpgt_ps ( len, zero ) ;
+  __m128 r  = _mm_div_ps ( one, _mm_sqrt_ps ( _mm_or_ps ( _mm_and_ps ( ok, len ),
+                                                          _mm_andnot_ps ( ok, one ) ) ) ) ;
+
+  for ( int c = 0 ; c < 4 ; c++ )
+    d [ c ] = _mm_mul_ps ( d [ c ], r ) ;
+}
+
+inline void _sgQuatToMatrix_SSE2 ( SGfloat *dst, const __m128 q [ 4 ] )
+{
+  __m128 one  = _mm_set1_ps ( SG_ONE ) ;
+  __m128 zero = _mm_setzero_ps () ;
+
+  __m128 x2 = _mm_add_ps ( q[SG_X], q[SG_X] ) ;
+  __m128 y2 = _mm_add_ps ( q[SG_Y], q[SG_Y] ) ;
+  __m128 z2 = _mm_add_ps ( q[SG_Z], q[SG_Z] ) ;
+
+  __m128 two_xx = _mm_mul_ps ( q[SG_X], x2 ) ;
+  __m128 two_xy = _mm_mul_ps ( q[SG_X], y2 ) ;
+  __m128 two_xz = _mm_mul_ps ( q[SG_X], z2 ) ;
+  __m128 two_wx = _mm_mul_ps ( q[SG_W], x2 ) ;
+  __m128 two_wy = _mm_mul_ps ( q[SG_W], y2 ) ;
+  __m128 two_wz = _mm_mul_ps ( q[SG_W], z2 ) ;
+  __m128 two_yy = _mm_mul_ps ( q[SG_Y], y2 ) ;
+  __m128 two_yz = _mm_mul_ps ( q[SG_Y], z2 ) ;
+  __m128 two_zz = _mm_mul_ps ( q[SG_Z], z2 ) ;
+
+  __m128 r0 [ 4 ] = { _mm_sub_ps ( one, _mm_add_ps ( two_yy, two_zz ) ),
+                      _mm_sub_ps ( two_xy, two_wz ),
+                      _mm_add_ps ( two_xz, two_wy ), zero } ;
+  __m128 r1 [ 4 ] = { _mm_add_ps ( two_xy, two_wz ),
+                      _mm_sub_ps ( one, _mm_add_ps ( two_xx, two_zz ) ),
+                      _mm_sub_ps ( two_yz, two_wx ), zero } ;
+  __m128 r2 [ 4 ] = { _mm_sub_ps ( two_xz, two_wy ),
+                      _mm_add_ps ( two_yz, two_wx ),
+                      _mm_sub_ps ( one, _mm_add_ps ( two_xx, two_yy ) ), zero } ;
+  __m128 r3 = _mm_setr_ps ( SG_ZERO, SG_ZERO, SG_ZERO, SG_ONE ) ;
+
+  _MM_TRANSPOSE4_PS ( r0 [ 0 ], r0 [ 1 ], r0 [ 2 ], r0 [ 3 ] ) ;
+  _MM_TRANSPOSE4_PS ( r1 [ 0 ], r1 [ 1 ], r1 [ 2 ], r1 [ 3 ] ) ;
+  _MM_TRANSPOSE4_PS ( r2 [ 0 ], r2 [ 1 ], r2 [ 2 ], r2 [ 3 ] ) ;
+
+  for ( int i = 0 ; i < 4 ; i++, dst += 16 )
+  {
+    _mm_storeu_ps ( dst     , r0 [ i ] ) ;
+    _mm_storeu_ps ( dst +  4, r1 [ i ] ) ;
+    _mm_storeu_ps ( dst +  8, r2 [ i ] ) ;
+    _mm_storeu_ps ( dst + 12, r3 ) ;
+  }
+}
+
+/*
+  Invert four matrices using 2x2 sub-determinants of the top and
+  bottom row pairs.  Returns a mask of the lanes whose determinant was
+  zero (or not finite) - the caller redoes those with sgInvertMat4.
+*/
+
+inline int _sgInvertMat4_SSE2 ( SGfloat *dst, const SGfloat *src )
+{
+  __m128 m [ 4 ][ 4 ] ;   /* m [ row ][ col ] - one matrix per lane */
+
+  for ( int r = 0 ; r < 4 ; r++ )
+  {
+    m [ r ][ 0 ] = _mm_loadu_ps ( src +      r * 4 ) ;
+    m [ r ][ 1 ] = _mm_loadu_ps ( src + 16 + r * 4 ) ;
+    m [ r ][ 2 ] = _mm_loadu_ps ( src + 32 + r * 4 ) ;
+    m [ r ][ 3 ] = _mm_loadu_ps ( src + 48 + r * 4 ) ;
+    _MM_TRANSPOSE4_PS ( m [ r ][ 0 ], m [ r ][ 1 ], m [ r ][ 2 ], m [ r ][ 3 ] ) ;
+  }
+
+#define _SG_DET2(a,b,c,d)  _mm_sub_ps ( _mm_mul_ps ( a, b ), _mm_mul_ps ( c, d ) )
+
+  __m128 s0 = _SG_DET2 ( m[0][0], m[1][1], m[1][0], m[0][1] ) ;
+  __m128 s1 = _SG_DET2 ( m[0][0], m[1][2], m[1][0], m[0][2] ) ;
+  __m128 s2 = _SG_DET2 ( m[0][0], m[1][3], m[1][0], m[0][3] ) ;
+  __m128 s3 = _SG_DET2 ( m[0][1], m[1][2], m[1][1], m[0][2] ) ;
+  __m128 s4 = _SG_DET2 ( m[0][1], m[1][3], m[1][1], m[0][3] ) ;
+  __m128 s5 = _SG_DET2 ( m[0][2], m[1][3], m[1][2], m[0][3] ) ;
+
+  __m128 c5 = _SG_DET2 ( m[2][2], m[3][3], m[3][2], m[2][3] ) ;
+  __m128 c4 = _SG_DET2 ( m[2][1], m[3][3], m[3][1], m[2][3] ) ;
+  __m128 c3 = _SG_DET2 ( m[2][1], m[3][2], m[3][1], m[2][2] ) ;
+  __m128 c2 = _SG_DET2 ( m[2][0], m[3][3], m[3][0], m[2][3] ) ;
+  __m128 c1 = _SG_DET2 ( m[2][0], m[3][2], m[3][0], m[2][2] ) ;
+  __m128 c0 = _SG_DET2 ( m[2][0], m[3][1], m[3][0], m[2][1] ) ;
+
+#undef _SG_DET2
+
+  __m128 det = _mm_add_ps ( _mm_sub_ps ( _mm_add_ps ( _mm_add_ps ( _mm_sub_ps (
+                   _mm_mul_ps ( s0, c5 ), _mm_mul_ps ( s1, c4 ) ),
+                   _mm_mul_ps ( s2, c3 ) ), _mm_mul_ps ( s3, c2 ) ),
+                   _mm_mul_ps ( s4, c1 ) ), _mm_mul_ps ( s5, c0 ) ) ;
+
+  __m128 inv = _mm_div_ps ( _mm_set1_ps ( SG_ONE ), det ) ;
+
+  /* A zero determinant gives inf, a NaN matrix gives NaN - both fail the self-compare below */
+
+  int bad = _mm_movemask_ps ( _mm_or_ps ( _mm_cmpeq_ps ( det, _mm_setzero_ps () ),
+                              _mm_cmpneq_ps ( _mm_sub_ps ( inv, inv ), _mm_setzero_ps () ) ) ) ;
+
+#define _SG_COF(a,b,c,d,e,f)  _mm_mul_ps ( _mm_add_ps ( _mm_sub_ps ( _mm_mul_ps ( a, b ), \
+                              _mm_mul_ps ( c, d ) ), _mm_mul_ps ( e, f ) ), inv )
+#define _SG_NCOF(a,b,c,d,e,f) _mm_mul_ps ( _mm_sub_ps ( _mm_sub_ps ( _mm_mul_ps ( c, d ), \
+                              _mm_mul_ps ( a, b ) ), _mm_mul_ps ( e, f ) ), inv )
+
+  __m128 b [ 4 ][ 4 ] ;
+
+  b[0][0] = _SG_COF  ( m[1][1], c5, m[1][2], c4, m[1][3], c3 ) ;
+  b[0][1] = _SG_NCOF ( m[0][1], c5, m[0][2], c4, m[0][3], c3 ) ;
+  b[0][2] = _SG_COF  ( m[3][1], s5, m[3][2], s4, m[3][3], s3 ) ;
+  b[0][3] = _SG_NCOF ( m[2][1], s5, m[2][2], s4, m[2][3], s3 ) ;
+
+  b[1][0] = _SG_NCOF ( m[1][0], c5, m[1][2], c2, m[1][3], c1 ) ;
+  b[1][1] = _SG_COF  ( m[0][0], c5, m[0][2], c2, m[0][3], c1 ) ;
+  b[1][2] = _SG_NCOF ( m[3][0], s5, m[3][2], s2, m[3][3], s1 ) ;
+  b[1][3] = _SG_COF  ( m[2][0], s5, m[2][2], s2, m[2][3], s1 ) ;
+
+  b[2][0] = _SG_COF  ( m[1][0], c4, m[1][1], c2, m[1][3], c0 ) ;
+  b[2][1] = _SG_NCOF ( m[0][0], c4, m[0][1], c2, m[0][3], c0 ) ;
+  b[2][2] = _SG_COF  ( m[3][0], s4, m[3][1], s2, m[3][3], s0 ) ;
+  b[2][3] = _SG_NCOF ( m[2][0], s4, m[2][1], s2, m[2][3], s0 ) ;
+
+  b[3][0] = _SG_NCOF ( m[1][0], c3, m[1][1], c1, m[1][2], c0 ) ;
+  b[3][1] = _SG_COF  ( m[0][0], c3, m[0][1], c1, m[0][2], c0 ) ;
+  b[3][2] = _SG_NCOF ( m[3][0], s3, m[3][1], s1, m[3][2], s0 ) ;
+  b[3][3] = _SG_COF  ( m[2][0], s3, m[2][1], s1, m[2][2], s0 ) ;
+
+#undef _SG_COF
+#undef _SG_NCOF
+
+  for ( int r = 0 ; r < 4 ; r++ )
+  {
+    _MM_TRANSPOSE4_PS ( b [ r ][ 0 ], b [ r ][ 1 ], b [ r ][ 2 ], b [ r ][ 3 ] ) ;
+
+    for ( int i = 0 ; i < 4 ; i++ )
+      _mm_storeu_ps ( dst + i * 16 + r * 4, b [ r ][ i ] ) ;
+  }
+
+  return bad ;
+}
+
+#endif  /* SG_HAVE_SSE2 */
+
+
+/*
+  Single precision, AoS.  'dst' may be the same array as any source.
+*/
+
+inline void sgMultQuatArray ( sgQuat *dst, const sgQuat *a, const sgQuat *b, int count )
+{
+  int i = 0 ;
+
+#if defined(SG_HAVE_SSE2)
+  if ( sgGetSIMDLevel () >= SG_SIMD_SSE2 )
+  {
+    for ( ; i + 4 <= count ; i += 4 )
+    {
+      __m128 qa [ 4 ], qb [ 4 ], qd [ 4 ] ;
+
+      _sgLoadQuat4 ( qa, a [ i ] ) ;
+      _sgLoadQuat4 ( qb, b [ i ] ) ;
+      _sgMultQuat_SSE2 ( qd, qa, qb ) ;
+      _sgStoreQuat4 ( dst [ i ], qd ) ;
+    }
+  }
+#endif
+
+  for ( ; i < count ; i++ )
+  {
+    sgQuat r ;
+    _sgMultQuat ( r, a [ i ], b [ i ] ) ;
+    sgCopyQuat ( dst [ i ], r ) ;
+  }
+}
+
+inline void sgSlerpQuatArray ( sgQuat *dst, const sgQuat *from, const sgQuat *to,
+                               const SGfloat *t, int count, int mode = SG_SLERP_EXACT )
+{
+  int i = 0 ;
+
+#if defined(SG_HAVE_SSE2)
+  if ( mode == SG_SLERP_NLERP && sgGetSIMDLevel () >= SG_SIMD_SSE2 )
+  {
+    for ( ; i + 4 <= count ; i += 4 )
+    {
+      __m128 qa [ 4 ], qb [ 4 ], qd [ 4 ] ;
+
+      _sgLoadQuat4 ( qa, from [ i ] ) ;
+      _sgLoadQuat4 ( qb, to   [ i ] ) ;
+      _sgNlerpQuat_SSE2 ( qd, qa, qb, _mm_loadu_ps ( t + i ) ) ;
+      _sgStoreQuat4 ( dst [ i ], qd ) ;
+    }
+  }
+#endif
+
+  for ( ; i < count ; i++ )
+    _sgSlerpQuat ( dst [ i ], from [ i ], to [ i ], t [ i ], mode ) ;
+}
+
+inline void sgQuatToMatrixArray ( sgMat4 *dst, const sgQuat *src, int count )
+{
+  int i = 0 ;
+
+#if defined(SG_HAVE_SSE2)
+  if ( sgGetSIMDLevel () >= SG_SIMD_SSE2 )
+  {
+    for ( ; i + 4 <= count ; i += 4 )
+    {
+      __m128 q [ 4 ] ;
+
+      _sgLoadQuat4 ( q, src [ i ] ) ;
+      _sgQuatToMatrix_SSE2 ( dst [ i ][ 0 ], q ) ;
+    }
+  }
+#endif
+
+  for ( ; i < count ; i++ )
+    _sgQuatToMatrix ( dst [ i ], src[i][SG_X], src[i][SG_Y], src[i][SG_Z], src[i][SG_W] ) ;
+}
+
+inline void sgMatrixToQuatArray ( sgQuat *dst, const sgMat4 *src, int count )
+{
+  /* Branchy and sqrt-bound - kept scalar, but inline */
+
+  for ( int i = 0 ; i < count ; i++ )
+    _sgMatrixToQuat ( dst [ i ], src [ i ] ) ;
+}
+
+inline void sgInvertMat4Array ( sgMat4 *dst, const sgMat4 *src, int count )
+{
+  int i = 0 ;
+
+#if defined(SG_HAVE_SSE2)
+  if ( sgGetSIMDLevel () >= SG_SIMD_SSE2 )
+  {
+    for ( ; i + 4 <= count ; i += 4 )
+    {
+      sgMat4 tmp [ 4 ] ;
+
+      /* Go via tmp so that the singular fallback still sees 'src' when dst == src */
+
+      int bad = _sgInvertMat4_SSE2 ( tmp [ 0 ][ 0 ], src [ i ][ 0 ] ) ;
+
+      for ( int k = 0 ; k < 4 ; k++ )
+        if ( bad & ( 1 << k ) )
+          sgInvertMat4 ( dst [ i + k ], src [ i + k ] ) ;
+        else
+          sgCopyMat4 ( dst [ i + k ], tmp [ k ] ) ;
+    }
+  }
+#endif
+
+  for ( ; i < count ; i++ )
+    sgInvertMat4 ( dst [ i ], src [ i ] ) ;
+}
+
+
+/*
+  Single precision, SoA.  Each argument is an array of four component
+  pointers, indexed by SG_X, SG_Y, SG_Z and SG_W.
+*/
+
+inline void sgMultQuatArraySoA ( SGfloat *const dst [ 4 ], const SGfloat *const a [ 4 ],
+                                 const SGfloat *const b [ 4 ], int count )
+{
+  int i = 0 ;
+
+#if defined(SG_HAVE_SSE2)
+  if ( sgGetSIMDLevel () >= SG_SIMD_SSE2 )
+  {
+    for ( ; i + 4 <= count ; i += 4 )
+    {
+      __m128 qa [ 4 ], qb [ 4 ], qd [ 4 ] ;
+
+      for ( int c = 0 ; c < 4 ; c++ )
+      {
+        qa [ c ] = _mm_loadu_ps ( a [ c ] + i ) ;
+        qb [ c ] = _mm_loadu_ps ( b [ c ] + i ) ;
+      }
+
+      _sgMultQuat_SSE2 ( qd, qa, qb ) ;
+
+      for ( int c = 0 ; c < 4 ; c++ )
+        _mm_storeu_ps ( dst [ c ] + i, qd [ c ] ) ;
+    }
+  }
+#endif
+
+  for ( ; i < count ; i++ )
+  {
+    sgQuat qa, qb, qd ;
+
+    for ( int c = 0 ; c < 4 ; c++ )
+    {
+      qa [ c ] = a [ c ][ i ] ;
+      qb [ c ] = b [ c ][ i ] ;
+    }
+
+    _sgMultQuat ( qd, qa, qb ) ;
+
+    for ( int c = 0 ; c < 4 ; c++ )
+      dst [ c ][ i ] = qd [ c ] ;
+  }
+}
+
+inline void sgSlerpQuatArraySoA ( SGfloat *const dst [ 4 ], const SGfloat *const from [ 4 ],
+                                  const SGfloat *const to [ 4 ], const SGfloat *t,
+                                  int count, int mode = SG_SLERP_EXACT )
+{
+  int i = 0 ;
+
+#if defined(SG_HAVE_SSE2)
+  if ( mode == SG_SLERP_NLERP && sgGetSIMDLevel () >= SG_SIMD_SSE2 )
+  {
+    for ( ; i + 4 <= count ; i += 4 )
+    {
+      __m128 qa [ 4 ], qb [ 4 ], qd [ 4 ] ;
+
+      for ( int c = 0 ; c < 4 ; c++ )
+      {
+        qa [ c ] = _mm_loadu_ps ( from [ c ] + i ) ;
+        qb [ c ] = _mm_loadu_ps ( to   [ c ] + i ) ;
+      }
+
+      _sgNlerpQuat_SSE2 ( qd, qa, qb, _mm_loadu_ps ( t + i ) ) ;
+
+      for ( int c = 0 ; c < 4 ; c++ )
+        _mm_storeu_ps ( dst [ c ] + i, qd [ c ] ) ;
+    }
+  }
+#endif
+
+  for ( ; i < count ; i++ )
+  {
+    sgQuat qa, qb, qd ;
+
+    for ( int c = 0 ; c < 4 ; c++ )
+    {
+      qa [ c ] = from [ c ][ i ] ;
+      qb [ c ] = to   [ c ][ i ] ;
+    }
+
+    _sgSlerpQuat ( qd, qa, qb, t [ i ], mode ) ;
+
+    for ( int c = 0 ; c < 4 ; c++ )
+      dst [ c ][ i ] = qd [ c ] ;
+  }
+}
+
+inline void sgQuatToMatrixArraySoA ( sgMat4 *dst, const SGfloat *const src [ 4 ], int count )
+{
+  int i = 0 ;
+
+#if defined(SG_HAVE_SSE2)
+  if ( sgGetSIMDLevel () >= SG_SIMD_SSE2 )
+  {
+    for ( ; i + 4 <= count ; i += 4 )
+    {
+      __m128 q [ 4 ] ;
+
+      for ( int c = 0 ; c < 4 ; c++ )
+        q [ c ] = _mm_loadu_ps ( src [ c ] + i ) ;
+
+      _sgQuatToMatrix_SSE2 ( dst [ i ][ 0 ], q ) ;
+    }
+  }
+#endif
+
+  for ( ; i < count ; i++ )
+    _sgQuatToMatrix ( dst [ i ], src[SG_X][i], src[SG_Y][i], src[SG_Z][i], src[SG_W][i] ) ;
+}
+
+inline void sgMatrixToQuatArraySoA ( SGfloat *const dst [ 4 ], const sgMat4 *src, int count )
+{
+  for ( int i = 0 ; i < count ; i++ )
+  {
+    sgQuat q ;
+
+    _sgMatrixToQuat ( q, src [ i ] ) ;
+
+    for ( int c = 0 ; c < 4 ; c++ )
+      dst [ c ][ i ] = q [ c ] ;
+  }
+}
+
+
+/*
+  Double precision.  These are plain inline loops over the same
+  arithmetic as the sgd routines - with only two doubles per SSE2
+  register there is little to be had from SIMD here.
+*/
+
+inline void _sgdMultQuat ( SGDfloat *dst, const SGDfloat *a, const SGDfloat *b )
+{
+  SGDfloat t0 = ( a[SG_W] + a[SG_X] ) * ( b[SG_W] + b[SG_X] ) ;
+  SGDfloat t1 = ( a[SG_Z] - a[SG_Y] ) * ( b[SG_Y] - b[SG_Z] ) ;
+  SGDfloat t2 = ( a[SG_X] - a[SG_W] ) * ( b[SG_Y] + b[SG_Z] ) ;
+  SGDfloat t3 = ( a[SG_Y] + a[SG_Z] ) * ( b[SG_X] - b[SG_W] ) ;
+  SGDfloat t4 = ( a[SG_X] + a[SG_Z] ) * ( b[SG_X] + b[SG_Y] ) ;
+  SGDfloat t5 = ( a[SG_X] - a[SG_Z] ) * ( b[SG_X] - b[SG_Y] ) ;
+  SGDfloat t6 = ( a[SG_W] + a[SG_Y] ) * ( b[SG_W] - b[SG_Z] ) ;
+  SGDfloat t7 = ( a[SG_W] - a[SG_Y] ) * ( b[SG_W] + b[SG_Z] ) ;
+
+  dst[SG_W] =  t1 + ( ( -t4 - t5 + t6 + t7 ) * SGD_HALF ) ;
+  dst[SG_X] =  t0 - ( (  t4 + t5 + t6 + t7 ) * SGD_HALF ) ;
+  dst[SG_Y] = -t2 + ( (  t4 - t5 + t6 - t7 ) * SGD_HALF ) ;
+  dst[SG_Z] = -t3 + ( (  t4 - t5 - t6 + t7 ) * SGD_HALF ) ;
+}
+
+inline void _sgdSlerpQuat ( SGDfloat *dst, const SGDfloat *from, const SGDfloat *to,
+                            SGDfloat t, int mode )
+{
+  SGDfloat co = sgdScalarProductVec4 ( from, to ) ;
+  SGDfloat scale0, scale1 ;
+  int flip = FALSE ;
+
+  if ( co < SGD_ZERO )
+  {
+    co   = -co ;
+    flip = TRUE ;
+  }
+
+  if ( mode == SG_SLERP_EXACT && co < 0.999999 )
+  {
+    SGDfloat o  = acos ( co ) ;
+    SGDfloat so = SGD_ONE / sin ( o ) ;
+
+    scale0 = sin ( ( SGD_ONE - t ) * o ) * so ;
+    scale1 = sin ( t * o ) * so ;
+  }
+  else
+  {
+    scale0 = SGD_ONE - t ;
+    scale1 = t ;
+  }
+
+  if ( flip )
+    scale1 = -scale1 ;
+
+  sgdVec4 r ;
+
+  r[SG_X] = scale0 * from[SG_X] + scale1 * to[SG_X] ;
+  r[SG_Y] = scale0 * from[SG_Y] + scale1 * to[SG_Y] ;
+  r[SG_Z] = scale0 * from[SG_Z] + scale1 * to[SG_Z] ;
+  r[SG_W] = scale0 * from[SG_W] + scale1 * to[SG_W] ;
+
+  if ( mode == SG_SLERP_NLERP )
+  {
+    SGDfloat d = sgdScalarProductVec4 ( r, r ) ;
+    sgdScaleVec4 ( r, ( d > SGD_ZERO ) ? SGD_ONE / sgdSqrt ( d ) : SGD_ONE ) ;
+  }
+
+  sgdCopyVec4 ( dst, r ) ;
+}
+
+inline void _sgdQuatToMatrix ( sgdMat4 dst, const SGDfloat *q )
+{
+  SGDfloat two_xx = q[SG_X] * ( q[SG_X] + q[SG_X] ) ;
+  SGDfloat two_xy = q[SG_X] * ( q[SG_Y] + q[SG_Y] ) ;
+  SGDfloat two_xz = q[SG_X] * ( q[SG_Z] + q[SG_Z] ) ;
+
+  SGDfloat two_wx = q[SG_W] * ( q[SG_X] + q[SG_X] ) ;
+  SGDfloat two_wy = q[SG_W] * ( q[SG_Y] + q[SG_Y] ) ;
+  SGDfloat two_wz = q[SG_W] * ( q[SG_Z] + q[SG_Z] ) ;
+
+  SGDfloat two_yy = q[SG_Y] * ( q[SG_Y] + q[SG_Y] ) ;
+  SGDfloat two_yz = q[SG_Y] * ( q[SG_Z] + q[SG_Z] ) ;
+
+  SGDfloat two_zz = q[SG_Z] * ( q[SG_Z] + q[SG_Z] ) ;
+
+  sgdSetVec4 ( dst[0], SGD_ONE - ( two_yy + two_zz ), two_xy - two_wz, two_xz + two_wy, SGD_ZERO ) ;
+  sgdSetVec4 ( dst[1], two_xy + two_wz, SGD_ONE - ( two_xx + two_zz ), two_yz - two_wx, SGD_ZERO ) ;
+  sgdSetVec4 ( dst[2], two_xz - two_wy, two_yz + two_wx, SGD_ONE - ( two_xx + two_yy ), SGD_ZERO ) ;
+  sgdSetVec4 ( dst[3], SGD_ZERO, SGD_ZERO, SGD_ZERO, SGD_ONE ) ;
+}
+
+inline void _sgdMatrixToQuat ( SGDfloat *quat, const sgdMat4 m )
+{
+  SGDfloat tr = m[0][0] + m[1][1] + m[2][2] ;
+
+  if ( tr > SGD_ZERO )
+  {
+    SGDfloat s = sqrt ( tr + SGD_ONE ) ;
+
+    quat[SG_W] = s / SGD_TWO ;
+    s = SGD_HALF / s ;
+    quat[SG_X] = ( m[1][2] - m[2][1] ) * s ;
+    quat[SG_Y] = ( m[2][0] - m[0][2] ) * s ;
+    quat[SG_Z] = ( m[0][1] - m[1][0] ) * s ;
+  }
+  else
+  {
+    static const int nxt [ 3 ] = { 1, 2, 0 } ;
+    SGDfloat q [ 4 ] ;
+
+    int i = 0 ;
+    if ( m[1][1] > m[0][0] ) i = 1 ;
+    if ( m[2][2] > m[i][i] ) i = 2 ;
+    int j = nxt [ i ] ;
+    int k = nxt [ j ] ;
+
+    SGDfloat s = sqrt ( ( m[i][i] - ( m[j][j] + m[k][k] ) ) + SGD_ONE ) ;
+
+    q[i] = s * SGD_HALF ;
+    if ( s != SGD_ZERO ) s = SGD_HALF / s ;
+    q[3] = ( m[j][k] - m[k][j] ) * s ;
+    q[j] = ( m[i][j] + m[j][i] ) * s ;
+    q[k] = ( m[i][k] + m[k][i] ) * s ;
+
+    quat[SG_X] = q[0] ;
+    quat[SG_Y] = q[1] ;
+    quat[SG_Z] = q[2] ;
+    quat[SG_W] = q[3] ;
+  }
+
+  quat[SG_W] = -quat[SG_W] ;
+}
+
+inline void sgdMultQuatArray ( sgdQuat *dst, const sgdQuat *a, const sgdQuat *b, int count )
+{
+  for ( int i = 0 ; i < count ; i++ )
+  {
+    sgdQuat r ;
+    _sgdMultQuat ( r, a [ i ], b [ i ] ) ;
+    sgdCopyQuat ( dst [ i ], r ) ;
+  }
+}
+
+inline void sgdSlerpQuatArray ( sgdQuat *dst, const sgdQuat *from, const sgdQuat *to,
+                                const SGDfloat *t, int count, int mode = SG_SLERP_EXACT )
+{
+  for ( int i = 0 ; i < count ; i++ )
+    _sgdSlerpQuat ( dst [ i ], from [ i ], to [ i ], t [ i ], mode ) ;
+}
+
+inline void sgdQuatToMatrixArray ( sgdMat4 *dst, const sgdQuat *src, int count )
+{
+  for ( int i = 0 ; i < count ; i++ )
+    _sgdQuatToMatrix ( dst [ i ], src [ i ] ) ;
+}
+
+inline void sgdMatrixToQuatArray ( sgdQuat *dst, const sgdMat4 *src, int count )
+{
+  for ( int i = 0 ; i < count ; i++ )
+    _sgdMatrixToQuat ( dst [ i ], src [ i ] ) ;
+}
+
+inline void sgdInvertMat4Array ( sgdMat4 *dst, const sgdMat4 *src, int count )
+{
+  for ( int i = 0 ; i < count ; i++ )
+    sgdInvertMat4 ( dst [ i ], src [ i ] ) ;
+}
+
+#endif
@@ -0,0 +1,562 @@
+/*
+     PLIB - A Suite of Portable Game Libraries
+     Copyright (C) 1998,2002  Steve Baker
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Library General Public
+     License as published by the Free Software Foundation; either
+     version 2 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Library General Public License for more details.
+
+     You should have received a copy of the GNU Library General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+
+     For further information visit http://plib.sourceforge.net
+*/
+
+/*
+  Scope profiling.
+  ~~~~~~~~~~~~~~~~
+
+  Named, nested zones timed with a monotonic nanosecond clock:
+
+    void drawScene ()
+    {
+      UL_PROFILE_ZONE ( "drawScene" ) ;
+      ...
+    }
+
+  Each thread records into a ring buffer of its own, so recording takes
+  no locks - a zone costs two clock reads and a few stores.  Only the
+  latest UL_PROFILE_RING_SIZE zones of each thread are kept, so
+  profiling can be left on in production:
+
+    ulProfileSetEnabled ( TRUE ) ;
+    ...
+    if ( frame_took_too_long )
+      ulProfileWriteTrace ( "spike.json" ) ;
+
+  The file is in the Chrome trace event format, for chrome://tracing or
+  any viewer that reads it.  ulProfileClock is an ulClock whose update()
+  also records each frame as a zone, so long frames stand out.
+
+  Zone names are not copied - use string literals or strings that live
+  as long as the program.  Writing a trace while other threads are
+  still recording may lose or garble their most recent zones, but
+  never crashes.
+
+  A thread gets its ring buffer when it first records a zone, so
+  threads that only cross zones while profiling is off cost nothing.
+  The buffer is kept until the thread calls ulProfileThreadExit(),
+  which drops its zones - call it before a thread that has been
+  profiled ends, or they leak.
+
+  Defining UL_PROFILE_DISABLE compiles the UL_PROFILE_* macros away.
+*/
+
+#ifndef _UL_PROFILE_H_
+#define _UL_PROFILE_H_  1
+
+#include "ul.h"
+
+#if defined(UL_WIN32)
+#  define UL_PROFILE_TLS  __declspec(thread)
+#else
+#  include <time.h>
+#  include <sched.h>
+#  if defined(UL_MAC_OSX)
+#    include <mach/mach_time.h>
+#  endif
+#  define UL_PROFILE_TLS  __thread
+#endif
+
+
+#define UL_PROFILE_RING_SIZE   16384   /* Zones kept per thread (a power of two) */
+#define UL_PROFILE_MAX_DEPTH   64
+#define UL_PROFILE_NAME_MAX    32
+
+
+/* Nanoseconds since some fixed point - never goes backwards */
+
+inline unsigned long long ulGetNanoTime ( void )
+{
+#if defined(UL_WIN32)
+  static LARGE_INTEGER freq = { 0 } ;
+
+  if ( freq.QuadPart == 0 )
+    QueryPerformanceFrequency ( &freq ) ;
+
+  LARGE_INTEGER t ;
+  QueryPerformanceCounter ( &t ) ;
+
+  /* Split to avoid overflowing 64 bits */
+
+  unsigned long long f = (unsigned long long) freq.QuadPart ;
+  unsigned long long c = (unsigned long long) t.QuadPart ;
+
+  return ( c / f ) * 1000000000ull + ( ( c % f ) * 1000000000ull ) / f ;
+#elif defined(UL_MAC_OSX)
+  static mach_timebase_info_data_t tb = { 0, 0 } ;
+
+  if ( tb.denom == 0 )
+    mach_timebase_info ( &tb ) ;
+
+  return mach_absolute_time () * tb.numer / tb.denom ;
+#else
+  struct timespec ts ;
+  clock_gettime ( CLOCK_MONOTONIC, &ts ) ;
+  return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec ;
+#endif
+}
+
+
+struct ulProfileEvent
+{
+  const char        *name  ;
+  unsigned long long begin ;   /* ns */
+  unsigned long long end   ;   /* ns */
+} ;
+
+struct ulProfileThread
+{
+  ulProfileThread *next ;      /* All threads, newest first */
+  int   id ;
+  char  name [ UL_PROFILE_NAME_MAX ] ;
+
+  volatile unsigned int written ;     /* Zones recorded since the reset */
+  volatile int          generation ;  /* Last ulProfileReset() seen     */
+  ulProfileEvent *ring ;              /* UL_PROFILE_RING_SIZE, or NULL  */
+} ;
+
+/* The zones a thread is in, kept whether profiling is on or not */
+
+struct ulProfileScopes
+{
+  int   depth ;
+  const char        *open_name  [ UL_PROFILE_MAX_DEPTH ] ;
+  unsigned long long open_begin [ UL_PROFILE_MAX_DEPTH ] ;
+} ;
+
+
+inline ulProfileThread * volatile *_ulProfileThreads ( void )
+{
+  static ulProfileThread * volatile threads = NULL ;
+  return & threads ;
+}
+
+/* Taken to change the list of threads, and to walk it */
+
+inline volatile int *_ulProfileThreadsLock ( void )
+{
+  static volatile int lock = 0 ;
+  return & lock ;
+}
+
+inline ulProfileThread **_ulProfileSelf ( void )
+{
+  static UL_PROFILE_TLS ulProfileThread *self = NULL ;
+  return & self ;
+}
+
+inline ulProfileScopes *_ulProfileGetScopes ( void )
+{
+  static UL_PROFILE_TLS ulProfileScopes scopes ;
+  return & scopes ;
+}
+
+inline volatile int *_ulProfileEnabled ( void )
+{
+  static volatile int enabled = FALSE ;
+  return & enabled ;
+}
+
+/* Bumped by ulProfileReset() */
+
+inline volatile int *_ulProfileGeneration ( void )
+{
+  static volatile int generation = 0 ;
+  return & generation ;
+}
+
+inline int _ulProfileAtomicIncrement ( volatile int *v )
+{
+#if defined(UL_WIN32)
+  return InterlockedIncrement ( (volatile LONG *) v ) ;
+#else
+  return __sync_add_and_fetch ( v, 1 ) ;
+#endif
+}
+
+inline int _ulProfileCompareAndSwap ( volatile int *p, int oldval, int newval )
+{
+#if defined(UL_WIN32)
+  return InterlockedCompareExchange ( (volatile LONG *) p, newval, oldval ) == oldval ;
+#else
+  return __sync_bool_compare_and_swap ( p, oldval, newval ) ;
+#endif
+}
+
+inline void _ulProfileBarrier ( void )
+{
+#if defined(UL_WIN32)
+  MemoryBarrier () ;
+#else
+  __sync_synchronize () ;
+#endif
+}
+
+inline void _ulProfileLockThreads ( void )
+{
+  while ( ! _ulProfileCompareAndSwap ( _ulProfileThreadsLock (), 0, 1 ) )
+  {
+#if defined(UL_WIN32)
+    Sleep ( 0 ) ;
+#else
+    sched_yield () ;
+#endif
+  }
+}
+
+inline void _ulProfileUnlockThreads ( void )
+{
+  _ulProfileBarrier () ;
+  *_ulProfileThreadsLock () = 0 ;
+}
+
+/* This thread's record, made and registered on first use */
+
+inline ulProfileThread *_ulProfileGetThread ( void )
+{
+  static volatile int next_id = 0 ;
+  ulProfileThread **self = _ulProfileSelf () ;
+
+  if ( *self != NULL )
+    return *self ;
+
+  ulProfileThread *t = (ulProfileThread *) calloc ( 1, sizeof(ulProfileThread) ) ;
+
+  if ( t == NULL )
+    return NULL ;
+
+  t -> id = _ulProfileAtomicIncrement ( &next_id ) ;
+  sprintf ( t -> name, "Thread %d", t -> id ) ;
+
+  _ulProfileLockThreads () ;
+  t -> next = *_ulProfileThreads () ;
+  *_ulProfileThreads () = t ;
+  _ulProfileUnlockThreads () ;
+
+  *self = t ;
+  return t ;
+}
+
+/*
+  Free this thread's record and ring buffer, and drop its zones.  The
+  thread gets new ones if it records zones again.
+*/
+
+inline void ulProfileThreadExit ( void )
+{
+  ulProfileThread **self = _ulProfileSelf () ;
+  ulProfileThread  *t    = *self ;
+
+  if ( t == NULL )
+    return ;
+
+  _ulProfileLockThreads () ;
+
+  ulProfileThread * volatile *p = _ulProfileThreads () ;
+
+  while ( *p != t )
+    p = & (*p) -> next ;
+
+  *p = t -> next ;
+
+  _ulProfileUnlockThreads () ;
+
+  free ( t -> ring ) ;
+  free ( t ) ;
+  *self = NULL ;
+}
+
+
+inline void ulProfileSetEnabled ( int e ) { *_ulProfileEnabled () = e ; }
+inline int  ulProfileIsEnabled  ( void  ) { return *_ulProfileEnabled () ; }
+
+inline void ulProfileSetThreadName ( const char *name )
+{
+  ulProfileThread *t = _ulProfileGetThread () ;
+
+  if ( t != NULL )
+  {
+    strncpy ( t -> name, name, UL_PROFILE_NAME_MAX - 1 ) ;
+    t -> name [ UL_PROFILE_NAME_MAX - 1 ] = '\0' ;
+  }
+}
+
+/* Record a zone that has already happened */
+
+inline void ulProfileRecord ( const char *name, unsigned long long begin,
+                                                unsigned long long end )
+{
+  ulProfileThread *t = _ulProfileGetThread () ;
+
+  if ( t == NULL )
+    return ;
+
+  if ( t -> ring == NULL )
+  {
+    t -> ring = (ulProfileEvent *) calloc ( UL_PROFILE_RING_SIZE, sizeof(ulProfileEvent) ) ;
+
+    if ( t -> ring == NULL )
+      return ;
+  }
+
+  /* Only this thread writes its record, so it does its own resetting */
+
+  int g = *_ulProfileGeneration () ;
+
+  if ( t -> generation != g )
+  {
+    t -> written = 0 ;
+    _ulProfileBarrier () ;
+    t -> generation = g ;
+  }
+
+  ulProfileEvent *e = & t -> ring [ t -> written & ( UL_PROFILE_RING_SIZE - 1 ) ] ;
+
+  e -> name  = name  ;
+  e -> begin = begin ;
+  e -> end   = end   ;
+
+  /* Publish the event before the count that makes it visible */
+
+  _ulProfileBarrier () ;
+  t -> written = t -> written + 1 ;
+}
+
+inline void ulProfileBegin ( const char *name )
+{
+  ulProfileScopes *t = _ulProfileGetScopes () ;
+
+  /*
+    Zones are tracked even while profiling is off, so that switching it
+    on or off inside one keeps the nesting right.  A zone that began
+    while off is not recorded, nor is one nested too deeply.
+  */
+
+  if ( t -> depth < UL_PROFILE_MAX_DEPTH )
+  {
+    t -> open_name  [ t -> depth ] = name ;
+    t -> open_begin [ t -> depth ] = *_ulProfileEnabled () ? ulGetNanoTime () : 0 ;
+  }
+
+  t -> depth ++ ;
+}
+
+inline void ulProfileEnd ( void )
+{
+  ulProfileScopes *t = _ulProfileGetScopes () ;
+
+  if ( t -> depth == 0 )
+    return ;
+
+  t -> depth -- ;
+
+  if ( t -> depth < UL_PROFILE_MAX_DEPTH && t -> open_begin [ t -> depth ] != 0 )
+    ulProfileRecord ( t -> open_name [ t -> depth ], t -> open_begin [ t -> depth ], ulGetNanoTime () ) ;
+}
+
+/*
+  Forget everything recorded so far, on all threads.  Each thread drops
+  its zones when it next records one; until then they are left out of
+  the trace.
+*/
+
+inline void ulProfileReset ( void )
+{
+  _ulProfileAtomicIncrement ( _ulProfileGeneration () ) ;
+}
+
+/* Zones of 't' that count, as seen from another thread */
+
+inline unsigned int _ulProfileWritten ( ulProfileThread *t )
+{
+  if ( t -> ring == NULL || t -> generation != *_ulProfileGeneration () )
+    return 0 ;
+
+  _ulProfileBarrier () ;
+  return t -> written ;
+}
+
+
+inline void _ulProfileWriteString ( FILE *fd, const char *s )
+{
+  fputc ( '"', fd ) ;
+
+  for ( ; *s != '\0' ; s++ )
+  {
+    unsigned char c = (unsigned char) *s ;
+
+    if ( c == '"' || c == '\\' )
+      fprintf ( fd, "\\%c", c ) ;
+    else
+    if ( c < 0x20 )
+      fprintf ( fd, "\\u%04x", c ) ;
+    else
+      fputc ( c, fd ) ;
+  }
+
+  fputc ( '"', fd ) ;
+}
+
+/*
+  Write every thread's zones to 'fname' as Chrome trace events.
+  Returns FALSE if the file cannot be written.
+*/
+
+inline int ulProfileWriteTrace ( const char *fname )
+{
+  FILE *fd = fopen ( fname, "w" ) ;
+
+  if ( fd == NULL )
+  {
+    ulSetError ( UL_WARNING, "ulProfileWriteTrace: Can't open '%s' for writing", fname ) ;
+    return FALSE ;
+  }
+
+  /* Times are written in microseconds from the earliest zone */
+
+  unsigned long long origin = ~0ull ;
+  ulProfileThread *t ;
+
+  /* Threads cannot go away while their zones are read */
+
+  _ulProfileLockThreads () ;
+
+  for ( t = *_ulProfileThreads () ; t != NULL ; t = t -> next )
+  {
+    unsigned int w = _ulProfileWritten ( t ) ;
+    unsigned int n = ( w < UL_PROFILE_RING_SIZE ) ? w : UL_PROFILE_RING_SIZE ;
+
+    for ( unsigned int i = w - n ; i != w ; i++ )
+    {
+      unsigned long long b = t -> ring [ i & ( UL_PROFILE_RING_SIZE - 1 ) ] . begin ;
+
+      if ( b < origin )
+        origin = b ;
+    }
+  }
+
+  fprintf ( fd, "{\"traceEvents\":[\n" ) ;
+
+  int first = TRUE ;
+
+  for ( t = *_ulProfileThreads () ; t != NULL ; t = t -> next )
+  {
+    fprintf ( fd, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+              first ? "" : ",\n", t -> id ) ;
+    _ulProfileWriteString ( fd, t -> name ) ;
+    fprintf ( fd, "}}" ) ;
+    first = FALSE ;
+
+    /*
+      The oldest entries may be overwritten while we read them, so
+      leave a margin at the old end of a full ring.
+    */
+
+    unsigned int w = _ulProfileWritten ( t ) ;
+    unsigned int n = ( w < UL_PROFILE_RING_SIZE ) ? w : UL_PROFILE_RING_SIZE - UL_PROFILE_RING_SIZE / 16 ;
+
+    _ulProfileBarrier () ;
+
+    for ( unsigned int i = w - n ; i != w ; i++ )
+    {
+      ulProfileEvent e = t -> ring [ i & ( UL_PROFILE_RING_SIZE - 1 ) ] ;
+
+      if ( e.name == NULL || e.end < e.begin || e.begin < origin )
+        continue ;
+
+      fprintf ( fd, ",\n{\"name\":" ) ;
+      _ulProfileWriteString ( fd, e.name ) ;
+      fprintf ( fd, ",\"cat\":\"ul\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                t -> id, (double) ( e.begin - origin ) / 1000.0,
+                         (double) ( e.end - e.begin  ) / 1000.0 ) ;
+    }
+  }
+
+  _ulProfileUnlockThreads () ;
+
+  fprintf ( fd, "\n],\"displayTimeUnit\":\"ms\"}\n" ) ;
+
+  int ok = ! ferror ( fd ) ;
+
+  if ( fclose ( fd ) != 0 )
+    ok = FALSE ;
+
+  if ( ! ok )
+    ulSetError ( UL_WARNING, "ulProfileWriteTrace: Error writing '%s'", fname ) ;
+
+  return ok ;
+}
+
+
+/* Times the scope it is declared in */
+
+class ulProfileZone
+{
+public:
+  ulProfileZone ( const char *name ) { ulProfileBegin ( name ) ; }
+  ~ulProfileZone () { ulProfileEnd () ; }
+} ;
+
+
+/* An ulClock that records every frame as a zone */
+
+class ulProfileClock : public ulClock
+{
+  const char        *name ;
+  unsigned long long last ;
+
+public:
+
+  ulProfileClock ( const char *frame_name = "frame" )
+  {
+    name = frame_name ;
+    last = ulGetNanoTime () ;
+  }
+
+  void update ()
+  {
+    unsigned long long t = ulGetNanoTime () ;
+
+    if ( *_ulProfileEnabled () )
+      ulProfileRecord ( name, last, t ) ;
+
+    last = t ;
+    ulClock::update () ;
+  }
+
+  unsigned long long getNanoTime () const { return ulGetNanoTime () ; }
+} ;
+
+
+#ifdef UL_PROFILE_DISABLE
+#  define UL_PROFILE_ZONE(name)
+#  define UL_PROFILE_BEGIN(name)
+#  define UL_PROFILE_END()
+#else
+#  define _UL_PROFILE_JOIN2(a,b)  a##b
+#  define _UL_PROFILE_JOIN(a,b)   _UL_PROFILE_JOIN2(a,b)
+#  define UL_PROFILE_ZONE(name)   ulProfileZone _UL_PROFILE_JOIN(_ul_profile_zone_,__LINE__) ( name )
+#  define UL_PROFILE_BEGIN(name)  ulProfileBegin ( name )
+#  define UL_PROFILE_END()        ulProfileEnd ()
+#endif
+
+#endif
+
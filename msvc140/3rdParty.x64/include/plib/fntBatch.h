@@ -0,0 +1,622 @@
+/*
+     PLIB - A Suite of Portable Game Libraries
+     Copyright (C) 1998,2002  Steve Baker
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Library General Public
+     License as published by the Free Software Foundation; either
+     version 2 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Library General Public License for more details.
+
+     You should have received a copy of the GNU Library General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+
+     For further information visit http://plib.sourceforge.net
+*/
+
+/*
+  Batched text for texture-mapped fonts.
+  ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+  fntTexFont::puts() sends one immediate-mode quad per character.  The
+  classes here split that into two stages:
+
+    Layout - fntGlyphTable::layout() turns a string into textured quads
+             in a caller-supplied vertex array.  This makes no GL calls
+             at all, so it can be used (and tested) without a context.
+
+    Draw   - fntDrawGlyphs() submits any number of those quads with a
+             single glDrawArrays() call.
+
+  The glyph metrics are copied out of the font into one packed
+  fntGlyph per character, so that laying out a character touches one
+  cache line rather than eight separate arrays.  The quads produced
+  are exactly the ones that fntTexFont::puts() would have drawn, and
+  the cursor is left in the same place.
+
+  Typical use, once per frame:
+
+    fntGlyphVertex  verts [ 1024 * FNT_VERTS_PER_GLYPH ] ;
+    fntTextBatch    batch ( &table, verts, 1024 ) ;
+
+    batch.puts ( pos1, 10.0f, 0.0f, "ALT" ) ;
+    batch.puts ( pos2, 10.0f, 0.0f, "SPD" ) ;
+    ...
+    batch.draw ( font ) ;
+
+  Strings that rarely change can skip the layout altogether by giving
+  the batch a fntLayoutCache (see below).
+
+  Everything is inline so that it can be used with an existing fnt
+  library build.
+*/
+
+#ifndef _FNTBATCH_H_
+#define _FNTBATCH_H_  1
+
+#include <string.h>
+#include "fnt.h"
+
+
+/*
+  Each glyph becomes four vertices, in GL_QUADS order:
+  bottom-left, bottom-right, top-right, top-left.  The vertex layout
+  is the one glInterleavedArrays() calls GL_T2F_V3F.
+*/
+
+#define FNT_VERTS_PER_GLYPH  4
+
+struct fntGlyphVertex
+{
+  float s, t ;       /* Texture coordinates */
+  float x, y, z ;    /* Position            */
+} ;
+
+
+/* Everything fntTexFont knows about one character */
+
+struct fntGlyph
+{
+  float advance ;    /* Nominal baseline width */
+
+  float t_left, t_right, t_bot, t_top ;
+  float v_left, v_right, v_bot, v_top ;
+
+  int   exists ;
+} ;
+
+
+class fntGlyphTable
+{
+  fntGlyph glyph [ FNTMAX_CHAR ] ;
+
+  int   fixed_pitch ;
+  float width ;
+  float gap ;
+
+  /*
+    The same character substitution as fntTexFont - returns NULL for
+    characters that are drawn as nothing, and sets *space for a missing
+    space (which only moves the cursor).
+  */
+
+  const fntGlyph *lookup ( char c, int *space ) const
+  {
+    unsigned int cc = (unsigned char) c ;
+
+    *space = FNT_FALSE ;
+
+    if ( ! glyph [ cc ] . exists )
+    {
+      if ( cc >= 'A' && cc <= 'Z' )
+        cc = cc - 'A' + 'a' ;
+      else
+      if ( cc >= 'a' && cc <= 'z' )
+        cc = cc - 'a' + 'A' ;
+
+      if ( cc == ' ' )
+      {
+        *space = FNT_TRUE ;
+        return NULL ;
+      }
+    }
+
+    return glyph [ cc ] . exists ? & glyph [ cc ] : NULL ;
+  }
+
+public:
+
+  fntGlyphTable () { clear () ; }
+  fntGlyphTable ( fntTexFont *font ) { load ( font ) ; }
+
+  void clear ()
+  {
+    memset ( glyph, 0, sizeof(glyph) ) ;
+    fixed_pitch = FNT_TRUE ;
+    width       = 1.0f ;
+    gap         = 0.1f ;
+  }
+
+  /*
+    Take a copy of the font's metrics.  Call this again if the font
+    is changed with setGlyph(), setWidth() etc.
+  */
+
+  void load ( fntTexFont *font )
+  {
+    clear () ;
+
+    fixed_pitch = font -> isFixedPitch () ;
+    width       = font -> getWidth () ;
+    gap         = font -> getGap   () ;
+
+    for ( int i = 0 ; i < FNTMAX_CHAR ; i++ )
+    {
+      fntGlyph *g = & glyph [ i ] ;
+
+      g -> exists = font -> getGlyph ( (char) i, & g -> advance,
+                                       & g -> t_left, & g -> t_right,
+                                       & g -> t_bot , & g -> t_top  ,
+                                       & g -> v_left, & g -> v_right,
+                                       & g -> v_bot , & g -> v_top  ) ;
+    }
+  }
+
+  void setGlyph ( char c, float wid,
+                  float tex_left, float tex_right,
+                  float tex_bot , float tex_top  ,
+                  float vtx_left, float vtx_right,
+                  float vtx_bot , float vtx_top  )
+  {
+    fntGlyph *g = & glyph [ (unsigned char) c ] ;
+
+    g -> advance = wid ;
+    g -> t_left  = tex_left ; g -> t_right = tex_right ;
+    g -> t_bot   = tex_bot  ; g -> t_top   = tex_top   ;
+    g -> v_left  = vtx_left ; g -> v_right = vtx_right ;
+    g -> v_bot   = vtx_bot  ; g -> v_top   = vtx_top   ;
+    g -> exists  = FNT_TRUE ;
+  }
+
+  const fntGlyph *getGlyph ( char c ) const
+  {
+    const fntGlyph *g = & glyph [ (unsigned char) c ] ;
+    return g -> exists ? g : NULL ;
+  }
+
+  int hasGlyph ( char c ) const { return glyph [ (unsigned char) c ] . exists ; }
+
+  void setFixedPitch ( int fix ) { fixed_pitch = fix ;  }
+  int   isFixedPitch () const    { return fixed_pitch ; }
+
+  void  setWidth     ( float w ) { width = w ; }
+  void  setGap       ( float g ) { gap   = g ; }
+
+  float getWidth     () const { return width ; }
+  float getGap       () const { return gap   ; }
+
+  /*
+    The number of quads that layout() will produce for 's' - use this
+    to size the vertex array.
+  */
+
+  int countGlyphs ( const char *s ) const
+  {
+    int n = 0 ;
+    int space ;
+
+    for ( ; *s != '\0' ; s++ )
+      if ( *s != '\n' && lookup ( *s, &space ) != NULL )
+        n++ ;
+
+    return n ;
+  }
+
+  /*
+    Lay out 's' starting at 'curpos', exactly as fntTexFont::puts()
+    would draw it, writing FNT_VERTS_PER_GLYPH vertices per quad into
+    'verts'.  At most 'max_glyphs' quads are written, but the cursor is
+    always advanced over the whole string.  Returns the number of quads
+    the string needs, so a result greater than 'max_glyphs' means that
+    the array was too small.
+  */
+
+  int layout ( sgVec3 curpos, float pointsize, float italic, const char *s,
+               fntGlyphVertex *verts, int max_glyphs ) const
+  {
+    float origx = curpos [ 0 ] ;
+    int   n     = 0 ;
+
+    for ( ; *s != '\0' ; s++ )
+    {
+      if ( *s == '\n' )
+      {
+        curpos [ 0 ]  = origx ;
+        curpos [ 1 ] -= pointsize ;
+        continue ;
+      }
+
+      int space ;
+      const fntGlyph *g = lookup ( *s, &space ) ;
+
+      if ( g == NULL )
+      {
+        if ( space )
+          curpos [ 0 ] += pointsize * 0.5f ;
+
+        continue ;
+      }
+
+      if ( n < max_glyphs )
+      {
+        /* Same arithmetic as fntTexFont::low_putch() */
+
+        float xl  = curpos[0] +   g -> v_left            * pointsize ;
+        float xr  = curpos[0] +   g -> v_right           * pointsize ;
+        float xtl = curpos[0] + ( g -> v_left  + italic ) * pointsize ;
+        float xtr = curpos[0] + ( g -> v_right + italic ) * pointsize ;
+        float yb  = curpos[1] +   g -> v_bot             * pointsize ;
+        float yt  = curpos[1] +   g -> v_top             * pointsize ;
+        float z   = curpos[2] ;
+
+        fntGlyphVertex *v = & verts [ n * FNT_VERTS_PER_GLYPH ] ;
+
+        v[0].s = g -> t_left  ; v[0].t = g -> t_bot ; v[0].x = xl  ; v[0].y = yb ; v[0].z = z ;
+        v[1].s = g -> t_right ; v[1].t = g -> t_bot ; v[1].x = xr  ; v[1].y = yb ; v[1].z = z ;
+        v[2].s = g -> t_right ; v[2].t = g -> t_top ; v[2].x = xtr ; v[2].y = yt ; v[2].z = z ;
+        v[3].s = g -> t_left  ; v[3].t = g -> t_top ; v[3].x = xtl ; v[3].y = yt ; v[3].z = z ;
+      }
+
+      n++ ;
+      curpos [ 0 ] += ( gap + ( fixed_pitch ? width : g -> advance ) ) * pointsize ;
+    }
+
+    return n ;
+  }
+} ;
+
+
+/*
+  Submit 'nglyphs' quads made by fntGlyphTable::layout() in one call.
+  The font is only used to bind its texture.
+*/
+
+inline void fntDrawGlyphs ( fntFont *font, const fntGlyphVertex *verts, int nglyphs )
+{
+  if ( nglyphs <= 0 )
+    return ;
+
+  font -> begin () ;
+
+  glPushClientAttrib  ( GL_CLIENT_VERTEX_ARRAY_BIT ) ;
+  glInterleavedArrays ( GL_T2F_V3F, sizeof(fntGlyphVertex), verts ) ;
+  glDrawArrays        ( GL_QUADS, 0, nglyphs * FNT_VERTS_PER_GLYPH ) ;
+  glPopClientAttrib   () ;
+
+  font -> end () ;
+}
+
+
+/*
+  A least-recently-used cache of laid-out strings.
+  ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+  Most HUD and panel labels change rarely, so laying them out again
+  every frame is wasted work.  fntLayoutCache keeps the quads for the
+  most recently used (glyph table, string, pointsize, slant)
+  combinations, laid out at the origin, and on a hit just copies them
+  out translated to the cursor.  The translated vertices may differ
+  from a fresh layout in the last bit, since the additions are done in
+  a different order.
+
+  The cache holds at most 'max_entries' strings.  Call flush() after
+  reloading a glyph table, since entries are keyed on its address.
+  getHits() and getMisses() report how well it is doing.
+*/
+
+class fntLayoutCache
+{
+  struct Entry
+  {
+    const fntGlyphTable *table ;
+    char  *text ;
+    float  pointsize ;
+    float  italic ;
+    unsigned int hash ;
+
+    fntGlyphVertex *verts ;   /* Laid out with the cursor at the origin */
+    int    num_glyphs ;
+    sgVec3 advance ;          /* Where the cursor ended up */
+
+    Entry *hash_next ;        /* Chain within a hash bucket   */
+    Entry *prev, *next ;      /* LRU list - most recent first */
+  } ;
+
+  Entry  *entries ;
+  Entry **buckets ;
+  Entry  *head, *tail ;
+  Entry  *free_list ;
+
+  int max_entries ;
+  int num_buckets ;
+  int num_entries ;
+
+  unsigned int hits ;
+  unsigned int misses ;
+
+  static unsigned int hashKey ( const fntGlyphTable *table, const char *s,
+                                float pointsize, float italic )
+  {
+    /* FNV-1a over the string, then the other parts of the key */
+
+    unsigned int h = 2166136261u ;
+
+    for ( ; *s != '\0' ; s++ )
+      h = ( h ^ (unsigned char) *s ) * 16777619u ;
+
+    unsigned int bits [ 2 ] ;
+    memcpy ( & bits [ 0 ], & pointsize, sizeof(float) ) ;
+    memcpy ( & bits [ 1 ], & italic   , sizeof(float) ) ;
+
+    h = ( h ^ bits [ 0 ] ) * 16777619u ;
+    h = ( h ^ bits [ 1 ] ) * 16777619u ;
+    h = ( h ^ (unsigned int) ( ( (size_t) table ) >> 4 ) ) * 16777619u ;
+
+    return h ;
+  }
+
+  void unlinkLRU ( Entry *e )
+  {
+    if ( e -> prev != NULL ) e -> prev -> next = e -> next ; else head = e -> next ;
+    if ( e -> next != NULL ) e -> next -> prev = e -> prev ; else tail = e -> prev ;
+  }
+
+  void pushLRU ( Entry *e )
+  {
+    e -> prev = NULL ;
+    e -> next = head ;
+
+    if ( head != NULL ) head -> prev = e ; else tail = e ;
+    head = e ;
+  }
+
+  void unlinkHash ( Entry *e )
+  {
+    Entry **p = & buckets [ e -> hash % num_buckets ] ;
+
+    while ( *p != e )
+      p = & (*p) -> hash_next ;
+
+    *p = e -> hash_next ;
+  }
+
+  void release ( Entry *e )
+  {
+    delete [] e -> text  ;
+    delete [] e -> verts ;
+    e -> text  = NULL ;
+    e -> verts = NULL ;
+    e -> next  = free_list ;
+    free_list  = e ;
+    num_entries-- ;
+  }
+
+  static void copyOut ( const Entry *e, sgVec3 curpos,
+                        fntGlyphVertex *verts, int max_glyphs )
+  {
+    int n = ( e -> num_glyphs < max_glyphs ) ? e -> num_glyphs : max_glyphs ;
+
+    const fntGlyphVertex *src = e -> verts ;
+
+    for ( int i = 0 ; i < n * FNT_VERTS_PER_GLYPH ; i++ )
+    {
+      verts [ i ] . s = src [ i ] . s ;
+      verts [ i ] . t = src [ i ] . t ;
+      verts [ i ] . x = src [ i ] . x + curpos [ 0 ] ;
+      verts [ i ] . y = src [ i ] . y + curpos [ 1 ] ;
+      verts [ i ] . z = src [ i ] . z + curpos [ 2 ] ;
+    }
+
+    sgAddVec3 ( curpos, e -> advance ) ;
+  }
+
+public:
+
+  fntLayoutCache ( int max = 256 )
+  {
+    max_entries = ( max < 1 ) ? 1 : max ;
+    num_buckets = max_entries * 2 + 1 ;
+
+    entries = new Entry  [ max_entries ] ;
+    buckets = new Entry* [ num_buckets ] ;
+
+    memset ( entries, 0, max_entries * sizeof(Entry ) ) ;
+    memset ( buckets, 0, num_buckets * sizeof(Entry*) ) ;
+
+    free_list = NULL ;
+
+    for ( int i = max_entries - 1 ; i >= 0 ; i-- )
+    {
+      entries [ i ] . next = free_list ;
+      free_list = & entries [ i ] ;
+    }
+
+    head = tail = NULL ;
+    num_entries = 0 ;
+    hits = misses = 0 ;
+  }
+
+  ~fntLayoutCache ()
+  {
+    flush () ;
+    delete [] entries ;
+    delete [] buckets ;
+  }
+
+  /* Throw away every cached layout (the counters are kept) */
+
+  void flush ()
+  {
+    while ( head != NULL )
+    {
+      Entry *e = head ;
+      unlinkLRU  ( e ) ;
+      unlinkHash ( e ) ;
+      release    ( e ) ;
+    }
+  }
+
+  /*
+    Same contract as fntGlyphTable::layout() - writes at most
+    'max_glyphs' quads, always advances 'curpos', and returns the
+    number of quads that the string needs.
+  */
+
+  int layout ( const fntGlyphTable *table, sgVec3 curpos, float pointsize,
+               float italic, const char *s, fntGlyphVertex *verts, int max_glyphs )
+  {
+    unsigned int h = hashKey ( table, s, pointsize, italic ) ;
+
+    for ( Entry *e = buckets [ h % num_buckets ] ; e != NULL ; e = e -> hash_next )
+    {
+      if ( e -> hash      == h         &&
+           e -> table     == table     &&
+           e -> pointsize == pointsize &&
+           e -> italic    == italic    &&
+           strcmp ( e -> text, s ) == 0 )
+      {
+        hits++ ;
+
+        if ( e != head )
+        {
+          unlinkLRU ( e ) ;
+          pushLRU   ( e ) ;
+        }
+
+        copyOut ( e, curpos, verts, max_glyphs ) ;
+        return e -> num_glyphs ;
+      }
+    }
+
+    misses++ ;
+
+    /* Recycle the least recently used entry if the cache is full */
+
+    if ( free_list == NULL )
+    {
+      Entry *old = tail ;
+      unlinkLRU  ( old ) ;
+      unlinkHash ( old ) ;
+      release    ( old ) ;
+    }
+
+    Entry *e  = free_list ;
+    free_list = e -> next ;
+    num_entries++ ;
+
+    int n = table -> countGlyphs ( s ) ;
+
+    e -> table      = table ;
+    e -> text       = strcpy ( new char [ strlen ( s ) + 1 ], s ) ;
+    e -> pointsize  = pointsize ;
+    e -> italic     = italic ;
+    e -> hash       = h ;
+    e -> num_glyphs = n ;
+    e -> verts      = new fntGlyphVertex [ ( n > 0 ? n : 1 ) * FNT_VERTS_PER_GLYPH ] ;
+
+    sgZeroVec3 ( e -> advance ) ;
+    table -> layout ( e -> advance, pointsize, italic, s, e -> verts, n ) ;
+
+    e -> hash_next = buckets [ h % num_buckets ] ;
+    buckets [ h % num_buckets ] = e ;
+    pushLRU ( e ) ;
+
+    copyOut ( e, curpos, verts, max_glyphs ) ;
+    return n ;
+  }
+
+  int getMaxEntries () const { return max_entries ; }
+  int getNumEntries () const { return num_entries ; }
+
+  unsigned int getHits   () const { return hits   ; }
+  unsigned int getMisses () const { return misses ; }
+
+  void resetStats () { hits = misses = 0 ; }
+} ;
+
+
+/*
+  Collects the text for one font over a frame into a caller-supplied
+  vertex array (room for 'max_glyphs' quads), then draws it all at once.
+  Text that does not fit is dropped - check isFull() or the value
+  returned by puts().  If a layout cache is set, strings are looked up
+  in it rather than laid out afresh.
+*/
+
+class fntTextBatch
+{
+  const fntGlyphTable *table ;
+  fntLayoutCache *cache ;
+
+  fntGlyphVertex *verts ;
+  int max_glyphs ;
+  int num_glyphs ;
+  int overflow   ;
+
+public:
+
+  fntTextBatch ( const fntGlyphTable *t, fntGlyphVertex *v, int max )
+  {
+    table      = t ;
+    cache      = NULL ;
+    verts      = v ;
+    max_glyphs = max ;
+    reset () ;
+  }
+
+  void reset () { num_glyphs = 0 ; overflow = FNT_FALSE ; }
+
+  void            setCache ( fntLayoutCache *c ) { cache = c ; }
+  fntLayoutCache *getCache () const { return cache ; }
+
+  /* Returns FNT_FALSE if the string did not fit (nothing of it is kept) */
+
+  int puts ( sgVec3 curpos, float pointsize, float italic, const char *s )
+  {
+    int room = max_glyphs - num_glyphs ;
+    fntGlyphVertex *dst = verts + num_glyphs * FNT_VERTS_PER_GLYPH ;
+
+    int n = ( cache != NULL ) ?
+              cache -> layout ( table, curpos, pointsize, italic, s, dst, room ) :
+              table -> layout (        curpos, pointsize, italic, s, dst, room ) ;
+
+    if ( n > room )
+    {
+      overflow = FNT_TRUE ;
+      return FNT_FALSE ;
+    }
+
+    num_glyphs += n ;
+    return FNT_TRUE ;
+  }
+
+  int puts ( float x, float y, float pointsize, float italic, const char *s )
+  {
+    sgVec3 pos = { x, y, 0.0f } ;
+    return puts ( pos, pointsize, italic, s ) ;
+  }
+
+  int   isFull        () const { return overflow   ; }
+  int   getNumGlyphs  () const { return num_glyphs ; }
+  const fntGlyphVertex *getVertices () const { return verts ; }
+
+  void draw ( fntFont *font ) const { fntDrawGlyphs ( font, verts, num_glyphs ) ; }
+} ;
+
+#endif
+
@@ -0,0 +1,647 @@
+/*
+     PLIB - A Suite of Portable Game Libraries
+     Copyright (C) 1998,2002  Steve Baker
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Library General Public
+     License as published by the Free Software Foundation; either
+     version 2 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Library General Public License for more details.
+
+     You should have received a copy of the GNU Library General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+
+     For further information visit http://plib.sourceforge.net
+*/
+
+/*
+  Allocation-free lists.
+  ~~~~~~~~~~~~~~~~~~~~~~
+
+  ulLinkedList allocates a node for every element added, and ulList
+  grows its pointer array as it goes.  Lists that are built and thrown
+  away every frame spend most of their time in the heap.
+
+  ulArena       - a bump allocator over caller-provided (or self-grown)
+                  memory.  Everything it handed out is released at once
+                  by reset().
+
+  ulPooledLinkedList
+                - a doubly linked list with the same interface as
+                  ulLinkedList.  Removed nodes go on a free list kept by
+                  the list and are re-used; new ones are taken from an
+                  ulArena if one is given, or else allocated in chunks.
+                  Adding a node returns its handle, which unlinkNode()
+                  removes in constant time.
+
+  ulPooledList  - the ulList interface over an array that grows
+                  geometrically (optionally in an ulArena), keeps its
+                  storage when emptied and can be reserve()d up front.
+
+  None of these are thread safe.  An arena must outlive the lists that
+  use it, and must not be reset() while they still hold nodes.
+*/
+
+#ifndef _UL_POOL_H_
+#define _UL_POOL_H_  1
+
+#include <string.h>
+#include "ul.h"
+
+
+#define UL_ARENA_ALIGN        16
+#define UL_ARENA_DEFAULT_SIZE 65536
+#define UL_POOL_CHUNK         64     /* Nodes allocated at a time */
+
+
+class ulArena
+{
+  struct Block
+  {
+    Block *next ;
+    size_t size ;
+  } ;
+
+  Block *blocks ;      /* Blocks we allocated ourselves           */
+  char  *base ;        /* The block being carved up               */
+  size_t size ;
+  size_t used ;
+  size_t block_size ;
+
+  char  *user_base ;   /* Memory provided by the caller, if any   */
+  size_t user_size ;
+
+  static size_t align ( size_t n )
+  {
+    return ( n + UL_ARENA_ALIGN - 1 ) & ~(size_t)( UL_ARENA_ALIGN - 1 ) ;
+  }
+
+public:
+
+  /* Grows itself in blocks of 'bsize' bytes */
+
+  ulArena ( size_t bsize = UL_ARENA_DEFAULT_SIZE )
+  {
+    blocks     = NULL ;
+    base       = NULL ;
+    size       = used = 0 ;
+    block_size = bsize ;
+    user_base  = NULL ;
+    user_size  = 0 ;
+  }
+
+  /* Carves up 'mem' first, then grows as above if that runs out */
+
+  ulArena ( void *mem, size_t msize, size_t bsize = UL_ARENA_DEFAULT_SIZE )
+  {
+    blocks     = NULL ;
+    block_size = bsize ;
+
+    /* Align the start of the caller's memory */
+
+    size_t skip = align ( (size_t) mem ) - (size_t) mem ;
+
+    user_base = ( msize > skip ) ? (char *) mem + skip : NULL ;
+    user_size = ( msize > skip ) ? msize - skip : 0 ;
+    base      = user_base ;
+    size      = user_size ;
+    used      = 0 ;
+  }
+
+  ~ulArena () { release () ; }
+
+  void *allocate ( size_t n )
+  {
+    n = align ( n ) ;
+
+    if ( base == NULL || used + n > size )
+    {
+      size_t bsize = align ( sizeof(Block) ) + ( ( n > block_size ) ? n : block_size ) ;
+      Block *b = (Block *) new char [ bsize ] ;
+
+      b -> next = blocks ;
+      b -> size = bsize ;
+      blocks    = b ;
+      base      = (char *) b + align ( sizeof(Block) ) ;
+      size      = bsize - align ( sizeof(Block) ) ;
+      used      = 0 ;
+    }
+
+    void *p = base + used ;
+    used += n ;
+    return p ;
+  }
+
+  /* Forget everything handed out, keeping the largest block for re-use */
+
+  void reset ( void )
+  {
+    Block *keep = NULL ;
+
+    while ( blocks != NULL )
+    {
+      Block *b = blocks ;
+      blocks = b -> next ;
+
+      if ( keep == NULL || b -> size > keep -> size )
+      {
+        if ( keep != NULL ) delete [] (char *) keep ;
+        keep = b ;
+      }
+      else
+        delete [] (char *) b ;
+    }
+
+    if ( user_base != NULL && ( keep == NULL || user_size >= keep -> size ) )
+    {
+      if ( keep != NULL ) delete [] (char *) keep ;
+      base = user_base ;
+      size = user_size ;
+    }
+    else if ( keep != NULL )
+    {
+      keep -> next = NULL ;
+      blocks = keep ;
+      base   = (char *) keep + align ( sizeof(Block) ) ;
+      size   = keep -> size - align ( sizeof(Block) ) ;
+    }
+
+    used = 0 ;
+  }
+
+  /* Give all our own memory back to the heap */
+
+  void release ( void )
+  {
+    while ( blocks != NULL )
+    {
+      Block *b = blocks ;
+      blocks = b -> next ;
+      delete [] (char *) b ;
+    }
+
+    base = user_base ;
+    size = user_size ;
+    used = 0 ;
+  }
+
+  size_t getBytesUsed ( void ) const { return used ; }
+} ;
+
+
+class ulPoolNode
+{
+  friend class ulPooledLinkedList ;
+
+  ulPoolNode *next ;
+  ulPoolNode *prev ;
+  void       *data ;
+
+public:
+
+  ulPoolNode *getNext ( void ) const { return next ; }
+  ulPoolNode *getPrev ( void ) const { return prev ; }
+  void       *getData ( void ) const { return data ; }
+  void        setData ( void *d ) { data = d ; }
+} ;
+
+
+class ulPooledLinkedList
+{
+protected:
+
+  ulPoolNode *head ;
+  ulPoolNode *tail ;
+  ulPoolNode *free_list ;
+  void       *chunks ;      /* Chunks we allocated, chained through their first word */
+  ulArena    *arena ;
+
+  int  nnodes ;
+  bool sorted ;
+
+  bool isValidPosition ( int pos ) const
+  {
+    if ( ( pos < 0 ) || ( pos >= nnodes ) )
+    {
+      ulSetError ( UL_WARNING, "ulPooledLinkedList: Invalid 'pos' %u", pos ) ;
+      return false ;
+    }
+    return true ;
+  }
+
+  ulPoolNode *newNode ( void *data )
+  {
+    if ( free_list == NULL )
+    {
+      ulPoolNode *block ;
+
+      if ( arena != NULL )
+        block = (ulPoolNode *) arena -> allocate ( UL_POOL_CHUNK * sizeof(ulPoolNode) ) ;
+      else
+      {
+        /* The first node of each chunk links the chunks together */
+
+        block = new ulPoolNode [ UL_POOL_CHUNK + 1 ] ;
+        block -> next = (ulPoolNode *) chunks ;
+        chunks = block ;
+        block ++ ;
+      }
+
+      for ( int i = 0 ; i < UL_POOL_CHUNK ; i++ )
+      {
+        block [ i ] . next = free_list ;
+        free_list = & block [ i ] ;
+      }
+    }
+
+    ulPoolNode *node = free_list ;
+    free_list = node -> next ;
+
+    node -> next = node -> prev = NULL ;
+    node -> data = data ;
+    return node ;
+  }
+
+  void freeNode ( ulPoolNode *node )
+  {
+    node -> next = free_list ;
+    node -> prev = NULL ;
+    node -> data = NULL ;
+    free_list = node ;
+  }
+
+  void linkBefore ( ulPoolNode *where, ulPoolNode *node )
+  {
+    if ( where == NULL )     /* At the end */
+    {
+      node -> prev = tail ;
+      node -> next = NULL ;
+
+      if ( tail != NULL ) tail -> next = node ; else head = node ;
+      tail = node ;
+    }
+    else
+    {
+      node -> prev = where -> prev ;
+      node -> next = where ;
+
+      if ( where -> prev != NULL ) where -> prev -> next = node ; else head = node ;
+      where -> prev = node ;
+    }
+
+    nnodes ++ ;
+  }
+
+  ulPoolNode *nodeAt ( int pos ) const
+  {
+    /* Walk from whichever end is nearer */
+
+    ulPoolNode *node ;
+
+    if ( pos < nnodes / 2 )
+      for ( node = head ; pos-- > 0 ; node = node -> next ) ;
+    else
+      for ( node = tail, pos = nnodes - 1 - pos ; pos-- > 0 ; node = node -> prev ) ;
+
+    return node ;
+  }
+
+public:
+
+  /* Nodes come from 'a' if given, else from chunks of our own */
+
+  ulPooledLinkedList ( ulArena *a = NULL )
+  {
+    head = tail = free_list = NULL ;
+    chunks = NULL ;
+    arena  = a ;
+    nnodes = 0 ;
+    sorted = true ;
+  }
+
+  ~ulPooledLinkedList ()
+  {
+    empty () ;
+    releaseNodes () ;
+  }
+
+  int  getNumNodes ( void ) const { return nnodes ; }
+  bool isSorted    ( void ) const { return sorted ; }
+
+  ulPoolNode *getHead ( void ) const { return head ; }
+  ulPoolNode *getTail ( void ) const { return tail ; }
+
+  int  getNodePosition ( void *data ) const
+  {
+    int pos = 0 ;
+
+    for ( ulPoolNode *node = head ; node != NULL ; node = node -> next, pos++ )
+      if ( node -> data == data )
+        return pos ;
+
+    return -1 ;
+  }
+
+  ulPoolNode *insertNode ( void *data, int pos )
+  {
+    if ( pos == nnodes )
+      return appendNode ( data ) ;
+
+    if ( ! isValidPosition ( pos ) )
+      return NULL ;
+
+    ulPoolNode *node = newNode ( data ) ;
+    linkBefore ( nodeAt ( pos ), node ) ;
+    sorted = false ;
+    return node ;
+  }
+
+  ulPoolNode *prependNode ( void *data ) { return insertNode ( data, 0 ) ; }
+
+  ulPoolNode *appendNode ( void *data )
+  {
+    ulPoolNode *node = newNode ( data ) ;
+    linkBefore ( NULL, node ) ;
+    sorted = false ;
+    return node ;
+  }
+
+  /* Before and after an existing node, in constant time */
+
+  ulPoolNode *insertBefore ( ulPoolNode *where, void *data )
+  {
+    ulPoolNode *node = newNode ( data ) ;
+    linkBefore ( where, node ) ;
+    sorted = false ;
+    return node ;
+  }
+
+  ulPoolNode *insertAfter ( ulPoolNode *where, void *data )
+  {
+    ulPoolNode *node = newNode ( data ) ;
+    linkBefore ( ( where != NULL ) ? where -> next : head, node ) ;
+    sorted = false ;
+    return node ;
+  }
+
+  int insertSorted ( void *data, ulCompareFunc comparefn )
+  {
+    if ( ! sorted )
+    {
+      ulSetError ( UL_WARNING, "ulPooledLinkedList::insertSorted: This is not a sorted list !" ) ;
+      return -1 ;
+    }
+
+    int pos = 0 ;
+    ulPoolNode *where = head ;
+
+    while ( where != NULL && (*comparefn) ( data, where -> data ) > 0 )
+    {
+      where = where -> next ;
+      pos ++ ;
+    }
+
+    linkBefore ( where, newNode ( data ) ) ;
+    return pos ;
+  }
+
+  /* Take 'node' out of the list in constant time */
+
+  void *unlinkNode ( ulPoolNode *node )
+  {
+    void *data = node -> data ;
+
+    if ( node -> prev != NULL ) node -> prev -> next = node -> next ; else head = node -> next ;
+    if ( node -> next != NULL ) node -> next -> prev = node -> prev ; else tail = node -> prev ;
+
+    freeNode ( node ) ;
+
+    if ( -- nnodes == 0 )
+      sorted = true ;
+
+    return data ;
+  }
+
+  void removeNode ( void *data )
+  {
+    for ( ulPoolNode *node = head ; node != NULL ; node = node -> next )
+      if ( node -> data == data )
+      {
+        unlinkNode ( node ) ;
+        return ;
+      }
+
+    ulSetError ( UL_WARNING, "ulPooledLinkedList::removeNode: No such node" ) ;
+  }
+
+  void *removeNode ( int pos )
+  {
+    if ( ! isValidPosition ( pos ) )
+      return NULL ;
+
+    return unlinkNode ( nodeAt ( pos ) ) ;
+  }
+
+  void *getNodeData ( int pos ) const
+  {
+    if ( ! isValidPosition ( pos ) )
+      return NULL ;
+
+    return nodeAt ( pos ) -> data ;
+  }
+
+  void *forEach ( ulIterateFunc fn, void *user_data = NULL ) const
+  {
+    for ( ulPoolNode *node = head ; node != NULL ; node = node -> next )
+      if ( (*fn) ( node -> data, user_data ) == 0 )
+        return node -> data ;
+
+    return NULL ;
+  }
+
+  /* Nodes go back on the free list, ready for re-use */
+
+  void empty ( ulIterateFunc destroyfn = NULL, void *user_data = NULL )
+  {
+    ulPoolNode *node = head ;
+
+    while ( node != NULL )
+    {
+      ulPoolNode *next = node -> next ;
+
+      if ( destroyfn != NULL )
+        (*destroyfn) ( node -> data, user_data ) ;
+
+      freeNode ( node ) ;
+      node = next ;
+    }
+
+    head = tail = NULL ;
+    nnodes = 0 ;
+    sorted = true ;
+  }
+
+  /*
+    Drop the free list, giving our own chunks back to the heap.  Only
+    allowed while the list is empty.  Call this before reset()ing the
+    arena the nodes came from if the list is going to be used again.
+  */
+
+  void releaseNodes ( void )
+  {
+    if ( nnodes != 0 )
+    {
+      ulSetError ( UL_WARNING, "ulPooledLinkedList::releaseNodes: List is not empty" ) ;
+      return ;
+    }
+
+    while ( chunks != NULL )
+    {
+      ulPoolNode *block = (ulPoolNode *) chunks ;
+      chunks = block -> next ;
+      delete [] block ;
+    }
+
+    free_list = NULL ;
+  }
+} ;
+
+
+class ulPooledList
+{
+protected:
+  unsigned int total ;  /* The total number of entities in the list */
+  unsigned int limit ;  /* The current limit on number of entities  */
+  unsigned int next  ;  /* The next entity when we are doing getNext ops */
+
+  void **entity_list ;  /* The list. */
+  ulArena *arena ;      /* Where the list lives, if not on the heap */
+
+  void grow ( unsigned int n )
+  {
+    if ( n <= limit )
+      return ;
+
+    unsigned int nlimit = ( limit < 8 ) ? 8 : limit ;
+
+    while ( nlimit < n )
+      nlimit += nlimit ;
+
+    void **nlist = ( arena != NULL ) ?
+                     (void **) arena -> allocate ( nlimit * sizeof(void *) ) :
+                     new void * [ nlimit ] ;
+
+    if ( total > 0 )
+      memcpy ( nlist, entity_list, total * sizeof(void *) ) ;
+
+    if ( arena == NULL )
+      delete [] entity_list ;
+
+    entity_list = nlist ;
+    limit = nlimit ;
+  }
+
+public:
+
+  ulPooledList ( int init_max = 1, ulArena *a = NULL )
+  {
+    total = limit = next = 0 ;
+    entity_list = NULL ;
+    arena = a ;
+    grow ( ( init_max > 0 ) ? init_max : 1 ) ;
+  }
+
+  virtual ~ulPooledList (void)
+  {
+    if ( arena == NULL )
+      delete [] entity_list ;
+  }
+
+  void reserve ( unsigned int n ) { grow ( n ) ; }
+
+  void *getEntity ( unsigned int n )
+  {
+    next = n + 1 ;
+    return ( n >= total ) ? (void *) NULL : entity_list [ n ] ;
+  }
+
+  virtual void addEntity ( void *entity )
+  {
+    grow ( total + 1 ) ;
+    entity_list [ total++ ] = entity ;
+  }
+
+  virtual void addEntityBefore ( int n, void *entity )
+  {
+    if ( n < 0 || (unsigned int) n >= total )
+    {
+      addEntity ( entity ) ;
+      return ;
+    }
+
+    grow ( total + 1 ) ;
+    memmove ( &entity_list [ n + 1 ], &entity_list [ n ], ( total - n ) * sizeof(void *) ) ;
+    entity_list [ n ] = entity ;
+    total ++ ;
+  }
+
+  virtual void removeEntity ( unsigned int n )
+  {
+    if ( n >= total )
+      return ;
+
+    total -- ;
+    memmove ( &entity_list [ n ], &entity_list [ n + 1 ], ( total - n ) * sizeof(void *) ) ;
+  }
+
+  /* Does not keep the order - the last entity takes the place of 'n' */
+
+  void removeEntityFast ( unsigned int n )
+  {
+    if ( n >= total )
+      return ;
+
+    entity_list [ n ] = entity_list [ --total ] ;
+  }
+
+  /* Keeps the storage for re-use */
+
+  void removeAllEntities () { total = next = 0 ; }
+
+  void removeEntity ( void *entity )
+  {
+    removeEntity ( searchForEntity ( entity ) ) ;
+  }
+
+  virtual void replaceEntity ( unsigned int n, void *new_entity )
+  {
+    if ( n < total )
+      entity_list [ n ] = new_entity ;
+  }
+
+  void replaceEntity ( void *old_entity, void *new_entity )
+  {
+    replaceEntity ( searchForEntity ( old_entity ), new_entity ) ;
+  }
+
+  void *getNextEntity   (void) { return getEntity ( next ) ; }
+
+  int   getNumEntities  (void) const { return total ; }
+
+  int   searchForEntity ( void *entity ) const
+  {
+    for ( unsigned int i = 0 ; i < total ; i++ )
+      if ( entity_list [ i ] == entity )
+        return (int) i ;
+
+    return -1 ;
+  }
+} ;
+
+#endif
+